@@ -1,10 +1,135 @@
 /* character-context.c - pokgame */
 #include "character-context.h"
 #include "error.h"
+#include "trace.h"
 #include "pokgame.h"
 #include "primatives.h"
 #include <stdlib.h>
 
+/* pok_character_grid */
+#define CHARACTER_GRID_INITIAL_CAPACITY 32
+
+static inline void character_grid_key(struct pok_character_grid_key* key,uint32_t mapNo,
+    const struct pok_point* chunkPos,const struct pok_location* tilePos)
+{
+    key->mapNo = mapNo;
+    key->chunkPos = *chunkPos;
+    key->column = tilePos->column / POK_CHARACTER_GRID_CELL;
+    key->row = tilePos->row / POK_CHARACTER_GRID_CELL;
+}
+static inline bool_t character_grid_key_equal(const struct pok_character_grid_key* left,const struct pok_character_grid_key* right)
+{
+    return left->mapNo == right->mapNo && left->chunkPos.X == right->chunkPos.X && left->chunkPos.Y == right->chunkPos.Y
+        && left->column == right->column && left->row == right->row;
+}
+static inline uint32_t character_grid_hash(const struct pok_character_grid* grid,const struct pok_character_grid_key* key)
+{
+    /* multiplicative hashing of the packed key; the high bits are the best mixed */
+    uint64_t k = (uint64_t)(uint32_t)key->chunkPos.X << 32 | (uint32_t)key->chunkPos.Y;
+    k ^= ((uint64_t)key->mapNo << 32 | (uint32_t)key->column << 16 | key->row) * UINT64_C(0xff51afd7ed558ccd);
+    return (uint32_t)((k * UINT64_C(0x9e3779b97f4a7c15)) >> 32) & grid->mask;
+}
+static void character_grid_init(struct pok_character_grid* grid)
+{
+    grid->count = 0;
+    grid->mask = 0;
+    grid->entries = NULL;
+}
+static void character_grid_delete(struct pok_character_grid* grid)
+{
+    if (grid->entries != NULL)
+        free(grid->entries);
+    character_grid_init(grid);
+}
+static struct pok_character_grid_entry* character_grid_lookup(const struct pok_character_grid* grid,
+    const struct pok_character_grid_key* key)
+{
+    uint32_t i;
+    if (grid->entries == NULL)
+        return NULL;
+    for (i = character_grid_hash(grid,key);grid->entries[i].list != NULL;i = (i+1) & grid->mask)
+        if ( character_grid_key_equal(&grid->entries[i].key,key) )
+            return grid->entries + i;
+    return NULL;
+}
+static bool_t character_grid_grow(struct pok_character_grid* grid)
+{
+    uint32_t i, j, capacity;
+    struct pok_character_grid_entry* old = grid->entries;
+    capacity = old == NULL ? CHARACTER_GRID_INITIAL_CAPACITY : (grid->mask + 1) << 1;
+    grid->entries = calloc(capacity,sizeof(struct pok_character_grid_entry));
+    if (grid->entries == NULL) {
+        grid->entries = old;
+        pok_exception_flag_memory_error();
+        return FALSE;
+    }
+    if (old != NULL) {
+        uint32_t oldCapacity = grid->mask + 1;
+        grid->mask = capacity - 1;
+        for (i = 0;i < oldCapacity;++i) {
+            if (old[i].list != NULL) {
+                for (j = character_grid_hash(grid,&old[i].key);grid->entries[j].list != NULL;j = (j+1) & grid->mask)
+                    ;
+                grid->entries[j] = old[i];
+            }
+        }
+        free(old);
+    }
+    else
+        grid->mask = capacity - 1;
+    return TRUE;
+}
+static bool_t character_grid_insert(struct pok_character_grid* grid,struct pok_character_context* cc)
+{
+    /* add the character context to the cell named by its grid key; the table is kept at most half full */
+    uint32_t i;
+    struct pok_character_grid_entry* entry = character_grid_lookup(grid,&cc->_gridKey);
+    if (entry == NULL) {
+        if ((grid->entries == NULL || (grid->count + 1) * 2 > grid->mask + 1) && !character_grid_grow(grid))
+            return FALSE;
+        for (i = character_grid_hash(grid,&cc->_gridKey);grid->entries[i].list != NULL;i = (i+1) & grid->mask)
+            ;
+        entry = grid->entries + i;
+        entry->key = cc->_gridKey;
+        entry->list = NULL;
+        ++grid->count;
+    }
+    cc->_gridNext = entry->list;
+    entry->list = cc;
+    return TRUE;
+}
+static void character_grid_remove(struct pok_character_grid* grid,struct pok_character_context* cc)
+{
+    /* remove the character context from its cell; a cell that becomes empty is removed from the
+       table and the entries that follow it in its probe run are shifted back so that no
+       tombstones are needed */
+    uint32_t i, j;
+    struct pok_character_context** link;
+    struct pok_character_grid_entry* entry = character_grid_lookup(grid,&cc->_gridKey);
+    if (entry == NULL)
+        return;
+    for (link = &entry->list;*link != NULL;link = &(*link)->_gridNext) {
+        if (*link == cc) {
+            *link = cc->_gridNext;
+            break;
+        }
+    }
+    cc->_gridNext = NULL;
+    if (entry->list != NULL)
+        return;
+    i = (uint32_t)(entry - grid->entries);
+    for (j = (i+1) & grid->mask;grid->entries[j].list != NULL;j = (j+1) & grid->mask) {
+        /* an entry may fill the hole if its home slot is not cyclically within (i,j] */
+        uint32_t k = character_grid_hash(grid,&grid->entries[j].key);
+        if (i <= j ? (k <= i || k > j) : (k <= i && k > j)) {
+            grid->entries[i] = grid->entries[j];
+            i = j;
+        }
+    }
+    grid->entries[i].list = NULL;
+    --grid->count;
+}
+
 /* pok_character_context */
 static struct pok_character_context* pok_character_context_new(struct pok_character* character)
 {
@@ -30,50 +155,82 @@ static struct pok_character_context* pok_character_context_new(struct pok_charac
     context->aniTicksAmt = 30;
     context->frameAlt = 0;
     context->update = FALSE;
+    context->_owner = NULL;
+    context->_gridNext = NULL;
+    character_grid_key(&context->_gridKey,character->mapNo,&character->chunkPos,&character->tilePos);
     return context;
 }
-static void pok_character_context_render(struct pok_character_context* context,const struct pok_map_render_context* mapRC,
-    const struct pok_sprite_manager* sman,const struct pok_graphics_subsystem* sys)
+static void pok_character_context_free(struct pok_character_context* context)
+{
+    if (context != NULL) {
+        pok_game_lock_unregister(context);
+        free(context);
+    }
+}
+static void pok_character_context_capture(const struct pok_character_context* context,struct pok_map_render_sprite* sprite)
+{
+    /* copy the render state of the character context */
+    const struct pok_character* ch = context->character;
+    sprite->mapNo = ch->mapNo;
+    sprite->chunkPos = ch->chunkPos;
+    sprite->tilePos = ch->tilePos;
+    sprite->spriteIndex = ch->spriteIndex;
+    sprite->frame = context->frame;
+    sprite->offset[0] = context->offset[0];
+    sprite->offset[1] = context->offset[1];
+    sprite->shadow = context->shadow;
+}
+static bool_t pok_character_sprite_visible(const struct pok_map_render_sprite* sprite,const struct pok_chunk_render_info* info)
+{
+    /* determine if the sprite lies within the region of a chunk that is drawn */
+    int32_t cols, rows;
+    cols = sprite->tilePos.column - info->loc.column;
+    rows = sprite->tilePos.row - info->loc.row;
+    return info->chunk != NULL && info->chunkPos.X == sprite->chunkPos.X && info->chunkPos.Y == sprite->chunkPos.Y
+        && cols >= 0 && cols < info->across && rows >= 0 && rows < info->down;
+}
+static bool_t pok_character_sprite_locate(const struct pok_map_render_sprite* sprite,const struct pok_map_render_snapshot* view,
+    const struct pok_graphics_subsystem* sys,int32_t* x,int32_t* y)
 {
     /* check to see if the character is within the viewing area defined by the
-       map render context; if the render context has no loaded maps, then do
-       nothing */
-    struct pok_character* ch = context->character;
-    if (mapRC->map != NULL && ch->mapNo == mapRC->map->mapNo) { /* same map */
+       map render snapshot and compute the screen position of its tile; if the
+       snapshot has no map, then the character is not visible */
+    if (view->map != NULL && sprite->mapNo == view->map->mapNo) { /* same map */
         int i;
         for (i = 0;i < 4;++i) {
-            if (mapRC->info[i].chunk != NULL && mapRC->info[i].chunkPos.X == ch->chunkPos.X
-                      && mapRC->info[i].chunkPos.Y == ch->chunkPos.Y) { /* same chunk */
-                int32_t cols, rows;
-                cols = ch->tilePos.column - mapRC->info[i].loc.column;
-                if (cols >= 0 && cols < mapRC->info[i].across) { /* same viewable column space */
-                    rows = ch->tilePos.row - mapRC->info[i].loc.row;
-                    if (rows >= 0 && rows < mapRC->info[i].down) { /* same viewable row space */
-                        int32_t x, y;
-                        x = mapRC->info[i].px + cols * sys->dimension + mapRC->offset[0] + sys->playerOffsetX;
-                        y = mapRC->info[i].py + rows * sys->dimension + mapRC->offset[1] + sys->playerOffsetY;
-                        pok_image_render(
-                            sman->spriteassoc[ch->spriteIndex][context->frame],
-                            x + context->offset[0],
-                            y + context->offset[1] );
-                        if (context->shadow) {
-                            /* draw the shadow (the character is probably hopping over something) */
-                            pok_primative_setup_modelview(
-                                x + sys->dimension / 2,
-                                y + sys->dimension + context->offset[1] / 2,
-                                sys->dimension,
-                                sys->dimension );
-                            glVertexPointer(2,GL_FLOAT,0,POK_SHADOW_ELLIPSE);
-                            glColor4f(BLACK_PIXEL_FLOAT[0],BLACK_PIXEL_FLOAT[1],BLACK_PIXEL_FLOAT[2],0.5);
-                            glDrawArrays(GL_POLYGON,0,POK_SHADOW_ELLIPSE_VERTEX_COUNT);
-                            glLoadIdentity();
-                        }
-                        break;
-                    }
-                }
+            if ( pok_character_sprite_visible(sprite,view->info + i) ) {
+                *x = view->info[i].px + (sprite->tilePos.column - view->info[i].loc.column) * sys->dimension
+                    + view->offset[0] + sys->playerOffsetX;
+                *y = view->info[i].py + (sprite->tilePos.row - view->info[i].loc.row) * sys->dimension
+                    + view->offset[1] + sys->playerOffsetY;
+                return TRUE;
             }
         }
     }
+    return FALSE;
+}
+static void pok_character_sprite_render(const struct pok_map_render_sprite* sprite,const struct pok_map_render_snapshot* view,
+    const struct pok_sprite_manager* sman,const struct pok_graphics_subsystem* sys)
+{
+    int32_t x, y;
+    if ( pok_character_sprite_locate(sprite,view,sys,&x,&y) ) {
+        pok_image_render(
+            sman->spriteassoc[sprite->spriteIndex][sprite->frame],
+            x + sprite->offset[0],
+            y + sprite->offset[1] );
+        if (sprite->shadow) {
+            /* draw the shadow (the character is probably hopping over something) */
+            pok_primative_setup_modelview(
+                x + sys->dimension / 2,
+                y + sys->dimension + sprite->offset[1] / 2,
+                sys->dimension,
+                sys->dimension );
+            glVertexPointer(2,GL_FLOAT,0,POK_SHADOW_ELLIPSE);
+            glColor4f(BLACK_PIXEL_FLOAT[0],BLACK_PIXEL_FLOAT[1],BLACK_PIXEL_FLOAT[2],0.5);
+            glDrawArrays(GL_POLYGON,0,POK_SHADOW_ELLIPSE_VERTEX_COUNT);
+            glLoadIdentity();
+        }
+    }
 }
 bool_t pok_character_context_move(struct pok_character_context* context,enum pok_direction direction)
 {
@@ -83,12 +240,34 @@ bool_t pok_character_context_move(struct pok_character_context* context,enum pok
 
     return FALSE;
 }
-void pok_character_context_set_player(struct pok_character_context* context,struct pok_map_render_context* mapRC)
+bool_t pok_character_context_set_position(struct pok_character_context* context,uint32_t mapNo,
+    const struct pok_point* chunkPos,const struct pok_location* tilePos)
+{
+    /* change the character's position; if the context belongs to a render context then the
+       context is moved to its new cell in the render context's spatial index (this locks the
+       render context for modification if the cell changes) */
+    struct pok_character_grid_key key;
+    struct pok_character_render_context* owner = context->_owner;
+    context->character->mapNo = mapNo;
+    context->character->chunkPos = *chunkPos;
+    context->character->tilePos = *tilePos;
+    character_grid_key(&key,mapNo,chunkPos,tilePos);
+    if (owner != NULL && !character_grid_key_equal(&key,&context->_gridKey)) {
+        bool_t result;
+        pok_game_modify_enter(owner);
+        character_grid_remove(&owner->grid,context);
+        context->_gridKey = key;
+        result = character_grid_insert(&owner->grid,context);
+        pok_game_modify_exit(owner);
+        return result;
+    }
+    context->_gridKey = key;
+    return TRUE;
+}
+bool_t pok_character_context_set_player(struct pok_character_context* context,struct pok_map_render_context* mapRC)
 {
     /* the player character is aligned with the map render context */
-    context->character->mapNo = mapRC->map->mapNo;
-    context->character->chunkPos = mapRC->chunkpos;
-    context->character->tilePos = mapRC->relpos;
+    return pok_character_context_set_position(context,mapRC->map->mapNo,&mapRC->chunkpos,&mapRC->relpos);
 }
 void pok_character_context_set_update(struct pok_character_context* context,
     enum pok_direction direction,
@@ -366,33 +545,36 @@ struct pok_character_render_context* pok_character_render_context_new(const stru
 void pok_character_render_context_free(struct pok_character_render_context* context)
 {
     pok_character_render_context_delete(context);
+    pok_game_lock_unregister(context);
     free(context);
 }
 void pok_character_render_context_init(struct pok_character_render_context* context,const struct pok_map_render_context* mapRC,
     const struct pok_sprite_manager* sman)
 {
     dynamic_array_init(&context->chars);
+    character_grid_init(&context->grid);
     context->mapRC = mapRC;
     context->sman = sman;
+    context->batch = TRUE;
+    context->_batchAlloc = 0;
+    context->_batchVertices = NULL;
+    context->_batchTexCoords = NULL;
+    context->_shadowAlloc = 0;
+    context->_shadowVertices = NULL;
+    context->_shadowQuads = NULL;
 }
 void pok_character_render_context_delete(struct pok_character_render_context* context)
 {
-    dynamic_array_delete_ex(&context->chars,free);
+    dynamic_array_delete_ex(&context->chars,(destructor)pok_character_context_free);
+    character_grid_delete(&context->grid);
+    free(context->_batchVertices);
+    free(context->_batchTexCoords);
+    free(context->_shadowVertices);
+    free(context->_shadowQuads);
 }
 bool_t pok_character_render_context_add(struct pok_character_render_context* context,struct pok_character* character)
 {
-    size_t i;
-    struct pok_character_context* cc = pok_character_context_new(character);
-    if (cc == NULL)
-        return FALSE;
-    for (i = 0;i < context->chars.da_top;++i) {
-        if (context->chars.da_data[i] == NULL) {
-            context->chars.da_data[i] = cc;
-            return TRUE;
-        }
-    }
-    dynamic_array_pushback(&context->chars,cc);
-    return TRUE;
+    return pok_character_render_context_add_ex(context,character) != NULL;
 }
 struct pok_character_context* pok_character_render_context_add_ex(struct pok_character_render_context* context,
     struct pok_character* character)
@@ -401,6 +583,11 @@ struct pok_character_context* pok_character_render_context_add_ex(struct pok_cha
     struct pok_character_context* cc = pok_character_context_new(character);
     if (cc == NULL)
         return NULL;
+    if ( !character_grid_insert(&context->grid,cc) ) {
+        free(cc);
+        return NULL;
+    }
+    cc->_owner = context;
     for (i = 0;i < context->chars.da_top;++i) {
         if (context->chars.da_data[i] == NULL) {
             context->chars.da_data[i] = cc;
@@ -416,27 +603,288 @@ bool_t pok_character_render_context_remove(struct pok_character_render_context*
     struct pok_character_context* cc;
     for (i = 0;i < context->chars.da_top;++i) {
         cc = context->chars.da_data[i];
-        if (cc->character == character) {
+        if (cc != NULL && cc->character == character) {
             context->chars.da_data[i] = NULL;
-            free(cc);
+            character_grid_remove(&context->grid,cc);
+            pok_character_context_free(cc);
             return TRUE;
         }
     }
     return FALSE;
 }
+struct pok_character_context* pok_character_render_context_find(const struct pok_character_render_context* context,
+    uint32_t mapNo,const struct pok_point* chunkPos,const struct pok_location* tilePos,bool_t npcOnly)
+{
+    /* find a character that occupies the specified tile (ignoring players if 'npcOnly'); this probes
+       a single cell of the spatial index; the caller should lock the render context for reading */
+    struct pok_character_grid_key key;
+    struct pok_character_grid_entry* entry;
+    character_grid_key(&key,mapNo,chunkPos,tilePos);
+    entry = character_grid_lookup(&context->grid,&key);
+    if (entry != NULL) {
+        struct pok_character_context* cc;
+        for (cc = entry->list;cc != NULL;cc = cc->_gridNext) {
+            const struct pok_character* ch = cc->character;
+            if (ch->tilePos.column == tilePos->column && ch->tilePos.row == tilePos->row && !(npcOnly && ch->isPlayer))
+                return cc;
+        }
+    }
+    return NULL;
+}
+static void pok_character_render_context_visit(const struct pok_character_render_context* context,
+    const struct pok_map_render_snapshot* view,void (*visit)(const struct pok_character_context*,void*),void* arg)
+{
+    /* visit each character context that lies within a region of the view; only the cells of the
+       spatial index that overlap the regions are probed */
+    int i;
+    if (view->map == NULL || context->grid.count == 0)
+        return;
+    for (i = 0;i < 4;++i) {
+        struct pok_location first, last;
+        struct pok_character_grid_key key;
+        const struct pok_chunk_render_info* info = view->info + i;
+        if (info->chunk == NULL || info->across == 0 || info->down == 0)
+            continue;
+        first = info->loc;
+        last.column = info->loc.column + info->across - 1;
+        last.row = info->loc.row + info->down - 1;
+        character_grid_key(&key,view->map->mapNo,&info->chunkPos,&first);
+        for (;key.row <= last.row / POK_CHARACTER_GRID_CELL;++key.row) {
+            for (key.column = first.column / POK_CHARACTER_GRID_CELL;key.column <= last.column / POK_CHARACTER_GRID_CELL;++key.column) {
+                const struct pok_character_context* cc;
+                const struct pok_character_grid_entry* entry = character_grid_lookup(&context->grid,&key);
+                if (entry == NULL)
+                    continue;
+                for (cc = entry->list;cc != NULL;cc = cc->_gridNext) {
+                    const struct pok_character* ch = cc->character;
+                    if (ch->tilePos.column >= first.column && ch->tilePos.column <= last.column
+                        && ch->tilePos.row >= first.row && ch->tilePos.row <= last.row)
+                        visit(cc,arg);
+                }
+            }
+        }
+    }
+}
+
+static void pok_character_render_context_capture_visit(const struct pok_character_context* cc,void* arg)
+{
+    struct pok_map_render_snapshot* snapshot = arg;
+    pok_character_context_capture(cc,snapshot->sprites + snapshot->spritec++);
+}
+bool_t pok_character_render_context_capture(struct pok_character_render_context* context,
+    struct pok_map_render_snapshot* snapshot)
+{
+    /* add the render state of each character within the snapshot's view to a map render snapshot
+       that has not yet been published (characters outside the view are never drawn); we lock for
+       read access so that we don't access the dynamic array member or the spatial index while in
+       an invalidated state */
+    bool_t result = TRUE;
+    pok_game_lock(context);
+    if ( pok_map_render_snapshot_reserve_sprites(snapshot,(uint16_t)context->chars.da_top) ) {
+        snapshot->spritec = 0;
+        pok_character_render_context_visit(context,snapshot,pok_character_render_context_capture_visit,snapshot);
+        snapshot->hasSprites = TRUE;
+    }
+    else
+        result = FALSE;
+    pok_game_unlock(context);
+    return result;
+}
 
 /* rendering routine */
+#define SHADOW_BATCH_STEP 15 /* the batch uses every 15th vertex of the shadow ellipse */
+#define SHADOW_BATCH_POINTS (POK_SHADOW_ELLIPSE_VERTEX_COUNT / SHADOW_BATCH_STEP)
+#define SHADOW_BATCH_VERTICES ((SHADOW_BATCH_POINTS - 2) * 3)
+
+/* state used to fill the batch vertex buffers */
+struct character_batch
+{
+    struct pok_character_render_context* context;
+    const struct pok_graphics_subsystem* sys;
+    const struct pok_map_render_snapshot* view;
+    GLfloat cw, ch; /* size of an atlas cell in texture coordinates */
+    size_t n;       /* number of sprite quads */
+    size_t shadows; /* number of shadows */
+};
+static bool_t pok_character_render_batch_reserve(struct pok_character_render_context* context,size_t sprites,size_t shadows)
+{
+    /* make sure the batch buffers can hold the specified number of sprite quads and shadows */
+    if (sprites > context->_batchAlloc) {
+        void* v, *t;
+        size_t n = context->_batchAlloc == 0 ? 64 : context->_batchAlloc;
+        while (n < sprites)
+            n <<= 1;
+        v = realloc(context->_batchVertices,sizeof(int32_t) * 8 * n);
+        if (v == NULL)
+            return FALSE;
+        context->_batchVertices = v;
+        t = realloc(context->_batchTexCoords,sizeof(float) * 8 * n);
+        if (t == NULL)
+            return FALSE;
+        context->_batchTexCoords = t;
+        context->_batchAlloc = n;
+    }
+    if (shadows > context->_shadowAlloc) {
+        void* v, *q;
+        size_t n = context->_shadowAlloc == 0 ? 8 : context->_shadowAlloc;
+        while (n < shadows)
+            n <<= 1;
+        v = realloc(context->_shadowVertices,sizeof(float) * 2 * SHADOW_BATCH_VERTICES * n);
+        if (v == NULL)
+            return FALSE;
+        context->_shadowVertices = v;
+        q = realloc(context->_shadowQuads,sizeof(size_t) * n);
+        if (q == NULL)
+            return FALSE;
+        context->_shadowQuads = q;
+        context->_shadowAlloc = n;
+    }
+    return TRUE;
+}
+static void pok_character_render_batch_sprite(struct character_batch* batch,const struct pok_map_render_sprite* sprite)
+{
+    /* add a quad for the sprite's frame (and triangles for its shadow); the quad is built exactly
+       like those produced by 'pok_image_render' so that the output is identical; if the buffers
+       cannot grow then the sprite is drawn by itself */
+    uint32_t cell;
+    int32_t x, y, x0, y0, X, Y, dim = batch->sys->dimension;
+    GLfloat u, v;
+    int32_t* vert;
+    float* texc;
+    struct pok_character_render_context* context = batch->context;
+    const struct pok_sprite_manager* sman = context->sman;
+    if ( !pok_character_sprite_locate(sprite,batch->view,batch->sys,&x,&y) )
+        return;
+    if ( !pok_character_render_batch_reserve(context,batch->n + 1,batch->shadows + (sprite->shadow != 0)) ) {
+        pok_character_sprite_render(sprite,batch->view,sman,batch->sys);
+        return;
+    }
+    cell = pok_sprite_manager_get_cell(sman,sprite->spriteIndex,sprite->frame);
+    u = (cell % sman->atlasColumns) * batch->cw;
+    v = (cell / sman->atlasColumns) * batch->ch;
+    vert = context->_batchVertices + batch->n * 8;
+    texc = context->_batchTexCoords + batch->n * 8;
+    x0 = x + sprite->offset[0];
+    y0 = y + sprite->offset[1];
+    X = x0 + dim;
+    Y = y0 + dim;
+    vert[0] = x0; vert[1] = y0; texc[0] = u; texc[1] = v;
+    vert[2] = X; vert[3] = y0; texc[2] = u+batch->cw; texc[3] = v;
+    vert[4] = X; vert[5] = Y; texc[4] = u+batch->cw; texc[5] = v+batch->ch;
+    vert[6] = x0; vert[7] = Y; texc[6] = u; texc[7] = v+batch->ch;
+    ++batch->n;
+    if (sprite->shadow) {
+        /* fan the ellipse into triangles centered where 'pok_primative_setup_modelview' would put it */
+        int k;
+        GLfloat cx = (GLfloat)(x + dim / 2), cy = (GLfloat)(y + dim + sprite->offset[1] / 2), r = dim / 2.0f;
+        float* sv = context->_shadowVertices + batch->shadows * 2 * SHADOW_BATCH_VERTICES;
+        for (k = 1;k < SHADOW_BATCH_POINTS - 1;++k,sv += 6) {
+            const GLfloat* a = POK_SHADOW_ELLIPSE + k * SHADOW_BATCH_STEP * 2;
+            const GLfloat* b = a + SHADOW_BATCH_STEP * 2;
+            sv[0] = cx + POK_SHADOW_ELLIPSE[0] * r; sv[1] = cy + POK_SHADOW_ELLIPSE[1] * r;
+            sv[2] = cx + a[0] * r; sv[3] = cy + a[1] * r;
+            sv[4] = cx + b[0] * r; sv[5] = cy + b[1] * r;
+        }
+        context->_shadowQuads[batch->shadows++] = batch->n;
+    }
+}
+static void pok_character_render_batch_visit(const struct pok_character_context* cc,void* arg)
+{
+    struct pok_map_render_sprite sprite;
+    pok_character_context_capture(cc,&sprite);
+    pok_character_render_batch_sprite(arg,&sprite);
+}
+static bool_t pok_character_render_batch(const struct pok_graphics_subsystem* sys,struct pok_character_render_context* context,
+    const struct pok_map_render_snapshot* view)
+{
+    /* draw every visible character as a vertex array of textured quads that sample from the sprite
+       manager's atlas; each shadow is drawn right after its sprite (so under the sprites after it)
+       like 'pok_character_sprite_render' does, which splits the quads into runs; shadows are only
+       drawn for characters that are hopping so there are few of them; FALSE is returned if the
+       atlas is not available */
+    size_t i, q;
+    struct character_batch batch;
+    const struct pok_sprite_manager* sman = context->sman;
+    if (sman == NULL || sman->atlas == NULL || sman->atlas->texref == 0 || sman->atlasCells == NULL)
+        return FALSE;
+    batch.context = context;
+    batch.sys = sys;
+    batch.view = view;
+    batch.cw = (GLfloat)sys->dimension / sman->atlas->width;
+    batch.ch = (GLfloat)sys->dimension / sman->atlas->height;
+    batch.n = 0;
+    batch.shadows = 0;
+    if (view->hasSprites) {
+        for (i = 0;i < view->spritec;++i)
+            pok_character_render_batch_sprite(&batch,view->sprites + i);
+    }
+    else {
+        pok_game_lock(context);
+        pok_character_render_context_visit(context,view,pok_character_render_batch_visit,&batch);
+        pok_game_unlock(context);
+    }
+    for (i = 0, q = 0;i <= batch.shadows;++i) {
+        size_t end = i < batch.shadows ? context->_shadowQuads[i] : batch.n;
+        if (end > q) {
+            glEnable(GL_TEXTURE_2D);
+            glBindTexture(GL_TEXTURE_2D,sman->atlas->texref);
+            glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+            glVertexPointer(2,GL_INT,0,context->_batchVertices);
+            glTexCoordPointer(2,GL_FLOAT,0,context->_batchTexCoords);
+            glDrawArrays(GL_QUADS,(GLint)q*4,(GLsizei)(end-q)*4);
+            glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+            glDisable(GL_TEXTURE_2D);
+            q = end;
+        }
+        if (i < batch.shadows) {
+            glVertexPointer(2,GL_FLOAT,0,context->_shadowVertices);
+            glColor4f(BLACK_PIXEL_FLOAT[0],BLACK_PIXEL_FLOAT[1],BLACK_PIXEL_FLOAT[2],0.5);
+            glDrawArrays(GL_TRIANGLES,(GLint)(i*SHADOW_BATCH_VERTICES),SHADOW_BATCH_VERTICES);
+        }
+    }
+    return TRUE;
+}
+
+struct character_render_args
+{
+    const struct pok_graphics_subsystem* sys;
+    const struct pok_character_render_context* context;
+};
+static void pok_character_render_visit(const struct pok_character_context* cc,void* arg)
+{
+    struct pok_map_render_sprite sprite;
+    const struct character_render_args* args = arg;
+    pok_character_context_capture(cc,&sprite);
+    pok_character_sprite_render(&sprite,args->context->mapRC->view,args->context->sman,args->sys);
+}
 void pok_character_render(const struct pok_graphics_subsystem* sys,struct pok_character_render_context* context)
 {
-    /* go through each character context and render it; we must lock for read access so that we don't
-       access the dynamic array member while in an invalidated state */
+    /* render each character over the map; characters are drawn from the map render context's
+       current view (captured with the map in the same update step) if it contains them; otherwise
+       go through the character contexts within the view: we must lock for read access so that we
+       don't access the spatial index while in an invalidated state; the batch renderer is used if
+       it is enabled and the sprite atlas has been loaded as a texture so that the cost of drawing
+       does not grow with the number of draw calls */
     size_t i;
+    struct character_render_args args;
+    const struct pok_map_render_snapshot* view = context->mapRC->view;
+    if (view == NULL)
+        return;
+    POK_TRACE_BEGIN(render);
+    if (context->batch && pok_character_render_batch(sys,context,view)) {
+        POK_TRACE_END(render,"pok_character_render");
+        return;
+    }
+    if (view->hasSprites) {
+        for (i = 0;i < view->spritec;++i)
+            pok_character_sprite_render(view->sprites + i,view,context->sman,sys);
+        POK_TRACE_END(render,"pok_character_render");
+        return;
+    }
+    args.sys = sys;
+    args.context = context;
     pok_game_lock(context);
-    for (i = 0;i < context->chars.da_top;++i)
-        pok_character_context_render(
-            context->chars.da_data[i],
-            context->mapRC,
-            context->sman,
-            sys );
+    pok_character_render_context_visit(context,view,pok_character_render_visit,&args);
     pok_game_unlock(context);
+    POK_TRACE_END(render,"pok_character_render");
 }
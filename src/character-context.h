@@ -6,6 +6,8 @@
 #include "character.h"
 #include <dstructs/dynarray.h>
 
+struct pok_character_render_context;
+
 /* Notes about character rendering: characters should always be rendered AFTER maps since
    character rendering depends on map rendering; map rendering information is used by the
    character rendering routines */
@@ -19,6 +21,29 @@ enum pok_character_effect
     pok_character_slide_effect      /* the character slides to the next tile (parameter is dimension) */
 };
 
+/* pok_character_grid: a spatial index of character contexts; a cell holds the characters in a
+   POK_CHARACTER_GRID_CELL x POK_CHARACTER_GRID_CELL block of tiles within a chunk of a map; the cells
+   are kept in an open-addressing hash table (with linear probing) keyed on the map number, chunk
+   position and block so that only occupied cells use memory; empty slots have a NULL list */
+#define POK_CHARACTER_GRID_CELL 8
+struct pok_character_grid_key
+{
+    uint32_t mapNo;
+    struct pok_point chunkPos;
+    uint16_t column, row; /* tile position divided by the cell size */
+};
+struct pok_character_grid_entry
+{
+    struct pok_character_grid_key key;
+    struct pok_character_context* list; /* characters in the cell (linked by '_gridNext') */
+};
+struct pok_character_grid
+{
+    uint32_t count; /* number of occupied cells */
+    uint32_t mask; /* capacity - 1 (capacity is a power of 2) */
+    struct pok_character_grid_entry* entries;
+};
+
 /* pok_character_context: provides information for rendering a single
    'pok_character' object; the context is NOT responsible for freeing its
    associated character */
@@ -38,9 +63,16 @@ struct pok_character_context
     uint32_t aniTicksAmt;             /* number of animation ticks needed before each update */
     uint8_t frameAlt;                 /* sprite frame alternation counter */
     bool_t update;                    /* is the character context being updated? */
+
+    /* spatial grid membership (see 'pok_character_grid'); maintained by the render context that owns this context */
+    struct pok_character_render_context* _owner;
+    struct pok_character_grid_key _gridKey;
+    struct pok_character_context* _gridNext;
 };
 bool_t pok_character_context_move(struct pok_character_context* context,enum pok_direction direction);
-void pok_character_context_set_player(struct pok_character_context* context,struct pok_map_render_context* mapRC);
+bool_t pok_character_context_set_position(struct pok_character_context* context,uint32_t mapNo,
+    const struct pok_point* chunkPos,const struct pok_location* tilePos);
+bool_t pok_character_context_set_player(struct pok_character_context* context,struct pok_map_render_context* mapRC);
 void pok_character_context_set_update(struct pok_character_context* context,
     enum pok_direction direction,
     enum pok_character_effect effect,
@@ -50,15 +82,31 @@ bool_t pok_character_context_update(struct pok_character_context* context,uint16
 
 /* pok_character_render_context: provides information for rendering a set 
    of 'pok_character_context' instances; this render context depends on the
-   map render context to draw characters */
+   map render context to draw characters; the character contexts are indexed
+   by position so that collision checks and rendering only visit characters in
+   the area they care about: character positions must be changed through
+   'pok_character_context_set_position' so that the index stays current */
 struct pok_character_render_context
 {
     /* dynamic array of 'pok_character_context' instances */
     struct dynamic_array chars;
 
+    /* spatial index of the character contexts in 'chars' */
+    struct pok_character_grid grid;
+
     /* character render context must have reference to map render context and sprite manager */
     const struct pok_map_render_context* mapRC;
     const struct pok_sprite_manager* sman;
+
+    bool_t batch; /* if true then draw characters (and shadows) from the sprite manager's atlas in a single batch */
+
+    /* vertex buffers used by the batch renderer (owned by the render thread) */
+    size_t _batchAlloc;
+    int32_t* _batchVertices;
+    float* _batchTexCoords;
+    size_t _shadowAlloc;
+    float* _shadowVertices;
+    size_t* _shadowQuads; /* number of sprite quads drawn before each shadow */
 };
 struct pok_character_render_context* pok_character_render_context_new(const struct pok_map_render_context* mapRC,
     const struct pok_sprite_manager* sman);
@@ -70,6 +118,10 @@ bool_t pok_character_render_context_add(struct pok_character_render_context* con
 struct pok_character_context* pok_character_render_context_add_ex(struct pok_character_render_context* context,
     struct pok_character* character);
 bool_t pok_character_render_context_remove(struct pok_character_render_context* context,struct pok_character* character);
+struct pok_character_context* pok_character_render_context_find(const struct pok_character_render_context* context,
+    uint32_t mapNo,const struct pok_point* chunkPos,const struct pok_location* tilePos,bool_t npcOnly);
+bool_t pok_character_render_context_capture(struct pok_character_render_context* context,
+    struct pok_map_render_snapshot* snapshot);
 
 /* render routine */
 void pok_character_render(const struct pok_graphics_subsystem* sys,struct pok_character_render_context* context);
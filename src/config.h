@@ -16,6 +16,7 @@ struct pok_string* pok_get_install_root_path();
 #define POKGAME_CONTENT_MAPS_FILE     "maps"
 #define POKGAME_CONTENT_LOG_FILE      "pokgame.log"
 #define POKGAME_CONTENT_PORTAL_FILE   "portals"
+#define POKGAME_CONTENT_TRACE_FILE    "trace.json" /* only written if built with POKGAME_TRACE */
 
 /* directories under the install directory */
 #define POKGAME_DEFAULT_DIRECTORY "default/"
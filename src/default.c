@@ -94,7 +94,7 @@ struct pok_game_info* pok_make_default_game(struct pok_graphics_subsystem* sys)
 
     /* prepare rendering contexts for initial scene */
     B( pok_map_render_context_set_position(game->mapRC,defmap,&ORIGIN,&DEFAULT_MAP_START_LOCATION) );
-    pok_character_context_set_player(game->playerContext,game->mapRC); /* align the player context with map context */
+    B( pok_character_context_set_player(game->playerContext,game->mapRC) ); /* align the player context with map context */
 
     return game;
 }
@@ -116,6 +116,7 @@ void setup_tileman(struct pok_tile_manager* tman)
         if (tman->terrain[i].length > 0)
             tman->terrain[i].list = DEFAULT_TILEMAN_TERRAIN_INFO[i] + 1;
     }
+    B( pok_tile_manager_build_terrain(tman) );
     B( pok_tile_manager_load_ani(tman,DEFAULT_TILEMAN_ANI_DATA_LENGTH,DEFAULT_TILEMAN_ANI_DATA,TRUE) );
 }
 
@@ -361,8 +362,8 @@ void open_portal_doorway(struct pok_map_chunk* A,struct pok_map_chunk* B,enum po
     const struct pok_location* doorA, *doorB;
     doorA = DEFAULT_MAP_DOOR_LOCATIONS + AtoB;
     doorB = DEFAULT_MAP_DOOR_LOCATIONS + pok_direction_opposite(AtoB);
-    A->data[doorA->row][doorA->column].data.tileid = DEFAULT_MAP_PASSABLE_TILE;
-    B->data[doorB->row][doorB->column].data.tileid = DEFAULT_MAP_PASSABLE_TILE;
+    pok_map_chunk_set_tileid(A,doorA->column,doorA->row,DEFAULT_MAP_PASSABLE_TILE);
+    pok_map_chunk_set_tileid(B,doorB->column,doorB->row,DEFAULT_MAP_PASSABLE_TILE);
 }
 
 void open_portal_doorways(struct pok_point pos,struct pok_map_chunk* src)
@@ -395,7 +396,7 @@ int test_player_near_doorway(const struct pok_character* player,const struct pok
         {
             /* make sure the door tile is there (meaning there is an unopened
                door in the specified direction) */
-            if (portalChunk->data[p.row][p.column].data.tileid == DEFAULT_MAP_DOOR_TILE)
+            if (pok_map_chunk_get_tileid(portalChunk,p.column,p.row) == DEFAULT_MAP_DOOR_TILE)
                 return i;
         }
     }
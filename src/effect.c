@@ -1,6 +1,7 @@
 /* effect.c - pokgame */
 #include "effect.h"
 #include "error.h"
+#include "trace.h"
 #include "opengl.h"
 #include "primatives.h"
 
@@ -156,6 +157,7 @@ bool_t pok_fadeout_effect_update(struct pok_fadeout_effect* effect,uint32_t tick
 }
 void pok_fadeout_effect_render(struct pok_graphics_subsystem* sys,const struct pok_fadeout_effect* effect)
 {
+    POK_TRACE_BEGIN(render);
     if (effect->_base.update) {
         if (effect->kind == pok_fadeout_black_screen) {
             /* set color to black; include alpha */
@@ -192,6 +194,7 @@ void pok_fadeout_effect_render(struct pok_graphics_subsystem* sys,const struct p
         glDrawArrays(GL_POLYGON,0,POK_BOX_VERTEX_COUNT);
         glLoadIdentity();
     }
+    POK_TRACE_END(render,"pok_fadeout_effect_render");
 }
 
 /* pok_daycycle_effect */
@@ -231,6 +234,7 @@ void pok_daycycle_effect_update(struct pok_daycycle_effect* effect,uint32_t tick
 void pok_daycycle_effect_render(struct pok_graphics_subsystem* sys,const struct pok_daycycle_effect* effect)
 {
     /* this function only applies an effect if it is night or morning */
+    POK_TRACE_BEGIN(render);
     if (effect->kind != pok_daycycle_time_day && effect->kind != pok_daycycle_time_clock) {
         pok_primative_setup_modelview(sys->wwidth/2,sys->wheight/2,sys->wwidth,sys->wheight);
         glVertexPointer(2,GL_FLOAT,0,POK_BOX);
@@ -241,4 +245,5 @@ void pok_daycycle_effect_render(struct pok_graphics_subsystem* sys,const struct
         glDrawArrays(GL_POLYGON,0,POK_BOX_VERTEX_COUNT);
         glLoadIdentity();
     }
+    POK_TRACE_END(render,"pok_daycycle_effect_render");
 }
@@ -38,14 +38,17 @@ static char const* const* POK_ERROR_MESSAGES[] = {
         "specified file does not exist", /* pok_ex_net_file_does_not_exist */
         "specified file already exists", /* pok_ex_net_file_already_exist */
         "cannot open specified file: permission denied", /* pok_ex_net_file_permission_denied */
-        "the file path is incorrect" /* pok_ex_net_file_bad_path */
+        "the file path is incorrect", /* pok_ex_net_file_bad_path */
         "couldn't create IO device (local)", /* pok_ex_net_could_not_create_local */
         "couldn't create IO device (named local)", /* pok_ex_net_could_not_create_named_local */
         "couldn't create IO device (remote)", /* pok_ex_net_could_not_create_remote */
         "cannot create process", /* pok_ex_net_could_not_create_process */
         "cannot execute program", /* pok_ex_net_bad_program */
         "cannot execute program: file does not exist", /* pok_ex_net_program_not_found */
-        "cannot execute program: permission denied" /* pok_ex_net_execute_denied */
+        "cannot execute program: permission denied", /* pok_ex_net_execute_denied */
+        "couldn't create IO poller", /* pok_ex_net_could_not_create_poller */
+        "couldn't create listener", /* pok_ex_net_could_not_create_listener */
+        "compressed stream is corrupt" /* pok_ex_net_corrupt_stream */
     },
     (const char* []) { /* pok_ex_netobj */
         "the specified network id was already allocated" /* pok_ex_netobj_bad_id */
@@ -73,7 +76,8 @@ static char const* const* POK_ERROR_MESSAGES[] = {
     },
     (const char* []) { /* pok_ex_spriteman */
         "the sprite manager was already configured for the specified operation", /* pok_ex_spriteman_already */
-        "the specified sprite sheet dimensions were incorrect" /* pok_ex_spriteman_bad_image_dimension */
+        "the specified sprite sheet dimensions were incorrect", /* pok_ex_spriteman_bad_image_dimension */
+        "the sprite frames were not loaded or no longer have pixel data" /* pok_ex_spriteman_no_pixels */
     },
     (const char* []) { /* pok_ex_tile */
         "a bad tile warp kind parameter was specified" /* pok_ex_tile_bad_warp_kind */
@@ -85,7 +89,8 @@ static char const* const* POK_ERROR_MESSAGES[] = {
         "the operation could not complete because the map was already loaded", /* pok_ex_map_already */
         "the operation could not complete because the map was not loaded", /* pok_ex_map_not_loaded */
         "map information was incorrect", /* pok_ex_map_bad_format */
-        "a new chunk was created at an already allocated position on the map" /* pok_ex_map_non_unique_chunk */
+        "a new chunk was created at an already allocated position on the map", /* pok_ex_map_non_unique_chunk */
+        "the specified position did not refer to a chunk that could be used in the operation" /* pok_ex_map_no_chunk */
     }
 };
 
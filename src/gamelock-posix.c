@@ -1,61 +1,9 @@
 /* pokgame-posix.c - pokgame */
 #include <pthread.h>
 #include <time.h>
+#include <errno.h>
 #include <unistd.h>
 
-#ifdef POKGAME_OSX
-/*#include <sys/time.h>*/
-#include <dispatch/dispatch.h>
-/* #define CLOCK_MONOTONIC 0*/
-
-/* clock_gettime is not implemented on OSX */
-/*int clock_gettime(int id,struct timespec* t) {
-    struct timeval now;
-    int rv = gettimeofday(&now,NULL);
-    if (rv) return rv;
-    t->tv_sec  = now.tv_sec;
-    t->tv_nsec = now.tv_usec * 1000;
-    return 0;
-    (void)id;
-}*/
-
-/* OSX doesn't implement POSIX semaphores completely so we wrap other semaphore calls */
-typedef struct {
-    dispatch_semaphore_t sem;
-    int counter;
-} sem_t;
-static int sem_init(sem_t* sem,int pshared,unsigned int value)
-{
-    sem->sem = dispatch_semaphore_create(value);
-    sem->counter = value;
-    return 0;
-    (void)pshared;
-}
-static int sem_wait(sem_t* sem)
-{
-    dispatch_semaphore_wait(sem->sem,DISPATCH_TIME_FOREVER);
-    --sem->counter;
-    return 0;
-}
-static int sem_post(sem_t* sem)
-{
-    dispatch_semaphore_signal(sem->sem);
-    ++sem->counter;
-    return 0;
-}
-static int sem_getvalue(sem_t* sem,int* sval)
-{
-    *sval = sem->counter;
-    return 0;
-}
-
-#elif defined(POKGAME_LINUX)
-#include <semaphore.h>
-
-#endif /* POKGAME_OSX/POKGAME_LINUX */
-
-#define SEMAPHORE_MAX 10
-
 #ifdef POKGAME_DEBUG
 #define CHECK_SUCCESS(call) \
     if (call != 0) \
@@ -67,9 +15,7 @@ static int sem_getvalue(sem_t* sem,int* sval)
 struct gamelock
 {
     void* object;          /* we need to provide synchronization for this object */
-    sem_t readOnly;        /* this semaphore allows more than 1 process to read the object */
-    sem_t modify;          /* this mutex allows 1 process to modify the object */
-    pthread_mutex_t atom;  /* this mutex makes certain operations atomic */
+    pthread_rwlock_t rw;   /* many threads may read the object; 1 thread may modify the object */
 };
 
 struct gamelock* gamelock_new(void* object)
@@ -81,63 +27,37 @@ struct gamelock* gamelock_new(void* object)
         return NULL;
     }
     lock->object = object;
-    sem_init(&lock->readOnly,0,SEMAPHORE_MAX);
-    sem_init(&lock->modify,0,1);
-    pthread_mutex_init(&lock->atom,NULL);
+    if (pthread_rwlock_init(&lock->rw,NULL) != 0) {
+        free(lock);
+        pok_error(pok_error_fatal,"fail pthread_rwlock_init()");
+        return NULL;
+    }
     return lock;
 }
 void gamelock_free(struct gamelock* lock)
 {
+    pthread_rwlock_destroy(&lock->rw);
     free(lock);
 }
 void gamelock_aquire(struct gamelock* lock)
 {
     /* aquire writer's lock */
-    CHECK_SUCCESS( sem_wait(&lock->modify) );
+    CHECK_SUCCESS( pthread_rwlock_wrlock(&lock->rw) );
 }
 void gamelock_release(struct gamelock* lock)
 {
     /* release writer's lock */
-    CHECK_SUCCESS( sem_post(&lock->modify) );
+    CHECK_SUCCESS( pthread_rwlock_unlock(&lock->rw) );
 }
 void gamelock_up(struct gamelock* lock)
 {
-    /* aquire readers' lock; make the following region executes atomically; the
-       mutex will also act as a queue for clients wishing to aquire read lock */
-    CHECK_SUCCESS( pthread_mutex_lock(&lock->atom) );
-    {
-        /* since this is a critical region, then we can accurately read the semaphore's value */
-        int value;
-        CHECK_SUCCESS( sem_getvalue(&lock->readOnly,&value) );
-        /* if no one has entered the readOnly context, then seal off the modify context
-           before entering the readOnly context */
-        if (value == SEMAPHORE_MAX) {
-            CHECK_SUCCESS( sem_wait(&lock->modify) );
-            CHECK_SUCCESS( sem_wait(&lock->readOnly) );
-            CHECK_SUCCESS( pthread_mutex_unlock(&lock->atom) );
-            return;
-        }
-    }
-    CHECK_SUCCESS( pthread_mutex_unlock(&lock->atom) );
-    /* default: enter read only context (this could but probably won't block) */
-    CHECK_SUCCESS( sem_wait(&lock->readOnly) );
+    /* aquire readers' lock */
+    CHECK_SUCCESS( pthread_rwlock_rdlock(&lock->rw) );
 }
 void gamelock_down(struct gamelock* lock)
 {
-    /* release readers' lock; make sure the following region executes atomically; the
-       mutex will also act as a queue for clients wishing to release read lock */
-    CHECK_SUCCESS( pthread_mutex_lock(&lock->atom) );
-    {
-        /* since this is a critical region, then we can accurately read the semaphore's value */
-        int value;
-        CHECK_SUCCESS( sem_post(&lock->readOnly) );
-        CHECK_SUCCESS( sem_getvalue(&lock->readOnly,&value) );
-        /* if we are the last to leave the readOnly context,
-           then yield access to the modify context */
-        if (value == SEMAPHORE_MAX)
-            CHECK_SUCCESS( sem_post(&lock->modify) );
-    }
-    CHECK_SUCCESS( pthread_mutex_unlock(&lock->atom) );
+    /* release readers' lock */
+    CHECK_SUCCESS( pthread_rwlock_unlock(&lock->rw) );
 }
 int gamelock_compar(const struct gamelock* left,const struct gamelock* right)
 {
@@ -166,3 +86,29 @@ void pok_timeout_no_elapsed(struct pok_timeout_interval* interval)
     ts.tv_nsec = interval->nseconds;
     nanosleep(&ts,NULL);
 }
+
+/* implement timestep clock from 'gamelock.c' */
+static uint64_t timestep_clock()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+static void timestep_sleep_until(uint64_t deadline)
+{
+    struct timespec ts;
+#if defined(POKGAME_OSX)
+    /* no absolute sleep is available; sleep for the time remaining until the deadline */
+    uint64_t now = timestep_clock();
+    if (now >= deadline)
+        return;
+    ts.tv_sec = (deadline - now) / 1000000000;
+    ts.tv_nsec = (deadline - now) % 1000000000;
+    nanosleep(&ts,NULL);
+#else
+    ts.tv_sec = deadline / 1000000000;
+    ts.tv_nsec = deadline % 1000000000;
+    while (clock_nanosleep(CLOCK_MONOTONIC,TIMER_ABSTIME,&ts,NULL) == EINTR)
+        ;
+#endif
+}
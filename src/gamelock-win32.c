@@ -1,15 +1,10 @@
 #include "error.h"
 #include <Windows.h>
 
-#define MAX_SEMAPHORE 10
-
 struct gamelock
 {
     void* object;
-    HANDLE readOnly;
-    HANDLE modify;
-    HANDLE atom;
-    INT updown;
+    SRWLOCK rw;
 };
 
 struct gamelock* gamelock_new(void* object)
@@ -21,48 +16,29 @@ struct gamelock* gamelock_new(void* object)
         return NULL;
     }
     lock->object = object;
-    lock->readOnly = CreateSemaphore(NULL, MAX_SEMAPHORE, MAX_SEMAPHORE, NULL);
-    lock->modify = CreateSemaphore(NULL, 1, 1, NULL);
-    lock->atom = CreateMutex(NULL, FALSE, NULL);
-    lock->updown = 0;
-    if (lock->readOnly == NULL || lock->modify == NULL)
-        pok_error(pok_error_fatal, "fail CreateSemaphore()");
-    if (lock->atom == NULL)
-        pok_error(pok_error_fatal, "fail CreateMutex()");
+    InitializeSRWLock(&lock->rw);
     return lock;
 }
 void gamelock_free(struct gamelock* lock)
 {
-    CloseHandle(lock->readOnly);
-    CloseHandle(lock->modify);
-    CloseHandle(lock->atom);
+    /* slim reader/writer locks do not need to be destroyed */
     free(lock);
 }
 void gamelock_aquire(struct gamelock* lock)
 {
-    WaitForSingleObject(lock->modify, INFINITE);
+    AcquireSRWLockExclusive(&lock->rw);
 }
 void gamelock_release(struct gamelock* lock)
 {
-    ReleaseSemaphore(lock->modify, 1, NULL);
+    ReleaseSRWLockExclusive(&lock->rw);
 }
 void gamelock_up(struct gamelock* lock)
 {
-    WaitForSingleObject(lock->atom, INFINITE);
-    if (lock->updown++ == 0)
-        /* get inside the modify context */
-        WaitForSingleObject(lock->modify, INFINITE);
-    ReleaseMutex(lock->atom);
-    WaitForSingleObject(lock->readOnly, INFINITE);
+    AcquireSRWLockShared(&lock->rw);
 }
 void gamelock_down(struct gamelock* lock)
 {
-    WaitForSingleObject(lock->atom, INFINITE);
-    if (--lock->updown == 0)
-        /* we are the last reader; get outside modify context */
-        ReleaseSemaphore(lock->modify, 1, NULL);
-    ReleaseMutex(lock->atom);
-    ReleaseSemaphore(lock->readOnly, 1, NULL);
+    ReleaseSRWLockShared(&lock->rw);
 }
 int gamelock_compar(const struct gamelock* left,const struct gamelock* right)
 {
@@ -121,3 +97,33 @@ void pok_timeout_no_elapsed(struct pok_timeout_interval* interval)
     /* this variant just does the sleep; it does not compute and set the elapsed time */
     Sleep(interval->mseconds);
 }
+
+/* implement timestep clock from 'gamelock.c' */
+static uint64_t timestep_clock()
+{
+    LARGE_INTEGER counter;
+    static LARGE_INTEGER freq = { 0, 0 };
+    if (freq.QuadPart == 0)
+        QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&counter);
+    return (uint64_t) (counter.QuadPart / freq.QuadPart * 1000000000
+        + counter.QuadPart % freq.QuadPart * 1000000000 / freq.QuadPart);
+}
+static void timestep_sleep_until(uint64_t deadline)
+{
+    /* use a waitable timer with a relative due time (in 100 ns units) */
+    LARGE_INTEGER due;
+    uint64_t now;
+    static HANDLE hTimer = NULL;
+    if (hTimer == NULL)
+        hTimer = CreateWaitableTimer(NULL,TRUE,NULL);
+    now = timestep_clock();
+    if (now >= deadline)
+        return;
+    due.QuadPart = -(LONGLONG) ((deadline - now) / 100);
+    if (hTimer == NULL || !SetWaitableTimer(hTimer,&due,0,NULL,NULL,FALSE)) {
+        Sleep((DWORD) ((deadline - now) / 1000000));
+        return;
+    }
+    WaitForSingleObject(hTimer,INFINITE);
+}
@@ -1,28 +1,121 @@
 /* gamelock.c - pokgame */
 #include "gamelock.h"
 #include "error.h"
-#include <dstructs/hashmap.h>
+#include "trace.h"
 #include <stdlib.h>
 
-static int gamelock_hash(const void** obj,int size)
+/* the lock table is a fixed-size open addressing table of locks keyed by object address; a lock
+   is registered the first time an object is used and remains registered until the object is
+   unregistered (see 'pok_game_lock_unregister'), which leaves a tombstone that a later registration
+   may reuse; lookups of registered objects do not need a global lock: a slot's lock is published
+   before its object address and the address is loaded with acquire semantics, so a thread that
+   finds the address also finds the lock; registration
+   and unregistration are serialized by a table lock so that no object is registered twice */
+#define GAMELOCK_TABLE_SIZE 4096 /* must be a power of 2 */
+#define GAMELOCK_TOMBSTONE ((void*)&tableLock)
+
+#if defined(POKGAME_WIN32)
+#include <Windows.h>
+#define gamelock_barrier() MemoryBarrier()
+static inline void* gamelock_load_acquire(void* volatile* p)
 {
-    return (long long int)*obj % size;
+    void* v = *p;
+    MemoryBarrier();
+    return v;
 }
+#else
+#define gamelock_barrier() __sync_synchronize()
+#define gamelock_load_acquire(p) __atomic_load_n(p,__ATOMIC_ACQUIRE)
+#endif
+
+struct gamelock_entry
+{
+    void* volatile object;
+    struct gamelock* volatile lock;
+};
 
 /* global game object collections */
-static struct gamelock* glock; /* global lock */
-static struct hashmap locks; /* void* --> void* */
+static struct gamelock_entry* locks; /* void* --> gamelock* */
+static struct gamelock* tableLock; /* serializes changes to 'locks' */
+
+static size_t gamelock_hash(const void* object)
+{
+    /* objects are at least word-aligned so drop the low bits before mixing */
+    uint64_t h = (uint64_t)(uintptr_t)object >> 3;
+    h *= 0x9e3779b97f4a7c15ull;
+    return (size_t)(h >> 32) & (GAMELOCK_TABLE_SIZE - 1);
+}
+static struct gamelock_entry* gamelock_find(const void* object,struct gamelock_entry** vacant)
+{
+    /* find the entry for the specified object; if 'vacant' is not NULL then it receives the
+       first empty or dead slot along the probe sequence */
+    size_t i, n;
+    i = gamelock_hash(object);
+    if (vacant != NULL)
+        *vacant = NULL;
+    for (n = 0;n < GAMELOCK_TABLE_SIZE;++n,i = (i+1) & (GAMELOCK_TABLE_SIZE-1)) {
+        struct gamelock_entry* entry = locks + i;
+        void* key = gamelock_load_acquire(&entry->object);
+        if (key == object)
+            return entry;
+        if (vacant != NULL && *vacant == NULL && (key == NULL || key == GAMELOCK_TOMBSTONE))
+            *vacant = entry;
+        if (key == NULL)
+            break;
+    }
+    return NULL;
+}
+static struct gamelock* gamelock_lookup(void* object)
+{
+    /* find the lock for the specified object; create and register it if it does not exist */
+    struct gamelock* lock;
+    struct gamelock_entry* entry;
+    struct gamelock_entry* vacant;
+    if ((entry = gamelock_find(object,NULL)) != NULL)
+        return entry->lock;
+    gamelock_aquire(tableLock);
+    if ((entry = gamelock_find(object,&vacant)) != NULL)
+        /* another thread registered the object first */
+        lock = entry->lock;
+    else {
+        if (vacant == NULL)
+            pok_error(pok_error_fatal,"too many objects in gamelock_lookup()");
+        lock = gamelock_new(object);
+        if (lock == NULL)
+            pok_error(pok_error_fatal,"memory fail in gamelock_lookup()");
+        vacant->lock = lock;
+        gamelock_barrier();
+        vacant->object = object;
+    }
+    gamelock_release(tableLock);
+    return lock;
+}
 
 /* module load/unload functions */
 void pok_gamelock_load_module()
 {
-    glock = gamelock_new(NULL);
-    hashmap_init(&locks,20,(hash_function)gamelock_hash,(key_comparator)gamelock_compar);
+    size_t i;
+    locks = malloc(sizeof(struct gamelock_entry) * GAMELOCK_TABLE_SIZE);
+    if (locks == NULL)
+        pok_error(pok_error_fatal,"memory fail in pok_gamelock_load_module()");
+    for (i = 0;i < GAMELOCK_TABLE_SIZE;++i) {
+        locks[i].object = NULL;
+        locks[i].lock = NULL;
+    }
+    tableLock = gamelock_new(NULL);
+    if (tableLock == NULL)
+        pok_error(pok_error_fatal,"memory fail in pok_gamelock_load_module()");
 }
 void pok_gamelock_unload_module()
 {
-    hashmap_delete_ex(&locks,(destructor)gamelock_free);
-    gamelock_free(glock);
+    size_t i;
+    for (i = 0;i < GAMELOCK_TABLE_SIZE;++i)
+        if (locks[i].lock != NULL)
+            gamelock_free(locks[i].lock);
+    free(locks);
+    locks = NULL;
+    gamelock_free(tableLock);
+    tableLock = NULL;
 }
 
 /* pok_timeout_interval */
@@ -34,72 +127,106 @@ void pok_timeout_interval_reset(struct pok_timeout_interval* t,uint32_t mseconds
     t->elapsed = 0;
 }
 
+/* pok_timestep; the platform code provides a monotonic clock and an absolute sleep */
+static uint64_t timestep_clock();
+static void timestep_sleep_until(uint64_t deadline);
+
+void pok_timestep_reset(struct pok_timestep* ts,uint32_t mseconds,uint32_t maxSteps)
+{
+    ts->mseconds = mseconds;
+    ts->maxSteps = maxSteps > 0 ? maxSteps : 1;
+    ts->nseconds = (uint64_t)mseconds * 1000000;
+    ts->slack = 0;
+    ts->waits = 0;
+    ts->steps = 0;
+    ts->overruns = 0;
+    ts->dropped = 0;
+    ts->_last = 0;
+    ts->_accum = 0;
+    ts->_deadline = 0;
+}
+void pok_timestep_reset_rate(struct pok_timestep* ts,uint32_t rate,uint32_t maxSteps)
+{
+    if (rate == 0)
+        rate = 1;
+    pok_timestep_reset(ts,1000 / rate,maxSteps);
+    ts->nseconds = 1000000000 / rate;
+}
+uint32_t pok_timestep_wait(struct pok_timestep* ts)
+{
+    uint64_t now, period, steps;
+    period = ts->nseconds > 0 ? ts->nseconds : 1;
+    now = timestep_clock();
+    if (ts->_last == 0) {
+        /* first wait: start the deadline grid now */
+        ts->_last = now;
+        ts->_deadline = now + period;
+    }
+
+    /* sleep until the next deadline; if it has already passed then the previous
+       step(s) overran and we must catch up */
+    ts->slack = 0;
+    if (now < ts->_deadline) {
+        uint64_t before = now;
+        timestep_sleep_until(ts->_deadline);
+        now = timestep_clock();
+        ts->slack = now - before;
+    }
+    ts->_accum += now - ts->_last;
+    ts->_last = now;
+
+    /* consume whole steps from the accumulator; the remainder carries into the next
+       step so that the deadline grid does not drift */
+    steps = ts->_accum / period;
+    if (steps == 0)
+        /* the clock reported a wakeup just before the deadline */
+        steps = 1;
+    ts->_accum = ts->_accum > steps * period ? ts->_accum - steps * period : 0;
+    ++ts->waits;
+    if (steps > 1)
+        ++ts->overruns;
+    if (steps > ts->maxSteps) {
+        ts->dropped += steps - ts->maxSteps;
+        steps = ts->maxSteps;
+    }
+    ts->steps += steps;
+    ts->_deadline = now + (period - ts->_accum);
+    return (uint32_t)steps;
+}
+uint64_t pok_timestep_clock()
+{
+    return timestep_clock();
+}
+
 /* global game locks */
 void pok_game_modify_enter(void* object)
 {
-    /* see if a gamelock exists for the specified object */
-    struct gamelock* lock;
-    gamelock_up(glock);
-    lock = hashmap_lookup(&locks,&object); /* thread safe */
-    gamelock_down(glock);
-    if (lock == NULL) {
-        /* create a new lock */
-        lock = gamelock_new(object);
-        if (lock == NULL)
-            pok_error(pok_error_fatal,"memory fail in pok_game_modify_enter()");
-        gamelock_aquire(glock);
-        hashmap_insert(&locks,lock);
-        gamelock_release(glock);
-    }
-    gamelock_aquire(lock);
+    POK_TRACE_CALL("pok_game_modify_enter",gamelock_aquire( gamelock_lookup(object) ));
 }
 void pok_game_modify_exit(void* object)
 {
-    /* see if a gamelock exists for the specified object (it should) */
-    struct gamelock* lock;
-    gamelock_up(glock);
-    lock = hashmap_lookup(&locks,&object); /* thread safe */
-    gamelock_down(glock);
-    if (lock != NULL)
-        gamelock_release(lock);
+    gamelock_release( gamelock_lookup(object) );
 }
 void pok_game_lock(void* object)
 {
-    struct gamelock* lock;
-    gamelock_up(glock);
-    lock = hashmap_lookup(&locks,&object); /* thread safe */
-    if (lock == NULL) {
-        gamelock_down(glock);
-        /* create a new lock */
-        lock = gamelock_new(object);
-        if (lock == NULL)
-            pok_error(pok_error_fatal,"memory fail in pok_game_modify_enter()");
-        gamelock_aquire(glock);
-        hashmap_insert(&locks,lock);
-        gamelock_release(glock);
-        gamelock_up(glock);
-    }
-    gamelock_up(lock);
-    gamelock_down(glock);
+    POK_TRACE_CALL("pok_game_lock",gamelock_up( gamelock_lookup(object) ));
 }
 void pok_game_unlock(void* object)
 {
-    struct gamelock* lock;
-    gamelock_up(glock);
-    lock = hashmap_lookup(&locks,&object); /* thread safe */
-    if (lock == NULL) {
-        gamelock_down(glock);
-        /* create a new lock */
-        lock = gamelock_new(object);
-        if (lock == NULL)
-            pok_error(pok_error_fatal,"memory fail in pok_game_modify_enter()");
-        gamelock_aquire(glock);
-        hashmap_insert(&locks,lock);
-        gamelock_release(glock);
-        gamelock_up(glock);
+    gamelock_down( gamelock_lookup(object) );
+}
+void pok_game_lock_unregister(void* object)
+{
+    struct gamelock_entry* entry;
+    gamelock_aquire(tableLock);
+    if ((entry = gamelock_find(object,NULL)) != NULL) {
+        struct gamelock* lock = entry->lock;
+        entry->object = GAMELOCK_TOMBSTONE;
+        gamelock_barrier();
+        entry->lock = NULL;
+        gamelock_free(lock);
     }
-    gamelock_down(lock);
-    gamelock_down(glock);
+    gamelock_release(tableLock);
 }
 
 /* include platform specific code */
@@ -25,6 +25,32 @@ void pok_timeout_no_elapsed(struct pok_timeout_interval* interval);
 void pok_timeout_grab_counter(struct pok_timeout_interval* interval);
 void pok_timeout_calc_elapsed(struct pok_timeout_interval* interval);
 
+/* timestep: fixed-timestep scheduler; steps are due on a fixed grid of absolute deadlines
+   so that time spent processing a step is not added to the step period; if the caller falls
+   behind, the scheduler reports multiple steps due (up to 'maxSteps') so the caller can
+   catch up, dropping any steps beyond that */
+struct pok_timestep
+{
+    uint32_t mseconds; /* duration of a single step (rounded down for rate-based steps) */
+    uint32_t maxSteps; /* maximum number of catch-up steps reported by a single wait */
+    uint64_t nseconds; /* exact duration of a single step */
+    uint64_t slack;    /* time (nanoseconds) the last wait spent sleeping */
+
+    /* statistics */
+    uint64_t waits;    /* number of calls to 'pok_timestep_wait' */
+    uint64_t steps;    /* number of steps reported */
+    uint64_t overruns; /* number of waits where the deadline had already passed by at least one step */
+    uint64_t dropped;  /* number of steps dropped because they exceeded 'maxSteps' */
+
+    uint64_t _last;       /* clock value (nanoseconds) of the previous wait */
+    uint64_t _accum;      /* time (nanoseconds) accumulated but not yet consumed by a step */
+    uint64_t _deadline;   /* absolute clock value (nanoseconds) of the next step */
+};
+void pok_timestep_reset(struct pok_timestep* ts,uint32_t mseconds,uint32_t maxSteps);
+void pok_timestep_reset_rate(struct pok_timestep* ts,uint32_t rate,uint32_t maxSteps); /* 'rate' steps per second */
+uint32_t pok_timestep_wait(struct pok_timestep* ts); /* block until a step is due; return number of steps due */
+uint64_t pok_timestep_clock(); /* monotonic clock value in nanoseconds */
+
 /* these functions provide mutual exclusion when an object is edited; the 'modify' functions
    should be called to ensure code may modify the specified object undisturbed; if the code
    need only read an object, then the 'lock' function should be called; these functions block
@@ -33,6 +59,9 @@ void pok_game_modify_enter(void* object); /* enter modify context */
 void pok_game_modify_exit(void* object); /* exit modify context */
 void pok_game_lock(void* object); /* ensure that 'object' is not being modified (read-only access) */
 void pok_game_unlock(void* object); /* exit 'lock' context (read-only access) */
+/* release the object's lock; call when the object is freed: the lock itself is freed, so the caller must
+   guarantee that no other thread can still reach the object (and so be using or looking up its lock) */
+void pok_game_lock_unregister(void* object);
 
 /* gamelock: represents a lock on a particular game object */
 
@@ -43,6 +43,8 @@ struct _pok_graphics_subsystem_impl
     volatile bool_t texinfoLoad;   /* texture information is for loading if TRUE, deleting otherwise */
     volatile int texinfoCount;     /* texture information; if set then the rendering thread loads new textures */
     volatile struct texture_info* texinfo;
+
+    bool_t vsync;                  /* if TRUE, buffer swaps are synchronized with the display (and block) */
 };
 
 #ifdef POKGAME_DEBUG
@@ -417,6 +419,15 @@ void make_frame(struct pok_graphics_subsystem* sys)
     /* make the context current on this thread and attach it to the window */
     if ( !glXMakeCurrent(display,sys->impl->window,sys->impl->context) )
         pok_error(pok_error_fatal,"fail glXMakeCurrent()");
+    /* request swap synchronization if specified; if the extension is unavailable then the
+       render loop will continue to pace itself */
+    sys->impl->vsync = FALSE;
+    if (sys->vsync) {
+        int (*swapInterval)(int);
+        swapInterval = (int(*)(int))glXGetProcAddressARB((const GLubyte*)"glXSwapIntervalSGI");
+        if (swapInterval != NULL && swapInterval(1) == 0)
+            sys->impl->vsync = TRUE;
+    }
     /* call function to setup OpenGL */
     gl_init(sys->wwidth,sys->wheight);
 }
@@ -451,14 +462,14 @@ void close_frame(struct pok_graphics_subsystem* sys)
 void* graphics_loop(struct pok_graphics_subsystem* sys)
 {
     uint16_t index;
-    int framerate = 0;
-    useconds_t sleepamt = 0;
+    struct frame_pacer pacer;
 
     /* initialize global X11 connection */
     do_x_init();
 
     /* make the frame */
     make_frame(sys);
+    frame_pacer_init(sys,&pacer);
 
     /* call load routine on graphics subsystem (if specified) */
     if (sys->loadRoutine != NULL)
@@ -537,36 +548,32 @@ void* graphics_loop(struct pok_graphics_subsystem* sys)
         }
 
         /* clear the screen */
+        frame_pacer_begin(&pacer);
         glClear(GL_COLOR_BUFFER_BIT);
 
         /* rendering */
         if (sys->impl->gameRendering) {
             /* go through and call each render function; we need to obtain
                a lock for the right to render; this allows for synchronization
-               with the update process */
+               with the update process (the map and characters are drawn from
+               render snapshots so the update process rarely needs the lock) */
             pthread_mutex_lock(&sys->impl->mutex);
 
             for (index = 0;index < sys->routinetop;++index)
                 if (sys->routines[index])
                     sys->routines[index](sys,sys->contexts[index]);
-            /* expose the backbuffer */
-            glXSwapBuffers(display,sys->impl->window);
 
             pthread_mutex_unlock(&sys->impl->mutex);
         }
-        else
-            /* expose just a black back buffer */
-            glXSwapBuffers(display,sys->impl->window);
-
-        /* check for framerate updates */
-        if (sys->framerate != framerate) {
-            framerate = sys->framerate;
-            /* usleep uses microseconds; there are 10^6 microseconds in a second */
-            sleepamt = 1000000 / framerate;
-        }
+        frame_pacer_rendered(sys,&pacer);
+
+        /* expose the backbuffer (just a black back buffer if the game is not rendering);
+           this is done without the lock since it may block until the next vertical retrace */
+        glXSwapBuffers(display,sys->impl->window);
+        frame_pacer_swapped(sys,&pacer);
 
-        /* put the thread to sleep to produce a frame rate */
-        usleep(sleepamt);
+        /* put the thread to sleep until the next frame deadline to produce a frame rate */
+        frame_pacer_wait(sys,&pacer,sys->impl->vsync);
     }
 
     /* cleanup */
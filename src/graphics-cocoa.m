@@ -489,13 +489,13 @@ bool_t pok_graphics_subsystem_keyboard_query(struct pok_graphics_subsystem* sys,
 
 void pok_graphics_subsystem_render_loop(struct pok_graphics_subsystem* sys)
 {
-    int framerate = 0;
-    int sleepamt;
+    struct frame_pacer pacer;
     PokCocoaSubsystem* cocoa;
 
     /* initialize Cocoa (if we are first to do so) and then create main app window */
     [PokCocoaSubsystem initApp];
     cocoa = [[PokCocoaSubsystem alloc] initWithSys:sys];
+    frame_pacer_init(sys,&pacer);
 
     /* call load routine */
     if (sys->loadRoutine != NULL)
@@ -548,26 +548,23 @@ void pok_graphics_subsystem_render_loop(struct pok_graphics_subsystem* sys)
         }
 
         /* clear the screen */
+        frame_pacer_begin(&pacer);
         glClear(GL_COLOR_BUFFER_BIT);
 
         /* do rendering */
         if (sys->impl->gameRendering) {
             pthread_mutex_lock(&sys->impl->graphicsLock);
             [cocoa callRenderRoutines];
-            [cocoa present];
             pthread_mutex_unlock(&sys->impl->graphicsLock);
         }
-        else
-            [cocoa present];
+        frame_pacer_rendered(sys,&pacer);
 
-        /* check for framerate change */
-        if (framerate != sys->framerate) {
-            framerate = sys->framerate;
-            sleepamt = 1000000 / framerate;
-        }
+        /* present without the lock since this may wait for the vertical retrace */
+        [cocoa present];
+        frame_pacer_swapped(sys,&pacer);
 
-        /* perform timeout */
-        usleep(sleepamt);
+        /* perform timeout until the next frame deadline */
+        frame_pacer_wait(sys,&pacer,FALSE);
     }
 
     /* cleanup */
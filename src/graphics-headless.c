@@ -0,0 +1,398 @@
+/* graphics-headless.c - implement graphics subsystem using an offscreen EGL surface */
+#include "graphics-impl.h"
+#include "graphics-headless.h"
+#include "error.h"
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GL/gl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+/* functions */
+static void make_surface(struct pok_graphics_subsystem* sys);
+static void edit_surface(struct pok_graphics_subsystem* sys);
+static void close_surface(struct pok_graphics_subsystem* sys);
+static void* graphics_loop(struct pok_graphics_subsystem* sys);
+
+/* globals */
+static struct pok_graphics_headless_options options = { 0, FALSE, 0, NULL };
+
+struct _pok_graphics_subsystem_impl
+{
+    EGLDisplay display;                /* EGL display connection (surfaceless if supported) */
+    EGLConfig config;                  /* framebuffer configuration */
+    EGLSurface surface;                /* offscreen pixel buffer */
+    EGLContext context;                /* OpenGL rendering context */
+    pthread_t tid;                     /* the rendering routine runs on the thread represented by this process id */
+    pthread_mutex_t mutex;             /* this locks the renderer; used for synchronizing updating and rendering */
+    struct gl_texture_info gltexinfo;  /* OpenGL texture information */
+    struct pok_graphics_headless_options options; /* options in effect for this subsystem */
+
+    /* shared variable flags: we can set a flag and have an operation performed on the rendering thread */
+    volatile bool_t rendering;     /* is the system rendering frames? */
+    volatile bool_t gameRendering; /* is the system invoking game rendering? */
+    volatile bool_t editFrame;     /* request to reinitialize the surface */
+    volatile bool_t texinfoLoad;   /* texture information is for loading if TRUE, deleting otherwise */
+    volatile int texinfoCount;     /* texture information; if set then the rendering thread loads new textures */
+    volatile struct texture_info* texinfo;
+};
+
+#ifdef POKGAME_DEBUG
+
+static void check_impl(struct pok_graphics_subsystem* sys)
+{
+    if (sys->impl == NULL)
+        pok_error(pok_error_fatal,"graphics_subsystem was not configured properly!");
+}
+
+#endif
+
+void pok_graphics_headless_configure(const struct pok_graphics_headless_options* opts)
+{
+    options = *opts;
+}
+
+/* implement the graphics subsystem interface */
+bool_t impl_new(struct pok_graphics_subsystem* sys)
+{
+    /* initialize a new impl object for the graphics subsystem */
+    sys->impl = malloc(sizeof(struct _pok_graphics_subsystem_impl));
+    if (sys->impl == NULL) {
+        pok_exception_flag_memory_error();
+        return FALSE;
+    }
+    sys->impl->display = EGL_NO_DISPLAY;
+    sys->impl->surface = EGL_NO_SURFACE;
+    sys->impl->context = EGL_NO_CONTEXT;
+    sys->impl->options = options;
+    sys->impl->texinfoLoad = TRUE;
+    sys->impl->gltexinfo.textureAlloc = 32;
+    sys->impl->gltexinfo.textureCount = 0;
+    sys->impl->gltexinfo.textureNames = malloc(sizeof(GLuint) * sys->impl->gltexinfo.textureAlloc);
+    if (sys->impl->gltexinfo.textureNames == NULL) {
+        pok_exception_flag_memory_error();
+        free(sys->impl);
+        return FALSE;
+    }
+    /* like the windowed implementations, rendering happens on a separate thread */
+    sys->background = TRUE;
+    sys->impl->rendering = TRUE;
+    sys->impl->gameRendering = TRUE;
+    sys->impl->editFrame = FALSE;
+    sys->impl->texinfo = NULL;
+    sys->impl->texinfoCount = 0;
+    pthread_mutex_init(&sys->impl->mutex,NULL);
+    if (pthread_create(&sys->impl->tid,NULL,(void*(*)(void*))graphics_loop,sys) != 0)
+        pok_error(pok_error_fatal,"fail pthread_create()");
+    return TRUE;
+}
+inline void impl_set_game_state(struct pok_graphics_subsystem* sys,bool_t state)
+{
+#ifdef POKGAME_DEBUG
+    check_impl(sys);
+#endif
+
+    sys->impl->gameRendering = state;
+}
+void impl_free(struct pok_graphics_subsystem* sys)
+{
+#ifdef POKGAME_DEBUG
+    check_impl(sys);
+#endif
+
+    /* flag that rendering should stop and join the render thread
+       back with this thread */
+    sys->impl->rendering = FALSE;
+    if (pthread_join(sys->impl->tid,NULL) != 0)
+        pok_error(pok_error_fatal,"fail pthread_join()");
+    if (sys->impl->texinfo != NULL)
+        free((struct texture_info*)sys->impl->texinfo);
+    pthread_mutex_destroy(&sys->impl->mutex);
+    free(sys->impl->gltexinfo.textureNames);
+    free(sys->impl);
+    sys->impl = NULL;
+}
+inline void impl_reload(struct pok_graphics_subsystem* sys)
+{
+#ifdef POKGAME_DEBUG
+    check_impl(sys);
+#endif
+
+    sys->impl->editFrame = TRUE;
+}
+void impl_load_textures(struct pok_graphics_subsystem* sys,struct texture_info* info,int count)
+{
+#ifdef POKGAME_DEBUG
+    check_impl(sys);
+#endif
+
+    /* wait until any previous request has been processed */
+    pthread_mutex_lock(&sys->impl->mutex);
+    while (sys->impl->texinfo != NULL) {
+        pthread_mutex_unlock(&sys->impl->mutex);
+        sched_yield();
+        pthread_mutex_lock(&sys->impl->mutex);
+    }
+    sys->impl->texinfoLoad = TRUE;
+    sys->impl->texinfo = info;
+    sys->impl->texinfoCount = count;
+    pthread_mutex_unlock(&sys->impl->mutex);
+}
+void impl_delete_textures(struct pok_graphics_subsystem* sys,struct texture_info* info,int count)
+{
+#ifdef POKGAME_DEBUG
+    check_impl(sys);
+#endif
+
+    /* wait until any previous request has been processed */
+    pthread_mutex_lock(&sys->impl->mutex);
+    while (sys->impl->texinfo != NULL) {
+        pthread_mutex_unlock(&sys->impl->mutex);
+        sched_yield();
+        pthread_mutex_lock(&sys->impl->mutex);
+    }
+    sys->impl->texinfoLoad = FALSE;
+    sys->impl->texinfo = info;
+    sys->impl->texinfoCount = count;
+    pthread_mutex_unlock(&sys->impl->mutex);
+}
+inline void impl_map_window(struct pok_graphics_subsystem* sys)
+{
+    /* there is no window to map */
+    (void)sys;
+}
+inline void impl_unmap_window(struct pok_graphics_subsystem* sys)
+{
+    (void)sys;
+}
+inline void impl_lock(struct pok_graphics_subsystem* sys)
+{
+#ifdef POKGAME_DEBUG
+    check_impl(sys);
+#endif
+
+    pthread_mutex_lock(&sys->impl->mutex);
+}
+inline void impl_unlock(struct pok_graphics_subsystem* sys)
+{
+#ifdef POKGAME_DEBUG
+    check_impl(sys);
+#endif
+
+    pthread_mutex_unlock(&sys->impl->mutex);
+}
+
+/* there is no keyboard */
+bool_t pok_graphics_subsystem_keyboard_query(struct pok_graphics_subsystem* sys,enum pok_input_key key,bool_t refresh)
+{
+    (void)sys;
+    (void)key;
+    (void)refresh;
+    return FALSE;
+}
+
+/* misc. pok_graphics_subsystem functions */
+bool_t pok_graphics_subsystem_is_running(struct pok_graphics_subsystem* sys)
+{
+    return sys->impl != NULL && sys->impl->rendering && sys->impl->gameRendering;
+}
+bool_t pok_graphics_subsystem_has_window(struct pok_graphics_subsystem* sys)
+{
+    /* the "window" is up until rendering stops (e.g. the frame limit is reached) */
+    return sys->impl != NULL && sys->impl->rendering;
+}
+void pok_graphics_subsystem_lock(struct pok_graphics_subsystem* sys)
+{
+#ifdef POKGAME_DEBUG
+    check_impl(sys);
+#endif
+
+    pthread_mutex_lock(&sys->impl->mutex);
+}
+void pok_graphics_subsystem_unlock(struct pok_graphics_subsystem* sys)
+{
+#ifdef POKGAME_DEBUG
+    check_impl(sys);
+#endif
+
+    pthread_mutex_unlock(&sys->impl->mutex);
+}
+void pok_graphics_subsystem_render_loop(struct pok_graphics_subsystem* sys)
+{
+    graphics_loop(sys);
+}
+
+bool_t pok_graphics_headless_save_frame(const struct pok_graphics_subsystem* sys,const char* file)
+{
+    /* read back the current framebuffer and save it as a PNG image; OpenGL returns
+       rows bottom to top so they are flipped while copying into the image */
+    uint32_t i;
+    bool_t result;
+    byte_t* pixels;
+    struct pok_image* img;
+    size_t pitch = (size_t)sys->wwidth * 3;
+    pixels = malloc(pitch * sys->wheight);
+    if (pixels == NULL) {
+        pok_exception_flag_memory_error();
+        return FALSE;
+    }
+    img = pok_image_new_rgb_fill(sys->wwidth,sys->wheight,BLACK_PIXEL);
+    if (img == NULL) {
+        free(pixels);
+        return FALSE;
+    }
+    glPixelStorei(GL_PACK_ALIGNMENT,1);
+    glReadPixels(0,0,sys->wwidth,sys->wheight,GL_RGB,GL_UNSIGNED_BYTE,pixels);
+    for (i = 0;i < (uint32_t)sys->wheight;++i)
+        memcpy((byte_t*)img->pixels.data + pitch * i,pixels + pitch * (sys->wheight - i - 1),pitch);
+    free(pixels);
+    result = pok_image_png_save(img,file);
+    pok_image_free(img);
+    return result;
+}
+
+/* EGL functions */
+void make_surface(struct pok_graphics_subsystem* sys)
+{
+    /* create an offscreen rendering surface; prefer Mesa's surfaceless platform so that
+       no display server is required */
+    EGLint count;
+    static const EGLint configAttribs[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RED_SIZE, 8,
+        EGL_GREEN_SIZE, 8,
+        EGL_BLUE_SIZE, 8,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_NONE
+    };
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay;
+    getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (getPlatformDisplay != NULL)
+        sys->impl->display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA,EGL_DEFAULT_DISPLAY,NULL);
+    if (sys->impl->display == EGL_NO_DISPLAY)
+        sys->impl->display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    if (sys->impl->display == EGL_NO_DISPLAY || !eglInitialize(sys->impl->display,NULL,NULL))
+        pok_error(pok_error_fatal,"cannot initialize EGL display");
+    if (!eglBindAPI(EGL_OPENGL_API))
+        pok_error(pok_error_fatal,"fail eglBindAPI()");
+    if (!eglChooseConfig(sys->impl->display,configAttribs,&sys->impl->config,1,&count) || count < 1)
+        pok_error(pok_error_fatal,"cannot find suitable EGL framebuffer configuration");
+    /* create the GL rendering context */
+    sys->impl->context = eglCreateContext(sys->impl->display,sys->impl->config,EGL_NO_CONTEXT,NULL);
+    if (sys->impl->context == EGL_NO_CONTEXT)
+        pok_error(pok_error_fatal,"cannot create OpenGL context");
+    edit_surface(sys);
+}
+void edit_surface(struct pok_graphics_subsystem* sys)
+{
+    /* (re)create the pixel buffer to match the window size and make it current */
+    EGLint surfaceAttribs[] = { EGL_WIDTH, 0, EGL_HEIGHT, 0, EGL_NONE };
+    surfaceAttribs[1] = sys->wwidth;
+    surfaceAttribs[3] = sys->wheight;
+    eglMakeCurrent(sys->impl->display,EGL_NO_SURFACE,EGL_NO_SURFACE,EGL_NO_CONTEXT);
+    if (sys->impl->surface != EGL_NO_SURFACE)
+        eglDestroySurface(sys->impl->display,sys->impl->surface);
+    sys->impl->surface = eglCreatePbufferSurface(sys->impl->display,sys->impl->config,surfaceAttribs);
+    if (sys->impl->surface == EGL_NO_SURFACE)
+        pok_error(pok_error_fatal,"fail eglCreatePbufferSurface()");
+    if ( !eglMakeCurrent(sys->impl->display,sys->impl->surface,sys->impl->surface,sys->impl->context) )
+        pok_error(pok_error_fatal,"fail eglMakeCurrent()");
+    gl_init(sys->wwidth,sys->wheight);
+}
+void close_surface(struct pok_graphics_subsystem* sys)
+{
+    eglMakeCurrent(sys->impl->display,EGL_NO_SURFACE,EGL_NO_SURFACE,EGL_NO_CONTEXT);
+    eglDestroyContext(sys->impl->display,sys->impl->context);
+    eglDestroySurface(sys->impl->display,sys->impl->surface);
+    eglTerminate(sys->impl->display);
+}
+
+/* graphics rendering loop */
+void* graphics_loop(struct pok_graphics_subsystem* sys)
+{
+    uint16_t index;
+    struct frame_pacer pacer;
+    struct pok_graphics_headless_options* opts = &sys->impl->options;
+
+    /* make the offscreen surface */
+    make_surface(sys);
+    frame_pacer_init(sys,&pacer);
+
+    /* call load routine on graphics subsystem (if specified) */
+    if (sys->loadRoutine != NULL)
+        sys->loadRoutine();
+
+    /* begin rendering loop */
+    while (sys->impl->rendering) {
+        /* check for event notifications from another thread */
+        if (sys->impl->editFrame) {
+            pthread_mutex_lock(&sys->impl->mutex);
+            edit_surface(sys);
+            sys->impl->editFrame = FALSE;
+            pthread_mutex_unlock(&sys->impl->mutex);
+        }
+        if (sys->impl->texinfo != NULL && sys->impl->texinfoCount > 0) {
+            /* load textures */
+            pthread_mutex_lock(&sys->impl->mutex);
+            if (sys->impl->texinfoLoad)
+                gl_create_textures(&sys->impl->gltexinfo,(struct texture_info*)sys->impl->texinfo,sys->impl->texinfoCount);
+            else
+                gl_delete_textures(&sys->impl->gltexinfo,(struct texture_info*)sys->impl->texinfo,sys->impl->texinfoCount);
+            free((struct texture_info*)sys->impl->texinfo);
+            sys->impl->texinfo = NULL;
+            sys->impl->texinfoCount = 0;
+            pthread_mutex_unlock(&sys->impl->mutex);
+        }
+
+        /* clear the surface */
+        frame_pacer_begin(&pacer);
+        glClear(GL_COLOR_BUFFER_BIT);
+
+        /* rendering */
+        if (sys->impl->gameRendering) {
+            pthread_mutex_lock(&sys->impl->mutex);
+            for (index = 0;index < sys->routinetop;++index)
+                if (sys->routines[index])
+                    sys->routines[index](sys,sys->contexts[index]);
+            pthread_mutex_unlock(&sys->impl->mutex);
+        }
+        frame_pacer_rendered(sys,&pacer);
+
+        /* there is nothing to expose; wait for the frame to complete so that the
+           timings reflect the work done by the (software) rasterizer */
+        glFinish();
+        frame_pacer_swapped(sys,&pacer);
+
+        /* save the frame if requested */
+        if (opts->dumpEvery > 0 && opts->dumpPrefix != NULL && sys->frameStats.frames % opts->dumpEvery == 0) {
+            char file[1024];
+            snprintf(file,sizeof(file),"%s%06llu.png",opts->dumpPrefix,(unsigned long long)sys->frameStats.frames);
+            if ( !pok_graphics_headless_save_frame(sys,file) )
+                pok_error_fromstack(pok_error_warning);
+        }
+
+        /* stop once the frame limit is reached */
+        if (opts->frameLimit > 0 && sys->frameStats.frames >= opts->frameLimit)
+            break;
+
+        /* pace the loop unless we are to render as fast as possible */
+        frame_pacer_wait(sys,&pacer,opts->unpaced);
+    }
+
+    /* cleanup */
+    sys->impl->gameRendering = FALSE;
+    sys->impl->rendering = FALSE;
+    /* free any textures that remain for our context */
+    if (sys->impl->gltexinfo.textureCount > 0) {
+        glDeleteTextures(sys->impl->gltexinfo.textureCount,sys->impl->gltexinfo.textureNames);
+        sys->impl->gltexinfo.textureCount = 0;
+    }
+    /* call unload routine on graphics subsystem (if specified) */
+    if (sys->unloadRoutine != NULL)
+        sys->unloadRoutine();
+    close_surface(sys);
+    return NULL;
+}
@@ -0,0 +1,23 @@
+/* graphics-headless.h - pokgame */
+#ifndef POKGAME_GRAPHICS_HEADLESS_H
+#define POKGAME_GRAPHICS_HEADLESS_H
+#include "graphics.h"
+
+/* the headless graphics implementation renders frames into an offscreen surface (using EGL)
+   instead of a window; it is meant for benchmarking and regression testing on machines without
+   a display; it is built in place of the platform implementation (see the makefile) */
+
+/* options that control the headless renderer; these are read when the graphics subsystem
+   begins, so they must be set before 'pok_graphics_subsystem_begin' is called */
+struct pok_graphics_headless_options
+{
+    uint64_t frameLimit; /* if non-zero, stop rendering (i.e. close the "window") after this many frames */
+    bool_t unpaced;      /* if non-zero, render frames as fast as possible instead of pacing to the framerate */
+    uint32_t dumpEvery;  /* if non-zero, save every nth frame to a PNG file */
+    const char* dumpPrefix; /* frames are saved as "<dumpPrefix><frame-number>.png" */
+};
+
+void pok_graphics_headless_configure(const struct pok_graphics_headless_options* options);
+bool_t pok_graphics_headless_save_frame(const struct pok_graphics_subsystem* sys,const char* file); /* call on render thread */
+
+#endif
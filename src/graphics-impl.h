@@ -2,6 +2,7 @@
 #ifndef POKGAME_GRAPHICS_IMPL
 #define POKGAME_GRAPHICS_IMPL
 #include "graphics.h"
+#include "gamelock.h"
 
 /* store image objects that are potential OpenGL textures */
 struct texture_info
@@ -29,6 +30,21 @@ void impl_unmap_window(struct pok_graphics_subsystem* sys);
 void impl_lock(struct pok_graphics_subsystem* sys);
 void impl_unlock(struct pok_graphics_subsystem* sys);
 
+/* frame pacing: the implementation's render loop calls these to time each frame and to pace the
+   loop against absolute deadlines derived from the subsystem's framerate; timing information is
+   stored in 'sys->frameStats' */
+struct frame_pacer
+{
+    int framerate;
+    struct pok_timestep step;
+    uint64_t mark;
+};
+void frame_pacer_init(struct pok_graphics_subsystem* sys,struct frame_pacer* pacer);
+void frame_pacer_begin(struct frame_pacer* pacer); /* call before rendering */
+void frame_pacer_rendered(struct pok_graphics_subsystem* sys,struct frame_pacer* pacer); /* call before exposing the back buffer */
+void frame_pacer_swapped(struct pok_graphics_subsystem* sys,struct frame_pacer* pacer); /* call after exposing the back buffer */
+void frame_pacer_wait(struct pok_graphics_subsystem* sys,struct frame_pacer* pacer,bool_t swapBlocks);
+
 /* OpenGL operations */
 void gl_init(int32_t viewWidth,int32_t viewHeight);
 void gl_create_textures(struct gl_texture_info* info,struct texture_info* texinfo,int count);
@@ -214,11 +214,11 @@ void pok_graphics_subsystem_render_loop(struct pok_graphics_subsystem* sys)
 
 DWORD WINAPI RenderLoop(struct pok_graphics_subsystem* sys)
 {
-    int framerate = 0;
-    DWORD sleepamt = 0;
+    struct frame_pacer pacer;
 
     /* make window; this creates and binds an OpenGL context */
     CreateMainWindow(sys);
+    frame_pacer_init(sys,&pacer);
 
     /* if specified, game load routine */
     if (sys->loadRoutine != NULL)
@@ -276,6 +276,7 @@ DWORD WINAPI RenderLoop(struct pok_graphics_subsystem* sys)
         }
 
         /* clear the screen */
+        frame_pacer_begin(&pacer);
         glClear(GL_COLOR_BUFFER_BIT);
 
         /* rendering */
@@ -288,21 +289,17 @@ DWORD WINAPI RenderLoop(struct pok_graphics_subsystem* sys)
             for (index = 0; index < sys->routinetop; ++index)
                 if (sys->routines[index])
                     sys->routines[index](sys, sys->contexts[index]);
-            /* expose the backbuffer */
-            SwapBuffers(sys->impl->hDC);
             ReleaseMutex(sys->impl->mutex);
         }
-        else
-            /* expose the blank backbuffer */
-            SwapBuffers(sys->impl->hDC);
+        frame_pacer_rendered(sys,&pacer);
 
-        /* check for framerate change */
-        if (framerate != sys->framerate) {
-            framerate = sys->framerate;
-            sleepamt = 1000 / framerate;
-        }
+        /* expose the backbuffer (blank if the game is not rendering); this is
+           done without the lock since this may wait for the vertical retrace */
+        SwapBuffers(sys->impl->hDC);
+        frame_pacer_swapped(sys,&pacer);
 
-        Sleep(sleepamt);
+        /* wait for the next frame deadline */
+        frame_pacer_wait(sys,&pacer,FALSE);
     }
 
     /* cleanup */
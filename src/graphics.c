@@ -2,6 +2,7 @@
 #include "graphics.h"
 #include "graphics-impl.h"
 #include "error.h"
+#include "trace.h"
 #include "protocol.h"
 #include "opengl.h"
 #include <stdlib.h>
@@ -72,6 +73,8 @@ void pok_graphics_subsystem_init(struct pok_graphics_subsystem* sys)
     sys->blacktile = NULL;
     sys->impl = NULL;
     sys->framerate = INITIAL_FRAMERATE;
+    sys->vsync = FALSE;
+    memset(&sys->frameStats,0,sizeof(struct pok_graphics_frame_stats));
     sys->background = FALSE;
     pok_string_init(&sys->title);
 }
@@ -364,6 +367,63 @@ void pok_graphics_subsystem_unregister(struct pok_graphics_subsystem* sys,graphi
 
 /* OpenGL functionality for the graphics subsystem */
 
+/* frame pacing */
+void frame_pacer_init(struct pok_graphics_subsystem* sys,struct frame_pacer* pacer)
+{
+    POK_TRACE_THREAD("graphics");
+    pacer->framerate = sys->framerate;
+    pacer->mark = 0;
+    /* frames that miss their deadline are not made up */
+    pok_timestep_reset_rate(&pacer->step,pacer->framerate,1);
+    memset(&sys->frameStats,0,sizeof(struct pok_graphics_frame_stats));
+}
+void frame_pacer_begin(struct frame_pacer* pacer)
+{
+    pacer->mark = pok_timestep_clock();
+}
+void frame_pacer_rendered(struct pok_graphics_subsystem* sys,struct frame_pacer* pacer)
+{
+    uint64_t now = pok_timestep_clock();
+    POK_TRACE_SPAN("render",pacer->mark);
+    sys->frameStats.renderTime = now - pacer->mark;
+    sys->frameStats.totalRenderTime += sys->frameStats.renderTime;
+    pacer->mark = now;
+}
+void frame_pacer_swapped(struct pok_graphics_subsystem* sys,struct frame_pacer* pacer)
+{
+    uint64_t now = pok_timestep_clock();
+    POK_TRACE_SPAN("swap",pacer->mark);
+    sys->frameStats.swapTime = now - pacer->mark;
+    sys->frameStats.totalSwapTime += sys->frameStats.swapTime;
+    pacer->mark = now;
+    ++sys->frameStats.frames;
+}
+void frame_pacer_wait(struct pok_graphics_subsystem* sys,struct frame_pacer* pacer,bool_t swapBlocks)
+{
+    /* if the framerate changed then start a new deadline schedule */
+    if (pacer->framerate != sys->framerate) {
+        struct pok_graphics_frame_stats stats = sys->frameStats;
+        frame_pacer_init(sys,pacer);
+        sys->frameStats = stats;
+    }
+
+    /* if buffer swaps wait for the display then the swap already paced the frame */
+    if (swapBlocks) {
+        sys->frameStats.slack = 0;
+        return;
+    }
+
+    /* sleep until the next frame deadline; the deadline is absolute, so the time spent rendering
+       and swapping is taken out of the sleep rather than added to it; the wait only skips the
+       sleep if the deadline had already passed, so a frame without slack missed its deadline (by
+       any amount, not just by a whole period like the timestep's overruns) */
+    POK_TRACE_CALL("frame_wait",pok_timestep_wait(&pacer->step));
+    sys->frameStats.slack = pacer->step.slack;
+    sys->frameStats.totalSlack += pacer->step.slack;
+    if (pacer->step.slack == 0)
+        ++sys->frameStats.missed;
+}
+
 void gl_init(int32_t viewWidth,int32_t viewHeight)
 {
     /* setup OpenGL to render pokgame according to the specified view dimensions */
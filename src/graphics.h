@@ -56,6 +56,18 @@ typedef void (*graphics_load_routine_t)();
 typedef void (*keyup_routine_t)(enum pok_input_key key,void* context);
 typedef void (*textentry_routine_t)(char asciiValue,void* context);
 
+/* frame timing statistics: these are updated by the rendering thread after each frame and should be
+   treated as read-only by other code; times are in nanoseconds */
+struct pok_graphics_frame_stats
+{
+    uint64_t frames;     /* number of frames rendered */
+    uint64_t missed;     /* number of frames that finished after their deadline */
+    uint64_t renderTime; /* time spent in the render routines for the last frame */
+    uint64_t swapTime;   /* time spent exposing the back buffer for the last frame */
+    uint64_t slack;      /* time spent sleeping until the deadline after the last frame */
+    uint64_t totalRenderTime, totalSwapTime, totalSlack;
+};
+
 /* define graphics subsystem object; this abstracts input/output to a graphical window frame */
 struct _pok_graphics_subsystem_impl;
 struct pok_graphics_subsystem
@@ -108,6 +120,8 @@ struct pok_graphics_subsystem
 
     /* misc other */
     int framerate; /* frames per second */
+    bool_t vsync; /* if non-zero, request buffer swaps that wait for the display; the render loop does not sleep if they do */
+    struct pok_graphics_frame_stats frameStats;
     bool_t background; /* if non-zero then the subsystem is executing on a separate thread */
     struct pok_string title; /* title bar text in graphical frame */
 };
@@ -425,6 +425,42 @@ bool_t pok_image_fromfile_rgba_ex(struct pok_image* img,const char* file,uint32_
     pok_data_source_free(fin);
     return TRUE;
 }
+static enum pok_network_result pok_image_netread_pixels(struct pok_image* img,struct pok_data_source* dsrc,
+    struct pok_netobj_readinfo* info)
+{
+    /* read the pixel data straight into the image's pixel buffer: bytes that the data source has
+       already buffered are copied first and the rest is read from the device in as few calls as it
+       allows; the number of bytes received so far is kept in 'info->depth' (low and high halves) so
+       that an incomplete transfer resumes where it left off (possibly within a pixel) */
+    size_t got, total, bytesRead;
+    total = ((img->flags&pok_image_flag_alpha) ? sizeof(union alpha_pixel) : sizeof(union pixel))
+        * img->width * img->height;
+    if (img->pixels.data == NULL) {
+        if (total > POK_MAX_IMAGE_SIZE) {
+            pok_exception_new_ex(pok_ex_image,pok_ex_image_too_big);
+            return pok_net_failed;
+        }
+        img->pixels.data = malloc(total);
+        if (img->pixels.data == NULL) {
+            pok_exception_flag_memory_error();
+            return pok_net_failed;
+        }
+    }
+    got = (size_t)info->depth[1] << 16 | info->depth[0];
+    while (got < total) {
+        if ( !pok_data_source_read_to_buffer(dsrc,(byte_t*)img->pixels.data + got,total - got,&bytesRead) )
+            break;
+        if (bytesRead == 0) {
+            /* end of communications: the rest never arrives */
+            pok_exception_new_ex(pok_ex_net,pok_ex_net_endofcomms);
+            break;
+        }
+        got += bytesRead;
+    }
+    info->depth[0] = (uint16_t)got;
+    info->depth[1] = (uint16_t)(got >> 16);
+    return pok_netobj_readinfo_process(info);
+}
 enum pok_network_result pok_image_netread(struct pok_image* img,struct pok_data_source* dsrc,struct pok_netobj_readinfo* info)
 {
     /* read the image from a data source; incomplete transfers are flagged and the user can use a 'pok_netobj_readinfo' object
@@ -434,11 +470,7 @@ enum pok_network_result pok_image_netread(struct pok_image* img,struct pok_data_
        [4 bytes] width
        [4 bytes] height
        [n bytes] pixel-data, where n = width*height * (4 if alpha channel, else 3) */
-    byte_t* recv;
     uint8_t alpha;
-    size_t amount;
-    byte_t* pixdata;
-    size_t allocation;
     enum pok_network_result result = pok_net_already;
     switch (info->fieldProg) {
     case 0:
@@ -463,38 +495,7 @@ enum pok_network_result pok_image_netread(struct pok_image* img,struct pok_data_
             break;
     case 3:
         /* read pixel-data */
-        allocation = (img->flags&pok_image_flag_alpha) ? sizeof(union alpha_pixel) : sizeof(union pixel);
-        if (img->pixels.data == NULL) {
-            amount = allocation * img->width * img->height;
-            if (amount > POK_MAX_IMAGE_SIZE) {
-                pok_exception_new_ex(pok_ex_image,pok_ex_image_too_big);
-                return pok_net_failed;
-            }
-            img->pixels.data = malloc(amount);
-            if (img->pixels.data == NULL) {
-                pok_exception_flag_memory_error();
-                return pok_net_failed;
-            }
-        }
-        pixdata = (byte_t*)img->pixels.data + allocation * (info->depth[1]*img->width + info->depth[0]);
-        while (info->depth[1] < img->height) {
-            recv = pok_data_source_read(dsrc,allocation,&amount);
-            if (recv != NULL) {
-                if (amount < allocation) {
-                    pok_data_source_unread(dsrc,amount);
-                    return pok_net_incomplete;
-                }
-                for (;amount > 0;--amount)
-                    *pixdata++ = *recv++;
-            }
-            if ((result = pok_netobj_readinfo_process_depth(info,0)) != pok_net_completed)
-                break;
-            if (info->depth[0] >= img->width) {
-                ++info->depth[1];
-                info->depth[0] = 0;
-            }
-        }
-        if ((result = pok_netobj_readinfo_process(info)) != pok_net_completed)
+        if ((result = pok_image_netread_pixels(img,dsrc,info)) != pok_net_completed)
             break;
     }
     return result;
@@ -510,9 +511,6 @@ enum pok_network_result pok_image_netread_ex(struct pok_image* img,uint32_t widt
        [n bytes] pixel-data, where n = width*height * (4 if alpha channel, else 3) */
 
     uint8_t alpha;
-    size_t amount;
-    byte_t* pixdata;
-    size_t allocation;
     enum pok_network_result result = pok_net_already;
     /* read flags */
     switch (info->fieldProg) {
@@ -530,39 +528,7 @@ enum pok_network_result pok_image_netread_ex(struct pok_image* img,uint32_t widt
         img->flags = alpha ? pok_image_flag_alpha : pok_image_flag_none;
     case 1:
         /* read pixel data */
-        allocation = (img->flags&pok_image_flag_alpha) ? sizeof(union alpha_pixel) : sizeof(union pixel);
-        if (img->pixels.data == NULL) {
-            amount = allocation * width * height;
-            if (amount > POK_MAX_IMAGE_SIZE) {
-                pok_exception_new_ex(pok_ex_image,pok_ex_image_too_big);
-                return pok_net_failed;
-            }
-            img->pixels.data = malloc(amount);
-            if (img->pixels.data == NULL) {
-                pok_exception_flag_memory_error();
-                return pok_net_failed;
-            }
-        }
-        pixdata = (byte_t*)img->pixels.data + allocation * (info->depth[1]*width + info->depth[0]);
-        while (info->depth[1] < height) {
-            byte_t* recv;
-            recv = pok_data_source_read(dsrc,allocation,&amount);
-            if (recv != NULL) {
-                if (amount < allocation) {
-                    pok_data_source_unread(dsrc,amount);
-                    return pok_net_incomplete;
-                }
-                for (;amount > 0;--amount)
-                    *pixdata++ = *recv++;
-            }
-            if ((result = pok_netobj_readinfo_process_depth(info,0)) != pok_net_completed)
-                break;
-            if (info->depth[0] >= width) {
-                ++info->depth[1];
-                info->depth[0] = 0;
-            }
-        }
-        if ((result = pok_netobj_readinfo_process(info)) != pok_net_completed)
+        if ((result = pok_image_netread_pixels(img,dsrc,info)) != pok_net_completed)
             break;
     }
     return result;
@@ -722,8 +688,75 @@ fail:
     return NULL;
 
 }
-void pok_image_png_save(struct pok_image* img,const char* file)
+bool_t pok_image_png_save(struct pok_image* img,const char* file)
 {
-    (void)img;
-    (void)file;
+    png_uint_32 i;
+    png_uint_32 channels;
+    png_bytep ptr;
+    png_bytepp rowptrs;
+    png_structp pngptr;
+    png_infop infoptr;
+    struct pok_data_source* dsrc;
+
+    if (img->pixels.data == NULL) {
+        pok_exception_new_ex(pok_ex_image,pok_ex_image_unrecognized_format);
+        return FALSE;
+    }
+    channels = img->flags & pok_image_flag_alpha ? 4 : 3;
+    rowptrs = malloc(sizeof(png_bytep) * img->height);
+    if (rowptrs == NULL) {
+        pok_exception_flag_memory_error();
+        return FALSE;
+    }
+    ptr = img->pixels.data;
+    for (i = 0;i < img->height;++i) {
+        rowptrs[i] = ptr;
+        ptr += img->width * channels;
+    }
+
+    /* open data source to file */
+    dsrc = pok_data_source_new_file(file,pok_filemode_create_always,pok_iomode_write);
+    if (dsrc == NULL) {
+        free(rowptrs);
+        return FALSE;
+    }
+
+    /* allocate libpng structures */
+    pngptr = png_create_write_struct(PNG_LIBPNG_VER_STRING,NULL,NULL,NULL);
+    if (pngptr == NULL) {
+        pok_exception_flag_memory_error();
+        goto fail;
+    }
+    infoptr = png_create_info_struct(pngptr);
+    if (infoptr == NULL) {
+        pok_exception_flag_memory_error();
+        png_destroy_write_struct(&pngptr,NULL);
+        goto fail;
+    }
+
+    /* setup libpng */
+    png_set_write_fn(pngptr,dsrc,write_data,flush_data); /* custom write functions */
+    if (setjmp(png_jmpbuf(pngptr)) != 0) { /* error handler */
+        pok_exception_new_format("libpng exception in pok_image_png_save()");
+        png_destroy_write_struct(&pngptr,&infoptr);
+        goto fail;
+    }
+
+    /* write image */
+    png_set_IHDR(pngptr,infoptr,img->width,img->height,8,
+        channels == 4 ? PNG_COLOR_TYPE_RGBA : PNG_COLOR_TYPE_RGB,
+        PNG_INTERLACE_NONE,PNG_COMPRESSION_TYPE_DEFAULT,PNG_FILTER_TYPE_DEFAULT);
+    png_write_info(pngptr,infoptr);
+    png_write_image(pngptr,rowptrs);
+    png_write_end(pngptr,NULL);
+
+    png_destroy_write_struct(&pngptr,&infoptr);
+    pok_data_source_free(dsrc);
+    free(rowptrs);
+    return TRUE;
+
+fail:
+    pok_data_source_free(dsrc);
+    free(rowptrs);
+    return FALSE;
 }
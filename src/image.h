@@ -85,6 +85,6 @@ enum pok_network_result pok_image_netread_ex(struct pok_image* img,uint32_t widt
 /* using portable network graphics format: data is still stored in same format; image
    may or may not have alpha information */
 struct pok_image* pok_image_png_new(const char* file);
-void pok_image_png_save(struct pok_image* img,const char* file);
+bool_t pok_image_png_save(struct pok_image* img,const char* file);
 
 #endif
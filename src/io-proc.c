@@ -1,6 +1,7 @@
 /* io-proc.c - pokgame */
 #include "pokgame.h"
 #include "error.h"
+#include "trace.h"
 #include "protocol.h"
 #include "default.h"
 #include "user.h"
@@ -14,8 +15,12 @@
    graphics subsystem is handled by the caller; the IO procedure is, however,
    responsible for the update thread which it spawns for the version it runs */
 
+/* the IO procedure sleeps on a poller (see 'pok_io_poller') until the version channel is ready, the
+   update thread wakes it or a timeout expires; the synchronous exchanges retry an incomplete transfer
+   as soon as the channel is ready instead of polling at a fixed interval */
+
 /* constants */
-#define WAIT_TIMEOUT 10000 /* wait 10 seconds before giving up on a read during the synchronous exchanges */
+#define WAIT_TIMEOUT 10000 /* wait 10 seconds (without progress) before giving up on a transfer during the synchronous exchanges */
 #define ERROR_WAIT "version failed to respond in enough time"
 #define ERROR_PEND "failed to transfer data to version in enough time"
 
@@ -33,6 +38,7 @@ struct pok_io_info
 {
     struct pok_string string;
     struct pok_netobj_readinfo readInfo;
+    struct pok_io_poller* poller;  /* waits on the version channel */
 
     bool_t protocolMode;           /* if non-zero, then the binary-based protocol is used, otherwise the text-based protocol is used */
     bool_t usingDefault;           /* if non-zero, then the game's graphics subsystem has the default parameters */
@@ -51,9 +57,10 @@ static bool_t seq_tile_manager(struct pok_game_info* game,struct pok_io_info* in
 static bool_t seq_sprite_manager(struct pok_game_info* game,struct pok_io_info* info);
 static bool_t seq_player_character(struct pok_game_info* game,struct pok_io_info* info);
 static bool_t seq_first_map(struct pok_game_info* game,struct pok_io_info* info);
-static bool_t write_netobj_sync(struct pok_game_info* game,
+static bool_t wait_channel(struct pok_game_info* game,struct pok_io_info* info,int event,bool_t progress,const char* error);
+static bool_t write_netobj_sync(struct pok_game_info* game,struct pok_io_info* info,
     struct pok_netobj* netobj,netwrite_func_t netwrite);
-static bool_t read_netobj_id(struct pok_game_info* game,uint32_t* id);
+static bool_t read_netobj_id(struct pok_game_info* game,struct pok_io_info* info,uint32_t* id);
 
 int io_proc(struct pok_graphics_subsystem* sys,struct pok_game_info* game)
 {
@@ -62,6 +69,7 @@ int io_proc(struct pok_graphics_subsystem* sys,struct pok_game_info* game)
     int r = 0;
     bool_t madeDefault = ( game == NULL );
     struct pok_game_info* save = NULL;
+    POK_TRACE_THREAD("io");
 
     /* don't try to render game until we have something set up */
     pok_graphics_subsystem_game_render_state(sys,FALSE);
@@ -151,13 +159,18 @@ enum pok_io_result run_game(struct pok_game_info* game)
 {
     struct pok_io_info info;
     enum pok_io_result result;
+    info.poller = pok_io_poller_new(game->versionChannel);
+    if (info.poller == NULL)
+        return pok_io_result_error;
     pok_string_init(&info.string);
     pok_netobj_readinfo_init(&info.readInfo);
 
     /* introductory exchange */
     result = exch_intro(game,&info);
-    if (result != pok_io_result_finished)
+    if (result != pok_io_result_finished) {
+        pok_io_poller_free(info.poller);
         return result;
+    }
     if ( !info.protocolMode ) {
         /* text-mode works differently (it is a minimal implementation; transfer control
            to another module to handle it) */
@@ -167,29 +180,38 @@ enum pok_io_result run_game(struct pok_game_info* game)
 
     /* intermediate exchange */
     result = exch_inter(game,&info);
-    if (result != pok_io_result_finished)
+    if (result != pok_io_result_finished) {
+        pok_io_poller_free(info.poller);
         return result;
+    }
 
     /* flush any data buffered in data source output buffer */
     pok_data_source_flush(game->versionChannel);
 
     /* Begin the update thread to control game login. At this point the game
-     * info should be set up and ready to go.
+     * info should be set up and ready to go. The update thread wakes us up when
+     * it has an intermsg for us and when it exits.
      */
+    game->ioPoller = info.poller;
+    pok_io_poller_set_timer(info.poller,0);
     pok_thread_start(game->updateThread);
 
     /* enter a loop to handle the game IO operations; each iteration we check to
-       see if we can perform a general exchange operation; the IO device should
-       be non-blocking so that we can check the window status each iteration */
+       see if we can perform a general exchange operation and then sleep until we
+       are woken; the general exchange does not read from the channel yet so we do
+       not wait for input (its readiness would never be cleared) */
     while (pok_graphics_subsystem_has_window(game->sys)) {
         /* general exchange operation */
-        result = exch_gener(game,&info);
+        POK_TRACE_CALL("exch_gener",result = exch_gener(game,&info));
         if (result != pok_io_result_finished && result != pok_io_result_waiting)
             break;
 
         /* intermessage processing */
 
-        pok_timeout(&game->ioTimeout);
+        if (pok_io_poller_wait(info.poller,pok_io_event_wakeup) == 0) {
+            result = pok_io_result_error;
+            break;
+        }
     }
 
     /* reset the window's title bar text back to its title for the default version
@@ -207,9 +229,11 @@ enum pok_io_result run_game(struct pok_game_info* game)
      */
     game->control = FALSE;
     pok_thread_join(game->updateThread);
+    game->ioPoller = NULL;
 
     pok_netobj_readinfo_delete(&info.readInfo);
     pok_string_delete(&info.string);
+    pok_io_poller_free(info.poller);
     return result;
 }
 
@@ -230,16 +254,12 @@ enum pok_io_result exch_inter(struct pok_game_info* game,struct pok_io_info* inf
 {
     /* read bitmask determining which network objects are to be sent */
     byte_t bitmask;
-    uint32_t elapsed = 0;
+    pok_io_poller_set_timer(info->poller,WAIT_TIMEOUT);
     while ( !pok_data_stream_read_byte(game->versionChannel,&bitmask) ) {
-        if ( !pok_exception_pop_ex(pok_ex_net,pok_ex_net_pending) )
+        if ( !pok_exception_pop_ex(pok_ex_net,pok_ex_net_wouldblock) )
             return pok_io_result_error;
-        pok_timeout(&game->ioTimeout);
-        elapsed += game->ioTimeout.elapsed;
-        if (elapsed > WAIT_TIMEOUT) {
-            pok_exception_new_format("exch_inter: " ERROR_WAIT);
+        if ( !wait_channel(game,info,pok_io_event_read,FALSE,"exch_inter: " ERROR_WAIT) )
             return pok_io_result_error;
-        }
     }
     /* depending on the bitmask, netread static network objects */
     info->usingDefault = (bitmask & POKGAME_DEFAULT_GRAPHICS_MASK) == 0;
@@ -273,29 +293,26 @@ enum pok_io_result exch_gener(struct pok_game_info* game,struct pok_io_info* inf
 
 static bool_t read_string(struct pok_game_info* game,struct pok_io_info* info)
 {
-    uint32_t elapsed = 0;
+    bool_t progress;
+    pok_io_poller_set_timer(info->poller,WAIT_TIMEOUT);
     while ( !pok_data_stream_read_string_ex(game->versionChannel,&info->string) ) {
-        if ( pok_exception_pop_ex(pok_ex_net,pok_ex_net_pending) )
-            /* some data was received but not enough; reset timer */
-            elapsed = 0;
-        else if ( !pok_exception_pop_ex(pok_ex_net,pok_ex_net_wouldblock) ) {
+        /* if some data was received but not enough then the timer is restarted */
+        progress = pok_exception_pop_ex(pok_ex_net,pok_ex_net_pending) != NULL;
+        if (!progress && !pok_exception_pop_ex(pok_ex_net,pok_ex_net_wouldblock)) {
             pok_string_clear(&info->string);
             return FALSE;
         }
-        pok_timeout(&game->ioTimeout);
-        elapsed += game->ioTimeout.elapsed;
-        if (elapsed > WAIT_TIMEOUT) {
-            pok_exception_new_format("exch_intro: " ERROR_WAIT);
+        if ( !wait_channel(game,info,pok_io_event_read,progress,"exch_intro: " ERROR_WAIT) )
             return FALSE;
-        }
     }
     return TRUE;
 }
 
 bool_t seq_greet(struct pok_game_info* game,struct pok_io_info* info)
 {
-    /* exchange greetings */
-    if ( !pok_data_stream_write_string(game->versionChannel,POKGAME_GREETING_SEQUENCE) )
+    /* exchange greetings; the greeting is sent with its null terminator since the peer reads it
+       as a string */
+    if ( !pok_data_stream_write_string_ex(game->versionChannel,POKGAME_GREETING_SEQUENCE,sizeof(POKGAME_GREETING_SEQUENCE)) )
         return FALSE;
     if ( !read_string(game,info) )
         return FALSE;
@@ -310,11 +327,20 @@ bool_t seq_greet(struct pok_game_info* game,struct pok_io_info* info)
 
 bool_t seq_mode(struct pok_game_info* game,struct pok_io_info* info)
 {
-    /* read the protocol mode from the peer */
+    /* read the protocol mode from the peer; the compressed binary mode switches the channel to the
+       compressed stream right after the mode sequence (any bytes of the stream that were already
+       read are inflated by the data source) */
     if ( !read_string(game,info) )
         return FALSE;
     if (strcmp(POKGAME_BINARYMODE_SEQUENCE,info->string.buf) == 0)
         info->protocolMode = TRUE;
+    else if (strcmp(POKGAME_BINARYMODE_Z_SEQUENCE,info->string.buf) == 0) {
+        info->protocolMode = TRUE;
+        if ( !pok_data_source_compress(game->versionChannel,pok_iomode_full_duplex,POK_COMPRESSION_DEFAULT) ) {
+            pok_string_clear(&info->string);
+            return FALSE;
+        }
+    }
     else if (strcmp(POKGAME_TEXTMODE_SEQUENCE,info->string.buf) == 0)
         info->protocolMode = FALSE;
     else {
@@ -361,19 +387,14 @@ bool_t seq_graphics_subsystem(struct pok_game_info* game,struct pok_io_info* inf
     /* netread the graphics subsystem parameters; this will override the default parameters; we
        make this property (info->usingDefault) so that we can reapply them after this game */
     enum pok_network_result result;
-    uint32_t elapsed = 0;
+    pok_io_poller_set_timer(info->poller,WAIT_TIMEOUT);
     while (TRUE) {
-        result = pok_graphics_subsystem_netread(game->sys,game->versionChannel,&info->readInfo);
+        POK_TRACE_CALL("pok_graphics_subsystem_netread",
+            result = pok_graphics_subsystem_netread(game->sys,game->versionChannel,&info->readInfo));
         if (result != pok_net_incomplete)
             break;
-        if (info->readInfo.pending)
-            elapsed = 0;
-        pok_timeout(&game->ioTimeout);
-        elapsed += game->ioTimeout.elapsed;
-        if (elapsed > WAIT_TIMEOUT) {
-            pok_exception_new_format("exch_inter: " ERROR_WAIT);
+        if ( !wait_channel(game,info,pok_io_event_read,info->readInfo.pending,"exch_inter: " ERROR_WAIT) )
             return FALSE;
-        }
     }
     pok_netobj_readinfo_reset(&info->readInfo);
     if (result != pok_net_completed)
@@ -383,21 +404,16 @@ bool_t seq_graphics_subsystem(struct pok_game_info* game,struct pok_io_info* inf
 
 bool_t seq_tile_manager(struct pok_game_info* game,struct pok_io_info* info)
 {
-    uint32_t elapsed;
     enum pok_network_result result;
     struct pok_tile_manager* tman = pok_tile_manager_new(game->sys);
     /* netread tile manager */
-    elapsed = 0;
+    pok_io_poller_set_timer(info->poller,WAIT_TIMEOUT);
     while (TRUE) {
-        result = pok_tile_manager_netread(tman,game->versionChannel,&info->readInfo);
+        POK_TRACE_CALL("pok_tile_manager_netread",
+            result = pok_tile_manager_netread(tman,game->versionChannel,&info->readInfo));
         if (result != pok_net_incomplete)
             break;
-        if (info->readInfo.pending)
-            elapsed = 0;
-        pok_timeout(&game->ioTimeout);
-        elapsed += game->ioTimeout.elapsed;
-        if (elapsed > WAIT_TIMEOUT) {
-            pok_exception_new_format("exch_inter: " ERROR_WAIT);
+        if ( !wait_channel(game,info,pok_io_event_read,info->readInfo.pending,"exch_inter: " ERROR_WAIT) ) {
             pok_tile_manager_free(tman);
             return FALSE;
         }
@@ -415,21 +431,16 @@ bool_t seq_tile_manager(struct pok_game_info* game,struct pok_io_info* info)
 
 bool_t seq_sprite_manager(struct pok_game_info* game,struct pok_io_info* info)
 {
-    uint32_t elapsed;
     enum pok_network_result result;
     struct pok_sprite_manager* sman = pok_sprite_manager_new(game->sys);
     /* netread sprite manager */
-    elapsed = 0;
+    pok_io_poller_set_timer(info->poller,WAIT_TIMEOUT);
     while (TRUE) {
-        result = pok_sprite_manager_netread(sman,game->versionChannel,&info->readInfo);
+        POK_TRACE_CALL("pok_sprite_manager_netread",
+            result = pok_sprite_manager_netread(sman,game->versionChannel,&info->readInfo));
         if (result != pok_net_incomplete)
             break;
-        if (info->readInfo.pending)
-            elapsed = 0;
-        pok_timeout(&game->ioTimeout);
-        elapsed += game->ioTimeout.elapsed;
-        if (elapsed > WAIT_TIMEOUT) {
-            pok_exception_new_format("exch_inter: " ERROR_WAIT);
+        if ( !wait_channel(game,info,pok_io_event_read,info->readInfo.pending,"exch_inter: " ERROR_WAIT) ) {
             pok_sprite_manager_free(sman);
             return FALSE;
         }
@@ -451,7 +462,7 @@ bool_t seq_player_character(struct pok_game_info* game,struct pok_io_info* info)
 
     /* read a unique network object id that we can assign to the player
        character object */
-    if (!read_netobj_id(game,&id)) {
+    if (!read_netobj_id(game,info,&id)) {
         /* exception is inherited */
         return FALSE;
     }
@@ -461,18 +472,17 @@ bool_t seq_player_character(struct pok_game_info* game,struct pok_io_info* info)
     }
 
     /* netwrite player character object */
-    return write_netobj_sync(game,POK_NETOBJ(game->player),(netwrite_func_t)pok_character_netwrite);
+    return write_netobj_sync(game,info,POK_NETOBJ(game->player),(netwrite_func_t)pok_character_netwrite);
 }
 
 bool_t seq_first_map(struct pok_game_info* game,struct pok_io_info* info)
 {
     uint32_t id;
-    uint32_t elapsed;
     struct pok_map* map;
     enum pok_network_result result;
 
     /* netread a unique network object id for our world object  */
-    if (!read_netobj_id(game,&id)) {
+    if (!read_netobj_id(game,info,&id)) {
         /* exception is inherited */
         return FALSE;
     }
@@ -482,25 +492,19 @@ bool_t seq_first_map(struct pok_game_info* game,struct pok_io_info* info)
     }
 
     /* netwrite our world object */
-    if (!write_netobj_sync(game,POK_NETOBJ(game->world),(netwrite_func_t)pok_world_netwrite))
+    if (!write_netobj_sync(game,info,POK_NETOBJ(game->world),(netwrite_func_t)pok_world_netwrite))
         return FALSE;
 
     /* expect a 'pok_world_method_add_map' operation to netread the first map;
        this map MUST have a map number of 1 */
-    elapsed = 0;
+    pok_io_poller_set_timer(info->poller,WAIT_TIMEOUT);
     while (TRUE) {
-        result = pok_world_netmethod_recv(game->world,game->versionChannel,
-            &info->readInfo,pok_world_method_add_map);
+        POK_TRACE_CALL("pok_world_netmethod_recv",
+            result = pok_world_netmethod_recv(game->world,game->versionChannel,&info->readInfo,pok_world_method_add_map));
         if (result != pok_net_incomplete)
             break;
-        if (info->readInfo.pending)
-            elapsed = 0;
-        pok_timeout(&game->ioTimeout);
-        elapsed += game->ioTimeout.elapsed;
-        if (elapsed > WAIT_TIMEOUT) {
-            pok_exception_new_format("exch_inter: " ERROR_WAIT);
+        if ( !wait_channel(game,info,pok_io_event_read,info->readInfo.pending,"exch_inter: " ERROR_WAIT) )
             return FALSE;
-        }
     }
     pok_netobj_readinfo_reset(&info->readInfo);
     if (result != pok_net_completed)
@@ -516,33 +520,53 @@ bool_t seq_first_map(struct pok_game_info* game,struct pok_io_info* info)
     pok_map_render_context_set_map(game->mapRC,map);
     pok_game_modify_exit(game->mapRC);
     pok_game_modify_enter(game->playerContext);
-    pok_character_context_set_player(game->playerContext,game->mapRC);
+    if ( !pok_character_context_set_player(game->playerContext,game->mapRC) ) {
+        pok_game_modify_exit(game->playerContext);
+        return FALSE;
+    }
     pok_game_modify_exit(game->playerContext);
 
     return TRUE;
 }
 
-bool_t write_netobj_sync(struct pok_game_info* game,
+bool_t wait_channel(struct pok_game_info* game,struct pok_io_info* info,int event,bool_t progress,const char* error)
+{
+    /* this function is called after an incomplete transfer on the version channel; if the transfer made
+       progress then the timer restarts and the caller retries at once (the rest of the data may already
+       be buffered); otherwise sleep until the channel is ready; buffered output is flushed before waiting
+       for input since the peer may be waiting on it; FALSE is returned (with an exception) if the timer
+       expires first */
+    int events;
+    if (progress) {
+        pok_io_poller_set_timer(info->poller,WAIT_TIMEOUT);
+        return TRUE;
+    }
+    if ((event & pok_io_event_read) && !pok_data_source_flush(game->versionChannel)
+        && !pok_exception_pop_ex(pok_ex_net,pok_ex_net_wouldblock))
+        return FALSE;
+    events = pok_io_poller_wait(info->poller,event);
+    if (events & event)
+        return TRUE;
+    if (events & pok_io_event_timer)
+        pok_exception_new_format("%s",error);
+    /* otherwise the exception is inherited */
+    return FALSE;
+}
+
+bool_t write_netobj_sync(struct pok_game_info* game,struct pok_io_info* info,
     struct pok_netobj* netobj,netwrite_func_t netwrite)
 {
-    uint32_t elapsed;
     struct pok_netobj_writeinfo winfo;
     enum pok_network_result result;
 
-    elapsed = 0;
+    pok_io_poller_set_timer(info->poller,WAIT_TIMEOUT);
     pok_netobj_writeinfo_init(&winfo);
     while (TRUE) {
-        result = (*netwrite)(netobj,game->versionChannel,&winfo);
+        POK_TRACE_CALL("netwrite",result = (*netwrite)(netobj,game->versionChannel,&winfo));
         if (result != pok_net_incomplete)
             break;
-        if (winfo.pending)
-            elapsed = 0;
-        pok_timeout(&game->ioTimeout);
-        elapsed += game->ioTimeout.elapsed;
-        if (elapsed > WAIT_TIMEOUT) {
-            pok_exception_new_format("exch_inter: " ERROR_PEND);
+        if ( !wait_channel(game,info,pok_io_event_write,winfo.pending,"exch_inter: " ERROR_PEND) )
             return FALSE;
-        }
     }
 
     if (result != pok_net_completed) {
@@ -554,21 +578,18 @@ bool_t write_netobj_sync(struct pok_game_info* game,
     return TRUE;
 }
 
-bool_t read_netobj_id(struct pok_game_info* game,uint32_t* id)
+bool_t read_netobj_id(struct pok_game_info* game,struct pok_io_info* info,uint32_t* id)
 {
-    uint32_t elapsed;
-    elapsed = 0;
+    bool_t progress;
+    pok_io_poller_set_timer(info->poller,WAIT_TIMEOUT);
     while (TRUE) {
         if (pok_data_stream_read_uint32(game->versionChannel,id))
             break;
-        else if (!pok_exception_pop_ex(pok_ex_net,pok_ex_net_pending))
+        progress = pok_exception_pop_ex(pok_ex_net,pok_ex_net_pending) != NULL;
+        if (!progress && !pok_exception_pop_ex(pok_ex_net,pok_ex_net_wouldblock))
             return FALSE;
-        pok_timeout(&game->ioTimeout);
-        elapsed += game->ioTimeout.elapsed;
-        if (elapsed > WAIT_TIMEOUT) {
-            pok_exception_new_format("exch_inter: " ERROR_WAIT);
+        if ( !wait_channel(game,info,pok_io_event_read,progress,"exch_inter: " ERROR_WAIT) )
             return FALSE;
-        }
     }
     return TRUE;
 }
@@ -2,7 +2,52 @@
 #include "map-context.h"
 #include "protocol.h"
 #include "error.h"
+#include "trace.h"
+#include "gamelock.h"
+#include "opengl.h"
 #include <stdlib.h>
+#include <string.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define snapshot_exchange(p,v) _InterlockedExchange((p),(v))
+#define bake_invalidate(p) _InterlockedIncrement(p)
+#else
+#define snapshot_exchange(p,v) __atomic_exchange_n((p),(v),__ATOMIC_ACQ_REL)
+#define bake_invalidate(p) __atomic_add_fetch((p),1,__ATOMIC_ACQ_REL)
+#endif
+
+/* the middle index of the snapshot triple buffer has this bit set if it refers to a snapshot
+   that the render thread has not yet seen */
+#define SNAPSHOT_FRESH 0x04
+
+/* baked layer cache (see 'pok_map_render_invalidate'); only the graphics thread touches the
+   cache; a frame bakes at most BAKE_PER_FRAME layers so that entering a new area does not
+   stall a single frame (blocks that are not baked yet are drawn tile by tile) */
+#define BAKE_SLOTS     16
+#define BAKE_PER_FRAME  2
+
+struct map_bake
+{
+    const struct pok_map_chunk* chunk;   /* chunk the layer was baked from (NULL if the slot is free) */
+    uint32_t revision;                   /* chunk revision at the time of baking */
+    const struct pok_tile_manager* tman; /* tiles used to bake the layer */
+    long generation;                     /* value of 'bakeGeneration' at the time of baking */
+    uint16_t column, row;                /* first tile of the block within the chunk */
+    uint16_t across, down;               /* dimensions of the block in tiles */
+    uint32_t frame;                      /* last frame that drew the layer */
+    bool_t opaque;                       /* if true then every pixel is opaque (the layer is drawn without blending) */
+    GLuint texref;
+    uint16_t overlayc;                   /* tiles to draw over the layer: [row * across + column] */
+    uint16_t overlay[POK_MAP_BAKE_TILES * POK_MAP_BAKE_TILES];
+};
+
+static struct map_bake bakes[BAKE_SLOTS];
+static uint32_t bakeFrame;
+static GLint bakeMaxSize;
+static byte_t* bakePixels;
+static size_t bakePixelsAlloc;
+static volatile long bakeGeneration;
 
 /* this function computes chunk render information for the map rendering routine; this is 'extern' for debugging */
 void compute_chunk_render_info(struct pok_map_render_context* context, const struct pok_graphics_subsystem* sys);
@@ -17,6 +62,15 @@ struct pok_map_render_context* pok_map_render_context_new(const struct pok_tile_
 }
 void pok_map_render_context_free(struct pok_map_render_context* context)
 {
+    int i;
+    for (i = 0;i < 3;++i)
+        if (context->_snapshots[i].sprites != NULL)
+            free(context->_snapshots[i].sprites);
+    if (context->_batchVertices != NULL)
+        free(context->_batchVertices);
+    if (context->_batchTexCoords != NULL)
+        free(context->_batchTexCoords);
+    pok_game_lock_unregister(context);
     free(context);
 }
 void pok_map_render_context_init(struct pok_map_render_context* context,const struct pok_tile_manager* tman)
@@ -43,6 +97,31 @@ void pok_map_render_context_init(struct pok_map_render_context* context,const st
     context->groove = FALSE;
     context->changed = FALSE;
     context->update = FALSE;
+    context->batch = TRUE;
+    context->bake = TRUE;
+    context->prefetchChunks = 1;
+    context->prefetchStats.hits = 0;
+    context->prefetchStats.misses = 0;
+    context->prefetchStats.requests = 0;
+    context->_prefetchDir = pok_direction_none;
+    context->_prefetchPos.X = context->_prefetchPos.Y = 0;
+    for (i = 0;i < 3;++i) {
+        context->_snapshots[i].map = NULL;
+        for (j = 0;j < 4;++j)
+            context->_snapshots[i].info[j].chunk = NULL;
+        context->_snapshots[i].hasSprites = FALSE;
+        context->_snapshots[i].spritec = 0;
+        context->_snapshots[i].spriteAlloc = 0;
+        context->_snapshots[i].sprites = NULL;
+    }
+    context->_snapshotBack = 0;
+    context->_snapshotMiddle = 1;
+    context->_snapshotFront = 2;
+    context->_snapshotEnabled = FALSE;
+    context->view = NULL;
+    context->_batchAlloc = 0;
+    context->_batchVertices = NULL;
+    context->_batchTexCoords = NULL;
 }
 void pok_map_render_context_set_map(struct pok_map_render_context* context,struct pok_map* map)
 {
@@ -62,7 +141,10 @@ void pok_map_render_context_set_map(struct pok_map_render_context* context,struc
 }
 void pok_map_render_context_align(struct pok_map_render_context* context)
 {
-    /* compute surrounding chunks; place the current chunk in the center */
+    /* compute surrounding chunks; place the current chunk in the center; the map is focused on
+       the current chunk first so that the surrounding chunks are loaded (if the map loads them
+       on demand) and are not evicted */
+    pok_map_focus(context->map,&context->chunkpos,&context->prefetchStats);
     context->focus[0] = context->focus[1] = 1;
     context->viewingChunks[1][1] = context->chunk;
     context->viewingChunks[1][0] = context->chunk->adjacent[pok_direction_up];
@@ -114,21 +196,55 @@ bool_t pok_map_render_context_set_position(struct pok_map_render_context* contex
     /* 'context->changed' was flagged in a previous function call */
     return TRUE;
 }
-static bool_t is_impassable(const struct pok_tile_manager* tman,struct pok_map_chunk* chunk,uint16_t column,uint16_t row)
+bool_t pok_map_chunk_is_impassable(const struct pok_map_chunk* chunk,const struct pok_tile_manager* tman,uint16_t column,uint16_t row)
 {
     /* check to see if the data specifies a warp for the tile in question; a
        warp location is always passable */
-    if (chunk->data[row][column].data.warpKind != pok_tile_warp_none)
+    if (chunk->warpc > 0 && pok_map_chunk_get_warp(chunk,column,row) != NULL)
         return FALSE;
-    if (chunk->data[row][column].data.tileid <= tman->impassibility) {
+    if (pok_map_chunk_get_tileid(chunk,column,row) <= tman->impassibility) {
         /* make sure there is not an exception to impassibility rule */
-        if ( !chunk->data[row][column].pass )
+        if ( !pok_map_chunk_get_pass(chunk,column,row) )
             return TRUE;
     }
-    else if ( chunk->data[row][column].impass ) /* check for exception */
+    else if ( pok_map_chunk_get_impass(chunk,column,row) ) /* check for exception */
         return TRUE;
     return FALSE;
 }
+static void pok_map_render_context_prefetch(struct pok_map_render_context* context,enum pok_direction dir)
+{
+    /* prepare the rows of chunks ahead of the current chunk along the heading; the next row is
+       needed when the 3x3 grid is next aligned so it is loaded, though only one chunk per move so
+       that the work is spread across update steps; the rows after it (up to 'prefetchChunks' ahead)
+       are read ahead in the background once per chunk and heading; this runs on every move so the
+       distance follows the scroll speed as soon as it is changed */
+    int d, k;
+    bool_t loaded = FALSE;
+    bool_t ahead = context->_prefetchDir != dir || pok_point_compar(&context->_prefetchPos,&context->chunkpos) != 0;
+    for (d = 1;d <= context->prefetchChunks;++d) {
+        if (d > 1 && !ahead)
+            break;
+        for (k = -1;k <= 1;++k) {
+            struct pok_point pos = context->chunkpos;
+            if (dir == pok_direction_up || dir == pok_direction_down) {
+                pos.X += k;
+                pos.Y += dir == pok_direction_up ? -d : d;
+            }
+            else {
+                pos.X += dir == pok_direction_left ? -d : d;
+                pos.Y += k;
+            }
+            if (d == 1 && loaded)
+                continue;
+            if ( pok_map_prefetch(context->map,&pos,d == 1) ) {
+                ++context->prefetchStats.requests;
+                loaded = d == 1;
+            }
+        }
+    }
+    context->_prefetchDir = dir;
+    context->_prefetchPos = context->chunkpos;
+}
 bool_t pok_map_render_context_move(struct pok_map_render_context* context,enum pok_direction dir,uint16_t skipTiles,bool_t checkPassable)
 {
     /* change the map position by skipTiles+1 position units in the specified direction; if this is not possible,
@@ -141,7 +257,7 @@ bool_t pok_map_render_context_move(struct pok_map_render_context* context,enum p
     if (dir == pok_direction_up) {
         if (context->relpos.row > skipTiles) {
             next = context->relpos.row - offset;
-            if (checkPassable && is_impassable(context->tman,context->chunk,context->relpos.column,next))
+            if (checkPassable && pok_map_chunk_is_impassable(context->chunk,context->tman,context->relpos.column,next))
                 return FALSE;
             context->relpos.row = next;
             if (context->focus[1] == 0 && context->relpos.row <= context->map->chunkSize.rows/2)
@@ -153,7 +269,7 @@ bool_t pok_map_render_context_move(struct pok_map_render_context* context,enum p
         else {
             /* focus on the new chunk */
             next = context->map->chunkSize.rows - offset;
-            if (checkPassable && is_impassable(context->tman,context->chunk->adjacent[dir],context->relpos.column,next))
+            if (checkPassable && pok_map_chunk_is_impassable(context->chunk->adjacent[dir],context->tman,context->relpos.column,next))
                 return FALSE;
             context->relpos.row = next;
             --context->chunkpos.Y;
@@ -164,7 +280,7 @@ bool_t pok_map_render_context_move(struct pok_map_render_context* context,enum p
     else if (dir == pok_direction_down) {
         if (context->relpos.row < context->map->chunkSize.rows-offset) {
             next = context->relpos.row + offset;
-            if (checkPassable && is_impassable(context->tman,context->chunk,context->relpos.column,next))
+            if (checkPassable && pok_map_chunk_is_impassable(context->chunk,context->tman,context->relpos.column,next))
                 return FALSE;
             context->relpos.row = next;
             if (context->focus[1] == 2 && context->relpos.row >= context->map->chunkSize.rows/2)
@@ -176,7 +292,7 @@ bool_t pok_map_render_context_move(struct pok_map_render_context* context,enum p
         else {
             /* focus on the new chunk */
             if (skipTiles < context->map->chunkSize.rows
-                && checkPassable && is_impassable(context->tman,context->chunk->adjacent[dir],context->relpos.column,skipTiles))
+                && checkPassable && pok_map_chunk_is_impassable(context->chunk->adjacent[dir],context->tman,context->relpos.column,skipTiles))
                 return FALSE;
             context->relpos.row = skipTiles;
             ++context->chunkpos.Y;
@@ -187,7 +303,7 @@ bool_t pok_map_render_context_move(struct pok_map_render_context* context,enum p
     else if (dir == pok_direction_left) {
         if (context->relpos.column > skipTiles) {
             next = context->relpos.column - offset;
-            if (checkPassable && is_impassable(context->tman,context->chunk,next,context->relpos.row))
+            if (checkPassable && pok_map_chunk_is_impassable(context->chunk,context->tman,next,context->relpos.row))
                 return FALSE;
             context->relpos.column = next;
             if (context->focus[0] == 0 && context->relpos.column <= context->map->chunkSize.columns/2)
@@ -199,7 +315,7 @@ bool_t pok_map_render_context_move(struct pok_map_render_context* context,enum p
         else {
             /* focus on the new chunk */
             next = context->map->chunkSize.columns - offset;
-            if (checkPassable && is_impassable(context->tman,context->chunk->adjacent[dir],next,context->relpos.row))
+            if (checkPassable && pok_map_chunk_is_impassable(context->chunk->adjacent[dir],context->tman,next,context->relpos.row))
                 return FALSE;
             context->relpos.column = next;
             --context->chunkpos.X;
@@ -210,7 +326,7 @@ bool_t pok_map_render_context_move(struct pok_map_render_context* context,enum p
     else if (dir == pok_direction_right) {
         if (context->relpos.column < context->map->chunkSize.columns-offset) {
             next = context->relpos.column + offset;
-            if (checkPassable && is_impassable(context->tman,context->chunk,next,context->relpos.row))
+            if (checkPassable && pok_map_chunk_is_impassable(context->chunk,context->tman,next,context->relpos.row))
                 return FALSE;
             context->relpos.column = next;
             if (context->focus[0] == 2 && context->relpos.column >= context->map->chunkSize.columns/2)
@@ -222,7 +338,7 @@ bool_t pok_map_render_context_move(struct pok_map_render_context* context,enum p
         else {
             /* focus on the new chunk */
             if (skipTiles < context->map->chunkSize.columns
-                && checkPassable && is_impassable(context->tman,context->chunk->adjacent[dir],skipTiles,context->relpos.row))
+                && checkPassable && pok_map_chunk_is_impassable(context->chunk->adjacent[dir],context->tman,skipTiles,context->relpos.row))
                 return FALSE;
             context->relpos.column = skipTiles;
             ++context->chunkpos.X;
@@ -232,6 +348,7 @@ bool_t pok_map_render_context_move(struct pok_map_render_context* context,enum p
     }
     else
         return FALSE;
+    pok_map_render_context_prefetch(context,dir);
     context->changed = TRUE;
     return TRUE;
 }
@@ -320,7 +437,7 @@ bool_t pok_map_render_context_update(struct pok_map_render_context* context,uint
     }
     return FALSE;
 }
-struct pok_tile* pok_map_render_context_get_adjacent_tile(struct pok_map_render_context* context,int x,int y)
+bool_t pok_map_render_context_get_adjacent_tile(struct pok_map_render_context* context,int x,int y,struct pok_tile* tile)
 {
     struct pok_map_chunk* chunk = context->chunk;
     struct pok_location pos = context->relpos;
@@ -331,7 +448,7 @@ struct pok_tile* pok_map_render_context_get_adjacent_tile(struct pok_map_render_
         else {
             chunk = context->viewingChunks[context->focus[0]+1][context->focus[1]];
             if (chunk == NULL)
-                return NULL;
+                return FALSE;
             pos.column = 0;
         }
     }
@@ -341,7 +458,7 @@ struct pok_tile* pok_map_render_context_get_adjacent_tile(struct pok_map_render_
         else {
             chunk = context->viewingChunks[context->focus[0]-1][context->focus[1]];
             if (chunk == NULL)
-                return NULL;
+                return FALSE;
             pos.column = chunkSize->columns-1;
         }
     }
@@ -351,7 +468,7 @@ struct pok_tile* pok_map_render_context_get_adjacent_tile(struct pok_map_render_
         else {
             chunk = context->viewingChunks[context->focus[0]+1][context->focus[1]+1];
             if (chunk == NULL)
-                return NULL;
+                return FALSE;
             pos.row = 0;
         }
     }
@@ -361,11 +478,76 @@ struct pok_tile* pok_map_render_context_get_adjacent_tile(struct pok_map_render_
         else {
             chunk = context->viewingChunks[context->focus[0]][context->focus[1]-1];
             if (chunk == NULL)
-                return NULL;
+                return FALSE;
             pos.row = chunkSize->rows-1;
         }
     }
-    return chunk->data[pos.row] + pos.column;
+    pok_map_chunk_get_tile(chunk,pos.column,pos.row,tile);
+    return TRUE;
+}
+
+static void pok_map_render_context_capture(struct pok_map_render_context* context,
+    const struct pok_graphics_subsystem* sys,struct pok_map_render_snapshot* snapshot)
+{
+    if (context->changed) {
+        /* compute dimensions of draw spaces if the context was changed */
+        compute_chunk_render_info(context,sys);
+        context->changed = FALSE;
+    }
+    snapshot->map = context->map;
+    snapshot->offset[0] = context->offset[0];
+    snapshot->offset[1] = context->offset[1];
+    snapshot->tileAniTicks = context->tileAniTicks;
+    memcpy(snapshot->info,context->info,sizeof(context->info));
+    snapshot->hasSprites = FALSE;
+    snapshot->spritec = 0;
+}
+struct pok_map_render_snapshot* pok_map_render_context_begin_snapshot(struct pok_map_render_context* context,
+    const struct pok_graphics_subsystem* sys)
+{
+    /* capture the current render state into the back snapshot; the caller may add sprites to the
+       snapshot before it is published; this should only be called by the thread that updates the
+       context and the context should be locked for modification (the chunk render info is
+       recomputed if the context was changed) */
+    struct pok_map_render_snapshot* snapshot = context->_snapshots + context->_snapshotBack;
+    pok_map_render_context_capture(context,sys,snapshot);
+    return snapshot;
+}
+bool_t pok_map_render_snapshot_reserve_sprites(struct pok_map_render_snapshot* snapshot,uint16_t count)
+{
+    /* make sure the snapshot can hold the specified number of sprites */
+    if (count > snapshot->spriteAlloc) {
+        struct pok_map_render_sprite* sprites;
+        sprites = realloc(snapshot->sprites,sizeof(struct pok_map_render_sprite) * count);
+        if (sprites == NULL) {
+            pok_exception_flag_memory_error();
+            return FALSE;
+        }
+        snapshot->sprites = sprites;
+        snapshot->spriteAlloc = count;
+    }
+    return TRUE;
+}
+void pok_map_render_context_publish(struct pok_map_render_context* context)
+{
+    /* make the back snapshot the latest snapshot; the back snapshot is swapped with the middle
+       snapshot in a single atomic exchange so that the render thread never observes a partially
+       written snapshot; the snapshot the render thread is drawing (the front) is never touched */
+    context->_snapshotBack = snapshot_exchange(&context->_snapshotMiddle,context->_snapshotBack | SNAPSHOT_FRESH) & 0x03;
+    context->_snapshotEnabled = TRUE;
+}
+static const struct pok_map_render_snapshot* pok_map_render_context_acquire(struct pok_map_render_context* context,
+    const struct pok_graphics_subsystem* sys)
+{
+    /* obtain the snapshot to draw: take the latest published snapshot if there is a new one; if
+       snapshots are not in use then the front snapshot is captured directly from the context */
+    if (context->_snapshotEnabled) {
+        if (context->_snapshotMiddle & SNAPSHOT_FRESH)
+            context->_snapshotFront = snapshot_exchange(&context->_snapshotMiddle,context->_snapshotFront) & 0x03;
+    }
+    else
+        pok_map_render_context_capture(context,sys,context->_snapshots + context->_snapshotFront);
+    return context->_snapshots + context->_snapshotFront;
 }
 
 /* Implementation of check render info function for map rendering routine. The
@@ -596,39 +778,385 @@ void compute_chunk_render_info(struct pok_map_render_context* context,
     }
 }
 
-/* pok map rendering function */
+/* pok map rendering functions */
+static bool_t pok_map_render_batch_reserve(struct pok_map_render_context* context,size_t tiles)
+{
+    /* make sure the batch buffers can hold the specified number of tile quads */
+    if (tiles > context->_batchAlloc) {
+        void* v, *t;
+        v = realloc(context->_batchVertices,sizeof(int32_t) * 8 * tiles);
+        if (v == NULL)
+            return FALSE;
+        context->_batchVertices = v;
+        t = realloc(context->_batchTexCoords,sizeof(float) * 8 * tiles);
+        if (t == NULL)
+            return FALSE;
+        context->_batchTexCoords = t;
+        context->_batchAlloc = tiles;
+    }
+    return TRUE;
+}
+/* state used to fill the batch vertex buffers */
+struct map_batch
+{
+    const struct pok_tile_manager* tman;
+    int32_t dim;
+    GLfloat cw, ch; /* size of an atlas cell in texture coordinates */
+    int32_t* vert;
+    float* texc;
+    size_t n;
+};
+static void pok_map_render_batch_tile(struct map_batch* batch,uint16_t id,int32_t x,int32_t y)
+{
+    /* add a quad for (resolved) tile 'id' at (x,y); the quad is built exactly like those produced
+       by 'pok_image_render' so that the output is identical; tiles that are not in the atlas (e.g.
+       the black tile) are rendered the usual way */
+    GLfloat u, v;
+    int32_t X, Y;
+    int32_t* vert = batch->vert;
+    float* texc = batch->texc;
+    const struct pok_tile_manager* tman = batch->tman;
+    if ( !tman->atlasMask[id] ) {
+        pok_image_render(tman->tileset[id],x,y);
+        return;
+    }
+    u = (id % tman->atlasColumns) * batch->cw;
+    v = (id / tman->atlasColumns) * batch->ch;
+    X = x + batch->dim;
+    Y = y + batch->dim;
+    vert[0] = x; vert[1] = y; texc[0] = u; texc[1] = v;
+    vert[2] = X; vert[3] = y; texc[2] = u+batch->cw; texc[3] = v;
+    vert[4] = X; vert[5] = Y; texc[4] = u+batch->cw; texc[5] = v+batch->ch;
+    vert[6] = x; vert[7] = Y; texc[6] = u; texc[7] = v+batch->ch;
+    batch->vert += 8;
+    batch->texc += 8;
+    ++batch->n;
+}
+static void pok_map_render_batch_region(struct map_batch* batch,const struct pok_map_chunk* chunk,uint32_t ticks,
+    uint16_t column,uint16_t row,uint16_t across,uint16_t down,int32_t x,int32_t y)
+{
+    /* add every tile in a region of a chunk; (x,y) is the screen position of tile (column,row) */
+    uint16_t c, r;
+    int32_t X;
+    for (r = 0;r < down;++r,y+=batch->dim)
+        for (c = 0,X = x;c < across;++c,X+=batch->dim)
+            pok_map_render_batch_tile(batch,pok_tile_manager_resolve_tile(batch->tman,
+                    pok_map_chunk_get_tileid(chunk,column+c,row+r),ticks),X,y);
+}
+
+static bool_t pok_map_bake_layer(struct map_bake* bake,const struct pok_tile_manager* tman,const struct pok_map_chunk* chunk,
+    uint16_t column,uint16_t row,int32_t dim)
+{
+    /* composite the non-animated tiles of a block from the tile manager's copy of the atlas; the
+       layer is always RGBA: if the tiles have alpha then the cells left for the overlay are
+       transparent so that the clear color shows through them like it would if the tiles were
+       drawn individually; otherwise every cell is opaque so that the layer can be drawn without
+       blending (the overlay tiles cover their cells completely); tiles that draw nothing (i.e.
+       black fill tiles) are left out of the overlay */
+    uint16_t c, r, i;
+    uint32_t w, h, k, atlasWidth;
+    size_t pixsz, sz;
+    bool_t alpha;
+    const struct pok_image* atlas = tman->atlasPixels;
+    bake->across = chunk->columns - column < POK_MAP_BAKE_TILES ? chunk->columns - column : POK_MAP_BAKE_TILES;
+    bake->down = chunk->rows - row < POK_MAP_BAKE_TILES ? chunk->rows - row : POK_MAP_BAKE_TILES;
+    w = (uint32_t)bake->across * dim;
+    h = (uint32_t)bake->down * dim;
+    if (bakeMaxSize == 0)
+        glGetIntegerv(GL_MAX_TEXTURE_SIZE,&bakeMaxSize);
+    if (w > (uint32_t)bakeMaxSize || h > (uint32_t)bakeMaxSize)
+        return FALSE;
+    sz = (size_t)w * h * sizeof(union alpha_pixel);
+    if (sz > bakePixelsAlloc) {
+        /* every layer fits in the space of a full block */
+        void* pixels = realloc(bakePixels,(size_t)POK_MAP_BAKE_TILES * POK_MAP_BAKE_TILES * dim * dim * sizeof(union alpha_pixel));
+        if (pixels == NULL)
+            return FALSE;
+        bakePixels = pixels;
+        bakePixelsAlloc = (size_t)POK_MAP_BAKE_TILES * POK_MAP_BAKE_TILES * dim * dim * sizeof(union alpha_pixel);
+    }
+    memset(bakePixels,0,sz);
+    /* take the revision before reading the tiles: if the chunk is updated while it is being
+       baked then the layer is baked again on a later frame */
+    bake->revision = chunk->revision;
+    bake->overlayc = 0;
+    alpha = (atlas->flags & pok_image_flag_alpha) != 0;
+    pixsz = alpha ? sizeof(union alpha_pixel) : sizeof(union pixel);
+    bake->opaque = !alpha;
+    atlasWidth = atlas->width;
+    for (r = 0,i = 0;r < bake->down;++r) {
+        for (c = 0;c < bake->across;++c,++i) {
+            uint16_t id = pok_map_chunk_get_tileid(chunk,column+c,row+r);
+            const struct pok_image* img;
+            if (id >= tman->tilecnt)
+                id = 0;
+            if (tman->tileani != NULL && tman->tileani[id].totalTicks > 0) {
+                bake->overlay[bake->overlayc++] = i;
+                continue;
+            }
+            if ( !tman->atlasMask[id] ) {
+                img = tman->tileset[id];
+                if (img->pixels.data != NULL || img->texref != 0 || img->fillref.r != BLACK_PIXEL.r
+                    || img->fillref.g != BLACK_PIXEL.g || img->fillref.b != BLACK_PIXEL.b)
+                    bake->overlay[bake->overlayc++] = i;
+                else if (!alpha) {
+                    /* paint the background color */
+                    for (k = 0;k < (uint32_t)dim;++k) {
+                        int32_t j;
+                        byte_t* dst = bakePixels + (((size_t)r * dim + k) * w + (size_t)c * dim) * sizeof(union alpha_pixel);
+                        for (j = 0;j < dim;++j,dst+=4) {
+                            dst[0] = BLACK_PIXEL.rgb[0];
+                            dst[1] = BLACK_PIXEL.rgb[1];
+                            dst[2] = BLACK_PIXEL.rgb[2];
+                            dst[3] = 0xff;
+                        }
+                    }
+                }
+                continue;
+            }
+            for (k = 0;k < (uint32_t)dim;++k) {
+                const byte_t* src = (const byte_t*)atlas->pixels.data
+                    + (((size_t)(id / tman->atlasColumns) * dim + k) * atlasWidth + (size_t)(id % tman->atlasColumns) * dim) * pixsz;
+                byte_t* dst = bakePixels + (((size_t)r * dim + k) * w + (size_t)c * dim) * sizeof(union alpha_pixel);
+                if (alpha)
+                    memcpy(dst,src,dim * sizeof(union alpha_pixel));
+                else {
+                    int32_t j;
+                    for (j = 0;j < dim;++j,src+=3,dst+=4) {
+                        dst[0] = src[0];
+                        dst[1] = src[1];
+                        dst[2] = src[2];
+                        dst[3] = 0xff;
+                    }
+                }
+            }
+        }
+    }
+    if (bake->texref == 0)
+        glGenTextures(1,&bake->texref);
+    glBindTexture(GL_TEXTURE_2D,bake->texref);
+    glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_NEAREST);
+    glTexImage2D(GL_TEXTURE_2D,0,GL_RGBA,w,h,0,GL_RGBA,GL_UNSIGNED_BYTE,bakePixels);
+    bake->chunk = chunk;
+    bake->tman = tman;
+    bake->column = column;
+    bake->row = row;
+    return TRUE;
+}
+static struct map_bake* pok_map_bake_acquire(const struct pok_tile_manager* tman,const struct pok_map_chunk* chunk,
+    uint16_t column,uint16_t row,int32_t dim,int* budget)
+{
+    /* find the layer for the block at (column,row) in 'chunk'; if there is none then bake it in the
+       least recently drawn slot (if the frame's budget allows); NULL is returned if the block must
+       be drawn tile by tile */
+    int i;
+    struct map_bake* victim = NULL;
+    long generation = bakeGeneration;
+    for (i = 0;i < BAKE_SLOTS;++i) {
+        struct map_bake* bake = bakes + i;
+        if (bake->chunk == chunk && bake->column == column && bake->row == row && bake->revision == chunk->revision
+            && bake->tman == tman && bake->generation == generation) {
+            bake->frame = bakeFrame;
+            return bake;
+        }
+        if (bake->frame != bakeFrame && (victim == NULL || bake->frame < victim->frame))
+            victim = bake;
+    }
+    if (victim == NULL || *budget <= 0)
+        return NULL;
+    --*budget;
+    victim->generation = generation;
+    if ( !pok_map_bake_layer(victim,tman,chunk,column,row,dim) ) {
+        victim->chunk = NULL;
+        return NULL;
+    }
+    victim->frame = bakeFrame;
+    return victim;
+}
+static void pok_map_bake_draw(struct map_bake* bake,struct map_batch* batch,uint32_t ticks,
+    uint16_t column,uint16_t row,uint16_t across,uint16_t down,int32_t x,int32_t y)
+{
+    /* draw the part of a layer that covers a region of its chunk; (x,y) is the screen position of
+       tile (column,row); the overlay tiles that fall in the region are added to the batch */
+    uint16_t i;
+    GLfloat u0, v0, u1, v1;
+    int32_t X = x + across * batch->dim, Y = y + down * batch->dim;
+    u0 = (GLfloat)(column - bake->column) / bake->across;
+    v0 = (GLfloat)(row - bake->row) / bake->down;
+    u1 = (GLfloat)(column + across - bake->column) / bake->across;
+    v1 = (GLfloat)(row + down - bake->row) / bake->down;
+    if (bake->opaque)
+        glDisable(GL_BLEND);
+    glEnable(GL_TEXTURE_2D);
+    glBindTexture(GL_TEXTURE_2D,bake->texref);
+    glBegin(GL_QUADS);
+    {
+        glTexCoord2f(u0,v0);
+        glVertex2i(x,y);
+
+        glTexCoord2f(u1,v0);
+        glVertex2i(X,y);
+
+        glTexCoord2f(u1,v1);
+        glVertex2i(X,Y);
+
+        glTexCoord2f(u0,v1);
+        glVertex2i(x,Y);
+    }
+    glEnd();
+    glDisable(GL_TEXTURE_2D);
+    if (bake->opaque)
+        glEnable(GL_BLEND);
+    for (i = 0;i < bake->overlayc;++i) {
+        uint16_t c = bake->column + bake->overlay[i] % bake->across;
+        uint16_t r = bake->row + bake->overlay[i] / bake->across;
+        if (c >= column && c < column + across && r >= row && r < row + down)
+            pok_map_render_batch_tile(batch,pok_tile_manager_resolve_tile(batch->tman,
+                    pok_map_chunk_get_tileid(bake->chunk,c,r),ticks),
+                x + (c - column) * batch->dim,y + (r - row) * batch->dim);
+    }
+}
+static bool_t pok_map_render_batch(const struct pok_graphics_subsystem* sys,struct pok_map_render_context* context,
+    const struct pok_map_render_snapshot* view)
+{
+    /* Draw all visible tiles as a single vertex array of textured quads that
+     * sample from the tile manager's atlas. If baking is enabled, each visible
+     * block of a chunk is drawn from its baked layer instead and only the
+     * overlay tiles of the block go into the vertex array. FALSE is returned if
+     * the batch could not be rendered.
+     */
+    int i, budget;
+    size_t tiles;
+    bool_t bake;
+    struct map_batch batch;
+    const struct pok_tile_manager* tman = context->tman;
+    if (tman->atlas == NULL || tman->atlas->texref == 0 || tman->atlasMask == NULL)
+        return FALSE;
+    tiles = 0;
+    for (i = 0;i < 4;++i)
+        if (view->info[i].chunk != NULL)
+            tiles += (size_t)view->info[i].across * view->info[i].down;
+    if ( !pok_map_render_batch_reserve(context,tiles) )
+        return FALSE;
+    batch.tman = tman;
+    batch.dim = sys->dimension;
+    batch.cw = (GLfloat)sys->dimension / tman->atlas->width;
+    batch.ch = (GLfloat)sys->dimension / tman->atlas->height;
+    batch.vert = context->_batchVertices;
+    batch.texc = context->_batchTexCoords;
+    batch.n = 0;
+    bake = context->bake && tman->atlasPixels != NULL;
+    budget = BAKE_PER_FRAME;
+    ++bakeFrame;
+    for (i = 0;i < 4;++i) {
+        const struct pok_chunk_render_info* info = view->info + i;
+        int32_t x = info->px + view->offset[0], y = info->py + view->offset[1];
+        uint16_t c0, r0, c1, r1, bc, br;
+        if (info->chunk == NULL)
+            continue;
+        if (!bake) {
+            pok_map_render_batch_region(&batch,info->chunk,view->tileAniTicks,
+                info->loc.column,info->loc.row,info->across,info->down,x,y);
+            continue;
+        }
+        /* visit each block that intersects the visible region [c0,c1) x [r0,r1) */
+        c0 = info->loc.column;
+        r0 = info->loc.row;
+        c1 = c0 + info->across;
+        r1 = r0 + info->down;
+        for (br = r0 - r0 % POK_MAP_BAKE_TILES;br < r1;br += POK_MAP_BAKE_TILES) {
+            uint16_t top = br > r0 ? br : r0;
+            uint16_t bottom = br + POK_MAP_BAKE_TILES < r1 ? br + POK_MAP_BAKE_TILES : r1;
+            for (bc = c0 - c0 % POK_MAP_BAKE_TILES;bc < c1;bc += POK_MAP_BAKE_TILES) {
+                struct map_bake* layer;
+                uint16_t left = bc > c0 ? bc : c0;
+                uint16_t right = bc + POK_MAP_BAKE_TILES < c1 ? bc + POK_MAP_BAKE_TILES : c1;
+                int32_t X = x + (left - c0) * batch.dim, Y = y + (top - r0) * batch.dim;
+                layer = pok_map_bake_acquire(tman,info->chunk,bc,br,batch.dim,&budget);
+                if (layer != NULL)
+                    pok_map_bake_draw(layer,&batch,view->tileAniTicks,left,top,right-left,bottom-top,X,Y);
+                else
+                    pok_map_render_batch_region(&batch,info->chunk,view->tileAniTicks,left,top,right-left,bottom-top,X,Y);
+            }
+        }
+    }
+    if (batch.n > 0) {
+        glEnable(GL_TEXTURE_2D);
+        glBindTexture(GL_TEXTURE_2D,tman->atlas->texref);
+        glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+        glVertexPointer(2,GL_INT,0,context->_batchVertices);
+        glTexCoordPointer(2,GL_FLOAT,0,context->_batchTexCoords);
+        glDrawArrays(GL_QUADS,0,(GLsizei)batch.n*4);
+        glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+        glDisable(GL_TEXTURE_2D);
+    }
+    return TRUE;
+}
 void pok_map_render(const struct pok_graphics_subsystem* sys,struct pok_map_render_context* context)
 {
     int i;
-    if (context->changed) {
-        /* Compute dimensions of draw spaces if the context was changed. This
-         * flag helps provide thread safety as well since another thread may
-         * change the context before toggling 'context->changed' to make the
-         * changes go into effect).
-         */
-        compute_chunk_render_info(context,sys);
-        context->changed = FALSE;
+    const struct pok_map_render_snapshot* view;
+    POK_TRACE_BEGIN(render);
+    /* Draw the latest render snapshot. If snapshots are not being published
+     * then the snapshot is taken from the context now; in that case the
+     * dimensions of the draw spaces are recomputed if the context was changed.
+     * The snapshot is kept as the context's view so that routines that draw
+     * over the map (e.g. characters) use the same state.
+     */
+    view = pok_map_render_context_acquire(context,sys);
+    context->view = view;
+    /* Use the batch renderer if it is enabled and the tile atlas has been
+     * loaded as a texture; otherwise fall back to drawing each tile.
+     */
+    if (context->batch && pok_map_render_batch(sys,context,view)) {
+        POK_TRACE_END(render,"pok_map_render");
+        return;
     }
     /* Draw each of the (possible) 4 chunks, and make sure to perform scroll
      * offset.
      */
     for (i = 0;i < 4;++i) {
-        if (context->info[i].chunk != NULL) {
-            uint16_t h, row = context->info[i].loc.row;
-            uint32_t y = context->info[i].py + context->offset[1];
-            for (h = 0;h < context->info[i].down;++h,++row,y+=sys->dimension) {
-                uint16_t w, col = context->info[i].loc.column;
-                uint32_t x = context->info[i].px + context->offset[0];
-                for (w = 0;w < context->info[i].across;++w,++col,x+=sys->dimension) {
+        if (view->info[i].chunk != NULL) {
+            uint16_t h, row = view->info[i].loc.row;
+            uint32_t y = view->info[i].py + view->offset[1];
+            for (h = 0;h < view->info[i].down;++h,++row,y+=sys->dimension) {
+                uint16_t w, col = view->info[i].loc.column;
+                uint32_t x = view->info[i].px + view->offset[0];
+                for (w = 0;w < view->info[i].across;++w,++col,x+=sys->dimension) {
                     pok_image_render(
                         pok_tile_manager_get_tile(
                             context->tman,
-                            context->info[i].chunk->data[row][col].data.tileid,
-                            context->tileAniTicks ),
+                            pok_map_chunk_get_tileid(view->info[i].chunk,col,row),
+                            view->tileAniTicks ),
                         x,
                         y );
                 }
             }
         }
     }
+    POK_TRACE_END(render,"pok_map_render");
+}
+void pok_map_render_invalidate()
+{
+    /* this may be called on any thread: the graphics thread compares the generation of each
+       layer against the current generation before drawing it */
+    bake_invalidate(&bakeGeneration);
+}
+void pok_map_render_unload()
+{
+    int i;
+    for (i = 0;i < BAKE_SLOTS;++i) {
+        if (bakes[i].texref != 0)
+            glDeleteTextures(1,&bakes[i].texref);
+        bakes[i].texref = 0;
+        bakes[i].chunk = NULL;
+        bakes[i].frame = 0;
+    }
+    bakeFrame = 0;
+    if (bakePixels != NULL) {
+        free(bakePixels);
+        bakePixels = NULL;
+        bakePixelsAlloc = 0;
+    }
 }
@@ -22,6 +22,39 @@ struct pok_chunk_render_info
     struct pok_map_chunk* chunk; /* the chunk specified; NULL if unused */
 };
 
+/* determine if a character may not step onto a tile: tiles with ids at or below the tile manager's
+   impassibility cutoff are impassable unless the chunk's 'pass' bitplane makes an exception and other
+   tiles are passable unless the 'impass' bitplane makes one; warp tiles are always passable */
+bool_t pok_map_chunk_is_impassable(const struct pok_map_chunk* chunk,const struct pok_tile_manager* tman,uint16_t column,uint16_t row);
+
+/* pok_map_render_sprite: the render state of a single sprite drawn over a map (see the
+   character render context) */
+struct pok_map_render_sprite
+{
+    uint32_t mapNo;              /* map occupied by the sprite */
+    struct pok_point chunkPos;   /* position of chunk containing the sprite */
+    struct pok_location tilePos; /* position within chunk */
+    uint16_t spriteIndex;        /* sprite set */
+    uint8_t frame;               /* sprite frame within set */
+    int offset[2];               /* pixel offset from position */
+    bool_t shadow;               /* if non-zero, a shadow is drawn on the occupied tile */
+};
+
+/* pok_map_render_snapshot: an immutable copy of the state needed to render a map (and the sprites
+   on it) for a single update step; the update thread fills and publishes snapshots and the render
+   thread draws the most recently published one; this lets both threads run without contending for
+   the graphics subsystem lock */
+struct pok_map_render_snapshot
+{
+    const struct pok_map* map;            /* map being drawn (NULL if none) */
+    int offset[2];                        /* scroll offset */
+    uint32_t tileAniTicks;                /* tile animation counter */
+    struct pok_chunk_render_info info[4]; /* chunk render info */
+    bool_t hasSprites;                    /* if non-zero then 'sprites' was captured for this snapshot */
+    uint16_t spritec, spriteAlloc;
+    struct pok_map_render_sprite* sprites;
+};
+
 /* pok_map_render_context: stores information useful for rendering a map and provides operations for changing a
    map's position; a map object should be managed through a context, not directly */
 struct pok_map_render_context
@@ -43,6 +76,27 @@ struct pok_map_render_context
     bool_t groove;                             /* true after a context has finished updating and for a period afterwards */
     bool_t changed;                            /* true if the map render context location has been changed */
     bool_t update;                             /* is the map render context being updated? */
+    bool_t batch;                              /* if true then draw tiles from the tile manager's atlas in a single batch */
+    bool_t bake;                               /* if true then the batch draws non-animated tiles from baked layers */
+    uint16_t prefetchChunks;                   /* number of chunks ahead of the heading to prefetch (0 disables prefetching) */
+    struct pok_map_prefetch_stats prefetchStats; /* chunk prefetch hits/misses for every map this context has viewed */
+
+    /* render snapshots: a triple buffer of snapshots that is in use once the first snapshot
+       is published; 'view' is the snapshot drawn by the most recent call to 'pok_map_render' */
+    struct pok_map_render_snapshot _snapshots[3];
+    volatile long _snapshotMiddle;
+    uint8_t _snapshotBack, _snapshotFront;
+    bool_t _snapshotEnabled;
+    const struct pok_map_render_snapshot* view;
+
+    /* heading and chunk position of the last prefetch that read chunks ahead */
+    enum pok_direction _prefetchDir;
+    struct pok_point _prefetchPos;
+
+    /* vertex buffers used by the batch renderer (owned by the render thread) */
+    size_t _batchAlloc;
+    int32_t* _batchVertices;
+    float* _batchTexCoords;
 };
 struct pok_map_render_context* pok_map_render_context_new(const struct pok_tile_manager* tman);
 void pok_map_render_context_free(struct pok_map_render_context* context);
@@ -59,9 +113,23 @@ bool_t pok_map_render_context_set_position(struct pok_map_render_context* contex
 bool_t pok_map_render_context_move(struct pok_map_render_context* context,enum pok_direction dir,uint16_t skipTiles,bool_t checkPassable);
 void pok_map_render_context_set_update(struct pok_map_render_context* context,enum pok_direction dir,uint16_t dimension);
 bool_t pok_map_render_context_update(struct pok_map_render_context* context,uint16_t dimension,uint32_t ticks);
-struct pok_tile* pok_map_render_context_get_adjacent_tile(struct pok_map_render_context* context,int x,int y);
+bool_t pok_map_render_context_get_adjacent_tile(struct pok_map_render_context* context,int x,int y,struct pok_tile* tile);
+struct pok_map_render_snapshot* pok_map_render_context_begin_snapshot(struct pok_map_render_context* context,
+    const struct pok_graphics_subsystem* sys);
+bool_t pok_map_render_snapshot_reserve_sprites(struct pok_map_render_snapshot* snapshot,uint16_t count);
+void pok_map_render_context_publish(struct pok_map_render_context* context);
 
 /* render routine for maps */
 void pok_map_render(const struct pok_graphics_subsystem* sys,struct pok_map_render_context* context);
 
+/* baked layers: most tiles never animate, so the batch renderer can composite the non-animated tiles of
+   each POK_MAP_BAKE_TILES x POK_MAP_BAKE_TILES block of a chunk into one texture; a frame then draws a
+   textured quad per visible block and only the animated (or untextured) tiles are drawn over them; the
+   layers are kept in a small cache owned by the graphics thread; a layer is baked again when its chunk's
+   revision changes; 'pok_map_render_invalidate' discards every layer (this must be called when a tile
+   manager is replaced) and 'pok_map_render_unload' releases the layers (graphics thread only) */
+#define POK_MAP_BAKE_TILES 16
+void pok_map_render_invalidate();
+void pok_map_render_unload();
+
 #endif
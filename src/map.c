@@ -4,6 +4,17 @@
 #include "pok.h"
 #include "parser.h"
 #include <stdlib.h>
+#include <string.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define chunk_revise(chunk) ((chunk)->revision = (uint32_t)_InterlockedIncrement(&chunkRevision))
+#else
+#define chunk_revise(chunk) ((chunk)->revision = (uint32_t)__atomic_add_fetch(&chunkRevision,1,__ATOMIC_RELAXED))
+#endif
+
+/* source of chunk revision stamps (chunks are created and updated on more than one thread) */
+static volatile long chunkRevision;
 
 /* structs used by the implementation */
 struct chunk_insert_hint
@@ -44,123 +55,416 @@ struct chunk_recursive_info
     bool_t complexTiles;
 };
 
-struct chunk_key
-{
-    struct pok_point pos;
-    struct pok_map_chunk* chunk;
-};
+/* chunk index */
+#define CHUNK_INDEX_INITIAL_CAPACITY 16
 
-static bool_t chunk_key_create(struct pok_map* map,struct pok_map_chunk* chunk,const struct pok_point* point)
+static inline uint32_t chunk_index_hash(const struct pok_map_chunk_index* index,const struct pok_point* pos)
+{
+    /* multiplicative hashing of the packed position; the high bits are the best mixed */
+    uint64_t key = (uint64_t)(uint32_t)pos->X << 32 | (uint32_t)pos->Y;
+    return (uint32_t)((key * UINT64_C(0x9e3779b97f4a7c15)) >> 32) & index->mask;
+}
+static void chunk_index_init(struct pok_map_chunk_index* index)
 {
-    struct chunk_key* key = malloc(sizeof(struct chunk_key));
-    if (key == NULL) {
+    index->count = 0;
+    index->mask = 0;
+    index->entries = NULL;
+}
+static void chunk_index_delete(struct pok_map_chunk_index* index)
+{
+    /* this does not delete the chunks */
+    if (index->entries != NULL)
+        free(index->entries);
+    chunk_index_init(index);
+}
+static struct pok_map_chunk* chunk_index_lookup(const struct pok_map_chunk_index* index,const struct pok_point* pos)
+{
+    /* lookup a loaded chunk; this never faults in a chunk from a map file */
+    uint32_t i;
+    if (index->entries == NULL)
+        return NULL;
+    for (i = chunk_index_hash(index,pos);index->entries[i].chunk != NULL;i = (i+1) & index->mask)
+        if (index->entries[i].pos.X == pos->X && index->entries[i].pos.Y == pos->Y)
+            return index->entries[i].chunk;
+    return NULL;
+}
+static bool_t chunk_index_grow(struct pok_map_chunk_index* index)
+{
+    uint32_t i, j, capacity;
+    struct pok_map_chunk_index_entry* old = index->entries;
+    capacity = old == NULL ? CHUNK_INDEX_INITIAL_CAPACITY : (index->mask + 1) << 1;
+    index->entries = calloc(capacity,sizeof(struct pok_map_chunk_index_entry));
+    if (index->entries == NULL) {
+        index->entries = old;
         pok_exception_flag_memory_error();
         return FALSE;
     }
-    key->pos = *point;
-    key->chunk = chunk;
-    if (treemap_insert(&map->loadedChunks,key) != 0) {
-        /* a chunk key already exists with the same position */
-        pok_exception_new_ex(pok_ex_map,pok_ex_map_non_unique_chunk);
-        return FALSE;
+    if (old != NULL) {
+        uint32_t oldCapacity = index->mask + 1;
+        index->mask = capacity - 1;
+        for (i = 0;i < oldCapacity;++i) {
+            if (old[i].chunk != NULL) {
+                for (j = chunk_index_hash(index,&old[i].pos);index->entries[j].chunk != NULL;j = (j+1) & index->mask)
+                    ;
+                index->entries[j] = old[i];
+            }
+        }
+        free(old);
     }
+    else
+        index->mask = capacity - 1;
     return TRUE;
 }
-
-/* pok_map_chunk */
-enum pok_map_chunk_flags
+static bool_t chunk_index_insert(struct pok_map_chunk_index* index,const struct pok_point* pos,struct pok_map_chunk* chunk)
 {
-    pok_map_chunk_flag_none = 0x00,
-    pok_map_chunk_flag_byref = 0x01
-};
-
-static struct pok_map_chunk* pok_map_chunk_new(struct pok_map* map,const struct pok_point* position)
+    /* add the chunk to the index; the table is kept at most half full */
+    uint32_t i;
+    if ((index->entries == NULL || (index->count + 1) * 2 > index->mask + 1) && !chunk_index_grow(index))
+        return FALSE;
+    for (i = chunk_index_hash(index,pos);index->entries[i].chunk != NULL;i = (i+1) & index->mask) {
+        if (index->entries[i].pos.X == pos->X && index->entries[i].pos.Y == pos->Y) {
+            /* a chunk already exists with the same position */
+            pok_exception_new_ex(pok_ex_map,pok_ex_map_non_unique_chunk);
+            return FALSE;
+        }
+    }
+    index->entries[i].pos = *pos;
+    index->entries[i].chunk = chunk;
+    ++index->count;
+    return TRUE;
+}
+static struct pok_map_chunk* chunk_index_remove(struct pok_map_chunk_index* index,const struct pok_point* pos)
 {
-    uint16_t i, j;
+    /* remove the chunk at the specified position from the index; the entries that follow it
+       in its probe run are shifted back so that no tombstones are needed */
+    uint32_t i, j;
     struct pok_map_chunk* chunk;
-    chunk = malloc(sizeof(struct pok_map_chunk));
-    if (chunk == NULL) {
-        pok_exception_flag_memory_error();
+    if (index->entries == NULL)
         return NULL;
-    }
-    chunk->data = malloc(sizeof(struct pok_tile*) * map->chunkSize.rows);
-    if (chunk->data == NULL) {
-        pok_exception_flag_memory_error();
+    for (i = chunk_index_hash(index,pos);index->entries[i].chunk != NULL;i = (i+1) & index->mask)
+        if (index->entries[i].pos.X == pos->X && index->entries[i].pos.Y == pos->Y)
+            break;
+    chunk = index->entries[i].chunk;
+    if (chunk == NULL)
         return NULL;
+    for (j = (i+1) & index->mask;index->entries[j].chunk != NULL;j = (j+1) & index->mask) {
+        /* an entry may fill the hole if its home slot is not cyclically within (i,j] */
+        uint32_t k = chunk_index_hash(index,&index->entries[j].pos);
+        if (i <= j ? (k <= i || k > j) : (k <= i && k > j)) {
+            index->entries[i] = index->entries[j];
+            i = j;
+        }
     }
-    for (i = 0;i < map->chunkSize.rows;++i) {
-        chunk->data[i] = malloc(sizeof(struct pok_tile) * map->chunkSize.columns);
-        if (chunk->data[i] == NULL) {
-            for (j = 0;j < i;++j)
-                free(chunk->data[j]);
-            free(chunk->data);
-            pok_exception_flag_memory_error();
-            return NULL;
+    index->entries[i].chunk = NULL;
+    --index->count;
+    return chunk;
+}
+
+/* indexed map files: an indexed map file stores a map so that any chunk can be located
+   without reading the chunks before it; the file is memory-mapped and a chunk's tile planes
+   are used in place; all integers are little-endian
+    format:
+     [32 bytes] header
+        [4 bytes] magic ("PKMI")
+        [2 bytes] version
+        [2 bytes] map flags
+        [4 bytes] map number
+        [2 bytes] chunk width
+        [2 bytes] chunk height
+        [4 bytes] origin chunk position X
+        [4 bytes] origin chunk position Y
+        [4 bytes] number of chunks
+        [4 bytes] (reserved)
+     [24 bytes * n] chunk directory sorted by chunk position (see 'pok_point_compar')
+        [4 bytes] chunk position X
+        [4 bytes] chunk position Y
+        [4 bytes] file offset of tile planes
+        [4 bytes] file offset of warp table
+        [2 bytes] number of warps
+        [6 bytes] (reserved)
+     [n bytes] tile planes; each chunk's planes have the same layout as a chunk's planes in
+               memory (tile ids, impass bitplane, pass bitplane) and start on an 8-byte boundary
+     [24 bytes * n] warp tables
+        [4 bytes] tile index (row * columns + column)
+        [4 bytes] warp map number
+        [4 bytes] warp chunk position X
+        [4 bytes] warp chunk position Y
+        [2 bytes] warp column
+        [2 bytes] warp row
+        [1 byte] warp kind
+        [3 bytes] (reserved)
+*/
+#define MAP_FILE_MAGIC "PKMI"
+#define MAP_FILE_VERSION 1
+#define MAP_FILE_HEADER_SIZE 32
+#define MAP_FILE_ENTRY_SIZE 24
+#define MAP_FILE_WARP_SIZE 24
+#define MAP_FILE_ALIGN(n) (((n) + 7) & ~(size_t)7)
+
+struct pok_map_file
+{
+    struct pok_file_view* view;
+    const byte_t* data;
+    size_t size;
+    uint32_t chunkc;
+};
+static bool_t pok_map_fault_all(struct pok_map* map);
+
+static inline bool_t map_file_native_planes()
+{
+    /* tile planes can be used in place if this machine is little-endian */
+    const uint16_t one = 1;
+    return *(const byte_t*)&one == 1;
+}
+static inline uint16_t map_file_get16(const byte_t* p)
+{ return (uint16_t)(p[0] | p[1] << 8); }
+static inline uint32_t map_file_get32(const byte_t* p)
+{ return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24; }
+static inline void map_file_put16(byte_t* p,uint16_t v)
+{ p[0] = v & 0xff; p[1] = v >> 8; }
+static inline void map_file_put32(byte_t* p,uint32_t v)
+{ p[0] = v & 0xff; p[1] = (v >> 8) & 0xff; p[2] = (v >> 16) & 0xff; p[3] = v >> 24; }
+static inline size_t map_file_plane_size(const struct pok_size* chunkSize)
+{
+    size_t ntiles = (size_t)chunkSize->columns * chunkSize->rows;
+    return MAP_FILE_ALIGN(sizeof(uint16_t) * ntiles + (ntiles + 7) / 8 * 2);
+}
+static bool_t map_file_write(struct pok_data_source* dsrc,const byte_t* buffer,size_t size)
+{
+    /* write the entire buffer; the blocks written may be larger than the data source's buffer */
+    while (size > 0) {
+        size_t bytesOut;
+        if ( !pok_data_source_write(dsrc,buffer,size,&bytesOut) )
+            return FALSE;
+        if (bytesOut == 0) {
+            pok_exception_new_ex(pok_ex_net,pok_ex_net_noroom);
+            return FALSE;
         }
-        for (j = 0;j < map->chunkSize.columns;++j)
-            chunk->data[i][j] = DEFAULT_TILE;
+        buffer += bytesOut;
+        size -= bytesOut;
     }
-    for (i = 0;i < 4;++i)
-        chunk->adjacent[i] = NULL;
-    chunk->flags = pok_map_chunk_flag_none;
-    chunk->discov = FALSE;
-    /* add the chunk to the map's treemap (if 'position' is specified); if this fails, then destroy the chunk */
-    if (position != NULL && !chunk_key_create(map,chunk,position)) {
-        for (i = 0;i < map->chunkSize.rows;++i)
-            free(chunk->data[i]);
-        free(chunk->data);
-        return NULL; /* exception is inherited */
+    return TRUE;
+}
+static long map_file_find(const struct pok_map_file* file,const struct pok_point* pos)
+{
+    /* binary search the chunk directory; return the entry index or -1 if not found */
+    long lo = 0, hi = file->chunkc;
+    while (lo < hi) {
+        int cmp;
+        long mid = (lo + hi) / 2;
+        struct pok_point pt;
+        const byte_t* entry = file->data + MAP_FILE_HEADER_SIZE + mid * MAP_FILE_ENTRY_SIZE;
+        pt.X = (int32_t)map_file_get32(entry);
+        pt.Y = (int32_t)map_file_get32(entry+4);
+        cmp = pok_point_compar(&pt,pos);
+        if (cmp == 0)
+            return mid;
+        if (cmp < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
     }
-    pok_netobj_default_ex(&chunk->_base,pok_netobj_mapchunk);
-    return chunk;
+    return -1;
 }
-static struct pok_map_chunk* pok_map_chunk_new_ex(struct pok_map* map,const struct pok_point* position,bool_t byref)
+
+/* pok_map_chunk */
+enum pok_map_chunk_flags
 {
-    /* this chunk only allocates space for pointers to row data and
-       assumes the row data is allocated by another context; the caller
-       can specify whether they want the chunk to destroy the row data
-       using the byref flag */
+    pok_map_chunk_flag_none = 0x00,
+    pok_map_chunk_flag_mapped = 0x01, /* the tile planes are in a map file view (not in the chunk's block) */
+    pok_map_chunk_flag_file = 0x02, /* the chunk was loaded from the map file */
+    pok_map_chunk_flag_warps_changed = 0x04, /* the warps no longer match the map file */
+    pok_map_chunk_flag_referenced = 0x08 /* the chunk was looked up since the clock hand passed it */
+};
+
+static struct pok_map_chunk* pok_map_chunk_new_ex(struct pok_map* map,const struct pok_point* position,byte_t* planes)
+{
+    /* allocate the chunk and its tile planes in a single block: the structure is followed by
+       the tile id plane and then the two passability bitplanes; every tile starts out as the
+       default tile (id 0 with no warp and no passability exceptions); if 'planes' is specified
+       then only the structure is allocated and the chunk uses the planes in place */
     uint16_t i;
+    size_t ntiles, nbits;
     struct pok_map_chunk* chunk;
-    chunk = malloc(sizeof(struct pok_map_chunk));
+    ntiles = (size_t)map->chunkSize.columns * map->chunkSize.rows;
+    nbits = (ntiles + 7) / 8;
+    chunk = calloc(1,sizeof(struct pok_map_chunk) + (planes != NULL ? 0 : sizeof(uint16_t) * ntiles + nbits * 2));
     if (chunk == NULL) {
         pok_exception_flag_memory_error();
         return NULL;
     }
-    chunk->data = malloc(sizeof(struct pok_tile*) * map->chunkSize.rows);
-    for (i = 0;i < map->chunkSize.rows;++i)
-        chunk->data[i] = NULL;
+    chunk->columns = map->chunkSize.columns;
+    chunk->rows = map->chunkSize.rows;
+    chunk->tiles = planes != NULL ? (uint16_t*)planes : (uint16_t*)(chunk + 1);
+    chunk->impass = (byte_t*)(chunk->tiles + ntiles);
+    chunk->pass = chunk->impass + nbits;
+    chunk->warpc = 0;
+    chunk->warpAlloc = 0;
+    chunk->warps = NULL;
     for (i = 0;i < 4;++i)
         chunk->adjacent[i] = NULL;
-    chunk->flags = byref ? pok_map_chunk_flag_byref : pok_map_chunk_flag_none;
+    /* a new chunk starts out referenced so that a chunk loaded ahead of time is not evicted
+       before it is used */
+    chunk->flags = (planes != NULL ? pok_map_chunk_flag_mapped : pok_map_chunk_flag_none) | pok_map_chunk_flag_referenced;
     chunk->discov = FALSE;
-    /* add the chunk to the map's treemap; if this fails, then destroy the chunk */
-    if ( !chunk_key_create(map,chunk,position) ) {
-        free(chunk->data);
-        return NULL; /* exception is inherited */
+    chunk_revise(chunk);
+    /* add the chunk to the map's index (if 'position' is specified); if this fails, then destroy the chunk */
+    if (position != NULL) {
+        if ( !chunk_index_insert(&map->loadedChunks,position,chunk) ) {
+            free(chunk);
+            return NULL; /* exception is inherited */
+        }
+        /* the chunk may have been supplied again after it was evicted */
+        if (map->residency.evicted.count > 0)
+            chunk_index_remove(&map->residency.evicted,position);
     }
     pok_netobj_default_ex(&chunk->_base,pok_netobj_mapchunk);
     return chunk;
 }
-static void pok_map_chunk_free(struct pok_map_chunk* chunk,uint16_t rows)
+static inline struct pok_map_chunk* pok_map_chunk_new(struct pok_map* map,const struct pok_point* position)
 {
-    uint16_t i;
-    if ((chunk->flags&pok_map_chunk_flag_byref) == 0 && chunk->data != NULL)
-        for (i = 0;i < rows;++i)
-            free(chunk->data[i]);
-    free(chunk->data);
+    return pok_map_chunk_new_ex(map,position,NULL);
+}
+static void pok_map_chunk_free(struct pok_map_chunk* chunk)
+{
+    /* delete the chunk; the caller is responsible for its adjacencies */
+    if (chunk->warps != NULL)
+        free(chunk->warps);
     pok_netobj_delete(&chunk->_base);
-    /* recursively delete adjacent chunks */
-    chunk->discov = TRUE;
-    for (i = 0;i < 4;++i) {
-        if (chunk->adjacent[i] != NULL) {
-            /* destroy the reverse adjacency information */
-            chunk->adjacent[i]->adjacent[ pok_direction_opposite(i) ] = NULL;
-            if (!chunk->adjacent[i]->discov)
-                pok_map_chunk_free(chunk->adjacent[i],rows);
+    free(chunk);
+}
+/* the public tile setters renew the chunk's revision; this module fills new chunks and applies
+   update methods with the following variants instead and renews the revision once */
+static inline void chunk_set_tileid(struct pok_map_chunk* chunk,uint16_t column,uint16_t row,uint16_t tileid)
+{
+    chunk->tiles[(uint32_t)row * chunk->columns + column] = tileid;
+}
+static void chunk_set_passability(struct pok_map_chunk* chunk,uint16_t column,uint16_t row,bool_t impass,bool_t pass)
+{
+    uint32_t i = (uint32_t)row * chunk->columns + column;
+    byte_t mask = 1 << (i & 7);
+    if (impass)
+        chunk->impass[i >> 3] |= mask;
+    else
+        chunk->impass[i >> 3] &= ~mask;
+    if (pass)
+        chunk->pass[i >> 3] |= mask;
+    else
+        chunk->pass[i >> 3] &= ~mask;
+}
+static int pok_map_chunk_find_warp(const struct pok_map_chunk* chunk,uint32_t index,bool_t* found)
+{
+    /* binary search the warp side table; return the position of the entry or the
+       position at which it should be inserted */
+    int lo = 0, hi = chunk->warpc;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (chunk->warps[mid].index < index)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    *found = lo < chunk->warpc && chunk->warps[lo].index == index;
+    return lo;
+}
+struct pok_tile_data* pok_map_chunk_get_warp(const struct pok_map_chunk* chunk,uint16_t column,uint16_t row)
+{
+    /* return the warp information for the specified tile; NULL is returned if the tile does not warp */
+    int i;
+    bool_t found;
+    if (chunk->warpc == 0)
+        return NULL;
+    i = pok_map_chunk_find_warp(chunk,(uint32_t)row * chunk->columns + column,&found);
+    return found ? &chunk->warps[i].data : NULL;
+}
+static bool_t chunk_set_warp(struct pok_map_chunk* chunk,uint16_t column,uint16_t row,const struct pok_tile_data* warp)
+{
+    int i;
+    bool_t found;
+    uint32_t index = (uint32_t)row * chunk->columns + column;
+    i = pok_map_chunk_find_warp(chunk,index,&found);
+    if (warp == NULL || warp->warpKind == pok_tile_warp_none) {
+        if (found) {
+            --chunk->warpc;
+            memmove(chunk->warps + i,chunk->warps + i + 1,sizeof(struct pok_map_chunk_warp) * (chunk->warpc - i));
+            chunk->flags |= pok_map_chunk_flag_warps_changed;
         }
+        return TRUE;
     }
-    free(chunk);
+    if (!found) {
+        if (chunk->warpc >= chunk->warpAlloc) {
+            uint16_t nalloc;
+            struct pok_map_chunk_warp* ndata;
+            nalloc = chunk->warpAlloc == 0 ? 4 : chunk->warpAlloc << 1;
+            ndata = realloc(chunk->warps,sizeof(struct pok_map_chunk_warp) * nalloc);
+            if (ndata == NULL) {
+                pok_exception_flag_memory_error();
+                return FALSE;
+            }
+            chunk->warps = ndata;
+            chunk->warpAlloc = nalloc;
+        }
+        memmove(chunk->warps + i + 1,chunk->warps + i,sizeof(struct pok_map_chunk_warp) * (chunk->warpc - i));
+        ++chunk->warpc;
+        chunk->warps[i].index = index;
+    }
+    chunk->warps[i].data = *warp;
+    chunk->warps[i].data.tileid = 0;
+    chunk->flags |= pok_map_chunk_flag_warps_changed;
+    return TRUE;
+}
+void pok_map_chunk_get_tile(const struct pok_map_chunk* chunk,uint16_t column,uint16_t row,struct pok_tile* tile)
+{
+    /* unpack the specified tile into a 'pok_tile' structure */
+    const struct pok_tile_data* warp;
+    warp = pok_map_chunk_get_warp(chunk,column,row);
+    if (warp != NULL)
+        pok_tile_init_ex(tile,warp);
+    else
+        pok_tile_init(tile,0);
+    tile->data.tileid = pok_map_chunk_get_tileid(chunk,column,row);
+    tile->impass = pok_map_chunk_get_impass(chunk,column,row);
+    tile->pass = pok_map_chunk_get_pass(chunk,column,row);
+}
+static bool_t chunk_set_tile(struct pok_map_chunk* chunk,uint16_t column,uint16_t row,const struct pok_tile* tile)
+{
+    /* pack the specified 'pok_tile' structure into the chunk */
+    chunk_set_tileid(chunk,column,row,tile->data.tileid);
+    chunk_set_passability(chunk,column,row,tile->impass,tile->pass);
+    return chunk_set_warp(chunk,column,row,&tile->data);
+}
+void pok_map_chunk_set_tileid(struct pok_map_chunk* chunk,uint16_t column,uint16_t row,uint16_t tileid)
+{
+    chunk_set_tileid(chunk,column,row,tileid);
+    chunk_revise(chunk);
+}
+void pok_map_chunk_set_passability(struct pok_map_chunk* chunk,uint16_t column,uint16_t row,bool_t impass,bool_t pass)
+{
+    chunk_set_passability(chunk,column,row,impass,pass);
+    chunk_revise(chunk);
+}
+bool_t pok_map_chunk_set_warp(struct pok_map_chunk* chunk,uint16_t column,uint16_t row,const struct pok_tile_data* warp)
+{
+    /* assign warp information to the specified tile; if 'warp' is NULL or its warp kind is none then the
+       tile's warp (if any) is removed; note that this may move other warp entries in memory */
+    if ( !chunk_set_warp(chunk,column,row,warp) )
+        return FALSE;
+    chunk_revise(chunk);
+    return TRUE;
+}
+bool_t pok_map_chunk_set_tile(struct pok_map_chunk* chunk,uint16_t column,uint16_t row,const struct pok_tile* tile)
+{
+    /* pack the specified 'pok_tile' structure into the chunk */
+    if ( !chunk_set_tile(chunk,column,row,tile) )
+        return FALSE;
+    chunk_revise(chunk);
+    return TRUE;
+}
+void pok_map_chunk_revise(struct pok_map_chunk* chunk)
+{
+    /* renew the chunk's revision stamp; this must be called after a loaded chunk's tiles are
+       changed directly (the tile setters and update methods call it for themselves) */
+    chunk_revise(chunk);
 }
 /*static*/ void pok_map_chunk_configure_adj(struct pok_map_chunk* chunk,
     const struct pok_point* loc,const struct pok_map* map)
@@ -170,7 +474,7 @@ static void pok_map_chunk_free(struct pok_map_chunk* chunk,uint16_t rows)
         struct pok_map_chunk* adj;
         pos = *loc;
         pok_direction_add_to_point(dir,&pos);
-        adj = pok_map_get_chunk(map,&pos);
+        adj = chunk_index_lookup(&map->loadedChunks,&pos); /* only link chunks that are already loaded */
 
         /* set the adjacency; if it exists, mark the connection in the
            adjacency (so it goes both ways) */
@@ -216,10 +520,12 @@ static bool_t pok_map_chunk_save(struct pok_map_chunk* chunk,struct chunk_recurs
     for (r = 0;r < info->map->chunkSize.rows;++r) {
         for (c = 0;c < info->map->chunkSize.columns;++c) {
             if (info->complexTiles) {
-                if ( !pok_tile_save(chunk->data[r] + c,info->dsrc) )
+                struct pok_tile tile;
+                pok_map_chunk_get_tile(chunk,c,r,&tile);
+                if ( !pok_tile_save(&tile,info->dsrc) )
                     return FALSE;
             }
-            else if ( !pok_data_stream_write_uint16(info->dsrc,chunk->data[r][c].data.tileid) )
+            else if ( !pok_data_stream_write_uint16(info->dsrc,pok_map_chunk_get_tileid(chunk,c,r)) )
                 return FALSE;
         }
     }
@@ -233,7 +539,7 @@ static bool_t pok_map_chunk_open(struct pok_map_chunk* chunk,struct chunk_recurs
         [n bytes] tile data
 
         This is a depth first way of reading chunk information. The representation is still a graph,
-        but it does not have any cycles. The chunk position is assigned into the pok_map's treemap here.
+        but it does not have any cycles. The chunk position is assigned into the pok_map's index here.
     */
     int i;
     byte_t adj;
@@ -259,7 +565,7 @@ static bool_t pok_map_chunk_open(struct pok_map_chunk* chunk,struct chunk_recurs
             else if (chunk->adjacent[orthog2] != NULL && chunk->adjacent[orthog2]->adjacent[i] != NULL
                     && chunk->adjacent[orthog2]->adjacent[i]->adjacent[orthog1] != NULL)
                 chunk->adjacent[i] = chunk->adjacent[orthog2]->adjacent[i]->adjacent[orthog1];
-            if (chunk->adjacent[i] == NULL) { /* create new chunk */
+            if (chunk->adjacent[i] == NULL) {
                 /* compute the chunk's position */
                 ptmp = point;
                 if (i == pok_direction_up)
@@ -270,7 +576,13 @@ static bool_t pok_map_chunk_open(struct pok_map_chunk* chunk,struct chunk_recurs
                     --ptmp.X;
                 else /*if (i == pok_direction_right)*/
                     ++ptmp.X;
+                /* the chunk may have been created by a longer path through the map */
+                chunk->adjacent[i] = chunk_index_lookup(&info->map->loadedChunks,&ptmp);
+            }
+            if (chunk->adjacent[i] == NULL) { /* create new chunk */
                 chunk->adjacent[i] = pok_map_chunk_new(info->map,&ptmp);
+                if (chunk->adjacent[i] == NULL)
+                    return FALSE;
                 chunk->adjacent[i]->adjacent[op] = chunk;
                 /* recursively build chunk; ptmp is a static variable whose value
                    is copied onto the stack */
@@ -288,10 +600,13 @@ static bool_t pok_map_chunk_open(struct pok_map_chunk* chunk,struct chunk_recurs
                 uint16_t id;
                 if ( !pok_data_stream_read_uint16(info->dsrc,&id) )
                     return FALSE;
-                pok_tile_init(chunk->data[r]+c,id);
+                chunk_set_tileid(chunk,c,r,id);
+            }
+            else {
+                struct pok_tile tile;
+                if (!pok_tile_open(&tile,info->dsrc) || !chunk_set_tile(chunk,c,r,&tile))
+                    return FALSE;
             }
-            else if ( !pok_tile_open(chunk->data[r]+c,info->dsrc) )
-                return FALSE;
         }
     }
     return TRUE;
@@ -311,13 +626,24 @@ static enum pok_network_result pok_map_chunk_netread(struct pok_map_chunk* chunk
             break;
         if ( !pok_netobj_readinfo_alloc_next(info) )
             return pok_net_failed_internal;
+        /* tiles are read into a staging structure (kept in 'info->aux' in case the
+           transfer is incomplete) and then packed into the chunk */
+        info->aux = malloc(sizeof(struct pok_tile));
+        if (info->aux == NULL) {
+            pok_exception_flag_memory_error();
+            return pok_net_failed_internal;
+        }
     case 1:
         /* tile structures */
         while (info->depth[0] < size->rows) {
             while (info->depth[1] < size->columns) {
-                result = pok_tile_netread(chunk->data[info->depth[0]]+info->depth[1],dsrc,info->next);
+                result = pok_tile_netread((struct pok_tile*)info->aux,dsrc,info->next);
                 if (result != pok_net_completed)
                     return result;
+                ((struct pok_tile*)info->aux)->impass = FALSE;
+                ((struct pok_tile*)info->aux)->pass = FALSE;
+                if ( !chunk_set_tile(chunk,info->depth[1],info->depth[0],(struct pok_tile*)info->aux) )
+                    return pok_net_failed_internal;
                 pok_netobj_readinfo_reset(info->next);
                 ++info->depth[1];
             }
@@ -336,13 +662,51 @@ static enum pok_network_result pok_map_chunk_netwrite(struct pok_map_chunk* chun
 
     return result;    
 }
+static int pok_map_chunk_method_fieldc(int method)
+{
+    /* get the number of 2-byte fields sent with a chunk method (zero if the method is not recognized):
+        update_tile:   [2 bytes] tile id, [2 bytes] column, [2 bytes] row
+        update_region: [2 bytes] tile id, [2 bytes] top, bottom, left, right (inclusive)
+    */
+    switch (method) {
+    case pok_map_chunk_update_tile:
+        return 3;
+    case pok_map_chunk_update_region:
+        return 5;
+    }
+    return 0;
+}
 enum pok_network_result pok_map_chunk_netmethod_send(struct pok_map_chunk* chunk,
     struct pok_data_source* dsrc,
     struct pok_netobj_writeinfo* winfo,
     struct pok_netobj_upinfo* uinfo)
 {
-    enum pok_network_result result = pok_net_completed;
-
+    int fieldc;
+    uint16_t fields[5];
+    enum pok_network_result result = pok_net_already;
+    const union pok_map_chunk_method_params* params = &uinfo->methodParams.mapChunk;
+    fieldc = pok_map_chunk_method_fieldc(uinfo->methodID);
+    if (fieldc == 0) {
+        pok_exception_new_format("bad method to map chunk object: %d",uinfo->methodID);
+        return pok_net_failed_protocol;
+    }
+    if (uinfo->methodID == pok_map_chunk_update_tile) {
+        fields[0] = params->update_tile.tileID;
+        fields[1] = params->update_tile.column;
+        fields[2] = params->update_tile.row;
+    }
+    else {
+        fields[0] = params->update_region.tileID;
+        fields[1] = params->update_region.top;
+        fields[2] = params->update_region.bottom;
+        fields[3] = params->update_region.left;
+        fields[4] = params->update_region.right;
+    }
+    while (winfo->fieldProg < fieldc) {
+        pok_data_stream_write_uint16(dsrc,fields[winfo->fieldProg]);
+        if ((result = pok_netobj_writeinfo_process(winfo)) != pok_net_completed)
+            break;
+    }
     return result;
 }
 enum pok_network_result pok_map_chunk_netmethod_recv(struct pok_map_chunk* chunk,
@@ -350,8 +714,50 @@ enum pok_network_result pok_map_chunk_netmethod_recv(struct pok_map_chunk* chunk
     struct pok_netobj_readinfo* info,
     enum pok_map_chunk_method method)
 {
-    enum pok_network_result result = pok_net_completed;
-
+    /* the fields are read into a staging array (kept in 'info->aux' in case the transfer is
+       incomplete); the chunk is not modified until every field has been read and checked */
+    int fieldc;
+    uint16_t* fields;
+    uint16_t r, c;
+    enum pok_network_result result = pok_net_already;
+    fieldc = pok_map_chunk_method_fieldc(method);
+    if (fieldc == 0) {
+        pok_exception_new_format("bad method to map chunk object: %d",method);
+        return pok_net_failed_protocol;
+    }
+    if (info->aux == NULL) {
+        info->aux = malloc(sizeof(uint16_t) * fieldc);
+        if (info->aux == NULL) {
+            pok_exception_flag_memory_error();
+            return pok_net_failed_internal;
+        }
+    }
+    fields = info->aux;
+    while (info->fieldProg < fieldc) {
+        pok_data_stream_read_uint16(dsrc,fields + info->fieldProg);
+        if ((result = pok_netobj_readinfo_process(info)) != pok_net_completed)
+            return result;
+    }
+    if (result != pok_net_completed)
+        return result; /* the method was already applied */
+    if (method == pok_map_chunk_update_tile) {
+        if (fields[1] >= chunk->columns || fields[2] >= chunk->rows) {
+            pok_exception_new_ex(pok_ex_map,pok_ex_map_bad_format);
+            return pok_net_failed_protocol;
+        }
+        chunk_set_tileid(chunk,fields[1],fields[2],fields[0]);
+    }
+    else {
+        if (fields[1] > fields[2] || fields[2] >= chunk->rows || fields[3] > fields[4] || fields[4] >= chunk->columns) {
+            pok_exception_new_ex(pok_ex_map,pok_ex_map_bad_format);
+            return pok_net_failed_protocol;
+        }
+        for (r = fields[1];r <= fields[2];++r)
+            for (c = fields[3];c <= fields[4];++c)
+                chunk_set_tileid(chunk,c,r,fields[0]);
+    }
+    /* the tile plane changed: renew the chunk's revision */
+    chunk_revise(chunk);
     return result;
 }
 
@@ -380,18 +786,35 @@ void pok_map_init(struct pok_map* map)
     map->chunkSize.columns = map->chunkSize.rows = 0;
     map->originPos.X = map->originPos.Y = 0;
     map->flags = pok_map_flag_none;
-    treemap_init(&map->loadedChunks,(key_comparator)pok_point_compar,free); /* does not delete chunks, just the keys */
+    map->file = NULL;
+    chunk_index_init(&map->loadedChunks);
+    map->residency.budget = 0;
+    map->residency.hand = 0;
+    map->residency.focused = FALSE;
+    map->residency.focus.X = map->residency.focus.Y = 0;
+    map->residency.request = NULL;
+    map->residency.requestContext = NULL;
+    chunk_index_init(&map->residency.evicted);
     pok_netobj_default_ex(&map->_base,pok_netobj_map);
 }
 void pok_map_delete(struct pok_map* map)
 {
+    uint32_t i;
     pok_netobj_delete(&map->_base);
-    if (map->origin != NULL) {
-        /* this will recursively delete the adjacent chunks */
-        pok_map_chunk_free(map->origin,map->chunkSize.rows);
-        map->origin = NULL;
+    /* every chunk in the map is in the index */
+    if (map->loadedChunks.entries != NULL)
+        for (i = 0;i <= map->loadedChunks.mask;++i)
+            if (map->loadedChunks.entries[i].chunk != NULL)
+                pok_map_chunk_free(map->loadedChunks.entries[i].chunk);
+    chunk_index_delete(&map->loadedChunks);
+    chunk_index_delete(&map->residency.evicted);
+    map->origin = NULL;
+    if (map->file != NULL) {
+        /* the chunk tile planes referred to the file view so it is deleted after the chunks */
+        pok_file_view_free(map->file->view);
+        free(map->file);
+        map->file = NULL;
     }
-    treemap_delete(&map->loadedChunks);
 }
 bool_t pok_map_configure(struct pok_map* map,const struct pok_size* chunkSize,const uint16_t firstChunk[],uint32_t length)
 {
@@ -414,7 +837,7 @@ bool_t pok_map_configure(struct pok_map* map,const struct pok_size* chunkSize,co
         if (length > 0)
             for (i = 0;i < chunkSize->rows;++i)
                 for (j = 0;j < chunkSize->columns;++j)
-                    map->origin->data[i][j].data.tileid = firstChunk[k++ % length];
+                    chunk_set_tileid(map->origin,j,i,firstChunk[k++ % length]);
         return TRUE;
     }
     pok_exception_new_ex(pok_ex_map,pok_ex_map_already);
@@ -444,7 +867,7 @@ struct pok_map_chunk* pok_map_add_chunk(struct pok_map* map,
             if (length > 0)
                 for (i = 0;i < map->chunkSize.rows;++i)
                     for (j = 0;j < map->chunkSize.columns;++j)
-                        chunk->data[i][j].data.tileid = chunkTiles[k++ % length];
+                        chunk_set_tileid(chunk,j,i,chunkTiles[k++ % length]);
 
             /* configure the chunk's initial adjacencies */
             pok_map_chunk_configure_adj(chunk,&pos,map);
@@ -454,6 +877,29 @@ struct pok_map_chunk* pok_map_add_chunk(struct pok_map* map,
     pok_exception_new_ex(pok_ex_map,pok_ex_map_not_loaded);
     return NULL;
 }
+bool_t pok_map_remove_chunk(struct pok_map* map,const struct pok_point* pos)
+{
+    /* remove the chunk at the specified position from the map and delete it; the origin chunk
+       cannot be removed; if the map has a map file, then the chunk is loaded again from the file
+       the next time it is looked up (so changes made to the chunk are lost) */
+    if (map->origin != NULL) {
+        int dir;
+        struct pok_map_chunk* chunk = NULL;
+        if (pok_point_compar(pos,&map->originPos) != 0)
+            chunk = chunk_index_remove(&map->loadedChunks,pos);
+        if (chunk == NULL) {
+            pok_exception_new_ex(pok_ex_map,pok_ex_map_no_chunk);
+            return FALSE;
+        }
+        for (dir = pok_direction_up;dir <= pok_direction_right;++dir)
+            if (chunk->adjacent[dir] != NULL)
+                chunk->adjacent[dir]->adjacent[pok_direction_opposite(dir)] = NULL;
+        pok_map_chunk_free(chunk);
+        return TRUE;
+    }
+    pok_exception_new_ex(pok_ex_map,pok_ex_map_not_loaded);
+    return FALSE;
+}
 bool_t pok_map_save(struct pok_map* map,struct pok_data_source* dsrc,bool_t complex)
 {
     /* write the map representation to a file
@@ -466,18 +912,21 @@ bool_t pok_map_save(struct pok_map* map,struct pok_data_source* dsrc,bool_t comp
         [4 bytes] origin chunk position Y
         [n bytes] origin chunk (and its adjacencies)
     */
-    if (map->origin == NULL) {
+    if (map->origin != NULL) {
         bool_t result;
         struct chunk_recursive_info info;
         info.dsrc = dsrc;
         info.map = map;
         info.complexTiles = complex;
+        if ( !pok_map_fault_all(map) )
+            return FALSE;
         if (!pok_data_stream_write_byte(dsrc,complex) || !pok_data_stream_write_uint32(dsrc,map->mapNo)
             || !pok_data_stream_write_uint16(dsrc,map->chunkSize.columns)
             || !pok_data_stream_write_uint16(dsrc,map->chunkSize.rows)
             || !pok_data_stream_write_int32(dsrc,map->originPos.X)
             || !pok_data_stream_write_int32(dsrc,map->originPos.Y))
             return FALSE;
+        map->origin->discov = TRUE; /* the origin is never written by its adjacencies */
         result = pok_map_chunk_save(map->origin,&info);
         pok_map_chunk_setstate(map->origin,FALSE); /* reset visit state for future operation */
         return result;
@@ -530,6 +979,175 @@ bool_t pok_map_open(struct pok_map* map,struct pok_data_source* dsrc)
     pok_exception_new_ex(pok_ex_map,pok_ex_map_already);
     return FALSE;
 }
+static int chunk_index_entry_compar(const struct pok_map_chunk_index_entry* left,const struct pok_map_chunk_index_entry* right)
+{
+    return pok_point_compar(&left->pos,&right->pos);
+}
+static struct pok_map_chunk_index_entry* pok_map_collect_chunks(struct pok_map* map,uint32_t* count)
+{
+    /* produce a list of every chunk in the map and its position, sorted by position */
+    uint32_t i;
+    struct pok_map_chunk_index_entry* list;
+    if ( !pok_map_fault_all(map) )
+        return NULL;
+    list = malloc(sizeof(struct pok_map_chunk_index_entry) * map->loadedChunks.count);
+    if (list == NULL) {
+        pok_exception_flag_memory_error();
+        return NULL;
+    }
+    *count = 0;
+    for (i = 0;i <= map->loadedChunks.mask;++i)
+        if (map->loadedChunks.entries[i].chunk != NULL)
+            list[(*count)++] = map->loadedChunks.entries[i];
+    qsort(list,*count,sizeof(struct pok_map_chunk_index_entry),(int(*)(const void*,const void*))chunk_index_entry_compar);
+    return list;
+}
+bool_t pok_map_save_indexed(struct pok_map* map,struct pok_data_source* dsrc)
+{
+    /* write the map as an indexed map file (see the format description above) */
+    if (map->origin != NULL) {
+        uint32_t i, j, count;
+        size_t ntiles, nbits, planeSize, planeStart, warpStart, bufferSize;
+        byte_t* buffer;
+        struct pok_map_chunk_index_entry* chunks;
+        chunks = pok_map_collect_chunks(map,&count);
+        if (chunks == NULL)
+            return FALSE;
+        ntiles = (size_t)map->chunkSize.columns * map->chunkSize.rows;
+        nbits = (ntiles + 7) / 8;
+        planeSize = map_file_plane_size(&map->chunkSize);
+        planeStart = MAP_FILE_ALIGN(MAP_FILE_HEADER_SIZE + (size_t)count * MAP_FILE_ENTRY_SIZE);
+        warpStart = planeStart + planeSize * count;
+        if (warpStart > UINT32_MAX) {
+            free(chunks);
+            pok_exception_new_ex(pok_ex_map,pok_ex_map_too_many_chunks);
+            return FALSE;
+        }
+        /* the buffer holds the header and directory and is then reused for each chunk's planes */
+        bufferSize = planeStart > planeSize ? planeStart : planeSize;
+        buffer = calloc(1,bufferSize > MAP_FILE_WARP_SIZE ? bufferSize : MAP_FILE_WARP_SIZE);
+        if (buffer == NULL) {
+            free(chunks);
+            pok_exception_flag_memory_error();
+            return FALSE;
+        }
+        memcpy(buffer,MAP_FILE_MAGIC,4);
+        map_file_put16(buffer+4,MAP_FILE_VERSION);
+        map_file_put16(buffer+6,map->flags);
+        map_file_put32(buffer+8,map->mapNo);
+        map_file_put16(buffer+12,map->chunkSize.columns);
+        map_file_put16(buffer+14,map->chunkSize.rows);
+        map_file_put32(buffer+16,(uint32_t)map->originPos.X);
+        map_file_put32(buffer+20,(uint32_t)map->originPos.Y);
+        map_file_put32(buffer+24,count);
+        for (i = 0;i < count;++i) {
+            byte_t* entry = buffer + MAP_FILE_HEADER_SIZE + (size_t)i * MAP_FILE_ENTRY_SIZE;
+            map_file_put32(entry,(uint32_t)chunks[i].pos.X);
+            map_file_put32(entry+4,(uint32_t)chunks[i].pos.Y);
+            map_file_put32(entry+8,(uint32_t)(planeStart + planeSize * i));
+            map_file_put32(entry+12,(uint32_t)warpStart);
+            map_file_put16(entry+16,chunks[i].chunk->warpc);
+            warpStart += (size_t)chunks[i].chunk->warpc * MAP_FILE_WARP_SIZE;
+        }
+        if ( !map_file_write(dsrc,buffer,planeStart) )
+            goto fail;
+        /* tile planes */
+        for (i = 0;i < count;++i) {
+            const struct pok_map_chunk* chunk = chunks[i].chunk;
+            memset(buffer,0,planeSize);
+            for (j = 0;j < ntiles;++j)
+                map_file_put16(buffer + j*2,chunk->tiles[j]);
+            memcpy(buffer + ntiles*2,chunk->impass,nbits);
+            memcpy(buffer + ntiles*2 + nbits,chunk->pass,nbits);
+            if ( !map_file_write(dsrc,buffer,planeSize) )
+                goto fail;
+        }
+        /* warp tables */
+        memset(buffer,0,MAP_FILE_WARP_SIZE);
+        for (i = 0;i < count;++i) {
+            const struct pok_map_chunk* chunk = chunks[i].chunk;
+            for (j = 0;j < chunk->warpc;++j) {
+                const struct pok_map_chunk_warp* warp = chunk->warps + j;
+                map_file_put32(buffer,warp->index);
+                map_file_put32(buffer+4,warp->data.warpMap);
+                map_file_put32(buffer+8,(uint32_t)warp->data.warpChunk.X);
+                map_file_put32(buffer+12,(uint32_t)warp->data.warpChunk.Y);
+                map_file_put16(buffer+16,warp->data.warpLocation.column);
+                map_file_put16(buffer+18,warp->data.warpLocation.row);
+                buffer[20] = warp->data.warpKind;
+                if ( !map_file_write(dsrc,buffer,MAP_FILE_WARP_SIZE) )
+                    goto fail;
+            }
+        }
+        free(buffer);
+        free(chunks);
+        return TRUE;
+    fail:
+        free(buffer);
+        free(chunks);
+        return FALSE;
+    }
+    pok_exception_new_ex(pok_ex_map,pok_ex_map_not_loaded);
+    return FALSE;
+}
+bool_t pok_map_open_indexed(struct pok_map* map,const char* filename)
+{
+    /* open an indexed map file; only the origin chunk is loaded: other chunks are loaded from
+       the file when they are looked up; the file remains mapped until the map is deleted */
+    if (map->origin == NULL) {
+        uint32_t count;
+        const byte_t* data;
+        size_t size;
+        struct pok_file_view* view;
+        struct pok_map_file* file;
+        view = pok_file_view_new(filename);
+        if (view == NULL)
+            return FALSE;
+        data = pok_file_view_data(view);
+        size = pok_file_view_size(view);
+        if (size < MAP_FILE_HEADER_SIZE || memcmp(data,MAP_FILE_MAGIC,4) != 0 || map_file_get16(data+4) != MAP_FILE_VERSION
+            || (count = map_file_get32(data+24)) == 0 || count > (size - MAP_FILE_HEADER_SIZE) / MAP_FILE_ENTRY_SIZE) {
+            pok_exception_new_ex(pok_ex_map,pok_ex_map_bad_format);
+            pok_file_view_free(view);
+            return FALSE;
+        }
+        map->chunkSize.columns = map_file_get16(data+12);
+        map->chunkSize.rows = map_file_get16(data+14);
+        if (map->chunkSize.columns < POK_MIN_MAP_CHUNK_DIMENSION || map->chunkSize.columns > POK_MAX_MAP_CHUNK_DIMENSION
+            || map->chunkSize.rows < POK_MIN_MAP_CHUNK_DIMENSION || map->chunkSize.rows > POK_MAX_MAP_CHUNK_DIMENSION) {
+            pok_exception_new_ex(pok_ex_map,pok_ex_map_bad_chunk_size);
+            pok_file_view_free(view);
+            return FALSE;
+        }
+        file = malloc(sizeof(struct pok_map_file));
+        if (file == NULL) {
+            pok_exception_flag_memory_error();
+            pok_file_view_free(view);
+            return FALSE;
+        }
+        file->view = view;
+        file->data = data;
+        file->size = size;
+        file->chunkc = count;
+        map->flags = map_file_get16(data+6);
+        map->mapNo = map_file_get32(data+8);
+        map->originPos.X = (int32_t)map_file_get32(data+16);
+        map->originPos.Y = (int32_t)map_file_get32(data+20);
+        map->file = file;
+        map->origin = pok_map_get_chunk(map,&map->originPos);
+        if (map->origin == NULL) {
+            if ( !pok_exception_check() )
+                pok_exception_new_ex(pok_ex_map,pok_ex_map_bad_format);
+            map->file = NULL;
+            pok_file_view_free(view);
+            free(file);
+            return FALSE;
+        }
+        return TRUE;
+    }
+    pok_exception_new_ex(pok_ex_map,pok_ex_map_already);
+    return FALSE;
+}
 static void pok_map_insert_chunk(struct pok_map* map,struct pok_map_chunk* chunk,struct chunk_insert_hint* hint)
 {
 #ifdef POKGAME_DEBUG
@@ -549,7 +1167,7 @@ static void pok_map_insert_chunk(struct pok_map* map,struct pok_map_chunk* chunk
         hint->column = chunk;
         chunk->adjacent[pok_direction_up] = hint->row;
         hint->row = chunk;
-        hint->pos.column = 0;
+        hint->pos.column = 1; /* the new chunk occupies the first column */
         ++hint->pos.row;
     }
     else {
@@ -563,146 +1181,405 @@ static void pok_map_insert_chunk(struct pok_map* map,struct pok_map_chunk* chunk
         ++hint->pos.column;
     }
 }
+/* map_simple_loader: builds a map from rows of tile ids; each row is written straight into the
+   tile planes of the row of chunks it falls in; a row of chunks is created (and linked into the
+   map) when its first tile row arrives; chunk tiles not covered by the tile data keep the
+   default tile id (0) */
+struct map_simple_loader
+{
+    struct pok_map* map;
+    uint32_t columns, rows;
+    struct pok_size area;
+    struct pok_size lefttop;
+    struct chunk_insert_hint hint;
+    struct pok_map_chunk** chunks; /* current row of chunks */
+};
+
+static bool_t map_simple_loader_init(struct map_simple_loader* loader,struct pok_map* map,uint32_t columns,uint32_t rows)
+{
+    struct pok_size rightbottom;
+    if (columns == 0 || rows == 0) {
+        pok_exception_new_ex(pok_ex_map,pok_ex_map_bad_format);
+        return FALSE;
+    }
+    loader->map = map;
+    loader->columns = columns;
+    loader->rows = rows;
+    loader->area = pok_util_compute_chunk_size(columns,rows,POK_MAX_MAP_CHUNK_DIMENSION,&map->chunkSize,&loader->lefttop,&rightbottom);
+    if (loader->lefttop.columns >= map->chunkSize.columns || rightbottom.columns >= map->chunkSize.columns
+        || loader->lefttop.rows >= map->chunkSize.rows || rightbottom.rows >= map->chunkSize.rows) {
+        /* the map is too large to be divided evenly */
+        pok_exception_new_ex(pok_ex_map,pok_ex_map_bad_format);
+        return FALSE;
+    }
+    chunk_insert_hint_init(&loader->hint,loader->area.columns,loader->area.rows);
+    loader->chunks = malloc(sizeof(struct pok_map_chunk*) * loader->area.columns);
+    if (loader->chunks == NULL) {
+        pok_exception_flag_memory_error();
+        return FALSE;
+    }
+    return TRUE;
+}
+static bool_t map_simple_loader_row(void* context,uint32_t rowNo,const uint16_t tiles[])
+{
+    uint16_t j;
+    uint32_t c, column, row;
+    struct map_simple_loader* loader = context;
+    struct pok_map* map = loader->map;
+    row = rowNo + loader->lefttop.rows;
+    if (rowNo == 0 || row % map->chunkSize.rows == 0) {
+        /* create the next row of chunks */
+        for (j = 0;j < loader->area.columns;++j) {
+            struct pok_point position;
+            struct pok_map_chunk* chunk;
+            position.X = j;
+            position.Y = row / map->chunkSize.rows;
+            chunk = pok_map_chunk_new(map,&position);
+            if (chunk == NULL)
+                return FALSE;
+            if (map->origin == NULL)
+                map->origin = chunk;
+            else
+                pok_map_insert_chunk(map,chunk,&loader->hint);
+            loader->chunks[j] = chunk;
+        }
+    }
+    /* copy the row in segments, one for each chunk */
+    row = row % map->chunkSize.rows * map->chunkSize.columns;
+    column = loader->lefttop.columns;
+    for (c = 0,j = 0;c < loader->columns;++j) {
+        uint32_t n = map->chunkSize.columns - column;
+        if (n > loader->columns - c)
+            n = loader->columns - c;
+        memcpy(loader->chunks[j]->tiles + row + column,tiles + c,sizeof(uint16_t) * n);
+        c += n;
+        column = 0;
+    }
+    return TRUE;
+}
+static bool_t map_simple_loader_finish(struct map_simple_loader* loader,bool_t success)
+{
+    /* if the load failed, then remove the chunks that were created */
+    free(loader->chunks);
+    if (!success) {
+        uint32_t i;
+        struct pok_map* map = loader->map;
+        for (i = 0;map->loadedChunks.entries != NULL && i <= map->loadedChunks.mask;++i)
+            if (map->loadedChunks.entries[i].chunk != NULL)
+                pok_map_chunk_free(map->loadedChunks.entries[i].chunk);
+        chunk_index_delete(&map->loadedChunks);
+        chunk_index_init(&map->loadedChunks);
+        map->origin = NULL;
+    }
+    return success;
+}
+
 bool_t pok_map_load_simple(struct pok_map* map,const uint16_t tiledata[],uint32_t columns,uint32_t rows)
 {
     /* load a map based on a rectangular tile configuration */
     if (map->origin == NULL) {
-        uint16_t i, j;
-        struct pok_size mapArea;
-        struct pok_size lefttop, rightbottom;
-        const uint16_t* td[3];
-        struct chunk_insert_hint hint;
-        mapArea = pok_util_compute_chunk_size(columns,rows,POK_MAX_MAP_CHUNK_DIMENSION,&map->chunkSize,&lefttop,&rightbottom);
-        chunk_insert_hint_init(&hint,mapArea.columns,mapArea.rows);
-        td[0] = tiledata;
-        for (i = 0;i < mapArea.rows;++i) {
-            struct pok_size size = {0,0};
-            td[1] = td[0];
-            for (j = 0;j < mapArea.columns;++j) {
-                uint16_t k, l = 0, m, n, o;
-                struct pok_point position;
-                struct pok_map_chunk* chunk;
-                position.X = i;
-                position.Y = j;
-                chunk = pok_map_chunk_new(map,&position);
-                if (chunk == NULL)
-                    return FALSE;
-                td[2] = td[1];
-                m = 0; n = 0; o = 0;
-                /* black out unused rows */
-                size.rows = map->chunkSize.rows;
-                if (i == 0) {
-                    for (;m < lefttop.rows;++m)
-                        for (k = 0;k < map->chunkSize.columns;++k)
-                            pok_tile_init(chunk->data[m]+k,0);
-                    size.rows -= lefttop.rows;
-                }
-                if (i+1 == mapArea.rows) {
-                    for (l = map->chunkSize.rows-rightbottom.rows;l < map->chunkSize.rows;++l)
-                        for (k = 0;k < map->chunkSize.columns;++k)
-                            pok_tile_init(chunk->data[l]+k,0);
-                    size.rows -= rightbottom.rows;
-                }
-                /* black out unused columns */
-                size.columns = map->chunkSize.columns;
-                if (j == 0) {
-                    for (;n < lefttop.columns;++n)
-                        /* we have already blacked-out all the columns in the first 'm' rows */
-                        for (k = m;k < map->chunkSize.rows;++k)
-                            pok_tile_init(chunk->data[k]+n,0);
-                    size.columns -= lefttop.columns;
-                }
-                if (j+1 == mapArea.columns) {
-                    for (o = map->chunkSize.columns-rightbottom.columns;o < map->chunkSize.rows;++o)
-                        /* we have already blacked-out all the columns in the last 'l' rows */
-                        for (k = 0;k < l;++k)
-                            pok_tile_init(chunk->data[k]+o,0);
-                    size.columns -= rightbottom.columns;
-                }
-                o = n;
-                for (k = 0;k < size.rows;++m,++k) {
-                    for (l = 0;l < size.columns;++n,++l)
-                        pok_tile_init(chunk->data[m]+n,td[2][l]);
-                    n = o;
-                    td[2] += columns; /* move to next logical row in tile data */
-                }
-                /* advance to the next chunk in the row of chunks */
-                td[1] += size.columns;
-                /* add the chunk to the graph */
-                if (map->origin == NULL)
-                    map->origin = chunk;
-                else
-                    pok_map_insert_chunk(map,chunk,&hint);
-            }
-            /* advance to the next row of chunks */
-            td[0] += columns * size.rows;
-        }
-        return TRUE;
+        uint32_t i;
+        struct map_simple_loader loader;
+        if ( !map_simple_loader_init(&loader,map,columns,rows) )
+            return FALSE;
+        for (i = 0;i < rows;++i)
+            if ( !map_simple_loader_row(&loader,i,tiledata + (size_t)i * columns) )
+                break;
+        return map_simple_loader_finish(&loader,i == rows);
     }
     pok_exception_new_ex(pok_ex_map,pok_ex_map_already);
     return FALSE;
 }
-bool_t pok_map_fromfile_space(struct pok_map* map,const char* filename)
+static bool_t pok_map_fromfile_simple(struct pok_map* map,const char* filename,char separator,bool_t exact)
 {
-    /* load space-separated tile data */
-    if (map->origin == NULL) {
-        bool_t result;
-        struct pok_parser_info info;
-        pok_parser_info_init(&info);
-        info.dsrc = pok_data_source_new_file(filename,pok_filemode_open_existing,pok_iomode_read);
-        if (info.dsrc == NULL)
-            return FALSE;
-        info.separator = ' ';
-        result = pok_parse_map_simple(&info);
-        if (result) {
-            if (info.qwords[0] == 0 || info.qwords[1] == 0 || info.words_c[0] < info.qwords[0] * info.qwords[1]) {
-                pok_exception_new_ex(pok_ex_map,pok_ex_map_bad_format);
-                result = FALSE;
-            }
-            else
-                result = pok_map_load_simple(map,info.words,info.qwords[0],info.qwords[1]);
+    /* stream the rows of a simple map file into the map's chunks; if 'exact' then the file must
+       have exactly as many tile ids as the map (otherwise extra ids are ignored) */
+    bool_t result = FALSE;
+    struct pok_parser_info info;
+    struct map_simple_loader loader;
+    pok_parser_info_init(&info);
+    info.dsrc = pok_data_source_new_file(filename,pok_filemode_open_existing,pok_iomode_read);
+    if (info.dsrc == NULL)
+        return FALSE;
+    info.separator = separator;
+    if (pok_parse_map_simple_header(&info) && map_simple_loader_init(&loader,map,info.qwords[0],info.qwords[1])) {
+        uint64_t count = (uint64_t)loader.columns * loader.rows;
+        result = pok_parse_map_simple_rows(&info,loader.columns,loader.rows,map_simple_loader_row,&loader);
+        if (result && ((uint64_t)info.number < count || (exact && (uint64_t)info.number != count))) {
+            pok_exception_new_ex(pok_ex_map,pok_ex_map_bad_format);
+            result = FALSE;
         }
-        pok_data_source_free(info.dsrc);
-        pok_parser_info_delete(&info);
-        return result;
+        map_simple_loader_finish(&loader,result);
     }
+    pok_data_source_free(info.dsrc);
+    pok_parser_info_delete(&info);
+    return result;
+}
+bool_t pok_map_fromfile_space(struct pok_map* map,const char* filename)
+{
+    /* load space-separated tile data */
+    if (map->origin == NULL)
+        return pok_map_fromfile_simple(map,filename,' ',FALSE);
     pok_exception_new_ex(pok_ex_map,pok_ex_map_already);
     return FALSE;
 }
 bool_t pok_map_fromfile_csv(struct pok_map* map,const char* filename)
 {
     /* load comma-separated tile data */
-    if (map->origin == NULL) {
-        bool_t result;
-        struct pok_parser_info info;
-        pok_parser_info_init(&info);
-        info.dsrc = pok_data_source_new_file(filename,pok_filemode_open_existing,pok_iomode_read);
-        if (info.dsrc == NULL)
-            return FALSE;
-        info.separator = ',';
-        result = pok_parse_map_simple(&info);
-        if (result) {
-            if (info.qwords[0] == 0 || info.qwords[1] == 0 || info.words_c[0] != info.qwords[0] * info.qwords[1]) {
-                pok_exception_new_ex(pok_ex_map,pok_ex_map_bad_format);
-                result = FALSE;
+    if (map->origin == NULL)
+        return pok_map_fromfile_simple(map,filename,',',TRUE);
+    pok_exception_new_ex(pok_ex_map,pok_ex_map_already);
+    return FALSE;
+}
+static struct pok_map_chunk* pok_map_fault_chunk(struct pok_map* map,uint32_t slot)
+{
+    /* load the chunk in the specified directory slot from the map's file; the chunk's tile
+       planes are used in place if possible; the chunk is linked with its loaded neighbors */
+    uint32_t i;
+    uint16_t warpc;
+    size_t planeSize, planeOffset, warpOffset;
+    struct pok_point pos;
+    struct pok_map_chunk* chunk;
+    struct pok_map_chunk_warp* warps = NULL;
+    struct pok_map_file* file = map->file;
+    const byte_t* entry = file->data + MAP_FILE_HEADER_SIZE + (size_t)slot * MAP_FILE_ENTRY_SIZE;
+    pos.X = (int32_t)map_file_get32(entry);
+    pos.Y = (int32_t)map_file_get32(entry+4);
+    planeOffset = map_file_get32(entry+8);
+    warpOffset = map_file_get32(entry+12);
+    warpc = map_file_get16(entry+16);
+    planeSize = map_file_plane_size(&map->chunkSize);
+    if (planeOffset % 8 != 0 || planeOffset > file->size || planeSize > file->size - planeOffset
+        || warpOffset > file->size || (size_t)warpc * MAP_FILE_WARP_SIZE > file->size - warpOffset) {
+        pok_exception_new_ex(pok_ex_map,pok_ex_map_bad_format);
+        return NULL;
+    }
+    /* decode the warp table first so that the chunk does not have to be removed from the
+       map if this fails */
+    if (warpc > 0) {
+        warps = malloc(sizeof(struct pok_map_chunk_warp) * warpc);
+        if (warps == NULL) {
+            pok_exception_flag_memory_error();
+            return NULL;
+        }
+        for (i = 0;i < warpc;++i) {
+            const byte_t* w = file->data + warpOffset + i * MAP_FILE_WARP_SIZE;
+            warps[i].index = map_file_get32(w);
+            warps[i].data.tileid = 0;
+            warps[i].data.warpMap = map_file_get32(w+4);
+            warps[i].data.warpChunk.X = (int32_t)map_file_get32(w+8);
+            warps[i].data.warpChunk.Y = (int32_t)map_file_get32(w+12);
+            warps[i].data.warpLocation.column = map_file_get16(w+16);
+            warps[i].data.warpLocation.row = map_file_get16(w+18);
+            warps[i].data.warpKind = w[20];
+        }
+    }
+    if ( map_file_native_planes() )
+        chunk = pok_map_chunk_new_ex(map,&pos,(byte_t*)file->data + planeOffset);
+    else {
+        /* decode the tile ids into the chunk's own planes; the bitplanes are byte arrays */
+        size_t ntiles = (size_t)map->chunkSize.columns * map->chunkSize.rows;
+        chunk = pok_map_chunk_new(map,&pos);
+        if (chunk != NULL) {
+            for (i = 0;i < ntiles;++i)
+                chunk->tiles[i] = map_file_get16(file->data + planeOffset + i*2);
+            memcpy(chunk->impass,file->data + planeOffset + ntiles*2,(ntiles + 7) / 8 * 2);
+        }
+    }
+    if (chunk == NULL) {
+        free(warps);
+        return NULL;
+    }
+    chunk->warps = warps;
+    chunk->warpc = chunk->warpAlloc = warpc;
+    chunk->flags |= pok_map_chunk_flag_file;
+    pok_map_chunk_configure_adj(chunk,&pos,map);
+    return chunk;
+}
+static bool_t pok_map_fault_all(struct pok_map* map)
+{
+    /* load every chunk that has not been loaded from the map's file */
+    uint32_t i;
+    if (map->file != NULL) {
+        for (i = 0;i < map->file->chunkc;++i) {
+            struct pok_point pos;
+            const byte_t* entry = map->file->data + MAP_FILE_HEADER_SIZE + (size_t)i * MAP_FILE_ENTRY_SIZE;
+            pos.X = (int32_t)map_file_get32(entry);
+            pos.Y = (int32_t)map_file_get32(entry+4);
+            if (chunk_index_lookup(&map->loadedChunks,&pos) == NULL && pok_map_fault_chunk(map,i) == NULL)
+                return FALSE;
+        }
+    }
+    return TRUE;
+}
+struct pok_map_chunk* pok_map_get_chunk(struct pok_map* map,const struct pok_point* pos)
+{
+    /* lookup the chunk at the specified position; if the map is backed by a map file then a
+       chunk that has not been loaded yet is loaded from the file (so this modifies the map); if
+       the chunk was evicted and is not in the map file, then it is requested again (the request
+       may supply the chunk immediately) */
+    struct pok_map_chunk* chunk;
+    chunk = chunk_index_lookup(&map->loadedChunks,pos);
+    if (chunk == NULL) {
+        if (map->file != NULL) {
+            long slot = map_file_find(map->file,pos);
+            if (slot >= 0)
+                chunk = pok_map_fault_chunk(map,(uint32_t)slot);
+        }
+        if (chunk == NULL && map->residency.request != NULL && map->residency.evicted.count > 0
+            && chunk_index_remove(&map->residency.evicted,pos) != NULL) {
+            map->residency.request(map,pos,map->residency.requestContext);
+            chunk = chunk_index_lookup(&map->loadedChunks,pos);
+        }
+        if (chunk == NULL)
+            return NULL;
+    }
+    chunk->flags |= pok_map_chunk_flag_referenced;
+    return chunk;
+}
+struct pok_map_chunk* pok_map_lookup_chunk(const struct pok_map* map,const struct pok_point* pos)
+{
+    /* lookup a chunk only if it is loaded; unlike 'pok_map_get_chunk' this never modifies the map
+       so it may be called by more than one reader at a time */
+    return chunk_index_lookup(&map->loadedChunks,pos);
+}
+void pok_map_focus(struct pok_map* map,const struct pok_point* pos,struct pok_map_prefetch_stats* stats)
+{
+    /* set the chunk position that the map is viewed from: the chunks around it are loaded (so
+       they are reachable through chunk adjacencies) and pinned; then chunks are evicted if the map
+       is over its budget; the pinned area is larger than the 3x3 area of a render context so that
+       the chunks in a render snapshot taken before the context moved to a new chunk stay valid; if
+       'stats' is specified, then it counts the chunks that were (or were not) already loaded */
+    int i, j;
+    map->residency.focused = TRUE;
+    map->residency.focus = *pos;
+    if (map->file != NULL || map->residency.evicted.count > 0) {
+        for (i = -1;i <= 1;++i) {
+            for (j = -1;j <= 1;++j) {
+                bool_t evicted;
+                struct pok_point pt;
+                pt.X = pos->X + i;
+                pt.Y = pos->Y + j;
+                if (chunk_index_lookup(&map->loadedChunks,&pt) != NULL) {
+                    if (stats != NULL)
+                        ++stats->hits;
+                    continue;
+                }
+                /* a miss is a chunk that exists but had to be loaded (or requested) just now */
+                evicted = chunk_index_lookup(&map->residency.evicted,&pt) != NULL;
+                if (pok_map_get_chunk(map,&pt) != NULL || evicted) {
+                    if (stats != NULL)
+                        ++stats->misses;
+                }
             }
-            else
-                result = pok_map_load_simple(map,info.words,info.qwords[0],info.qwords[1]);
         }
-        pok_data_source_free(info.dsrc);
-        pok_parser_info_delete(&info);
-        return result;
     }
-    pok_exception_new_ex(pok_ex_map,pok_ex_map_already);
+    if (map->residency.budget > 0)
+        pok_map_trim(map);
+}
+bool_t pok_map_prefetch(struct pok_map* map,const struct pok_point* pos,bool_t load)
+{
+    /* prepare the chunk at the specified position ahead of its use: if 'load' is set then a chunk
+       from the map file is loaded now, otherwise the system is only asked to start reading the
+       chunk's part of the map file in the background; an evicted chunk is requested again through
+       the residency callback (whoever installed it answers the request later); TRUE is returned if
+       anything was done */
+    long slot;
+    if (chunk_index_lookup(&map->loadedChunks,pos) != NULL)
+        return FALSE;
+    if (map->file != NULL && (slot = map_file_find(map->file,pos)) >= 0) {
+        const byte_t* entry = map->file->data + MAP_FILE_HEADER_SIZE + (size_t)slot * MAP_FILE_ENTRY_SIZE;
+        if (load)
+            return pok_map_fault_chunk(map,(uint32_t)slot) != NULL;
+        pok_file_view_prefetch(map->file->view,map_file_get32(entry+8),map_file_plane_size(&map->chunkSize));
+        if (map_file_get16(entry+16) > 0)
+            pok_file_view_prefetch(map->file->view,map_file_get32(entry+12),(size_t)map_file_get16(entry+16) * MAP_FILE_WARP_SIZE);
+        return TRUE;
+    }
+    if (map->residency.evicted.count > 0 && chunk_index_lookup(&map->residency.evicted,pos) != NULL) {
+        pok_map_get_chunk(map,pos);
+        return TRUE;
+    }
     return FALSE;
 }
-struct pok_map_chunk* pok_map_get_chunk(const struct pok_map* map,const struct pok_point* pos)
+void pok_map_set_budget(struct pok_map* map,size_t budget,pok_map_chunk_request request,void* context)
 {
-    struct chunk_key* key;
-    key = treemap_lookup((struct treemap*)&map->loadedChunks,pos);
-    if (key == NULL)
-        return NULL;
-    return key->chunk;
+    /* set the maximum number of bytes used by the map's chunks (zero means no limit); chunks
+       that are not in the map file are only evicted if 'request' is specified; if 'request' is
+       not specified then chunks that were evicted before can no longer be requested */
+    if (request == NULL)
+        chunk_index_delete(&map->residency.evicted);
+    map->residency.budget = budget;
+    map->residency.request = request;
+    map->residency.requestContext = context;
+    if (budget > 0)
+        pok_map_trim(map);
+}
+static bool_t pok_map_evictable(const struct pok_map* map,const struct pok_map_chunk_index_entry* entry)
+{
+    const struct pok_map_chunk* chunk = entry->chunk;
+    if (chunk == map->origin)
+        return FALSE;
+    if (map->residency.focused && abs(entry->pos.X - map->residency.focus.X) <= POK_MAP_FOCUS_RADIUS
+        && abs(entry->pos.Y - map->residency.focus.Y) <= POK_MAP_FOCUS_RADIUS)
+        return FALSE;
+    /* the chunk must be restorable */
+    if (chunk->flags & pok_map_chunk_flag_file)
+        return !(chunk->flags & pok_map_chunk_flag_warps_changed);
+    return map->residency.request != NULL;
+}
+static bool_t pok_map_evict(struct pok_map* map,struct pok_point pos)
+{
+    /* evict the chunk at the specified position; 'pos' is copied since the index entry it came
+       from is overwritten */
+    int dir;
+    struct pok_map_chunk* chunk;
+    chunk = chunk_index_lookup(&map->loadedChunks,&pos);
+    if (!(chunk->flags & pok_map_chunk_flag_file) && chunk_index_lookup(&map->residency.evicted,&pos) == NULL
+        && !chunk_index_insert(&map->residency.evicted,&pos,(struct pok_map_chunk*)map)) /* the chunk pointer is unused */
+        return FALSE;
+    chunk_index_remove(&map->loadedChunks,&pos);
+    if ((chunk->flags & pok_map_chunk_flag_file) && !(chunk->flags & pok_map_chunk_flag_mapped)) {
+        /* the chunk's planes were decoded from the map file; encode them back into the file view
+           (which is private) so that changes are kept when the chunk is loaded again */
+        uint32_t i;
+        size_t ntiles = (size_t)chunk->columns * chunk->rows;
+        byte_t* planes = (byte_t*)map->file->data
+            + map_file_get32(map->file->data + MAP_FILE_HEADER_SIZE + map_file_find(map->file,&pos) * MAP_FILE_ENTRY_SIZE + 8);
+        for (i = 0;i < ntiles;++i)
+            map_file_put16(planes + i*2,chunk->tiles[i]);
+        memcpy(planes + ntiles*2,chunk->impass,(ntiles + 7) / 8 * 2);
+    }
+    for (dir = pok_direction_up;dir <= pok_direction_right;++dir)
+        if (chunk->adjacent[dir] != NULL)
+            chunk->adjacent[dir]->adjacent[pok_direction_opposite(dir)] = NULL;
+    /* this removes the chunk from the network object registry */
+    pok_map_chunk_free(chunk);
+    return TRUE;
+}
+void pok_map_trim(struct pok_map* map)
+{
+    /* evict chunks until the map is within its budget; the clock hand sweeps the chunk index at
+       most twice (once to clear reference bits and once to evict) so this stops if too few
+       chunks can be evicted */
+    uint32_t limit, scanned, capacity;
+    struct pok_map_chunk_index* index = &map->loadedChunks;
+    if (map->residency.budget == 0 || index->entries == NULL)
+        return;
+    limit = (uint32_t)(map->residency.budget / (sizeof(struct pok_map_chunk) + map_file_plane_size(&map->chunkSize)));
+    capacity = index->mask + 1;
+    map->residency.hand &= index->mask;
+    for (scanned = 0;index->count > limit && scanned < capacity * 2;++scanned) {
+        struct pok_map_chunk_index_entry* entry = index->entries + map->residency.hand;
+        if (entry->chunk != NULL && pok_map_evictable(map,entry)) {
+            if (entry->chunk->flags & pok_map_chunk_flag_referenced)
+                entry->chunk->flags &= ~pok_map_chunk_flag_referenced;
+            else if ( pok_map_evict(map,entry->pos) )
+                /* another entry may have been shifted into this slot */
+                continue;
+        }
+        map->residency.hand = (map->residency.hand + 1) & index->mask;
+    }
 }
 static bool_t pok_map_configure_adj(struct pok_map* map,struct chunk_adj_info* info)
 {
@@ -712,7 +1589,7 @@ static bool_t pok_map_configure_adj(struct pok_map* map,struct chunk_adj_info* i
     /* set origin chunk */
     map->origin = info->c[0];
     info->p[0] = map->originPos;
-    if ( !chunk_key_create(map,map->origin,&map->originPos) )
+    if ( !chunk_index_insert(&map->loadedChunks,&map->originPos,map->origin) )
         return FALSE;
     /* setup adjacencies */
     for (i = 0,j = 1;i < info->n;++i) {
@@ -741,7 +1618,7 @@ static bool_t pok_map_configure_adj(struct pok_map* map,struct chunk_adj_info* i
                     if (chunk != NULL) {
                         /* two chunks have been specified in the same place (peer made an error); delete the unassigned
                            chunk and continue (we want to handle this gracefully) */
-                        pok_map_chunk_free(info->c[j++],map->chunkSize.rows);
+                        pok_map_chunk_free(info->c[j++]);
                         continue;
                     }
                     /* compute chunk position */
@@ -756,8 +1633,8 @@ static bool_t pok_map_configure_adj(struct pok_map* map,struct chunk_adj_info* i
                         ++pos.X;
                     info->p[j] = pos; /* save position for later */
                     chunk = info->c[j++];
-                    /* add the new chunk to the map's treemap */
-                    if ( !chunk_key_create(map,chunk,&pos) )
+                    /* add the new chunk to the map's index */
+                    if ( !chunk_index_insert(&map->loadedChunks,&pos,chunk) )
                         return FALSE;
                 }
                 else if (chunk == NULL) {
@@ -985,14 +1862,19 @@ bool_t pok_world_fromfile_warps(struct pok_world* world,const char* filename)
                     struct pok_map_chunk* chunk;
                     if ((chunk = pok_map_get_chunk(map,&chunkpos)) != NULL) {
                         if (relpos.column < map->chunkSize.columns && relpos.row < map->chunkSize.rows) {
-                            struct pok_tile_data* data;
-                            data = &chunk->data[relpos.row][relpos.column].data;
-                            data->warpKind = parser.bytes[i];
-                            data->warpMap = parser.qwords[j+1];
-                            data->warpChunk.X = parser.qwords[j+4];
-                            data->warpChunk.Y = parser.qwords[j+5];
-                            data->warpLocation.column = parser.qwords[j+8];
-                            data->warpLocation.row = parser.qwords[j+9];
+                            struct pok_tile_data data;
+                            data.tileid = 0;
+                            data.warpKind = parser.bytes[i];
+                            data.warpMap = parser.qwords[j+1];
+                            data.warpChunk.X = parser.qwords[j+4];
+                            data.warpChunk.Y = parser.qwords[j+5];
+                            data.warpLocation.column = parser.qwords[j+8];
+                            data.warpLocation.row = parser.qwords[j+9];
+                            if ( !chunk_set_warp(chunk,relpos.column,relpos.row,&data) ) {
+                                result = FALSE;
+                                break;
+                            }
+                            chunk_revise(chunk);
                         }
                     }
                 }
@@ -15,23 +15,56 @@ enum pok_ex_map
     pok_ex_map_already, /* map object was already loaded */
     pok_ex_map_not_loaded, /* map object was not loaded so the operation could not complete */
     pok_ex_map_bad_format, /* map information was not formatted correctly */
-    pok_ex_map_non_unique_chunk /* a new chunk was created at an already specified location */
+    pok_ex_map_non_unique_chunk, /* a new chunk was created at an already specified location */
+    pok_ex_map_no_chunk /* the specified location did not refer to a chunk that could be used in the operation */
 };
 
-/* pok_map_chunk: a map chunk is a mxn 2d array of pok_tile structures; it
-   forms the basic building block of any map; most trivial statically
-   sized maps will consist of only a single map chunk; a map chunk is
-   a dynamic network object */
+/* pok_map_chunk: a map chunk is a mxn 2d array of tiles; it forms the basic building
+   block of any map; most trivial statically sized maps will consist of only a single
+   map chunk; a map chunk is a dynamic network object; the tile information is not stored
+   as an array of 'pok_tile' structures: the chunk and its tile planes occupy a single
+   allocation made up of a dense plane of tile ids (stored in row-major order) and two
+   passability bitplanes; since most tiles do not warp, warp information is kept in a
+   small side table sorted by tile index; use the accessor functions to get at the tiles */
+struct pok_map_chunk_warp
+{
+    uint32_t index; /* row * columns + column */
+    struct pok_tile_data data; /* warp information ('data.tileid' is not used) */
+};
 struct pok_map_chunk
 {
     struct pok_netobj _base;
 
-    struct pok_tile** data; /* data stored in [row][column] order */
+    uint16_t columns, rows; /* dimensions of chunk (same as map's chunk size) */
+    uint16_t* tiles; /* tile id plane: [row * columns + column] */
+    byte_t* impass; /* bitplane: if bit set, then otherwise passable tile is impassable */
+    byte_t* pass; /* bitplane: if bit set, then otherwise impassable tile is passable */
+    uint16_t warpc, warpAlloc; /* warp side table */
+    struct pok_map_chunk_warp* warps;
+
     struct pok_map_chunk* adjacent[4]; /* chunks adjacent to this chunk; index by pok_direction flag */
 
     uint8_t flags; /* enum pok_map_chunk_flags */
     bool_t discov; /* (reserved) */
+
+    /* revision stamp: unique among all chunks ever created; it is renewed whenever the
+       chunk's tiles are changed (by the tile setters or an update method) so that caches
+       of the chunk's tiles (e.g. a renderer's baked layers) can tell when they are stale */
+    uint32_t revision;
 };
+static inline uint16_t pok_map_chunk_get_tileid(const struct pok_map_chunk* chunk,uint16_t column,uint16_t row)
+{ return chunk->tiles[(uint32_t)row * chunk->columns + column]; }
+static inline bool_t pok_map_chunk_get_impass(const struct pok_map_chunk* chunk,uint16_t column,uint16_t row)
+{ uint32_t i = (uint32_t)row * chunk->columns + column; return (chunk->impass[i >> 3] >> (i & 7)) & 1; }
+static inline bool_t pok_map_chunk_get_pass(const struct pok_map_chunk* chunk,uint16_t column,uint16_t row)
+{ uint32_t i = (uint32_t)row * chunk->columns + column; return (chunk->pass[i >> 3] >> (i & 7)) & 1; }
+void pok_map_chunk_set_tileid(struct pok_map_chunk* chunk,uint16_t column,uint16_t row,uint16_t tileid);
+void pok_map_chunk_set_passability(struct pok_map_chunk* chunk,uint16_t column,uint16_t row,bool_t impass,bool_t pass);
+struct pok_tile_data* pok_map_chunk_get_warp(const struct pok_map_chunk* chunk,uint16_t column,uint16_t row);
+bool_t pok_map_chunk_set_warp(struct pok_map_chunk* chunk,uint16_t column,uint16_t row,const struct pok_tile_data* warp);
+void pok_map_chunk_get_tile(const struct pok_map_chunk* chunk,uint16_t column,uint16_t row,struct pok_tile* tile);
+bool_t pok_map_chunk_set_tile(struct pok_map_chunk* chunk,uint16_t column,uint16_t row,const struct pok_tile* tile);
+void pok_map_chunk_revise(struct pok_map_chunk* chunk);
 enum pok_network_result pok_map_chunk_netmethod_send(struct pok_map_chunk* chunk,
     struct pok_data_source* dsrc,
     struct pok_netobj_writeinfo* winfo,
@@ -41,9 +74,59 @@ enum pok_network_result pok_map_chunk_netmethod_recv(struct pok_map_chunk* chunk
     struct pok_netobj_readinfo* info,
     enum pok_map_chunk_method method);
 
+/* pok_map_chunk_index: maps chunk positions to chunks; this is an open-addressing hash table
+   (with linear probing) keyed on the packed position so lookups do not allocate or compare
+   through a callback; empty slots have a NULL chunk */
+struct pok_map_chunk_index_entry
+{
+    struct pok_point pos;
+    struct pok_map_chunk* chunk;
+};
+struct pok_map_chunk_index
+{
+    uint32_t count; /* number of chunks in the index */
+    uint32_t mask; /* capacity - 1 (capacity is a power of 2) */
+    struct pok_map_chunk_index_entry* entries;
+};
+
+/* pok_map_residency: limits the amount of memory used by a map's chunks; when a map is over
+   its budget, chunks are evicted using the clock algorithm (a chunk that was looked up since the
+   clock hand last passed it is skipped once); chunks near the map's focus (the chunk position
+   of the render context) and the origin chunk are never evicted; a chunk is only evicted if it
+   can be restored: chunks from a map file are loaded again from the file and other chunks are
+   requested again through the 'request' callback (if there is no callback, they are kept); the
+   engine does not install a callback (the protocol has no way yet for an engine to request a
+   chunk from its version) so the chunks of dynamic maps are never evicted or requested */
+struct pok_map;
+typedef void (*pok_map_chunk_request)(struct pok_map* map,const struct pok_point* pos,void* context);
+struct pok_map_residency
+{
+    size_t budget; /* bytes of chunk memory; if zero then chunks are never evicted */
+    uint32_t hand; /* clock hand (a slot in the chunk index) */
+    bool_t focused;
+    struct pok_point focus; /* chunks within 'POK_MAP_FOCUS_RADIUS' of this position are pinned */
+    pok_map_chunk_request request; /* called when an evicted chunk (not from a map file) is looked up */
+    void* requestContext;
+    struct pok_map_chunk_index evicted; /* positions of evicted chunks that can be requested again */
+};
+#define POK_MAP_FOCUS_RADIUS 2
+
+/* pok_map_prefetch_stats: measures how well chunks are prepared ahead of the render context; a
+   hit is a chunk that was already loaded when the map was focused next to it and a miss is one
+   that had to be loaded (or requested) at that moment, which may stall the update procedure */
+struct pok_map_prefetch_stats
+{
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t requests; /* chunks prefetched (loaded, requested or read ahead) */
+};
+
 /* pok_map: a map is a grid of map chunks; each map chunk is sized the same; maps are
    linked together by their tile warp structures; this ultimately forms a graph-like
-   structure; a map is a dynamic network object */
+   structure; a map is a dynamic network object; a map may be backed by an indexed map
+   file (see 'pok_map_open_indexed'): the file is memory-mapped and chunks are loaded
+   from it the first time they are looked up */
+struct pok_map_file;
 struct pok_map
 {
     struct pok_netobj _base;
@@ -53,9 +136,12 @@ struct pok_map
     struct pok_map_chunk* origin; /* original chunk */
     struct pok_size chunkSize; /* dimensions of chunks */
 
-    struct treemap loadedChunks; /* maps chunk position to chunk for fast lookup */
+    struct pok_map_chunk_index loadedChunks; /* maps chunk position to chunk for fast lookup */
     struct pok_point originPos; /* position of original chunk */
     uint16_t flags; /* enum pok_map_flags */
+
+    struct pok_map_file* file; /* if non-NULL, chunks not yet loaded are faulted in from this file */
+    struct pok_map_residency residency;
 };
 struct pok_map* pok_map_new();
 void pok_map_free(struct pok_map* map);
@@ -67,12 +153,20 @@ struct pok_map_chunk* pok_map_add_chunk(struct pok_map* map,
     enum pok_direction direction,
     const uint16_t chunkTiles[],
     uint32_t length);
+bool_t pok_map_remove_chunk(struct pok_map* map,const struct pok_point* pos);
 bool_t pok_map_save(struct pok_map* map,struct pok_data_source* dsrc,bool_t complex);
 bool_t pok_map_open(struct pok_map* map,struct pok_data_source* dsrc);
+bool_t pok_map_save_indexed(struct pok_map* map,struct pok_data_source* dsrc);
+bool_t pok_map_open_indexed(struct pok_map* map,const char* filename);
 bool_t pok_map_load_simple(struct pok_map* map,const uint16_t tiledata[],uint32_t columns,uint32_t rows);
 bool_t pok_map_fromfile_space(struct pok_map* map,const char* filename);
 bool_t pok_map_fromfile_csv(struct pok_map* map,const char* filename);
-struct pok_map_chunk* pok_map_get_chunk(const struct pok_map* map,const struct pok_point* pos);
+struct pok_map_chunk* pok_map_get_chunk(struct pok_map* map,const struct pok_point* pos);
+struct pok_map_chunk* pok_map_lookup_chunk(const struct pok_map* map,const struct pok_point* pos);
+void pok_map_focus(struct pok_map* map,const struct pok_point* pos,struct pok_map_prefetch_stats* stats);
+bool_t pok_map_prefetch(struct pok_map* map,const struct pok_point* pos,bool_t load);
+void pok_map_set_budget(struct pok_map* map,size_t budget,pok_map_chunk_request request,void* context);
+void pok_map_trim(struct pok_map* map);
 enum pok_network_result pok_map_netwrite(struct pok_map* map,
     struct pok_data_source* dsrc,
     struct pok_netobj_writeinfo* info);
@@ -401,7 +401,7 @@ static void strip_leading_spaces(struct pok_text_context* text)
             ++i;
         if (i > 0) {
             /* shift the line down to delete the leading whitespace */
-            strcpy(text->lines[line],text->lines[line] + i);
+            memmove(text->lines[line],text->lines[line] + i,strlen(text->lines[line] + i) + 1);
             memmove(cbuf,cbuf + i,text->colorbuf+text->coloralloc - cbuf - i);
         }
         cbuf += strlen(text->lines[line]);
@@ -2,7 +2,10 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 #include <signal.h>
 #ifdef __APPLE__
@@ -10,9 +13,18 @@
 #else
 #include <wait.h>
 #endif
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#else
+#include <poll.h>
+#include <time.h>
+#endif
 #include <pthread.h>
 #include <errno.h>
 #include <ctype.h>
+#include <zlib.h>
 
 /* pok_network_address */
 
@@ -26,9 +38,35 @@ enum pok_data_source_mode_flag
     DS_MODE_BUFFER_OUTPUT = 0x1 << 0x3,
     DS_MODE_IS_SOCKET = 0x1 << 0x4,
     DS_MODE_USING_STD_FILENO = 0x1 << 0x5,
+    DS_MODE_MEMORY = 0x1 << 0x6,
     DS_MODE_REACH_EOF = 0x1 << 0x7
 };
 
+/* buffer sizes: each buffer starts out in storage inside the data source and grows (by powers of
+   two) when a single request needs more room; requests beyond the largest size are capped; the
+   sizes must be powers of two */
+#define DS_BUFFER_INITIAL 4096
+#define DS_BUFFER_MAX (1 << 20)
+
+/* ring buffer: 'size' bytes starting at 'head' (wrapping around at 'cap') */
+struct ds_ring
+{
+    byte_t* buf;
+    size_t cap, head, size;
+};
+
+/* compression layer: sits between the data source's buffers and its device (see 'pok_data_source_compress');
+   its buffers hold compressed bytes and never wrap ('head' + 'size' <= 'cap') so that zlib can use them */
+#define DS_ZBUFFER_INITIAL 16384
+struct ds_zstream
+{
+    bool_t deflating, inflating;
+    z_stream deflater, inflater;
+    bool_t inflatePending;  /* the last inflate filled its output (so it may have more without more input) */
+    struct ds_ring out;     /* deflated bytes that have not been written to the device */
+    struct ds_ring in;      /* bytes read from the device that have not been inflated */
+};
+
 struct pok_data_source
 {
     /* mode:
@@ -36,7 +74,8 @@ struct pok_data_source
        bit 2: if 1, then device uses two descriptors
        bit 3: if 1, then write output is buffered until flush or buffer full
        bit 4: if 1, then fd[0] is a socket descriptor
-
+       bit 5: if 1, then the descriptors are the standard input and output
+       bit 6: if 1, then the device is memory (the output buffer keeps everything written)
        bit 7: if 1, then fd[0] has reached EOF */
     byte_t mode;
     
@@ -44,22 +83,33 @@ struct pok_data_source
     int fd[2];
 
     /* internal buffer to store read data for caller */
-    size_t szRead, itRead;
-    byte_t bufferRead[4096];
+    struct ds_ring in;
+    byte_t initRead[DS_BUFFER_INITIAL];
 
     /* internal buffer to store write data for caller */
-    size_t szWrite, itWrite;
-    byte_t bufferWrite[4096];
+    struct ds_ring out;
+    byte_t initWrite[DS_BUFFER_INITIAL];
+
+    /* compression layer; NULL unless 'pok_data_source_compress' was called */
+    struct ds_zstream* zstream;
+
+    struct pok_data_source_stats stats;
 };
 
 static void pok_data_source_init(struct pok_data_source* dsrc,enum pok_iomode iomode)
 {
     /* turn on output buffering by default */
     dsrc->mode |= (byte_t)(iomode & 0x3) | DS_MODE_BUFFER_OUTPUT;
-    dsrc->szRead = 0;
-    dsrc->itRead = 0;
-    dsrc->szWrite = 0;
-    dsrc->itWrite = 0;
+    dsrc->in.buf = dsrc->initRead;
+    dsrc->in.cap = DS_BUFFER_INITIAL;
+    dsrc->in.head = 0;
+    dsrc->in.size = 0;
+    dsrc->out.buf = dsrc->initWrite;
+    dsrc->out.cap = DS_BUFFER_INITIAL;
+    dsrc->out.head = 0;
+    dsrc->out.size = 0;
+    dsrc->zstream = NULL;
+    memset(&dsrc->stats,0,sizeof(struct pok_data_source_stats));
 }
 struct pok_data_source* pok_data_source_new_standard()
 {
@@ -68,8 +118,8 @@ struct pok_data_source* pok_data_source_new_standard()
         pok_exception_flag_memory_error();
         return NULL;
     }
-    dsrc->fd[0] = STDOUT_FILENO;
-    dsrc->fd[1] = STDIN_FILENO;
+    dsrc->fd[0] = STDIN_FILENO;
+    dsrc->fd[1] = STDOUT_FILENO;
     dsrc->mode = DS_MODE_FD_BOTH | DS_MODE_USING_STD_FILENO;
     pok_data_source_init(dsrc,pok_iomode_full_duplex);
     return dsrc;
@@ -92,7 +142,8 @@ struct pok_data_source* pok_data_source_new_local_named(const char* name)
     addr.sun_family = AF_UNIX;
     strncpy(addr.sun_path,name,sizeof(addr.sun_path));
     if (connect(dsrc->fd[0],(const struct sockaddr*)&addr,sizeof(struct sockaddr_un)) == -1) {
-
+        pok_exception_new_ex(pok_ex_net,pok_ex_net_could_not_create_named_local);
+        close(dsrc->fd[0]);
         free(dsrc);
         return NULL;
     }
@@ -181,274 +232,611 @@ struct pok_data_source* pok_data_source_new_file(const char* filename,enum pok_f
     pok_data_source_init(dsrc,access);
     return dsrc;
 }
+struct pok_data_source* pok_data_source_new_memory()
+{
+    struct pok_data_source* dsrc = malloc(sizeof(struct pok_data_source));
+    if (dsrc == NULL) {
+        pok_exception_flag_memory_error();
+        return NULL;
+    }
+    dsrc->fd[0] = -1;
+    dsrc->mode = DS_MODE_MEMORY;
+    pok_data_source_init(dsrc,pok_iomode_write);
+    return dsrc;
+}
+/* ring buffer operations */
+static int ds_ring_data(const struct ds_ring* ring,struct iovec iov[2])
+{
+    /* describe the bytes in the ring as (at most) two segments; return the number of segments */
+    size_t first;
+    if (ring->size == 0)
+        return 0;
+    first = ring->cap - ring->head;
+    iov[0].iov_base = ring->buf + ring->head;
+    if (ring->size <= first) {
+        iov[0].iov_len = ring->size;
+        return 1;
+    }
+    iov[0].iov_len = first;
+    iov[1].iov_base = ring->buf;
+    iov[1].iov_len = ring->size - first;
+    return 2;
+}
+static int ds_ring_space(const struct ds_ring* ring,struct iovec iov[2])
+{
+    /* describe the free space that follows the bytes in the ring as (at most) two segments */
+    size_t tail, room;
+    room = ring->cap - ring->size;
+    if (room == 0)
+        return 0;
+    tail = (ring->head + ring->size) & (ring->cap - 1);
+    iov[0].iov_base = ring->buf + tail;
+    if (tail + room <= ring->cap) {
+        iov[0].iov_len = room;
+        return 1;
+    }
+    iov[0].iov_len = ring->cap - tail;
+    iov[1].iov_base = ring->buf;
+    iov[1].iov_len = room - iov[0].iov_len;
+    return 2;
+}
+static inline void ds_ring_consume(struct ds_ring* ring,size_t n)
+{
+    ring->head = (ring->head + n) & (ring->cap - 1);
+    ring->size -= n;
+}
+static void ds_ring_copy_out(const struct ds_ring* ring,byte_t* dst,size_t n)
+{
+    /* copy the first 'n' bytes (which must exist) out of the ring */
+    size_t first = ring->cap - ring->head;
+    if (n <= first)
+        memcpy(dst,ring->buf + ring->head,n);
+    else {
+        memcpy(dst,ring->buf + ring->head,first);
+        memcpy(dst + first,ring->buf,n - first);
+    }
+}
+static void ds_ring_copy_in(struct ds_ring* ring,const byte_t* src,size_t n)
+{
+    /* append 'n' bytes (which must fit) to the ring */
+    size_t tail, first;
+    tail = (ring->head + ring->size) & (ring->cap - 1);
+    first = ring->cap - tail;
+    if (n <= first)
+        memcpy(ring->buf + tail,src,n);
+    else {
+        memcpy(ring->buf + tail,src,first);
+        memcpy(ring->buf,src + first,n - first);
+    }
+    ring->size += n;
+}
+static void ds_ring_reverse(byte_t* p,size_t n)
+{
+    size_t i;
+    for (i = 0;i < n / 2;++i) {
+        byte_t t = p[i];
+        p[i] = p[n-i-1];
+        p[n-i-1] = t;
+    }
+}
+static void ds_ring_linearize(struct ds_ring* ring)
+{
+    /* move the bytes to the front of the buffer so that they are contiguous */
+    struct iovec iov[2];
+    if (ds_ring_data(ring,iov) == 2) {
+        size_t a = iov[0].iov_len, b = iov[1].iov_len;
+        if (a <= ring->head - b) {
+            /* the gap between the segments can hold the first segment */
+            memmove(ring->buf + a,ring->buf,b);
+            memcpy(ring->buf,ring->buf + ring->head,a);
+        }
+        else {
+            /* close the gap and then rotate the bytes in place */
+            memmove(ring->buf + b,ring->buf + ring->head,a);
+            ds_ring_reverse(ring->buf,b);
+            ds_ring_reverse(ring->buf + b,a);
+            ds_ring_reverse(ring->buf,a + b);
+        }
+    }
+    else if (ring->size > 0)
+        memmove(ring->buf,ring->buf + ring->head,ring->size);
+    ring->head = 0;
+}
+static bool_t ds_ring_reserve(struct ds_ring* ring,const byte_t* init,size_t bytes)
+{
+    /* grow the ring so that it can hold 'bytes' bytes (which must not exceed DS_BUFFER_MAX unless the
+       ring belongs to a memory data source); the bytes already in the ring are moved to the front of the new buffer; return FALSE if memory
+       could not be allocated */
+    size_t cap;
+    byte_t* buf;
+    if (bytes <= ring->cap)
+        return TRUE;
+    cap = ring->cap;
+    while (cap < bytes)
+        cap <<= 1;
+    buf = malloc(cap);
+    if (buf == NULL)
+        return FALSE;
+    ds_ring_copy_out(ring,buf,ring->size);
+    if (ring->buf != init)
+        free(ring->buf);
+    ring->buf = buf;
+    ring->cap = cap;
+    ring->head = 0;
+    return TRUE;
+}
+
+static bool_t pok_data_source_readv_device(struct pok_data_source* dsrc,struct iovec* iov,int cnt,size_t* bytesRead)
+{
+    /* utilizes a system-call to read data from the input descriptor into the specified segments; if an
+       exception was generated, FALSE is returned; the EOF mode bit is set if no bytes were read */
+    ssize_t r;
+    ++dsrc->stats.readCalls;
+    r = readv(dsrc->fd[0],iov,cnt);
+    if (r == -1) {
+        /* read error */
+        struct pok_exception* ex;
+        ex = pok_exception_new();
+        ex->kind = pok_ex_net;
+        if (errno==EAGAIN || errno==EWOULDBLOCK)
+            ex->id = pok_ex_net_wouldblock;
+        else if (errno == EINTR)
+            ex->id = pok_ex_net_interrupt;
+        else
+            ex->id = pok_ex_net_unspec;
+        *bytesRead = 0;
+        return FALSE;
+    }
+    if (r == 0)
+        /* set EOF mode bit */
+        dsrc->mode |= DS_MODE_REACH_EOF;
+    dsrc->stats.bytesIn += r;
+    *bytesRead = r;
+    return TRUE;
+}
+static bool_t pok_data_source_writev_device(struct pok_data_source* dsrc,struct iovec* iov,int cnt,size_t* bytesWritten,bool_t flagError)
+{
+    /* utilizes a system-call to write the specified segments to the output descriptor; if an exception was
+       generated, FALSE is returned and no bytes would have been written */
+    ssize_t r;
+    ++dsrc->stats.writeCalls;
+    r = writev(dsrc->mode & DS_MODE_FD_BOTH ? dsrc->fd[1] : dsrc->fd[0],iov,cnt);
+    if (r == -1) {
+        /* write error */
+        if (flagError) {
+            struct pok_exception* ex;
+            ex = pok_exception_new();
+            ex->kind = pok_ex_net;
+            if (errno==EAGAIN || errno==EWOULDBLOCK)
+                ex->id = pok_ex_net_wouldblock;
+            else if (errno == EINTR)
+                ex->id = pok_ex_net_interrupt;
+            else if (errno == EPIPE)
+                ex->id = pok_ex_net_brokenpipe;
+            else {
+                ex->id = -1;
+                pok_exception_append_message(ex,"%s",strerror(errno));
+            }
+            pok_exception_load_message(ex);
+        }
+        *bytesWritten = 0;
+        return FALSE;
+    }
+    dsrc->stats.bytesOut += r;
+    *bytesWritten = r;
+    return TRUE;
+}
+
+/* compression layer */
+static bool_t ds_zstream_room(struct ds_ring* ring,const byte_t* init,size_t need)
+{
+    /* make room for at least 'need' bytes after the bytes in a buffer that does not wrap; FALSE is
+       returned (and the memory error flagged) if memory could not be allocated */
+    if (ring->cap - ring->head - ring->size >= need)
+        return TRUE;
+    if (ring->cap - ring->size >= need) {
+        memmove(ring->buf,ring->buf + ring->head,ring->size);
+        ring->head = 0;
+        return TRUE;
+    }
+    if ( !ds_ring_reserve(ring,init,ring->size + need) ) {
+        pok_exception_flag_memory_error();
+        return FALSE;
+    }
+    return TRUE;
+}
+static bool_t ds_zstream_deflate(z_stream* strm,struct ds_ring* dst,const byte_t* init,const byte_t* data,size_t size,int flush)
+{
+    /* compress bytes onto the end of a buffer that does not wrap; FALSE is returned if memory could not
+       be allocated */
+    strm->next_in = (Bytef*)data;
+    strm->avail_in = size;
+    do {
+        size_t room;
+        if ( !ds_zstream_room(dst,init,1024) )
+            return FALSE;
+        room = dst->cap - dst->head - dst->size;
+        strm->next_out = dst->buf + dst->head + dst->size;
+        strm->avail_out = room;
+        /* this cannot fail on a valid stream (Z_BUF_ERROR only means that no progress was possible) */
+        deflate(strm,flush);
+        dst->size += room - strm->avail_out;
+    } while (strm->avail_in > 0 || strm->avail_out == 0);
+    return TRUE;
+}
+static bool_t ds_zstream_drain(struct pok_data_source* dsrc,bool_t flagError)
+{
+    /* write deflated bytes that are waiting for the device; FALSE is returned if an exception was
+       generated (in which case no bytes were written) */
+    size_t r;
+    struct iovec iov;
+    struct ds_ring* ring = &dsrc->zstream->out;
+    if (ring->size == 0)
+        return TRUE;
+    iov.iov_base = ring->buf + ring->head;
+    iov.iov_len = ring->size;
+    if ( !pok_data_source_writev_device(dsrc,&iov,1,&r,flagError) )
+        return FALSE;
+    ds_ring_consume(ring,r);
+    if (ring->size == 0)
+        ring->head = 0;
+    return TRUE;
+}
+static bool_t ds_zstream_writev(struct pok_data_source* dsrc,struct iovec* iov,int cnt,size_t* bytesWritten,bool_t flagError)
+{
+    /* deflate the segments and write them to the device; the segments are only accepted (all of them at
+       once) after every deflated byte from earlier writes has been written; since the deflated bytes are
+       flushed to a byte boundary, the peer can inflate everything that was accepted */
+    int i;
+    size_t total = 0;
+    struct ds_zstream* z = dsrc->zstream;
+    *bytesWritten = 0;
+    if ( !ds_zstream_drain(dsrc,flagError) )
+        return FALSE;
+    if (z->out.size > 0)
+        return TRUE;
+    for (i = 0;i < cnt;++i) {
+        if ( !ds_zstream_deflate(&z->deflater,&z->out,NULL,iov[i].iov_base,iov[i].iov_len,Z_NO_FLUSH) )
+            return FALSE;
+        total += iov[i].iov_len;
+    }
+    if ( !ds_zstream_deflate(&z->deflater,&z->out,NULL,NULL,0,Z_SYNC_FLUSH) )
+        return FALSE;
+    *bytesWritten = total;
+    dsrc->stats.deflated += total;
+    /* the segments were accepted even if the device cannot take their deflated bytes yet */
+    if ( !ds_zstream_drain(dsrc,flagError) && flagError && !pok_exception_pop_ex(pok_ex_net,pok_ex_net_wouldblock) )
+        return FALSE;
+    return TRUE;
+}
+static bool_t ds_zstream_readv(struct pok_data_source* dsrc,struct iovec* iov,int cnt,size_t* bytesRead)
+{
+    /* inflate bytes into the segments; the device is only read when the bytes already read from it
+       cannot produce any more and the function returns as soon as any bytes are inflated; if an
+       exception was generated, FALSE is returned; if no bytes were read then EOF was reached */
+    int i, r;
+    size_t n;
+    struct iovec dev;
+    struct ds_zstream* z = dsrc->zstream;
+    *bytesRead = 0;
+    while (TRUE) {
+        if (z->in.size > 0 || z->inflatePending) {
+            z->inflater.next_in = z->in.buf + z->in.head;
+            z->inflater.avail_in = z->in.size;
+            for (i = 0;i < cnt;++i) {
+                z->inflater.next_out = iov[i].iov_base;
+                z->inflater.avail_out = iov[i].iov_len;
+                r = inflate(&z->inflater,Z_SYNC_FLUSH);
+                *bytesRead += iov[i].iov_len - z->inflater.avail_out;
+                if (r != Z_OK && r != Z_BUF_ERROR) {
+                    pok_exception_new_ex(pok_ex_net,pok_ex_net_corrupt_stream);
+                    *bytesRead = 0;
+                    return FALSE;
+                }
+                if (z->inflater.avail_out > 0)
+                    break;
+            }
+            /* the inflater may hold more output if it filled every segment */
+            z->inflatePending = i == cnt;
+            ds_ring_consume(&z->in,z->in.size - z->inflater.avail_in);
+            if (z->in.size == 0)
+                z->in.head = 0;
+            if (*bytesRead > 0) {
+                dsrc->stats.inflated += *bytesRead;
+                return TRUE;
+            }
+        }
+        if ( !ds_zstream_room(&z->in,NULL,DS_BUFFER_INITIAL) )
+            return FALSE;
+        dev.iov_base = z->in.buf + z->in.head + z->in.size;
+        dev.iov_len = z->in.cap - z->in.head - z->in.size;
+        if ( !pok_data_source_readv_device(dsrc,&dev,1,&n) )
+            return FALSE;
+        if (n == 0)
+            return TRUE;
+        z->in.size += n;
+    }
+}
+static bool_t ds_zstream_ring_init(struct ds_ring* ring)
+{
+    ring->buf = malloc(DS_ZBUFFER_INITIAL);
+    if (ring->buf == NULL) {
+        pok_exception_flag_memory_error();
+        return FALSE;
+    }
+    ring->cap = DS_ZBUFFER_INITIAL;
+    ring->head = 0;
+    ring->size = 0;
+    return TRUE;
+}
+static void ds_zstream_free(struct ds_zstream* z)
+{
+    if (z->deflating)
+        deflateEnd(&z->deflater);
+    if (z->inflating)
+        inflateEnd(&z->inflater);
+    free(z->out.buf);
+    free(z->in.buf);
+    free(z);
+}
+
+static bool_t pok_data_source_readv(struct pok_data_source* dsrc,struct iovec* iov,int cnt,size_t* bytesRead)
+{
+    /* read into the specified segments from the device or (if the input is compressed) the inflater */
+    if (dsrc->zstream != NULL && dsrc->zstream->inflating)
+        return ds_zstream_readv(dsrc,iov,cnt,bytesRead);
+    return pok_data_source_readv_device(dsrc,iov,cnt,bytesRead);
+}
+static bool_t pok_data_source_writev(struct pok_data_source* dsrc,struct iovec* iov,int cnt,size_t* bytesWritten,bool_t flagError)
+{
+    /* write the specified segments to the device or (if the output is compressed) the deflater */
+    if (dsrc->zstream != NULL && dsrc->zstream->deflating)
+        return ds_zstream_writev(dsrc,iov,cnt,bytesWritten,flagError);
+    return pok_data_source_writev_device(dsrc,iov,cnt,bytesWritten,flagError);
+}
 byte_t* pok_data_source_read(struct pok_data_source* dsrc,size_t bytesRequested,size_t* bytesRead)
 {
     /* this function attempts to provide the user with a data buffer of the requested length read
        from the data source; it will return what it was able to read; NULL is returned if an
        exception was generated; if non-NULL is returned and *bytesRead==0 then the EOF was reached on
-       the device */
-    size_t it;
-    struct pok_exception* ex;
+       the device; the input buffer grows to fit the request (up to DS_BUFFER_MAX bytes, beyond
+       which requests are capped) and a single call fills all of its free space */
+    byte_t* data;
+    struct ds_ring* ring = &dsrc->in;
     /* check end of file on fd[0] */
     if (dsrc->mode & DS_MODE_REACH_EOF) {
         *bytesRead = 0;
-        return dsrc->bufferRead;
-    }
-    /* cap max bytes able to read at buffer size */
-    if (bytesRequested > sizeof(dsrc->bufferRead))
-        bytesRequested = sizeof(dsrc->bufferRead);
-    /* try read the remaining capacity of the buffer if we don't already
-       have the requested number of bytes */
-    if (bytesRequested > dsrc->szRead) {
-        ssize_t r;
-        size_t remain;
-        /* compute remaining bytes */
-        remain = sizeof(dsrc->bufferRead) - dsrc->szRead - dsrc->itRead;
-        /* reduce used buffer portion to maximize capacity if needed */
-        if (dsrc->itRead>0 && bytesRequested>remain) {
-            remain += dsrc->itRead;
-            if (dsrc->szRead > 0)
-                memcpy(dsrc->bufferRead,dsrc->bufferRead+dsrc->itRead,dsrc->szRead);
-            dsrc->itRead = 0;
-        }
-        if (remain > 0) {
-            /* read from the device into the remaining buffer space */
-            r = read(dsrc->fd[0],dsrc->bufferRead + dsrc->szRead + dsrc->itRead,remain);
-            if (r == -1) {
-                /* read error */
-                ex = pok_exception_new();
-                ex->kind = pok_ex_net;
-                if (errno==EAGAIN || errno==EWOULDBLOCK)
-                    ex->id = pok_ex_net_wouldblock;
-                else if (errno == EINTR)
-                    ex->id = pok_ex_net_interrupt;
-                else
-                    ex->id = pok_ex_net_unspec;
+        return ring->buf + ring->head;
+    }
+    if (bytesRequested > DS_BUFFER_MAX)
+        bytesRequested = DS_BUFFER_MAX;
+    /* try to fill the buffer if we don't already have the requested number of bytes */
+    if (bytesRequested > ring->size) {
+        int cnt;
+        size_t r;
+        struct iovec iov[2];
+        if (bytesRequested > ring->cap) {
+            if ( !ds_ring_reserve(ring,dsrc->initRead,bytesRequested) ) {
+                pok_exception_flag_memory_error();
                 *bytesRead = 0;
                 return NULL;
             }
-            if (r == 0)
-                /* set EOF mode bit */
-                dsrc->mode |= DS_MODE_REACH_EOF;
-            dsrc->szRead += r;
+            ++dsrc->stats.resizes;
         }
+        /* an empty buffer is filled from its beginning so that the bytes are contiguous */
+        if (ring->size == 0)
+            ring->head = 0;
+        cnt = ds_ring_space(ring,iov);
+        if ( !pok_data_source_readv(dsrc,iov,cnt,&r) ) {
+            *bytesRead = 0;
+            return NULL;
+        }
+        ring->size += r;
     }
-    /* return a pointer to the specified memory */
-    *bytesRead = dsrc->szRead > bytesRequested ? bytesRequested : dsrc->szRead;
-    it = dsrc->itRead;
-    dsrc->itRead += *bytesRead;
-    dsrc->szRead -= *bytesRead;
-    return dsrc->bufferRead + it;
+    /* the bytes returned must be contiguous; if they wrap around the end of the buffer then move
+       them to the front */
+    *bytesRead = ring->size > bytesRequested ? bytesRequested : ring->size;
+    if (ring->head + *bytesRead > ring->cap) {
+        ds_ring_linearize(ring);
+        ++dsrc->stats.compactions;
+    }
+    data = ring->buf + ring->head;
+    ds_ring_consume(ring,*bytesRead);
+    return data;
 }
 byte_t* pok_data_source_read_any(struct pok_data_source* dsrc,size_t maxBytes,size_t* bytesRead)
 {
     /* this function attempts to read any available bytes from the data source;
        if bytes are buffered, they are returned instantly; otherwise a read call
-       is issued; in other words, if any bytes are available, they are returned */
-    size_t it;
-    ssize_t br;
-    struct pok_exception* ex;
+       is issued; in other words, if any bytes are available, they are returned;
+       buffered bytes that wrap around the end of the buffer are returned by the
+       next call */
+    size_t br;
+    byte_t* data;
+    struct ds_ring* ring = &dsrc->in;
     /* check end of file on fd[0] */
     if (dsrc->mode & DS_MODE_REACH_EOF) {
         *bytesRead = 0;
-        return dsrc->bufferRead;
+        return ring->buf + ring->head;
     }
 
-    /* if some bytes already exist in the buffer, return them (no matter how
-       many there are) */
-    if (dsrc->szRead > 0) {
-        br = ( dsrc->szRead > maxBytes ) ? maxBytes : dsrc->szRead;
-        it = dsrc->itRead;
-        dsrc->itRead += br;
-        dsrc->szRead -= br;
-        *bytesRead = br;
-        return dsrc->bufferRead + it;
-    }
-
-    /* issue a read for more bytes; the entire buffer is available */
-    br = read(dsrc->fd[0],dsrc->bufferRead,sizeof(dsrc->bufferRead));
-    if (br == -1) {
-        /* read error */
-        ex = pok_exception_new();
-        ex->kind = pok_ex_net;
-        if (errno==EAGAIN || errno==EWOULDBLOCK)
-            ex->id = pok_ex_net_wouldblock;
-        else if (errno == EINTR)
-            ex->id = pok_ex_net_interrupt;
-        else
-            ex->id = pok_ex_net_unspec;
-        *bytesRead = 0;
-        return NULL;
+    /* issue a read for more bytes if the buffer is empty; the entire buffer is available */
+    if (ring->size == 0) {
+        struct iovec iov;
+        ring->head = 0;
+        iov.iov_base = ring->buf;
+        iov.iov_len = ring->cap;
+        if ( !pok_data_source_readv(dsrc,&iov,1,&br) ) {
+            *bytesRead = 0;
+            return NULL;
+        }
+        ring->size = br;
     }
-    if (br == 0)
-        /* set EOF mode bit */
-        dsrc->mode |= DS_MODE_REACH_EOF;
-    dsrc->szRead += br;
 
     /* return a pointer to the specified memory */
-    br = dsrc->szRead > maxBytes ? maxBytes : dsrc->szRead;
-    it = dsrc->itRead;
-    dsrc->itRead += br;
-    dsrc->szRead -= br;
+    br = ring->cap - ring->head;
+    if (br > ring->size)
+        br = ring->size;
+    if (br > maxBytes)
+        br = maxBytes;
+    data = ring->buf + ring->head;
+    ds_ring_consume(ring,br);
     *bytesRead = br;
-    return dsrc->bufferRead + it;
+    return data;
 }
 bool_t pok_data_source_read_to_buffer(struct pok_data_source* dsrc,void* buffer,size_t bytesRequested,size_t* bytesRead)
 {
     /* perform a simpler read into a user-provided buffer */
-    ssize_t r;
+    int cnt;
+    size_t r;
+    struct iovec iov[3];
+    struct ds_ring* ring = &dsrc->in;
     if (dsrc->mode & DS_MODE_REACH_EOF) {
         *bytesRead = 0;
         return TRUE;
     }
     /* transfer bytes in our input buffer first; then read the remainder in directly to the user-provided buffer */
-    if (dsrc->szRead > 0) {
-        ssize_t amt;
-        amt = bytesRequested > dsrc->szRead ? dsrc->szRead : bytesRequested;
-        memcpy(buffer,dsrc->bufferRead + dsrc->itRead,amt);
-        buffer = (char*)buffer + amt;
-        bytesRequested -= amt;
-        dsrc->szRead -= amt;
-        dsrc->itRead += amt;
-        *bytesRead = amt;
+    *bytesRead = ring->size > bytesRequested ? bytesRequested : ring->size;
+    if (*bytesRead > 0) {
+        ds_ring_copy_out(ring,buffer,*bytesRead);
+        ds_ring_consume(ring,*bytesRead);
+        buffer = (byte_t*)buffer + *bytesRead;
+        bytesRequested -= *bytesRead;
     }
-    else
-        *bytesRead = 0;
     if (bytesRequested == 0)
         return TRUE;
-    /* read the remaining bytes directly */
-    r = read(dsrc->fd[0],buffer,bytesRequested);
-    if (r == -1) {
-        /* read error */
-        struct pok_exception* ex;
-        ex = pok_exception_new();
-        ex->kind = pok_ex_net;
-        if (errno==EAGAIN || errno==EWOULDBLOCK)
-            ex->id = pok_ex_net_wouldblock;
-        else if (errno == EINTR)
-            ex->id = pok_ex_net_interrupt;
-        else
-            ex->id = pok_ex_net_unspec;
-        *bytesRead = 0;
+    /* read the remaining bytes directly; the (now empty) input buffer is refilled by the same call
+       unless the request is large, in which case the bytes only go to the caller */
+    ring->head = 0;
+    iov[0].iov_base = buffer;
+    iov[0].iov_len = bytesRequested;
+    cnt = 1;
+    if (bytesRequested < ring->cap)
+        cnt += ds_ring_space(ring,iov + 1);
+    if ( !pok_data_source_readv(dsrc,iov,cnt,&r) ) {
+        /* read error; if bytes were transferred from the input buffer then report them
+           instead (the error will occur again on the next call) */
+        if (*bytesRead > 0) {
+            pok_exception_pop();
+            return TRUE;
+        }
         return FALSE;
     }
-    if (r == 0)
-        /* set EOF mode bit */
-        dsrc->mode |= DS_MODE_REACH_EOF;
+    if (r > bytesRequested) {
+        ring->size = r - bytesRequested;
+        r = bytesRequested;
+    }
     *bytesRead += r;
     return TRUE;
 }
 char pok_data_source_peek(struct pok_data_source* dsrc)
 {
     size_t bytesRead;
-    if (dsrc->szRead > 0)
-        return dsrc->bufferRead[dsrc->itRead];
-    if (pok_data_source_read(dsrc,1,&bytesRead) && bytesRead > 0)
-        return dsrc->bufferRead[--dsrc->itRead];
+    if (dsrc->in.size > 0)
+        return dsrc->in.buf[dsrc->in.head];
+    /* the read consumes the bytes it returns so put them back */
+    if (pok_data_source_read(dsrc,1,&bytesRead) && bytesRead > 0) {
+        pok_data_source_unread(dsrc,1);
+        return dsrc->in.buf[dsrc->in.head];
+    }
     return (char) -1;
 }
 char pok_data_source_peek_ex(struct pok_data_source* dsrc,size_t lookahead)
 {
     size_t bytesRead;
-    if (dsrc->szRead > lookahead)
-        return dsrc->bufferRead[dsrc->itRead + lookahead];
-    if (pok_data_source_read(dsrc,lookahead - dsrc->szRead,&bytesRead) && bytesRead >= lookahead)
-        return dsrc->bufferRead[dsrc->itRead -= bytesRead];
+    struct ds_ring* ring = &dsrc->in;
+    if (ring->size > lookahead)
+        return ring->buf[(ring->head + lookahead) & (ring->cap - 1)];
+    if (pok_data_source_read(dsrc,lookahead + 1,&bytesRead) && bytesRead > 0) {
+        pok_data_source_unread(dsrc,bytesRead);
+        if (bytesRead > lookahead)
+            return ring->buf[(ring->head + lookahead) & (ring->cap - 1)];
+    }
     return (char) -1;
 }
 char pok_data_source_pop(struct pok_data_source* dsrc)
 {
+    byte_t* data;
     size_t bytesRead;
-    if (dsrc->szRead > 0) {
-        --dsrc->szRead;
-        return dsrc->bufferRead[dsrc->itRead++];
+    if (dsrc->in.size > 0) {
+        char c = dsrc->in.buf[dsrc->in.head];
+        ds_ring_consume(&dsrc->in,1);
+        return c;
     }
-    if (pok_data_source_read(dsrc,1,&bytesRead) && bytesRead > 0)
-        return dsrc->bufferRead[dsrc->itRead-1];
+    data = pok_data_source_read(dsrc,1,&bytesRead);
+    if (data != NULL && bytesRead > 0)
+        return data[0];
     return (char) -1;
 }
-static bool_t pok_data_source_write_primative(int fd,const byte_t* buffer,size_t size,size_t* bytesWritten,bool_t flagError)
+static bool_t pok_data_source_append(struct pok_data_source* dsrc,const byte_t* buffer,size_t size)
 {
-    /* utilizes a system-call to write data to the specified descriptor; if an exception was generated, FALSE
-       is returned and no bytes would have been written */
-    ssize_t r;
-    if (size == 0) {
-        *bytesWritten = 0;
+    /* append bytes to the output buffer of a memory data source; its buffer is never consumed so it
+       stays contiguous from the start */
+    struct ds_ring* ring = &dsrc->out;
+    if (dsrc->zstream != NULL && dsrc->zstream->deflating) {
+        size_t before = ring->size;
+        if ( !ds_zstream_deflate(&dsrc->zstream->deflater,ring,dsrc->initWrite,buffer,size,Z_NO_FLUSH) )
+            return FALSE;
+        dsrc->stats.deflated += size;
+        dsrc->stats.bytesOut += ring->size - before;
         return TRUE;
     }
-    r = write(fd,buffer,size);
-    if (r == -1) {
-        /* write error */
-        if (flagError) {
-            struct pok_exception* ex;
-            ex = pok_exception_new();
-            ex->kind = pok_ex_net;
-            if (errno==EAGAIN || errno==EWOULDBLOCK)
-                ex->id = pok_ex_net_wouldblock;
-            else if (errno == EINTR)
-                ex->id = pok_ex_net_interrupt;
-            else if (errno == EPIPE)
-                ex->id = pok_ex_net_brokenpipe;
-            else {
-                ex->id = -1;
-                pok_exception_append_message(ex,"%s %d",strerror(errno));
-            }
-            pok_exception_load_message(ex);
+    if (size > ring->cap - ring->size) {
+        if ( !ds_ring_reserve(ring,dsrc->initWrite,ring->size + size) ) {
+            pok_exception_flag_memory_error();
+            return FALSE;
         }
-        *bytesWritten = 0;
-        return FALSE;
+        ++dsrc->stats.resizes;
     }
-    *bytesWritten = r;
+    ds_ring_copy_in(ring,buffer,size);
+    dsrc->stats.bytesOut += size;
     return TRUE;
 }
 bool_t pok_data_source_write(struct pok_data_source* dsrc,const byte_t* buffer,size_t size,size_t* bytesWritten)
 {
     /* this function attempts to write a data buffer to the device of a specified length; it 
        returns FALSE if an exception was generated; if the data source object is in buffering
-       mode, then attempt to write to the buffer; if the buffer becomes full then the data is
-       flushed before any extra bytes are written to the device */
-    bool_t result;
-    if (dsrc->mode & DS_MODE_BUFFER_OUTPUT) {
-        ssize_t remain, bufR;
-        /* compute remaining bytes; write as much data as possible to the buffer */
-        remain = sizeof(dsrc->bufferWrite) - dsrc->szWrite - dsrc->itWrite;
-        if (remain > 0) {
-            if (size > (size_t)remain) {
-                /* reduce used buffer portion to maximize capacity */
-                if (dsrc->itWrite > 0) {
-                    remain += dsrc->itWrite;
-                    if (dsrc->szWrite > 0)
-                        memcpy(dsrc->bufferWrite,dsrc->bufferWrite+dsrc->itWrite,dsrc->szWrite);
-                    dsrc->itWrite = 0;
-                }
-                bufR = remain;
-            }
-            else
-                bufR = (ssize_t)size;
-            memcpy(dsrc->bufferWrite + dsrc->itWrite + dsrc->szWrite,buffer,bufR);
-            dsrc->szWrite += bufR;
-            remain -= bufR;
-        }
-        else
-            bufR = 0;
-        /* if the buffer became full, flush its contents */
-        result = remain <= 0 ? pok_data_source_flush(dsrc) : TRUE;
-        *bytesWritten = bufR;
-        return result;
-    }
-    /* the output buffer is non-empty; we must write these bytes before attempting to
-       write new data */
-    if (dsrc->szWrite > 0) {
-        result = pok_data_source_flush(dsrc);
-        if (!result || dsrc->szWrite>0) {
-            /* flush failed or was incomplete */
+       mode and the data fits in the buffer (without filling it), then the data is buffered;
+       otherwise the buffered bytes and the new data are written by a single call; the new
+       data is only written once every buffered byte has been */
+    int cnt;
+    size_t r;
+    struct iovec iov[3];
+    struct ds_ring* ring = &dsrc->out;
+    if (dsrc->mode & DS_MODE_MEMORY) {
+        if ( !pok_data_source_append(dsrc,buffer,size) ) {
             *bytesWritten = 0;
-            return result;
+            return FALSE;
         }
+        *bytesWritten = size;
+        return TRUE;
     }
-    /* attempt to write the supplied buffer to the output device */
-    result = pok_data_source_write_primative(dsrc->mode & DS_MODE_FD_BOTH ? dsrc->fd[1] : dsrc->fd[0],buffer,size,bytesWritten,TRUE);
-    return result;
+    if ((dsrc->mode & DS_MODE_BUFFER_OUTPUT) && size < ring->cap - ring->size) {
+        ds_ring_copy_in(ring,buffer,size);
+        *bytesWritten = size;
+        return TRUE;
+    }
+    if (size == 0 && ring->size == 0) {
+        *bytesWritten = 0;
+        return TRUE;
+    }
+    cnt = ds_ring_data(ring,iov);
+    iov[cnt].iov_base = (byte_t*)buffer;
+    iov[cnt].iov_len = size;
+    if ( !pok_data_source_writev(dsrc,iov,cnt+1,&r,TRUE) ) {
+        *bytesWritten = 0;
+        return FALSE;
+    }
+    if (r < ring->size) {
+        /* the write was incomplete: only buffered bytes were written */
+        ds_ring_consume(ring,r);
+        *bytesWritten = 0;
+        return TRUE;
+    }
+    *bytesWritten = r - ring->size;
+    ring->head = 0;
+    ring->size = 0;
+    return TRUE;
 }
 void pok_data_source_buffering(struct pok_data_source* dsrc,bool_t on)
 {
@@ -460,87 +848,715 @@ void pok_data_source_buffering(struct pok_data_source* dsrc,bool_t on)
 }
 bool_t pok_data_source_flush(struct pok_data_source* dsrc)
 {
-    /* flushes the write buffer; returns FALSE if an exception was generated; the buffer iterator
-       and size variable indicate how much (or how little) of the buffer was actually written */
-    bool_t result;
+    /* flushes the write buffer; returns FALSE if an exception was generated; the buffer
+       is left with any bytes that were not written */
+    int cnt;
     size_t bytesOut;
-    result = pok_data_source_write_primative(dsrc->mode & DS_MODE_FD_BOTH ? dsrc->fd[1] : dsrc->fd[0],
-        dsrc->bufferWrite+dsrc->itWrite,dsrc->szWrite,&bytesOut,TRUE);
-    if (result) {
-        dsrc->itWrite += bytesOut;
-        dsrc->szWrite -= bytesOut;
-        if (dsrc->szWrite == 0)
-            /* collapse empty buffer to maximize capacity */
-            dsrc->itWrite = 0;
-    }
-    return result;
+    struct iovec iov[2];
+    struct ds_ring* ring = &dsrc->out;
+    if (dsrc->mode & DS_MODE_MEMORY)
+        /* there is no device to flush to */
+        return TRUE;
+    cnt = ds_ring_data(ring,iov);
+    if (cnt == 0)
+        /* deflated bytes may still be waiting for the device */
+        return dsrc->zstream == NULL || ds_zstream_drain(dsrc,TRUE);
+    if ( !pok_data_source_writev(dsrc,iov,cnt,&bytesOut,TRUE) )
+        return FALSE;
+    ds_ring_consume(ring,bytesOut);
+    if (ring->size == 0)
+        /* collapse empty buffer to maximize contiguous capacity */
+        ring->head = 0;
+    return TRUE;
 }
 enum pok_iomode pok_data_source_getmode(struct pok_data_source* dsrc)
 {
     /* the first two mode bits correspond to the io-mode */
     return (enum pok_iomode) (dsrc->mode & 0x3);
 }
+void pok_data_source_getstats(struct pok_data_source* dsrc,struct pok_data_source_stats* stats)
+{
+    *stats = dsrc->stats;
+}
+const byte_t* pok_data_source_memory(struct pok_data_source* dsrc,size_t* size)
+{
+    /* get the bytes written to a memory data source; the pointer is valid until the next write; compressed
+       output is flushed to a byte boundary first */
+    if ((dsrc->mode & DS_MODE_MEMORY) == 0) {
+        *size = 0;
+        return NULL;
+    }
+    if (dsrc->zstream != NULL && dsrc->zstream->deflating) {
+        size_t before = dsrc->out.size;
+        if ( !ds_zstream_deflate(&dsrc->zstream->deflater,&dsrc->out,dsrc->initWrite,NULL,0,Z_SYNC_FLUSH) ) {
+            *size = 0;
+            return NULL;
+        }
+        dsrc->stats.bytesOut += dsrc->out.size - before;
+    }
+    *size = dsrc->out.size;
+    return dsrc->out.buf + dsrc->out.head;
+}
+bool_t pok_data_source_compress(struct pok_data_source* dsrc,enum pok_iomode iomode,int level)
+{
+    /* put a raw deflate stream between the data source and its device for the specified directions;
+       buffered output has not reached the device and was written before the switch so it is moved
+       (as it is) ahead of the deflated bytes; buffered input came from the device after the switch so
+       it is moved to be inflated */
+    struct ds_zstream* z = dsrc->zstream;
+    if (z == NULL) {
+        z = malloc(sizeof(struct ds_zstream));
+        if (z == NULL) {
+            pok_exception_flag_memory_error();
+            return FALSE;
+        }
+        memset(z,0,sizeof(struct ds_zstream));
+        dsrc->zstream = z;
+    }
+    if ((iomode & pok_iomode_write) && !z->deflating) {
+        if ((dsrc->mode & DS_MODE_MEMORY) == 0
+            && ((z->out.buf == NULL && !ds_zstream_ring_init(&z->out)) || !ds_zstream_room(&z->out,NULL,dsrc->out.size)))
+            return FALSE;
+        if (deflateInit2(&z->deflater,level,Z_DEFLATED,-MAX_WBITS,8,Z_DEFAULT_STRATEGY) != Z_OK) {
+            pok_exception_new_format("pok_data_source_compress: bad compression level: %d",level);
+            return FALSE;
+        }
+        z->deflating = TRUE;
+        if ((dsrc->mode & DS_MODE_MEMORY) == 0) {
+            ds_ring_copy_out(&dsrc->out,z->out.buf + z->out.head + z->out.size,dsrc->out.size);
+            z->out.size += dsrc->out.size;
+            dsrc->out.head = 0;
+            dsrc->out.size = 0;
+        }
+    }
+    if ((iomode & pok_iomode_read) && !z->inflating && (dsrc->mode & DS_MODE_MEMORY) == 0) {
+        if ((z->in.buf == NULL && !ds_zstream_ring_init(&z->in)) || !ds_zstream_room(&z->in,NULL,dsrc->in.size))
+            return FALSE;
+        if (inflateInit2(&z->inflater,-MAX_WBITS) != Z_OK) {
+            pok_exception_flag_memory_error();
+            return FALSE;
+        }
+        z->inflating = TRUE;
+        ds_ring_copy_out(&dsrc->in,z->in.buf + z->in.head + z->in.size,dsrc->in.size);
+        z->in.size += dsrc->in.size;
+        dsrc->in.head = 0;
+        dsrc->in.size = 0;
+    }
+    return TRUE;
+}
 void pok_data_source_free(struct pok_data_source* dsrc)
 {
+    int cnt;
     size_t dummy;
+    struct iovec iov[2];
     /* write any remaining bytes in buffer; don't add error to error stack if failure */
-    pok_data_source_write_primative(dsrc->mode & DS_MODE_FD_BOTH ? dsrc->fd[1] : dsrc->fd[0],
-        dsrc->bufferWrite+dsrc->itWrite,dsrc->szWrite,&dummy,FALSE);
+    cnt = (dsrc->mode & DS_MODE_MEMORY) ? 0 : ds_ring_data(&dsrc->out,iov);
+    if (cnt > 0)
+        pok_data_source_writev(dsrc,iov,cnt,&dummy,FALSE);
     /* call shutdown syscall if device is socket */
     if (dsrc->mode & DS_MODE_IS_SOCKET)
         shutdown(dsrc->fd[0],SHUT_RDWR);
-    if ((dsrc->mode & DS_MODE_USING_STD_FILENO) == 0) {
-        /* close file descriptions (if not standard input/output) */
+    if ((dsrc->mode & (DS_MODE_USING_STD_FILENO | DS_MODE_MEMORY)) == 0) {
+        /* close file descriptions (if not standard input/output or memory) */
         close(dsrc->fd[0]);
         if (dsrc->mode & DS_MODE_FD_BOTH)
             close(dsrc->fd[1]);
     }
+    if (dsrc->in.buf != dsrc->initRead)
+        free(dsrc->in.buf);
+    if (dsrc->out.buf != dsrc->initWrite)
+        free(dsrc->out.buf);
+    if (dsrc->zstream != NULL)
+        ds_zstream_free(dsrc->zstream);
     free(dsrc);
 }
 void pok_data_source_unread(struct pok_data_source* dsrc,size_t size)
 {
-    /* this function places unreads the last bytes read by advancing/retreating
-       the internal buffer iterators by the specified number of spaces */
-    size_t tmp;
-    tmp = dsrc->itRead;
-    dsrc->itRead -= size;
-    dsrc->szRead += size;
-    if (dsrc->itRead > tmp) /* overflow on unsigned integer variable */
-        dsrc->itRead = 0;
-    if (dsrc->szRead > sizeof(dsrc->bufferRead))
-        dsrc->szRead = sizeof(dsrc->bufferRead);
+    /* this function places unreads the last bytes read by retreating the internal
+       buffer head by the specified number of spaces */
+    struct ds_ring* ring = &dsrc->in;
+    if (size > ring->cap - ring->size)
+        size = ring->cap - ring->size;
+    ring->head = (ring->head - size) & (ring->cap - 1);
+    ring->size += size;
 }
 bool_t pok_data_source_save(struct pok_data_source* dsrc,const byte_t* buffer,size_t size)
 {
-    /* this function saves data in the data source's output buffer; if not all of the bytes in the
-       buffer could be written, then the function returns false and no data was buffered */
-    size_t remain = sizeof(dsrc->bufferWrite) - dsrc->szWrite - dsrc->itWrite;
-    /* maximize buffer space if it is lacking */
-    if (remain < size) {
-        if (dsrc->itWrite > 0) {
-            remain += dsrc->itWrite;
-            if (dsrc->szWrite > 0)
-                memcpy(dsrc->bufferWrite,dsrc->bufferWrite+dsrc->itWrite,dsrc->szWrite);
-            dsrc->itWrite = 0;
-            if (remain < size)
-                return FALSE;
-        }
-        else
+    /* this function saves data in the data source's output buffer; the buffer grows if it
+       lacks room (up to DS_BUFFER_MAX bytes); if not all of the bytes in the buffer could be
+       saved, then the function returns false and no data was buffered */
+    struct ds_ring* ring = &dsrc->out;
+    if (dsrc->mode & DS_MODE_MEMORY)
+        return pok_data_source_append(dsrc,buffer,size);
+    if (size > ring->cap - ring->size) {
+        if (ring->size + size > DS_BUFFER_MAX || !ds_ring_reserve(ring,dsrc->initWrite,ring->size + size))
             return FALSE;
+        ++dsrc->stats.resizes;
     }
-    memcpy(dsrc->bufferWrite+dsrc->itWrite+dsrc->szWrite,buffer,size);
-    dsrc->szWrite += size;
+    ds_ring_copy_in(ring,buffer,size);
     return TRUE;
 }
 inline bool_t pok_data_source_readbuf_full(struct pok_data_source* dsrc)
 {
-    return dsrc->szRead == sizeof(dsrc->bufferRead);
+    return dsrc->in.size == dsrc->in.cap;
 }
 inline bool_t pok_data_source_endofcomms(struct pok_data_source* dsrc)
 {
     return dsrc->mode & DS_MODE_REACH_EOF;
 }
 
+/* pok_io_poller */
+#ifdef __linux__
+/* the poller is an epoll instance watching the data source's descriptors (only while the caller is
+   interested in them), a timerfd for the timer and an eventfd for wakeups; descriptors that epoll
+   cannot watch (e.g. regular files) are always ready */
+enum pok_io_poller_tag
+{
+    POLLER_INPUT,
+    POLLER_OUTPUT,
+    POLLER_TIMER,
+    POLLER_WAKEUP
+};
+
+struct pok_io_poller
+{
+    int epfd;
+    int timerfd;
+    int eventfd;
+    int fd[2];         /* input and output descriptors; if they are the same then only fd[0] is watched */
+    uint32_t watch[2]; /* epoll events for which each descriptor is registered (zero if not registered) */
+    bool_t always[2];  /* if non-zero, then the descriptor cannot be watched and is always ready */
+    bool_t woken;      /* a wakeup arrived that has not been reported */
+};
+
+static bool_t pok_io_poller_watch(struct pok_io_poller* poller,int index,uint32_t events)
+{
+    /* change the events for which a descriptor is registered; descriptors are not registered at all while
+       no events are wanted so that hang-ups are not reported to a caller that isn't interested */
+    int op;
+    struct epoll_event ev;
+    if (poller->always[index] || poller->watch[index] == events)
+        return TRUE;
+    op = events == 0 ? EPOLL_CTL_DEL : (poller->watch[index] == 0 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD);
+    ev.events = events;
+    ev.data.u32 = index;
+    if (epoll_ctl(poller->epfd,op,poller->fd[index],&ev) == -1) {
+        if (errno != EPERM) {
+            pok_exception_new_ex(pok_ex_net,pok_ex_net_unspec);
+            return FALSE;
+        }
+        poller->always[index] = TRUE;
+    }
+    poller->watch[index] = events;
+    return TRUE;
+}
+struct pok_io_poller* pok_io_poller_new(struct pok_data_source* dsrc)
+{
+    struct epoll_event ev;
+    struct pok_io_poller* poller;
+    poller = malloc(sizeof(struct pok_io_poller));
+    if (poller == NULL) {
+        pok_exception_flag_memory_error();
+        return NULL;
+    }
+    poller->fd[0] = dsrc->fd[0];
+    poller->fd[1] = dsrc->mode & DS_MODE_FD_BOTH ? dsrc->fd[1] : dsrc->fd[0];
+    poller->watch[0] = poller->watch[1] = 0;
+    poller->always[0] = poller->always[1] = FALSE;
+    poller->woken = FALSE;
+    poller->epfd = epoll_create1(EPOLL_CLOEXEC);
+    poller->timerfd = timerfd_create(CLOCK_MONOTONIC,TFD_NONBLOCK | TFD_CLOEXEC);
+    poller->eventfd = eventfd(0,EFD_NONBLOCK | EFD_CLOEXEC);
+    if (poller->epfd != -1 && poller->timerfd != -1 && poller->eventfd != -1) {
+        ev.events = EPOLLIN;
+        ev.data.u32 = POLLER_TIMER;
+        if (epoll_ctl(poller->epfd,EPOLL_CTL_ADD,poller->timerfd,&ev) != -1) {
+            ev.data.u32 = POLLER_WAKEUP;
+            if (epoll_ctl(poller->epfd,EPOLL_CTL_ADD,poller->eventfd,&ev) != -1)
+                return poller;
+        }
+    }
+    pok_exception_new_ex(pok_ex_net,pok_ex_net_could_not_create_poller);
+    pok_io_poller_free(poller);
+    return NULL;
+}
+void pok_io_poller_free(struct pok_io_poller* poller)
+{
+    /* the data source's descriptors belong to the data source */
+    if (poller->epfd != -1)
+        close(poller->epfd);
+    if (poller->timerfd != -1)
+        close(poller->timerfd);
+    if (poller->eventfd != -1)
+        close(poller->eventfd);
+    free(poller);
+}
+void pok_io_poller_set_timer(struct pok_io_poller* poller,uint32_t mseconds)
+{
+    /* re-arming the timer discards an expiration that has not been reported */
+    struct itimerspec spec;
+    memset(&spec,0,sizeof(struct itimerspec));
+    spec.it_value.tv_sec = mseconds / 1000;
+    spec.it_value.tv_nsec = (long)(mseconds % 1000) * 1000000;
+    timerfd_settime(poller->timerfd,0,&spec,NULL);
+}
+void pok_io_poller_wakeup(struct pok_io_poller* poller)
+{
+    uint64_t one = 1;
+    if (write(poller->eventfd,&one,sizeof(uint64_t)) == -1) {
+        /* the counter is already non-zero so the waiter will wake up anyway */
+    }
+}
+int pok_io_poller_wait(struct pok_io_poller* poller,int events)
+{
+    /* block until one of the specified events occurs (or the timer expires) */
+    int result = 0;
+    int out = poller->fd[1] == poller->fd[0] ? 0 : 1;
+    uint32_t want[2] = { 0, 0 };
+    if (events & pok_io_event_read)
+        want[0] |= EPOLLIN;
+    if (events & pok_io_event_write)
+        want[out] |= EPOLLOUT;
+    if ( !pok_io_poller_watch(poller,0,want[0]) || (out == 1 && !pok_io_poller_watch(poller,1,want[1])) )
+        return 0;
+    if ((events & pok_io_event_read) && poller->always[0])
+        result |= pok_io_event_read;
+    if ((events & pok_io_event_write) && poller->always[out])
+        result |= pok_io_event_write;
+    if ((events & pok_io_event_wakeup) && poller->woken) {
+        poller->woken = FALSE;
+        result |= pok_io_event_wakeup;
+    }
+    while (result == 0) {
+        int i, n;
+        uint64_t count;
+        struct epoll_event evs[4];
+        n = epoll_wait(poller->epfd,evs,4,-1);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            pok_exception_new_ex(pok_ex_net,pok_ex_net_unspec);
+            return 0;
+        }
+        for (i = 0;i < n;++i) {
+            uint32_t ev = evs[i].events;
+            switch (evs[i].data.u32) {
+            case POLLER_INPUT:
+            case POLLER_OUTPUT:
+                /* errors and hang-ups are reported as readiness so that the caller's next
+                   operation reports them */
+                if ((int)evs[i].data.u32 == 0 && (want[0] & EPOLLIN) && (ev & (EPOLLIN | EPOLLERR | EPOLLHUP)))
+                    result |= pok_io_event_read;
+                if ((int)evs[i].data.u32 == out && (want[out] & EPOLLOUT) && (ev & (EPOLLOUT | EPOLLERR | EPOLLHUP)))
+                    result |= pok_io_event_write;
+                break;
+            case POLLER_TIMER:
+                if (read(poller->timerfd,&count,sizeof(uint64_t)) > 0)
+                    result |= pok_io_event_timer;
+                break;
+            case POLLER_WAKEUP:
+                if (read(poller->eventfd,&count,sizeof(uint64_t)) > 0) {
+                    if (events & pok_io_event_wakeup)
+                        result |= pok_io_event_wakeup;
+                    else
+                        poller->woken = TRUE;
+                }
+                break;
+            }
+        }
+    }
+    return result;
+}
+#else
+/* the poller uses poll(2) on the data source's descriptors and a pipe for wakeups; the timer is
+   a deadline on the monotonic clock */
+struct pok_io_poller
+{
+    int fd[2];          /* input and output descriptors */
+    int wake[2];        /* pipe used to deliver wakeups */
+    uint64_t deadline;  /* time (milliseconds) at which the timer expires; zero if disarmed */
+    bool_t woken;       /* a wakeup arrived that has not been reported */
+};
+
+static uint64_t pok_io_poller_clock()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+struct pok_io_poller* pok_io_poller_new(struct pok_data_source* dsrc)
+{
+    struct pok_io_poller* poller;
+    poller = malloc(sizeof(struct pok_io_poller));
+    if (poller == NULL) {
+        pok_exception_flag_memory_error();
+        return NULL;
+    }
+    if (pipe(poller->wake) == -1) {
+        pok_exception_new_ex(pok_ex_net,pok_ex_net_could_not_create_poller);
+        free(poller);
+        return NULL;
+    }
+    fcntl(poller->wake[0],F_SETFL,O_NONBLOCK);
+    fcntl(poller->wake[1],F_SETFL,O_NONBLOCK);
+    poller->fd[0] = dsrc->fd[0];
+    poller->fd[1] = dsrc->mode & DS_MODE_FD_BOTH ? dsrc->fd[1] : dsrc->fd[0];
+    poller->deadline = 0;
+    poller->woken = FALSE;
+    return poller;
+}
+void pok_io_poller_free(struct pok_io_poller* poller)
+{
+    close(poller->wake[0]);
+    close(poller->wake[1]);
+    free(poller);
+}
+void pok_io_poller_set_timer(struct pok_io_poller* poller,uint32_t mseconds)
+{
+    poller->deadline = mseconds == 0 ? 0 : pok_io_poller_clock() + mseconds;
+}
+void pok_io_poller_wakeup(struct pok_io_poller* poller)
+{
+    byte_t one = 1;
+    if (write(poller->wake[1],&one,1) == -1) {
+        /* the pipe is full so the waiter will wake up anyway */
+    }
+}
+int pok_io_poller_wait(struct pok_io_poller* poller,int events)
+{
+    int result = 0;
+    if ((events & pok_io_event_wakeup) && poller->woken) {
+        poller->woken = FALSE;
+        return pok_io_event_wakeup;
+    }
+    while (result == 0) {
+        int n, timeout = -1;
+        nfds_t cnt = 1;
+        struct pollfd fds[3];
+        fds[0].fd = poller->wake[0];
+        fds[0].events = POLLIN;
+        if (events & pok_io_event_read) {
+            fds[cnt].fd = poller->fd[0];
+            fds[cnt++].events = POLLIN;
+        }
+        if (events & pok_io_event_write) {
+            fds[cnt].fd = poller->fd[1];
+            fds[cnt++].events = POLLOUT;
+        }
+        if (poller->deadline != 0) {
+            uint64_t now = pok_io_poller_clock();
+            timeout = now >= poller->deadline ? 0 : (int)(poller->deadline - now);
+        }
+        n = poll(fds,cnt,timeout);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            pok_exception_new_ex(pok_ex_net,pok_ex_net_unspec);
+            return 0;
+        }
+        if (n == 0) {
+            poller->deadline = 0;
+            result |= pok_io_event_timer;
+        }
+        for (n = 1;n < (int)cnt;++n)
+            if (fds[n].revents != 0)
+                result |= fds[n].events == POLLIN ? pok_io_event_read : pok_io_event_write;
+        if (fds[0].revents != 0) {
+            byte_t buf[64];
+            while (read(poller->wake[0],buf,sizeof(buf)) > 0)
+                ;
+            if (events & pok_io_event_wakeup)
+                result |= pok_io_event_wakeup;
+            else
+                poller->woken = TRUE;
+        }
+    }
+    return result;
+}
+#endif
+
+/* pok_listener */
+struct pok_listener
+{
+    int fd;
+    struct sockaddr_un addr;
+};
+
+struct pok_listener* pok_listener_new_local_named(const char* name)
+{
+    int err;
+    struct stat st;
+    struct pok_exception* ex;
+    struct pok_listener* listener = malloc(sizeof(struct pok_listener));
+    if (listener == NULL) {
+        pok_exception_flag_memory_error();
+        return NULL;
+    }
+    memset(&listener->addr,0,sizeof(struct sockaddr_un));
+    listener->addr.sun_family = AF_UNIX;
+    strncpy(listener->addr.sun_path,name,sizeof(listener->addr.sun_path) - 1);
+    /* remove a socket left behind by a previous server (but nothing else) */
+    if (stat(listener->addr.sun_path,&st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(listener->addr.sun_path);
+    listener->fd = socket(AF_UNIX,SOCK_STREAM,0);
+    if (listener->fd == -1
+        || bind(listener->fd,(const struct sockaddr*)&listener->addr,sizeof(struct sockaddr_un)) == -1
+        || listen(listener->fd,SOMAXCONN) == -1)
+    {
+        err = errno;
+        if (listener->fd != -1)
+            close(listener->fd);
+        ex = pok_exception_new_ex(pok_ex_net,pok_ex_net_could_not_create_listener);
+        pok_exception_append_message(ex,": '%s': %s",name,strerror(err));
+        free(listener);
+        return NULL;
+    }
+    fcntl(listener->fd,F_SETFL,O_NONBLOCK);
+    fcntl(listener->fd,F_SETFD,FD_CLOEXEC);
+    /* a peer that disconnects must not terminate the process the next time it is written to (the
+       write fails with 'pok_ex_net_brokenpipe' instead) */
+    signal(SIGPIPE,SIG_IGN);
+    return listener;
+}
+void pok_listener_free(struct pok_listener* listener)
+{
+    close(listener->fd);
+    unlink(listener->addr.sun_path);
+    free(listener);
+}
+struct pok_data_source* pok_listener_accept(struct pok_listener* listener)
+{
+    int fd;
+    struct pok_data_source* dsrc;
+    fd = accept(listener->fd,NULL,NULL);
+    if (fd == -1) {
+        struct pok_exception* ex;
+        ex = pok_exception_new();
+        ex->kind = pok_ex_net;
+        if (errno==EAGAIN || errno==EWOULDBLOCK || errno==ECONNABORTED)
+            ex->id = pok_ex_net_wouldblock;
+        else if (errno == EINTR)
+            ex->id = pok_ex_net_interrupt;
+        else {
+            ex->id = -1;
+            pok_exception_append_message(ex,"%s",strerror(errno));
+        }
+        pok_exception_load_message(ex);
+        return NULL;
+    }
+    dsrc = malloc(sizeof(struct pok_data_source));
+    if (dsrc == NULL) {
+        close(fd);
+        pok_exception_flag_memory_error();
+        return NULL;
+    }
+    fcntl(fd,F_SETFL,O_NONBLOCK);
+    fcntl(fd,F_SETFD,FD_CLOEXEC);
+    dsrc->fd[0] = fd;
+    dsrc->mode = DS_MODE_IS_SOCKET;
+    pok_data_source_init(dsrc,pok_iomode_full_duplex);
+    return dsrc;
+}
+
+/* pok_io_group */
+#ifdef __linux__
+/* the group is an epoll instance; a data source that uses two descriptors registers each one for
+   the events that apply to it (with the same tag) */
+#define POK_IO_GROUP_BATCH 64
+
+struct pok_io_group
+{
+    int epfd;
+    struct epoll_event evs[POK_IO_GROUP_BATCH];
+};
+
+struct pok_io_group* pok_io_group_new()
+{
+    struct pok_io_group* group;
+    group = malloc(sizeof(struct pok_io_group));
+    if (group == NULL) {
+        pok_exception_flag_memory_error();
+        return NULL;
+    }
+    group->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (group->epfd == -1) {
+        pok_exception_new_ex(pok_ex_net,pok_ex_net_could_not_create_poller);
+        free(group);
+        return NULL;
+    }
+    return group;
+}
+void pok_io_group_free(struct pok_io_group* group)
+{
+    close(group->epfd);
+    free(group);
+}
+static bool_t pok_io_group_ctl(struct pok_io_group* group,int fd,uint32_t events,void* tag)
+{
+    /* register, modify or remove (if 'events' is zero) a descriptor */
+    struct epoll_event ev;
+    ev.events = events;
+    ev.data.ptr = tag;
+    if (events == 0) {
+        if (epoll_ctl(group->epfd,EPOLL_CTL_DEL,fd,&ev) != -1 || errno == ENOENT)
+            return TRUE;
+    }
+    else if (epoll_ctl(group->epfd,EPOLL_CTL_MOD,fd,&ev) != -1
+        || (errno == ENOENT && epoll_ctl(group->epfd,EPOLL_CTL_ADD,fd,&ev) != -1))
+        return TRUE;
+    pok_exception_append_message(pok_exception_new_ex(pok_ex_net,pok_ex_net_unspec),": %s",strerror(errno));
+    return FALSE;
+}
+bool_t pok_io_group_watch(struct pok_io_group* group,struct pok_data_source* dsrc,int events,void* tag)
+{
+    uint32_t in, out;
+    in = (events & pok_io_event_read) ? EPOLLIN : 0;
+    out = (events & pok_io_event_write) ? EPOLLOUT : 0;
+    if ((dsrc->mode & DS_MODE_FD_BOTH) == 0)
+        return pok_io_group_ctl(group,dsrc->fd[0],in | out,tag);
+    return pok_io_group_ctl(group,dsrc->fd[0],in,tag) && pok_io_group_ctl(group,dsrc->fd[1],out,tag);
+}
+bool_t pok_io_group_watch_listener(struct pok_io_group* group,struct pok_listener* listener,void* tag)
+{
+    return pok_io_group_ctl(group,listener->fd,EPOLLIN,tag);
+}
+int pok_io_group_wait(struct pok_io_group* group,struct pok_io_group_event events[],int max,int mseconds)
+{
+    /* a hang-up or error is reported as both events so that the next operation discovers it */
+    int i, n;
+    if (max > POK_IO_GROUP_BATCH)
+        max = POK_IO_GROUP_BATCH;
+    n = epoll_wait(group->epfd,group->evs,max,mseconds < 0 ? -1 : mseconds);
+    if (n == -1) {
+        if (errno == EINTR)
+            return 0;
+        pok_exception_new_ex(pok_ex_net,pok_ex_net_unspec);
+        return -1;
+    }
+    for (i = 0;i < n;++i) {
+        uint32_t ev = group->evs[i].events;
+        events[i].tag = group->evs[i].data.ptr;
+        events[i].events = 0;
+        if (ev & (EPOLLIN | EPOLLHUP | EPOLLERR))
+            events[i].events |= pok_io_event_read;
+        if (ev & (EPOLLOUT | EPOLLHUP | EPOLLERR))
+            events[i].events |= pok_io_event_write;
+    }
+    return n;
+}
+#else
+/* the group is an array of descriptors for poll(2); the scan for ready descriptors resumes where
+   the last one stopped so that busy members cannot starve the rest */
+struct pok_io_group
+{
+    struct pollfd* fds;
+    void** tags;
+    nfds_t count, alloc, next;
+};
+
+struct pok_io_group* pok_io_group_new()
+{
+    struct pok_io_group* group;
+    group = malloc(sizeof(struct pok_io_group));
+    if (group == NULL) {
+        pok_exception_flag_memory_error();
+        return NULL;
+    }
+    group->fds = NULL;
+    group->tags = NULL;
+    group->count = group->alloc = group->next = 0;
+    return group;
+}
+void pok_io_group_free(struct pok_io_group* group)
+{
+    free(group->fds);
+    free(group->tags);
+    free(group);
+}
+static bool_t pok_io_group_set(struct pok_io_group* group,int fd,short events,void* tag)
+{
+    /* register, modify or remove (if 'events' is zero) a descriptor */
+    nfds_t i;
+    for (i = 0;i < group->count && group->fds[i].fd != fd;++i)
+        ;
+    if (events == 0) {
+        if (i < group->count) {
+            --group->count;
+            group->fds[i] = group->fds[group->count];
+            group->tags[i] = group->tags[group->count];
+        }
+        return TRUE;
+    }
+    if (i == group->count) {
+        if (group->count == group->alloc) {
+            nfds_t alloc = group->alloc == 0 ? 16 : group->alloc * 2;
+            struct pollfd* fds = realloc(group->fds,alloc * sizeof(struct pollfd));
+            void** tags;
+            if (fds == NULL) {
+                pok_exception_flag_memory_error();
+                return FALSE;
+            }
+            group->fds = fds;
+            tags = realloc(group->tags,alloc * sizeof(void*));
+            if (tags == NULL) {
+                pok_exception_flag_memory_error();
+                return FALSE;
+            }
+            group->tags = tags;
+            group->alloc = alloc;
+        }
+        group->fds[i].fd = fd;
+        ++group->count;
+    }
+    group->fds[i].events = events;
+    group->fds[i].revents = 0;
+    group->tags[i] = tag;
+    return TRUE;
+}
+bool_t pok_io_group_watch(struct pok_io_group* group,struct pok_data_source* dsrc,int events,void* tag)
+{
+    short in, out;
+    in = (events & pok_io_event_read) ? POLLIN : 0;
+    out = (events & pok_io_event_write) ? POLLOUT : 0;
+    if ((dsrc->mode & DS_MODE_FD_BOTH) == 0)
+        return pok_io_group_set(group,dsrc->fd[0],in | out,tag);
+    return pok_io_group_set(group,dsrc->fd[0],in,tag) && pok_io_group_set(group,dsrc->fd[1],out,tag);
+}
+bool_t pok_io_group_watch_listener(struct pok_io_group* group,struct pok_listener* listener,void* tag)
+{
+    return pok_io_group_set(group,listener->fd,POLLIN,tag);
+}
+int pok_io_group_wait(struct pok_io_group* group,struct pok_io_group_event events[],int max,int mseconds)
+{
+    /* a hang-up or error is reported as both events so that the next operation discovers it */
+    int n, cnt = 0;
+    nfds_t i, k;
+    n = poll(group->fds,group->count,mseconds < 0 ? -1 : mseconds);
+    if (n == -1) {
+        if (errno == EINTR)
+            return 0;
+        pok_exception_new_ex(pok_ex_net,pok_ex_net_unspec);
+        return -1;
+    }
+    for (k = 0;k < group->count && cnt < max && cnt < n;++k) {
+        short ev;
+        i = (group->next + k) % group->count;
+        ev = group->fds[i].revents;
+        if (ev == 0)
+            continue;
+        events[cnt].tag = group->tags[i];
+        events[cnt].events = 0;
+        if (ev & (POLLIN | POLLHUP | POLLERR))
+            events[cnt].events |= pok_io_event_read;
+        if (ev & (POLLOUT | POLLHUP | POLLERR))
+            events[cnt].events |= pok_io_event_write;
+        ++cnt;
+    }
+    group->next = group->count > 0 ? (group->next + k) % group->count : 0;
+    return cnt;
+}
+#endif
+
 /* pok_process */
 struct pok_process
 {
@@ -839,3 +1855,88 @@ int pok_thread_join(struct pok_thread* thread)
     thread->hasTerm = TRUE; /* flag that the thread has terminated */
     return thread->retval;
 }
+
+/* pok_file_view */
+struct pok_file_view
+{
+    byte_t* data;
+    size_t size;
+};
+
+struct pok_file_view* pok_file_view_new(const char* filename)
+{
+    int fd;
+    struct stat st;
+    struct pok_file_view* view;
+    view = malloc(sizeof(struct pok_file_view));
+    if (view == NULL) {
+        pok_exception_flag_memory_error();
+        return NULL;
+    }
+    fd = open(filename,O_RDONLY);
+    if (fd == -1) {
+        struct pok_exception* ex;
+        if (errno == EACCES)
+            ex = pok_exception_new_ex(pok_ex_net,pok_ex_net_file_permission_denied);
+        else if (errno == EINTR)
+            ex = pok_exception_new_ex(pok_ex_net,pok_ex_net_interrupt);
+        else if (errno==ENAMETOOLONG || errno==ENOTDIR || errno==EISDIR)
+            ex = pok_exception_new_ex(pok_ex_net,pok_ex_net_file_bad_path);
+        else if (errno == ENOENT)
+            ex = pok_exception_new_ex(pok_ex_net,pok_ex_net_file_does_not_exist);
+        else
+            ex = pok_exception_new_ex(pok_ex_default,pok_ex_default_undocumented);
+        pok_exception_append_message(ex,": '%s'",filename);
+        free(view);
+        return NULL;
+    }
+    if (fstat(fd,&st) == -1) {
+        pok_exception_new_ex(pok_ex_default,pok_ex_default_undocumented);
+        close(fd);
+        free(view);
+        return NULL;
+    }
+    view->size = st.st_size;
+    if (view->size == 0)
+        /* empty files cannot be mapped */
+        view->data = NULL;
+    else {
+        /* the mapping is private so that the view may be written to without changing the
+           file; the descriptor is not needed once the mapping exists */
+        view->data = mmap(NULL,view->size,PROT_READ | PROT_WRITE,MAP_PRIVATE,fd,0);
+        if (view->data == MAP_FAILED) {
+            pok_exception_new_ex(pok_ex_default,pok_ex_default_undocumented);
+            close(fd);
+            free(view);
+            return NULL;
+        }
+    }
+    close(fd);
+    return view;
+}
+void pok_file_view_free(struct pok_file_view* view)
+{
+    if (view->data != NULL)
+        munmap(view->data,view->size);
+    free(view);
+}
+byte_t* pok_file_view_data(struct pok_file_view* view)
+{
+    return view->data;
+}
+size_t pok_file_view_size(const struct pok_file_view* view)
+{
+    return view->size;
+}
+void pok_file_view_prefetch(struct pok_file_view* view,size_t offset,size_t size)
+{
+    /* ask the system to start reading in the pages that hold the range; this returns without
+       waiting for the reads and any error is ignored since it is only a hint */
+    size_t start;
+    if (view->data == NULL || offset >= view->size)
+        return;
+    if (size > view->size - offset)
+        size = view->size - offset;
+    start = offset - offset % (size_t)sysconf(_SC_PAGESIZE);
+    madvise(view->data + start,size + (offset - start),MADV_WILLNEED);
+}
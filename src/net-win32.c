@@ -1,6 +1,7 @@
 /* net-win32.c - pokgame */
 #include <WinSock2.h>
 #include <Windows.h>
+#include <zlib.h>
 
 /* Note: this file mirrors net-posix.c and as such it is not fully documented; see
    net-posix.c to find documented explainations of the functions defined in
@@ -8,12 +9,33 @@
    typenames, ETC. will be different (and of course the implementation will
    vary slightly) */
 
+/* compression layer (see 'pok_data_source_compress'); its buffers hold compressed bytes and never wrap */
+#define POK_ZBUFFER_INITIAL 16384
+struct pok_zbuffer
+{
+    BYTE* pData;
+    size_t Capacity;
+    size_t Head;
+    size_t Size;
+};
+struct pok_zstream
+{
+    BOOLEAN bDeflating;
+    BOOLEAN bInflating;
+    BOOLEAN bInflatePending; /* the last inflate filled its output */
+    z_stream Deflater;
+    z_stream Inflater;
+    struct pok_zbuffer Out; /* deflated bytes that have not been written to the device */
+    struct pok_zbuffer In; /* bytes read from the device that have not been inflated */
+};
+
 struct pok_data_source
 {
     BOOLEAN bIsSocket;
     BOOLEAN bAtEOF;
     BOOLEAN bDoBuffering;
     BOOLEAN bUsingStandard;
+    BOOLEAN bNonBlocking; /* the handle is a pipe in nonblocking mode (see 'pok_listener') */
 
     HANDLE hBoth;
     HANDLE hInput;
@@ -26,6 +48,14 @@ struct pok_data_source
     BYTE OutputBuffer[4096];
     DWORD OutputBufferSize;
     DWORD OutputBufferIterator;
+
+    BYTE* pMemory; /* non-NULL for a memory data source */
+    size_t MemorySize;
+    size_t MemoryCapacity;
+
+    struct pok_zstream* pZStream; /* NULL unless 'pok_data_source_compress' was called */
+
+    struct pok_data_source_stats Stats;
 };
 
 static void PokDataSourceInit(struct pok_data_source* dsrc)
@@ -34,6 +64,7 @@ static void PokDataSourceInit(struct pok_data_source* dsrc)
     dsrc->bAtEOF = FALSE;
     dsrc->bDoBuffering = TRUE;
     dsrc->bUsingStandard = FALSE;
+    dsrc->bNonBlocking = FALSE;
     dsrc->InputBufferSize = 0;
     dsrc->InputBufferIterator = 0;
     dsrc->OutputBufferSize = 0;
@@ -41,6 +72,11 @@ static void PokDataSourceInit(struct pok_data_source* dsrc)
     dsrc->hBoth = INVALID_HANDLE_VALUE;
     dsrc->hInput = INVALID_HANDLE_VALUE;
     dsrc->hOutput = INVALID_HANDLE_VALUE;
+    dsrc->pMemory = NULL;
+    dsrc->MemorySize = 0;
+    dsrc->MemoryCapacity = 0;
+    dsrc->pZStream = NULL;
+    memset(&dsrc->Stats, 0, sizeof(struct pok_data_source_stats));
 }
 struct pok_data_source* pok_data_source_new_standard()
 {
@@ -159,6 +195,270 @@ struct pok_data_source* pok_data_source_new_file(const char* filename, enum pok_
     }
     return dsrc;
 }
+struct pok_data_source* pok_data_source_new_memory()
+{
+    struct pok_data_source* dsrc = malloc(sizeof(struct pok_data_source));
+    if (dsrc == NULL) {
+        pok_exception_flag_memory_error();
+        return NULL;
+    }
+    PokDataSourceInit(dsrc);
+    dsrc->MemoryCapacity = sizeof(dsrc->OutputBuffer);
+    dsrc->pMemory = malloc(dsrc->MemoryCapacity);
+    if (dsrc->pMemory == NULL) {
+        pok_exception_flag_memory_error();
+        free(dsrc);
+        return NULL;
+    }
+    return dsrc;
+}
+static void PokDataSourceReadFailed(struct pok_data_source* dsrc)
+{
+    /* handle a failed read: reading from a broken pipe doesn't generate a normal end of file
+       on Win32 so we must check for the error codes denoting the end of file; a nonblocking
+       pipe with no data reports ERROR_NO_DATA */
+    struct pok_exception* ex;
+    DWORD err = GetLastError();
+    if (err == ERROR_BROKEN_PIPE || (dsrc->bNonBlocking && err == ERROR_PIPE_NOT_CONNECTED)) {
+        dsrc->bAtEOF = TRUE;
+        return;
+    }
+    ex = pok_exception_new();
+    ex->kind = pok_ex_net;
+    ex->id = dsrc->bNonBlocking && err == ERROR_NO_DATA ? pok_ex_net_wouldblock : pok_ex_net_unspec;
+}
+static bool_t PokDataSourceReadDevice(struct pok_data_source* dsrc, void* buffer, DWORD size, DWORD* bytesRead)
+{
+    ++dsrc->Stats.readCalls;
+    if (!ReadFile(dsrc->hBoth != INVALID_HANDLE_VALUE ? dsrc->hBoth : dsrc->hInput, buffer, size, bytesRead, NULL)) {
+        *bytesRead = 0;
+        PokDataSourceReadFailed(dsrc);
+        return FALSE;
+    }
+    if (*bytesRead == 0)
+        dsrc->bAtEOF = TRUE;
+    dsrc->Stats.bytesIn += *bytesRead;
+    return TRUE;
+}
+static bool_t PokDataSourceWriteDevice(struct pok_data_source* dsrc, const byte_t* buffer, size_t size, size_t* bytesWritten, bool_t flagError)
+{
+    DWORD r;
+    if (size == 0) {
+        *bytesWritten = 0;
+        return TRUE;
+    }
+    ++dsrc->Stats.writeCalls;
+    if (!WriteFile(
+        dsrc->hBoth != INVALID_HANDLE_VALUE ? dsrc->hBoth : dsrc->hOutput,
+        buffer,
+        size,
+        &r,
+        NULL)) {
+        /* write error */
+        if (flagError) {
+            struct pok_exception* ex;
+            ex = pok_exception_new();
+            ex->kind = pok_ex_net;
+            ex->id = pok_ex_net_unspec;
+        }
+        *bytesWritten = 0;
+        return FALSE;
+    }
+    if (r == 0 && dsrc->bNonBlocking) {
+        /* a nonblocking pipe whose buffer is full accepts nothing */
+        if (flagError)
+            pok_exception_new_ex(pok_ex_net, pok_ex_net_wouldblock);
+        *bytesWritten = 0;
+        return FALSE;
+    }
+    dsrc->Stats.bytesOut += r;
+    *bytesWritten = r;
+    return TRUE;
+}
+static bool_t PokDataSourceStore(struct pok_data_source* dsrc, const byte_t* buffer, size_t size)
+{
+    if (dsrc->MemorySize + size > dsrc->MemoryCapacity) {
+        BYTE* pNew;
+        size_t cap = dsrc->MemoryCapacity;
+        while (cap < dsrc->MemorySize + size)
+            cap <<= 1;
+        pNew = realloc(dsrc->pMemory, cap);
+        if (pNew == NULL) {
+            pok_exception_flag_memory_error();
+            return FALSE;
+        }
+        dsrc->pMemory = pNew;
+        dsrc->MemoryCapacity = cap;
+        ++dsrc->Stats.resizes;
+    }
+    memcpy(dsrc->pMemory + dsrc->MemorySize, buffer, size);
+    dsrc->MemorySize += size;
+    dsrc->Stats.bytesOut += size;
+    return TRUE;
+}
+
+/* compression layer: this mirrors the one in net-posix.c except that it sits beneath
+   single buffers instead of segments */
+static bool_t PokZBufferRoom(struct pok_zbuffer* zbuf, size_t need)
+{
+    size_t cap;
+    BYTE* pNew;
+    if (zbuf->pData != NULL && zbuf->Capacity - zbuf->Head - zbuf->Size >= need)
+        return TRUE;
+    if (zbuf->Capacity - zbuf->Size >= need) {
+        memmove(zbuf->pData, zbuf->pData + zbuf->Head, zbuf->Size);
+        zbuf->Head = 0;
+        return TRUE;
+    }
+    cap = zbuf->Capacity > 0 ? zbuf->Capacity : POK_ZBUFFER_INITIAL;
+    while (cap - zbuf->Size < need)
+        cap <<= 1;
+    pNew = malloc(cap);
+    if (pNew == NULL) {
+        pok_exception_flag_memory_error();
+        return FALSE;
+    }
+    if (zbuf->Size > 0)
+        memcpy(pNew, zbuf->pData + zbuf->Head, zbuf->Size);
+    free(zbuf->pData);
+    zbuf->pData = pNew;
+    zbuf->Capacity = cap;
+    zbuf->Head = 0;
+    return TRUE;
+}
+static bool_t PokZBufferDeflate(z_stream* strm, struct pok_zbuffer* dst, const byte_t* data, size_t size, int flush)
+{
+    strm->next_in = (Bytef*)data;
+    strm->avail_in = size;
+    do {
+        size_t room;
+        if (!PokZBufferRoom(dst, 1024))
+            return FALSE;
+        room = dst->Capacity - dst->Head - dst->Size;
+        strm->next_out = dst->pData + dst->Head + dst->Size;
+        strm->avail_out = room;
+        deflate(strm, flush);
+        dst->Size += room - strm->avail_out;
+    } while (strm->avail_in > 0 || strm->avail_out == 0);
+    return TRUE;
+}
+static bool_t PokZStreamDeflateMemory(struct pok_data_source* dsrc, const byte_t* data, size_t size, int flush)
+{
+    /* deflate bytes onto the end of a memory data source */
+    struct pok_zstream* z = dsrc->pZStream;
+    if (!PokZBufferDeflate(&z->Deflater, &z->Out, data, size, flush)
+        || !PokDataSourceStore(dsrc, z->Out.pData + z->Out.Head, z->Out.Size))
+        return FALSE;
+    z->Out.Head = 0;
+    z->Out.Size = 0;
+    dsrc->Stats.deflated += size;
+    return TRUE;
+}
+static bool_t PokZStreamDrain(struct pok_data_source* dsrc, bool_t flagError)
+{
+    size_t r;
+    struct pok_zbuffer* zbuf = &dsrc->pZStream->Out;
+    if (zbuf->Size == 0)
+        return TRUE;
+    if (!PokDataSourceWriteDevice(dsrc, zbuf->pData + zbuf->Head, zbuf->Size, &r, flagError))
+        return FALSE;
+    zbuf->Head += r;
+    zbuf->Size -= r;
+    if (zbuf->Size == 0)
+        zbuf->Head = 0;
+    return TRUE;
+}
+static bool_t PokZStreamWrite(struct pok_data_source* dsrc, const byte_t* buffer, size_t size, size_t* bytesWritten, bool_t flagError)
+{
+    /* the buffer is only accepted after every deflated byte from earlier writes has been
+       written; it is then deflated and flushed to a byte boundary so that the peer can inflate
+       everything that was accepted */
+    struct pok_zstream* z = dsrc->pZStream;
+    *bytesWritten = 0;
+    if (!PokZStreamDrain(dsrc, flagError))
+        return FALSE;
+    if (z->Out.Size > 0 || size == 0)
+        return TRUE;
+    if (!PokZBufferDeflate(&z->Deflater, &z->Out, buffer, size, Z_SYNC_FLUSH))
+        return FALSE;
+    *bytesWritten = size;
+    dsrc->Stats.deflated += size;
+    /* the buffer was accepted even if the device cannot take its deflated bytes yet */
+    if (!PokZStreamDrain(dsrc, flagError) && flagError && !pok_exception_pop_ex(pok_ex_net, pok_ex_net_wouldblock))
+        return FALSE;
+    return TRUE;
+}
+static bool_t PokZStreamRead(struct pok_data_source* dsrc, void* buffer, DWORD size, DWORD* bytesRead)
+{
+    /* inflate bytes into the buffer; the device is only read when the bytes already read from
+       it cannot produce any more */
+    int r;
+    DWORD n;
+    struct pok_zstream* z = dsrc->pZStream;
+    *bytesRead = 0;
+    while (TRUE) {
+        if (z->In.Size > 0 || z->bInflatePending) {
+            z->Inflater.next_in = z->In.pData + z->In.Head;
+            z->Inflater.avail_in = z->In.Size;
+            z->Inflater.next_out = buffer;
+            z->Inflater.avail_out = size;
+            r = inflate(&z->Inflater, Z_SYNC_FLUSH);
+            if (r != Z_OK && r != Z_BUF_ERROR) {
+                pok_exception_new_ex(pok_ex_net, pok_ex_net_corrupt_stream);
+                return FALSE;
+            }
+            *bytesRead = size - z->Inflater.avail_out;
+            z->bInflatePending = z->Inflater.avail_out == 0;
+            z->In.Head += z->In.Size - z->Inflater.avail_in;
+            z->In.Size = z->Inflater.avail_in;
+            if (z->In.Size == 0)
+                z->In.Head = 0;
+            if (*bytesRead > 0) {
+                dsrc->Stats.inflated += *bytesRead;
+                return TRUE;
+            }
+        }
+        if (!PokZBufferRoom(&z->In, sizeof(dsrc->InputBuffer)))
+            return FALSE;
+        if (!PokDataSourceReadDevice(dsrc, z->In.pData + z->In.Head + z->In.Size, z->In.Capacity - z->In.Head - z->In.Size, &n))
+            return FALSE;
+        if (n == 0)
+            return TRUE;
+        z->In.Size += n;
+    }
+}
+static void PokZStreamFree(struct pok_zstream* z)
+{
+    if (z->bDeflating)
+        deflateEnd(&z->Deflater);
+    if (z->bInflating)
+        inflateEnd(&z->Inflater);
+    free(z->Out.pData);
+    free(z->In.pData);
+    free(z);
+}
+
+static bool_t PokDataSourceAppend(struct pok_data_source* dsrc, const byte_t* buffer, size_t size)
+{
+    if (dsrc->pZStream != NULL && dsrc->pZStream->bDeflating)
+        return PokZStreamDeflateMemory(dsrc, buffer, size, Z_NO_FLUSH);
+    return PokDataSourceStore(dsrc, buffer, size);
+}
+static bool_t PokDataSourceReadPrimative(struct pok_data_source* dsrc, void* buffer, DWORD size, DWORD* bytesRead)
+{
+    /* read from the device or (if the input is compressed) the inflater; FALSE is returned if the
+       read failed, in which case either an exception was generated or the end of file was reached */
+    if (dsrc->pZStream != NULL && dsrc->pZStream->bInflating)
+        return PokZStreamRead(dsrc, buffer, size, bytesRead);
+    return PokDataSourceReadDevice(dsrc, buffer, size, bytesRead);
+}
+static bool_t pok_data_source_write_primative(struct pok_data_source* dsrc, const byte_t* buffer, size_t size, size_t* bytesWritten, bool_t flagError)
+{
+    /* write to the device or (if the output is compressed) the deflater */
+    if (dsrc->pZStream != NULL && dsrc->pZStream->bDeflating)
+        return PokZStreamWrite(dsrc, buffer, size, bytesWritten, flagError);
+    return PokDataSourceWriteDevice(dsrc, buffer, size, bytesWritten, flagError);
+}
 byte_t* pok_data_source_read(struct pok_data_source* dsrc, size_t bytesRequested, size_t* bytesRead)
 {
     DWORD it;
@@ -177,29 +477,17 @@ byte_t* pok_data_source_read(struct pok_data_source* dsrc, size_t bytesRequested
             if (dsrc->InputBufferSize > 0)
                 memcpy(dsrc->InputBuffer, dsrc->InputBuffer + dsrc->InputBufferIterator, dsrc->InputBufferSize);
             dsrc->InputBufferIterator = 0;
+            ++dsrc->Stats.compactions;
         }
         if (remain > 0) {
-            if (!ReadFile(dsrc->hBoth != INVALID_HANDLE_VALUE ? dsrc->hBoth : dsrc->hInput,
-                            dsrc->InputBuffer + dsrc->InputBufferSize + dsrc->InputBufferIterator,
-                            remain,
-                            &r,
-                            NULL))
+            if (!PokDataSourceReadPrimative(dsrc,
+                    dsrc->InputBuffer + dsrc->InputBufferSize + dsrc->InputBufferIterator,
+                    remain,
+                    &r))
             {
-                struct pok_exception* ex;
                 *bytesRead = 0;
-                if (GetLastError() == ERROR_BROKEN_PIPE) {
-                    /* reading from a broken pipe doesn't generate a normal end of file on
-                       Win32; we must check for the error code denoting the end of file */
-                    dsrc->bAtEOF = TRUE;
-                    return dsrc->InputBuffer;
-                }
-                ex = pok_exception_new();
-                ex->kind = pok_ex_net;
-                ex->id = pok_ex_net_unspec;
-                return NULL;
+                return dsrc->bAtEOF ? dsrc->InputBuffer : NULL;
             }
-            if (r == 0)
-                dsrc->bAtEOF = TRUE;
             dsrc->InputBufferSize += r;
         }
     }
@@ -213,8 +501,6 @@ byte_t* pok_data_source_read_any(struct pok_data_source* dsrc, size_t maxBytes,
 {
     DWORD it;
     DWORD br;
-    BOOLEAN b;
-    struct pok_exception* ex;
     if (dsrc->bAtEOF) {
         *bytesRead = 0;
         return dsrc->InputBuffer;
@@ -227,26 +513,11 @@ byte_t* pok_data_source_read_any(struct pok_data_source* dsrc, size_t maxBytes,
         *bytesRead = br;
         return dsrc->InputBuffer + it;
     }
-    b = ReadFile(dsrc->hBoth != INVALID_HANDLE_VALUE ? dsrc->hBoth : dsrc->hInput,
-                    dsrc->InputBuffer,
-                    sizeof(dsrc->InputBuffer),
-                    &br,
-                    FALSE);
-    if (!b) {
+    if (!PokDataSourceReadPrimative(dsrc, dsrc->InputBuffer, sizeof(dsrc->InputBuffer), &br)) {
         *bytesRead = 0;
-        if (GetLastError() == ERROR_BROKEN_PIPE) {
-            /* reading from a broken pipe doesn't generate a normal end of file on
-               Win32; we must check for the error code denoting the end of file */
-            dsrc->bAtEOF = TRUE;
-            return dsrc->InputBuffer;
-        }
-        ex = pok_exception_new();
-        ex->kind = pok_ex_net;
-        ex->id = pok_ex_net_unspec;
-        return NULL;
+        return dsrc->bAtEOF ? dsrc->InputBuffer : NULL;
     }
-    if (br == 0)
-        dsrc->bAtEOF = TRUE;
+    dsrc->InputBufferIterator = 0;
     dsrc->InputBufferSize += br;
     br = dsrc->InputBufferSize > maxBytes ? maxBytes : dsrc->InputBufferSize;
     it = dsrc->InputBufferIterator;
@@ -276,26 +547,16 @@ bool_t pok_data_source_read_to_buffer(struct pok_data_source* dsrc, void* buffer
         *bytesRead = 0;
     if (bytesRequested == 0)
         return TRUE;
-    if (!ReadFile(dsrc->hBoth != INVALID_HANDLE_VALUE ? dsrc->hBoth : dsrc->hInput,
-                    buffer, bytesRequested,
-                    &r,
-                    NULL))
-    {
-        struct pok_exception* ex;
-        *bytesRead = 0;
-        if (GetLastError() == ERROR_BROKEN_PIPE) {
-            /* reading from a broken pipe doesn't generate a normal end of file on
-               Win32; we must check for the error code denoting the end of file */
-            dsrc->bAtEOF = TRUE;
+    if (!PokDataSourceReadPrimative(dsrc, buffer, bytesRequested, &r)) {
+        /* if bytes were transferred from the input buffer then report them instead (the
+           error will occur again on the next call); an exception is left on the stack */
+        if (*bytesRead > 0) {
+            if (!dsrc->bAtEOF)
+                pok_exception_pop();
             return TRUE;
         }
-        ex = pok_exception_new();
-        ex->kind = pok_ex_net;
-        ex->id = pok_ex_net_unspec;
-        return FALSE;
+        return dsrc->bAtEOF;
     }
-    if (r == 0)
-        dsrc->bAtEOF = TRUE;
     *bytesRead += r;
     return TRUE;
 }
@@ -304,8 +565,11 @@ char pok_data_source_peek(struct pok_data_source* dsrc)
     size_t bytesRead;
     if (dsrc->InputBufferSize > 0)
         return dsrc->InputBuffer[dsrc->InputBufferIterator];
-    if (pok_data_source_read(dsrc, 1, &bytesRead) && bytesRead > 0)
+    /* the read consumes the bytes it returns so put them back */
+    if (pok_data_source_read(dsrc, 1, &bytesRead) && bytesRead > 0) {
+        ++dsrc->InputBufferSize;
         return dsrc->InputBuffer[--dsrc->InputBufferIterator];
+    }
     return (char)-1;
 }
 char pok_data_source_peek_ex(struct pok_data_source* dsrc, size_t lookahead)
@@ -313,8 +577,12 @@ char pok_data_source_peek_ex(struct pok_data_source* dsrc, size_t lookahead)
     size_t bytesRead;
     if (dsrc->InputBufferSize > lookahead)
         return dsrc->InputBuffer[dsrc->InputBufferIterator + lookahead];
-    if (pok_data_source_read(dsrc, lookahead - dsrc->InputBufferSize, &bytesRead) && bytesRead >= lookahead)
-        return dsrc->InputBuffer[dsrc->InputBufferIterator -= bytesRead];
+    if (pok_data_source_read(dsrc, lookahead + 1, &bytesRead) && bytesRead > 0) {
+        dsrc->InputBufferIterator -= bytesRead;
+        dsrc->InputBufferSize += bytesRead;
+        if (bytesRead > lookahead)
+            return dsrc->InputBuffer[dsrc->InputBufferIterator + lookahead];
+    }
     return (char)-1;
 }
 char pok_data_source_pop(struct pok_data_source* dsrc)
@@ -328,35 +596,13 @@ char pok_data_source_pop(struct pok_data_source* dsrc)
         return dsrc->InputBuffer[dsrc->InputBufferIterator - 1];
     return (char)-1;
 }
-static bool_t pok_data_source_write_primative(HANDLE hFile, const byte_t* buffer, size_t size, size_t* bytesWritten, bool_t flagError)
-{
-    DWORD r;
-    if (size == 0) {
-        *bytesWritten = 0;
-        return TRUE;
-    }
-    if (!WriteFile(
-        hFile,
-        buffer,
-        size,
-        &r,
-        NULL)) {
-        /* write error */
-        if (flagError) {
-            struct pok_exception* ex;
-            ex = pok_exception_new();
-            ex->kind = pok_ex_net;
-            ex->id = pok_ex_net_unspec;
-        }
-        *bytesWritten = 0;
-        return FALSE;
-    }
-    *bytesWritten = r;
-    return TRUE;
-}
 bool_t pok_data_source_write(struct pok_data_source* dsrc, const byte_t* buffer, size_t size, size_t* bytesWritten)
 {
     bool_t result;
+    if (dsrc->pMemory != NULL) {
+        *bytesWritten = PokDataSourceAppend(dsrc, buffer, size) ? size : 0;
+        return *bytesWritten == size;
+    }
     if (dsrc->bDoBuffering) {
         DWORD remain, bufR;
         remain = sizeof(dsrc->OutputBuffer) - dsrc->OutputBufferSize - dsrc->OutputBufferIterator;
@@ -390,7 +636,7 @@ bool_t pok_data_source_write(struct pok_data_source* dsrc, const byte_t* buffer,
         }
     }
     result = pok_data_source_write_primative(
-        dsrc->hBoth != INVALID_HANDLE_VALUE ? dsrc->hBoth : dsrc->hOutput,
+        dsrc,
         buffer,
         size,
         bytesWritten,
@@ -405,8 +651,10 @@ bool_t pok_data_source_flush(struct pok_data_source* dsrc)
 {
     bool_t result;
     size_t bytesOut;
+    if (dsrc->pMemory != NULL)
+        return TRUE;
     result = pok_data_source_write_primative(
-        dsrc->hBoth != INVALID_HANDLE_VALUE ? dsrc->hBoth : dsrc->hOutput,
+        dsrc,
         dsrc->OutputBuffer + dsrc->OutputBufferIterator,
         dsrc->OutputBufferSize,
         &bytesOut,
@@ -421,17 +669,83 @@ bool_t pok_data_source_flush(struct pok_data_source* dsrc)
 }
 enum pok_iomode pok_data_source_getmode(struct pok_data_source* dsrc)
 {
+    if (dsrc->pMemory != NULL)
+        return pok_iomode_write;
     if (dsrc->hBoth != INVALID_HANDLE_VALUE)
         return pok_iomode_full_duplex;
     else if (dsrc->hInput)
         return pok_iomode_read;
     return pok_iomode_write;
 }
+void pok_data_source_getstats(struct pok_data_source* dsrc, struct pok_data_source_stats* stats)
+{
+    *stats = dsrc->Stats;
+}
+const byte_t* pok_data_source_memory(struct pok_data_source* dsrc, size_t* size)
+{
+    if (dsrc->pMemory != NULL && dsrc->pZStream != NULL && dsrc->pZStream->bDeflating
+        && !PokZStreamDeflateMemory(dsrc, NULL, 0, Z_SYNC_FLUSH))
+    {
+        *size = 0;
+        return NULL;
+    }
+    *size = dsrc->MemorySize;
+    return dsrc->pMemory;
+}
+bool_t pok_data_source_compress(struct pok_data_source* dsrc, enum pok_iomode iomode, int level)
+{
+    /* buffered output was written before the switch so it is moved ahead of the deflated bytes;
+       buffered input came from the device after the switch so it is moved to be inflated */
+    struct pok_zstream* z = dsrc->pZStream;
+    if (z == NULL) {
+        z = malloc(sizeof(struct pok_zstream));
+        if (z == NULL) {
+            pok_exception_flag_memory_error();
+            return FALSE;
+        }
+        memset(z, 0, sizeof(struct pok_zstream));
+        dsrc->pZStream = z;
+    }
+    if ((iomode & pok_iomode_write) && !z->bDeflating) {
+        if (!PokZBufferRoom(&z->Out, dsrc->OutputBufferSize))
+            return FALSE;
+        if (deflateInit2(&z->Deflater, level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            pok_exception_new_format("pok_data_source_compress: bad compression level: %d", level);
+            return FALSE;
+        }
+        z->bDeflating = TRUE;
+        memcpy(z->Out.pData + z->Out.Head + z->Out.Size, dsrc->OutputBuffer + dsrc->OutputBufferIterator, dsrc->OutputBufferSize);
+        z->Out.Size += dsrc->OutputBufferSize;
+        dsrc->OutputBufferIterator = 0;
+        dsrc->OutputBufferSize = 0;
+    }
+    if ((iomode & pok_iomode_read) && !z->bInflating && dsrc->pMemory == NULL) {
+        if (!PokZBufferRoom(&z->In, dsrc->InputBufferSize))
+            return FALSE;
+        if (inflateInit2(&z->Inflater, -MAX_WBITS) != Z_OK) {
+            pok_exception_flag_memory_error();
+            return FALSE;
+        }
+        z->bInflating = TRUE;
+        memcpy(z->In.pData + z->In.Head + z->In.Size, dsrc->InputBuffer + dsrc->InputBufferIterator, dsrc->InputBufferSize);
+        z->In.Size += dsrc->InputBufferSize;
+        dsrc->InputBufferIterator = 0;
+        dsrc->InputBufferSize = 0;
+    }
+    return TRUE;
+}
 void pok_data_source_free(struct pok_data_source* dsrc)
 {
     size_t dummy;
+    if (dsrc->pMemory != NULL) {
+        if (dsrc->pZStream != NULL)
+            PokZStreamFree(dsrc->pZStream);
+        free(dsrc->pMemory);
+        free(dsrc);
+        return;
+    }
     pok_data_source_write_primative(
-        dsrc->hBoth != INVALID_HANDLE_VALUE ? dsrc->hBoth : dsrc->hOutput,
+        dsrc,
         dsrc->OutputBuffer + dsrc->OutputBufferIterator,
         dsrc->OutputBufferSize,
         &dummy,
@@ -446,6 +760,8 @@ void pok_data_source_free(struct pok_data_source* dsrc)
         if (dsrc->hOutput != INVALID_HANDLE_VALUE)
             CloseHandle(dsrc->hOutput);
     }
+    if (dsrc->pZStream != NULL)
+        PokZStreamFree(dsrc->pZStream);
     free(dsrc);
 }
 void pok_data_source_unread(struct pok_data_source* dsrc, size_t size)
@@ -461,7 +777,10 @@ void pok_data_source_unread(struct pok_data_source* dsrc, size_t size)
 }
 bool_t pok_data_source_save(struct pok_data_source* dsrc, const byte_t* buffer, size_t size)
 {
-    size_t remain = sizeof(dsrc->OutputBuffer) - dsrc->OutputBufferSize - dsrc->OutputBufferIterator;
+    size_t remain;
+    if (dsrc->pMemory != NULL)
+        return PokDataSourceAppend(dsrc, buffer, size);
+    remain = sizeof(dsrc->OutputBuffer) - dsrc->OutputBufferSize - dsrc->OutputBufferIterator;
     if (remain < size) {
         if (dsrc->OutputBufferIterator > 0) {
             remain += dsrc->OutputBufferIterator;
@@ -487,6 +806,322 @@ inline bool_t pok_data_source_endofcomms(struct pok_data_source* dsrc)
     return dsrc->bAtEOF;
 }
 
+/* pok_io_poller */
+struct pok_io_poller
+{
+    HANDLE hWakeup;    /* auto-reset event signaled by pok_io_poller_wakeup */
+    DWORD Deadline;    /* tick count at which the timer expires */
+    BOOLEAN bTimer;    /* the timer is armed */
+    BOOLEAN bWoken;    /* a wakeup arrived that has not been reported */
+};
+
+struct pok_io_poller* pok_io_poller_new(struct pok_data_source* dsrc)
+{
+    struct pok_io_poller* poller;
+    poller = malloc(sizeof(struct pok_io_poller));
+    if (poller == NULL) {
+        pok_exception_flag_memory_error();
+        return NULL;
+    }
+    poller->hWakeup = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if (poller->hWakeup == NULL) {
+        pok_exception_new_ex(pok_ex_net, pok_ex_net_could_not_create_poller);
+        free(poller);
+        return NULL;
+    }
+    poller->Deadline = 0;
+    poller->bTimer = FALSE;
+    poller->bWoken = FALSE;
+    (void)dsrc;
+    return poller;
+}
+void pok_io_poller_free(struct pok_io_poller* poller)
+{
+    CloseHandle(poller->hWakeup);
+    free(poller);
+}
+void pok_io_poller_set_timer(struct pok_io_poller* poller, uint32_t mseconds)
+{
+    poller->bTimer = mseconds != 0;
+    poller->Deadline = GetTickCount() + mseconds;
+}
+void pok_io_poller_wakeup(struct pok_io_poller* poller)
+{
+    SetEvent(poller->hWakeup);
+}
+int pok_io_poller_wait(struct pok_io_poller* poller, int events)
+{
+    /* data sources use blocking handles on Win32 so they are always ready; otherwise wait
+       on the wakeup event until the timer expires */
+    DWORD r, timeout = INFINITE;
+    if (events & (pok_io_event_read | pok_io_event_write))
+        return events & (pok_io_event_read | pok_io_event_write);
+    if (poller->bWoken && (events & pok_io_event_wakeup)) {
+        poller->bWoken = FALSE;
+        return pok_io_event_wakeup;
+    }
+    while (TRUE) {
+        if (poller->bTimer) {
+            DWORD now = GetTickCount();
+            timeout = (int)(poller->Deadline - now) <= 0 ? 0 : poller->Deadline - now;
+        }
+        r = WaitForSingleObject(poller->hWakeup, timeout);
+        if (r == WAIT_TIMEOUT) {
+            poller->bTimer = FALSE;
+            return pok_io_event_timer;
+        }
+        if (r != WAIT_OBJECT_0) {
+            pok_exception_new_ex(pok_ex_net, pok_ex_net_unspec);
+            return 0;
+        }
+        if (events & pok_io_event_wakeup)
+            return pok_io_event_wakeup;
+        poller->bWoken = TRUE;
+    }
+}
+
+/* pok_listener: a named pipe server; the pipe instance that waits for a client is in nonblocking
+   mode (PIPE_NOWAIT) so that 'ConnectNamedPipe' reports whether a client is connected without
+   waiting; once a client connects, the instance becomes the accepted data source (it stays in
+   nonblocking mode) and a new instance is created to wait for the next client */
+struct pok_listener
+{
+    HANDLE hPipe;
+    char* pName;
+};
+
+static HANDLE PokListenerCreatePipe(const char* name, DWORD dwFlags)
+{
+    return CreateNamedPipe(
+        name,
+        PIPE_ACCESS_DUPLEX | dwFlags,
+        PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_NOWAIT,
+        PIPE_UNLIMITED_INSTANCES,
+        sizeof(((struct pok_data_source*)NULL)->OutputBuffer),
+        sizeof(((struct pok_data_source*)NULL)->InputBuffer),
+        0,
+        NULL);
+}
+static int PokListenerProbe(struct pok_listener* listener)
+{
+    /* return 1 if a client is connected to the waiting instance, 0 if not or -1 if an exception
+       was generated; in nonblocking mode 'ConnectNamedPipe' only succeeds when it makes a
+       disconnected instance available again */
+    if (ConnectNamedPipe(listener->hPipe, NULL))
+        return 0;
+    switch (GetLastError()) {
+    case ERROR_PIPE_CONNECTED:
+        return 1;
+    case ERROR_PIPE_LISTENING:
+        return 0;
+    case ERROR_NO_DATA:
+        /* a client connected and closed its end before it was accepted */
+        DisconnectNamedPipe(listener->hPipe);
+        return 0;
+    }
+    pok_exception_new_ex(pok_ex_net, pok_ex_net_unspec);
+    return -1;
+}
+struct pok_listener* pok_listener_new_local_named(const char* name)
+{
+    struct pok_exception* ex;
+    struct pok_listener* listener;
+    if (strncmp(name, "\\\\.\\pipe\\", 9) != 0) {
+        ex = pok_exception_new_ex(pok_ex_net, pok_ex_net_could_not_create_listener);
+        pok_exception_append_message(ex, ": '%s': not a named pipe", name);
+        return NULL;
+    }
+    listener = malloc(sizeof(struct pok_listener));
+    if (listener == NULL) {
+        pok_exception_flag_memory_error();
+        return NULL;
+    }
+    listener->pName = malloc(strlen(name) + 1);
+    if (listener->pName == NULL) {
+        pok_exception_flag_memory_error();
+        free(listener);
+        return NULL;
+    }
+    strcpy(listener->pName, name);
+    /* the first instance fails if another server owns the name */
+    listener->hPipe = PokListenerCreatePipe(name, FILE_FLAG_FIRST_PIPE_INSTANCE);
+    if (listener->hPipe == INVALID_HANDLE_VALUE) {
+        ex = pok_exception_new_ex(pok_ex_net, pok_ex_net_could_not_create_listener);
+        pok_exception_append_message(ex, ": '%s'", name);
+        free(listener->pName);
+        free(listener);
+        return NULL;
+    }
+    return listener;
+}
+void pok_listener_free(struct pok_listener* listener)
+{
+    CloseHandle(listener->hPipe);
+    free(listener->pName);
+    free(listener);
+}
+struct pok_data_source* pok_listener_accept(struct pok_listener* listener)
+{
+    int r;
+    HANDLE hNext;
+    struct pok_data_source* dsrc;
+    r = PokListenerProbe(listener);
+    if (r <= 0) {
+        if (r == 0)
+            pok_exception_new_ex(pok_ex_net, pok_ex_net_wouldblock);
+        return NULL;
+    }
+    /* create the instance that waits for the next client before handing this one off */
+    hNext = PokListenerCreatePipe(listener->pName, 0);
+    if (hNext == INVALID_HANDLE_VALUE) {
+        pok_exception_new_ex(pok_ex_net, pok_ex_net_unspec);
+        return NULL;
+    }
+    dsrc = malloc(sizeof(struct pok_data_source));
+    if (dsrc == NULL) {
+        pok_exception_flag_memory_error();
+        CloseHandle(hNext);
+        return NULL;
+    }
+    PokDataSourceInit(dsrc);
+    dsrc->hBoth = listener->hPipe;
+    dsrc->bNonBlocking = TRUE;
+    listener->hPipe = hNext;
+    return dsrc;
+}
+
+/* pok_io_group */
+struct pok_io_group_member
+{
+    struct pok_data_source* dsrc;   /* NULL if the member is a listener */
+    struct pok_listener* listener;
+    int events;
+    void* tag;
+};
+
+struct pok_io_group
+{
+    struct pok_io_group_member* Members;
+    int Count;
+    int Capacity;
+};
+
+struct pok_io_group* pok_io_group_new()
+{
+    struct pok_io_group* group;
+    group = malloc(sizeof(struct pok_io_group));
+    if (group == NULL) {
+        pok_exception_flag_memory_error();
+        return NULL;
+    }
+    group->Members = NULL;
+    group->Count = 0;
+    group->Capacity = 0;
+    return group;
+}
+void pok_io_group_free(struct pok_io_group* group)
+{
+    free(group->Members);
+    free(group);
+}
+static int PokIoGroupFind(struct pok_io_group* group, struct pok_data_source* dsrc, struct pok_listener* listener)
+{
+    /* find the member or add a new one; -1 is returned if memory could not be allocated */
+    int i;
+    for (i = 0; i < group->Count; ++i)
+        if (group->Members[i].dsrc == dsrc && group->Members[i].listener == listener)
+            return i;
+    if (group->Count == group->Capacity) {
+        int cap = group->Capacity == 0 ? 16 : group->Capacity * 2;
+        struct pok_io_group_member* pNew = realloc(group->Members, cap * sizeof(struct pok_io_group_member));
+        if (pNew == NULL) {
+            pok_exception_flag_memory_error();
+            return -1;
+        }
+        group->Members = pNew;
+        group->Capacity = cap;
+    }
+    group->Members[i].dsrc = dsrc;
+    group->Members[i].listener = listener;
+    group->Members[i].events = 0;
+    ++group->Count;
+    return i;
+}
+static int PokIoGroupPoll(struct pok_io_group_member* member)
+{
+    /* return the events that are ready for a member or -1 if an exception was generated: a
+       listener is readable when a client is connected; a pipe is readable when it has data or
+       has been closed (other handles block so they are always readable); every data source is
+       writable since a nonblocking pipe accepts what fits and other handles block */
+    DWORD avail;
+    HANDLE h;
+    int ready;
+    struct pok_data_source* dsrc = member->dsrc;
+    if (member->listener != NULL) {
+        ready = PokListenerProbe(member->listener);
+        return ready <= 0 ? ready : pok_io_event_read;
+    }
+    ready = member->events & pok_io_event_write;
+    if (member->events & pok_io_event_read) {
+        h = dsrc->hBoth != INVALID_HANDLE_VALUE ? dsrc->hBoth : dsrc->hInput;
+        if (dsrc->InputBufferSize > 0 || dsrc->bAtEOF || !PeekNamedPipe(h, NULL, 0, NULL, &avail, NULL) || avail > 0)
+            ready |= pok_io_event_read;
+    }
+    return ready;
+}
+bool_t pok_io_group_watch(struct pok_io_group* group, struct pok_data_source* dsrc, int events, void* tag)
+{
+    int i;
+    if (events == 0) {
+        for (i = 0; i < group->Count && group->Members[i].dsrc != dsrc; ++i)
+            ;
+        if (i < group->Count)
+            group->Members[i] = group->Members[--group->Count];
+        return TRUE;
+    }
+    if ((i = PokIoGroupFind(group, dsrc, NULL)) == -1)
+        return FALSE;
+    group->Members[i].events = events;
+    group->Members[i].tag = tag;
+    return TRUE;
+}
+bool_t pok_io_group_watch_listener(struct pok_io_group* group, struct pok_listener* listener, void* tag)
+{
+    int i;
+    if ((i = PokIoGroupFind(group, NULL, listener)) == -1)
+        return FALSE;
+    group->Members[i].events = pok_io_event_read;
+    group->Members[i].tag = tag;
+    return TRUE;
+}
+int pok_io_group_wait(struct pok_io_group* group, struct pok_io_group_event events[], int max, int mseconds)
+{
+    /* anonymous and named pipes cannot be waited on without overlapped IO so the members are
+       polled: if none is ready, the thread sleeps for a tick and polls again until the time
+       expires */
+    DWORD start = GetTickCount();
+    while (TRUE) {
+        int i, n = 0;
+        DWORD elapsed;
+        for (i = 0; i < group->Count && n < max; ++i) {
+            int ready = PokIoGroupPoll(group->Members + i);
+            if (ready == -1)
+                return -1;
+            if (ready != 0) {
+                events[n].tag = group->Members[i].tag;
+                events[n].events = ready;
+                ++n;
+            }
+        }
+        if (n > 0)
+            return n;
+        elapsed = GetTickCount() - start;
+        if (mseconds >= 0 && elapsed >= (DWORD)mseconds)
+            return 0;
+        Sleep(1);
+    }
+}
+
 /* pok_process */
 struct pok_process
 {
@@ -701,3 +1336,95 @@ int pok_thread_join(struct pok_thread* thread)
         pok_error(pok_error_fatal, "fail pok_thread_join()");
     return thread->retval;
 }
+
+/* pok_file_view */
+struct pok_file_view
+{
+    byte_t* data;
+    size_t size;
+};
+
+struct pok_file_view* pok_file_view_new(const char* filename)
+{
+    HANDLE hFile, hMapping;
+    LARGE_INTEGER size;
+    struct pok_file_view* view;
+    view = malloc(sizeof(struct pok_file_view));
+    if (view == NULL) {
+        pok_exception_flag_memory_error();
+        return NULL;
+    }
+    hFile = CreateFile(
+        filename,
+        GENERIC_READ,
+        FILE_SHARE_READ,
+        NULL,
+        OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL,
+        NULL);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        struct pok_exception* ex;
+        DWORD err = GetLastError();
+        if (err == ERROR_ACCESS_DENIED)
+            ex = pok_exception_new_ex(pok_ex_net, pok_ex_net_file_permission_denied);
+        else if (err == ERROR_FILE_NOT_FOUND || err == ERROR_PATH_NOT_FOUND)
+            ex = pok_exception_new_ex(pok_ex_net, pok_ex_net_file_does_not_exist);
+        else
+            ex = pok_exception_new_ex(pok_ex_default, pok_ex_default_undocumented);
+        pok_exception_append_message(ex, ": '%s'", filename);
+        free(view);
+        return NULL;
+    }
+    if ( !GetFileSizeEx(hFile, &size) ) {
+        pok_exception_new_ex(pok_ex_default, pok_ex_default_undocumented);
+        CloseHandle(hFile);
+        free(view);
+        return NULL;
+    }
+    view->size = (size_t)size.QuadPart;
+    view->data = NULL;
+    if (view->size > 0) {
+        /* a copy-on-write view lets the process write to the pages without changing the file; the
+           handles are not needed once the view exists */
+        hMapping = CreateFileMapping(hFile, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+        if (hMapping != NULL) {
+            view->data = MapViewOfFile(hMapping, FILE_MAP_COPY, 0, 0, 0);
+            CloseHandle(hMapping);
+        }
+        if (view->data == NULL) {
+            pok_exception_new_ex(pok_ex_default, pok_ex_default_undocumented);
+            CloseHandle(hFile);
+            free(view);
+            return NULL;
+        }
+    }
+    CloseHandle(hFile);
+    return view;
+}
+void pok_file_view_free(struct pok_file_view* view)
+{
+    if (view->data != NULL)
+        UnmapViewOfFile(view->data);
+    free(view);
+}
+byte_t* pok_file_view_data(struct pok_file_view* view)
+{
+    return view->data;
+}
+size_t pok_file_view_size(const struct pok_file_view* view)
+{
+    return view->size;
+}
+void pok_file_view_prefetch(struct pok_file_view* view, size_t offset, size_t size)
+{
+    /* ask the system to start reading in the pages that hold the range; this is only a hint and
+       it requires Windows 8 (on older systems the pages are read when they are first touched) */
+#if _WIN32_WINNT >= 0x0602
+    WIN32_MEMORY_RANGE_ENTRY range;
+    if (view->data == NULL || offset >= view->size)
+        return;
+    range.VirtualAddress = view->data + offset;
+    range.NumberOfBytes = size > view->size - offset ? view->size - offset : size;
+    PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#endif
+}
@@ -66,14 +66,14 @@ static void from_bin32(uint32_t src,byte_t* dst)
 }
 static void to_bin64(const byte_t* src,uint64_t* dst)
 {
-    size_t i;
+    int i;
     *dst = 0;
 #ifdef POKGAME_BIG_ENDIAN
     for (i = 7;i >= 0;--i)
 #else
     for (i = 0;i < 8;++i)
 #endif
-        *dst |= *(src+i) << (8*i);
+        *dst |= (uint64_t)*(src+i) << (8*i);
 }
 static void from_bin64(uint64_t src,byte_t* dst)
 {
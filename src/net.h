@@ -27,7 +27,16 @@ enum pok_ex_net
     pok_ex_net_could_not_create_process,
     pok_ex_net_bad_program,
     pok_ex_net_program_not_found,
-    pok_ex_net_execute_denied
+    pok_ex_net_execute_denied,
+
+    /* flagged when 'pok_io_poller_new' fails */
+    pok_ex_net_could_not_create_poller,
+
+    /* flagged when 'pok_listener_new_local_named' fails */
+    pok_ex_net_could_not_create_listener,
+
+    /* flagged when compressed input cannot be inflated */
+    pok_ex_net_corrupt_stream
 };
 
 /* IPv4 network address information */
@@ -58,11 +67,23 @@ enum pok_iomode
    operating system; to the rest of the application it is an opaque type used to receive
    and send data to another process, either local or remote */
 struct pok_data_source;
+
+/* pok_data_source_stats: counters kept by a data source for profiling */
+struct pok_data_source_stats
+{
+    uint64_t bytesIn, bytesOut;     /* bytes read from and written to the device */
+    uint64_t readCalls, writeCalls; /* system calls issued to read and write */
+    uint64_t compactions;           /* buffered input moved so that a read is contiguous */
+    uint64_t resizes;               /* buffers grown to fit a request */
+    uint64_t deflated, inflated;    /* bytes written before compression and read after decompression */
+};
+
 struct pok_data_source* pok_data_source_new_standard();
 struct pok_data_source* pok_data_source_new_local_named(const char* name);
 struct pok_data_source* pok_data_source_new_local_anon();
 struct pok_data_source* pok_data_source_new_network(struct pok_network_address* address);
 struct pok_data_source* pok_data_source_new_file(const char* filename,enum pok_filemode mode,enum pok_iomode access);
+struct pok_data_source* pok_data_source_new_memory();
 byte_t* pok_data_source_read(struct pok_data_source* dsrc,size_t bytesRequested,size_t* bytesRead);
 byte_t* pok_data_source_read_any(struct pok_data_source* dsrc,size_t maxBytes,size_t* bytesRead);
 bool_t pok_data_source_read_to_buffer(struct pok_data_source* dsrc,void* buffer,size_t bytesRequested,size_t* bytesRead);
@@ -75,6 +96,9 @@ void pok_data_source_unread(struct pok_data_source* dsrc,size_t size);
 bool_t pok_data_source_save(struct pok_data_source* dsrc,const byte_t* buffer,size_t size);
 bool_t pok_data_source_flush(struct pok_data_source* dsrc);
 enum pok_iomode pok_data_source_getmode(struct pok_data_source* dsrc);
+void pok_data_source_getstats(struct pok_data_source* dsrc,struct pok_data_source_stats* stats);
+const byte_t* pok_data_source_memory(struct pok_data_source* dsrc,size_t* size);
+bool_t pok_data_source_compress(struct pok_data_source* dsrc,enum pok_iomode iomode,int level);
 void pok_data_source_free(struct pok_data_source* dsrc);
 
 /* higher-level data-stream operations */
@@ -106,6 +130,69 @@ bool_t pok_data_stream_write_string(struct pok_data_source* dsrc,const char* src
 bool_t pok_data_stream_write_string_ex(struct pok_data_source* dsrc,const char* src,size_t numBytes);
 bool_t pok_data_stream_write_string_obj(struct pok_data_source* dsrc,const struct pok_string* src);
 
+/* a memory data source keeps everything that is written to it in a growing buffer (see
+   'pok_data_source_memory') and cannot be read; it lets an object be encoded once (e.g. with
+   the data-stream functions) and the bytes sent to many peers */
+
+/* stream compression: 'pok_data_source_compress' puts a raw deflate stream between a data source
+   and its device for the directions in 'iomode'; it applies to every byte that has not yet reached
+   the device (or been read by the caller) so it is called at the point in a protocol where the
+   peers agreed to switch; 'level' is a zlib compression level (POK_COMPRESSION_DEFAULT or 0 to 9);
+   output is flushed to a byte boundary every time it is sent to the device (i.e. when the data source
+   is flushed or its output buffer fills) so that a peer can inflate each message as soon as it
+   arrives; the output of a memory data source is flushed by 'pok_data_source_memory'; since the
+   flushed segments do not refer to one another, segments compressed separately (e.g. by different
+   memory data sources) can be sent one after another on the same stream */
+#define POK_COMPRESSION_DEFAULT (-1)
+
+/* pok_io_poller: waits on a data source until it is ready to be read or written, a one-shot timer
+   expires or another thread calls 'pok_io_poller_wakeup'; this lets a thread sleep until it has
+   something to do instead of polling; a wakeup that arrives while the waiter is not interested in
+   wakeups is remembered until it is; its implementation is platform specific */
+enum pok_io_event
+{
+    pok_io_event_none = 0x00,
+    pok_io_event_read = 0x01,   /* the data source has input (or reached the end of communications) */
+    pok_io_event_write = 0x02,  /* the data source can accept output */
+    pok_io_event_timer = 0x04,  /* the timer expired (this is always reported) */
+    pok_io_event_wakeup = 0x08  /* another thread called 'pok_io_poller_wakeup' */
+};
+
+struct pok_io_poller;
+struct pok_io_poller* pok_io_poller_new(struct pok_data_source* dsrc);
+void pok_io_poller_free(struct pok_io_poller* poller);
+void pok_io_poller_set_timer(struct pok_io_poller* poller,uint32_t mseconds); /* zero disarms the timer */
+void pok_io_poller_wakeup(struct pok_io_poller* poller); /* may be called from any thread */
+int pok_io_poller_wait(struct pok_io_poller* poller,int events); /* returns the events that occurred; zero if an exception was generated */
+
+/* pok_listener: accepts connections on a local named socket (a Unix domain socket or a named pipe);
+   the accepted data sources do not block: an operation that cannot make progress generates a
+   'pok_ex_net_wouldblock' exception; its implementation is platform specific */
+struct pok_listener;
+struct pok_listener* pok_listener_new_local_named(const char* name);
+void pok_listener_free(struct pok_listener* listener);
+struct pok_data_source* pok_listener_accept(struct pok_listener* listener); /* NULL with 'pok_ex_net_wouldblock' if no connection is pending */
+
+/* pok_io_group: waits on many data sources (and listeners) at once so that a single thread can
+   serve many peers; each member is registered with the events it wants ('pok_io_event_read' and/or
+   'pok_io_event_write') and a tag that is reported back with its events; a listener is readable
+   when a connection is pending; a data source must be removed (by watching no events) before it
+   is freed; its implementation is platform specific */
+struct pok_io_group_event
+{
+    void* tag;
+    int events;
+};
+
+struct pok_io_group;
+struct pok_io_group* pok_io_group_new();
+void pok_io_group_free(struct pok_io_group* group);
+bool_t pok_io_group_watch(struct pok_io_group* group,struct pok_data_source* dsrc,int events,void* tag);
+bool_t pok_io_group_watch_listener(struct pok_io_group* group,struct pok_listener* listener,void* tag);
+/* wait at most 'mseconds' (or indefinitely if negative) for events; returns the number of events stored
+   in 'events' (zero if the time expired) or -1 if an exception was generated */
+int pok_io_group_wait(struct pok_io_group* group,struct pok_io_group_event events[],int max,int mseconds);
+
 /* pok_process: an abstraction around starting a process; its implementation is platform specific */
 #define PROCESS_TIMEOUT_INFINITE -1
 enum pok_process_state
@@ -130,4 +217,14 @@ void pok_thread_free(struct pok_thread* thread);
 void pok_thread_start(struct pok_thread* thread);
 int pok_thread_join(struct pok_thread* thread);
 
+/* pok_file_view: a memory mapping of an entire file; the view is private to the process: it
+   may be written to (pages are copied when they are first written) but the changes never reach
+   the file; its implementation is platform specific */
+struct pok_file_view;
+struct pok_file_view* pok_file_view_new(const char* filename);
+void pok_file_view_free(struct pok_file_view* view);
+byte_t* pok_file_view_data(struct pok_file_view* view);
+size_t pok_file_view_size(const struct pok_file_view* view);
+void pok_file_view_prefetch(struct pok_file_view* view,size_t offset,size_t size); /* hint: range is read soon */
+
 #endif
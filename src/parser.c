@@ -5,6 +5,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#endif
 
 typedef int pstatus_t;
 #define SUCCESS_PARSE   0
@@ -90,8 +93,6 @@ static bool_t pok_parser_info_check_generic(void** array,size_t elemsize,size_t
 }
 static inline bool_t pok_parser_info_check_bytes(struct pok_parser_info* info)
 { return pok_parser_info_check_generic((void**)&info->bytes,1,info->bytes_c); }
-static inline bool_t pok_parser_info_check_words(struct pok_parser_info* info)
-{ return pok_parser_info_check_generic((void**)&info->words,sizeof(uint16_t),info->words_c); }
 static inline bool_t pok_parser_info_check_qwords(struct pok_parser_info* info)
 { return pok_parser_info_check_generic((void**)&info->qwords,sizeof(uint32_t),info->qwords_c); }
 static inline bool_t pok_parser_info_check_strings(struct pok_parser_info* info)
@@ -104,8 +105,6 @@ static inline bool_t pok_parser_info_check_strings(struct pok_parser_info* info)
 
     [newline]: ( '\n' | '\r' )+
 
-    [sep]: ( ' ' | '\t' )* info->sep ( ' ' | '\t' )*
-
     [wspace]: ( ' ' | '\t' | '\r' | '\n' )+
 
     [wspace-opt]: ( ' ' | '\t' | '\r' | '\n' )*
@@ -168,17 +167,6 @@ static pstatus_t pok_parse_byte(struct pok_parser_info* info)
     return FAIL_NO_MATCH;
 }
 
-static pstatus_t pok_parse_word(struct pok_parser_info* info)
-{
-    if ( pok_parse_number(info) ) {
-        if ( !pok_parser_info_check_words(info) )
-            return FAIL_WITH_ERROR;
-        info->words[info->words_c[0]++] = (uint16_t) info->number;
-        return SUCCESS_PARSE;
-    }
-    return FAIL_NO_MATCH;
-}
-
 static pstatus_t pok_parse_qword(struct pok_parser_info* info)
 {
     if ( pok_parse_number(info) ) {
@@ -239,25 +227,6 @@ static pstatus_t pok_parse_newline(struct pok_parser_info* info)
     return SUCCESS_PARSE;
 }
 
-static pstatus_t pok_parse_sep(struct pok_parser_info* info)
-{
-    /* nothing is extracted here */
-    char c;
-    while (TRUE) {
-        c = pok_data_source_peek(info->dsrc);
-        if (c != ' ' && c != '\t')
-            break;
-        pok_data_source_pop(info->dsrc);
-    }
-    if (c != info->separator)
-        return FAIL_NO_MATCH;
-    do {
-        pok_data_source_pop(info->dsrc);
-        c = pok_data_source_peek(info->dsrc);
-    } while (c == ' ' || c == '\t');
-    return SUCCESS_PARSE;
-}
-
 static pstatus_t pok_parse_wspace(struct pok_parser_info* info)
 {
     /* nothing is extracted here */
@@ -596,63 +565,214 @@ bool_t pok_parse_cmdline_ex(const char* cmdline,struct pok_string* buffer,const
       <row> <row-data>
       []      // empty
 
+    [sep]: ( ' ' | '\t' )* info->separator ( ' ' | '\t' )*
+
+    when the separator is ' ', [sep] is any run of spaces and tabs; the last row may end the
+    input without a newline
  */
-static pstatus_t map_simple_row(struct pok_parser_info* info);
-static pstatus_t map_simple_row_part(struct pok_parser_info* info)
+
+/* streaming tokenizer for the pok-map/simple grammar: the row data is read a block at a time
+   into a buffer and tokenized in place by a state machine (there is no recursion and nothing
+   is collected into the 'words' array); the buffer always has a padding of zero bytes after the
+   data so that the number kernel may load a full vector past the end of a token */
+#define MAP_STREAM_BLOCK 65536
+#define MAP_STREAM_PAD 16
+#define MAP_STREAM_LOOKAHEAD 64 /* a number must be completely in the buffer before it is parsed */
+
+enum map_stream_state
 {
-    if (pok_parse_sep(info) == SUCCESS_PARSE)
-        return map_simple_row(info);
-    if (pok_parse_newline(info) == SUCCESS_PARSE)
-        return SUCCESS_PARSE;
-    return FAIL_NO_MATCH;
+    map_stream_row,   /* expecting a number at the start of a row */
+    map_stream_sign,  /* expecting the digits of a negative number */
+    map_stream_after, /* after a number */
+    map_stream_space, /* after a number and whitespace */
+    map_stream_sep    /* after a separator */
+};
+
+static inline unsigned map_stream_count_digits(const char* p)
+{
+    /* count the decimal digits at 'p' sixteen bytes at a time (eight without SSE2); the run is
+       always terminated by the padding after the data */
+    unsigned n = 0;
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    const __m128i zero = _mm_set1_epi8('0' - 1), nine = _mm_set1_epi8('9' + 1);
+    while (TRUE) {
+        unsigned mask;
+        __m128i v = _mm_loadu_si128((const __m128i*)(p + n));
+        mask = (unsigned)_mm_movemask_epi8(_mm_and_si128(_mm_cmpgt_epi8(v,zero),_mm_cmplt_epi8(v,nine)));
+        if (mask != 0xffff) {
+            mask = ~mask;
+#if defined(_MSC_VER)
+            {
+                unsigned long bit;
+                _BitScanForward(&bit,mask);
+                return n + (unsigned)bit;
+            }
+#else
+            return n + (unsigned)__builtin_ctz(mask);
+#endif
+        }
+        n += 16;
+    }
+#else
+    while (p[n] >= '0' && p[n] <= '9')
+        ++n;
+    return n;
+#endif
 }
-pstatus_t map_simple_row(struct pok_parser_info* info)
+
+static inline uint64_t map_stream_eight_digits(const char* p,unsigned n)
 {
-    pstatus_t r;
-    r = pok_parse_word(info);
-    if (r == SUCCESS_PARSE)
-        return map_simple_row_part(info);
-    return r;
+    /* convert 1 to 8 digits at once: the digits are loaded into a word with the first digit in
+       the low byte and shifted up so that the unused bytes become leading zeros; then adjacent
+       bytes, 16-bit halves and 32-bit halves are combined with one multiply each */
+    uint64_t w;
+    w = (uint64_t)(byte_t)p[0] | (uint64_t)(byte_t)p[1] << 8 | (uint64_t)(byte_t)p[2] << 16 | (uint64_t)(byte_t)p[3] << 24
+        | (uint64_t)(byte_t)p[4] << 32 | (uint64_t)(byte_t)p[5] << 40 | (uint64_t)(byte_t)p[6] << 48 | (uint64_t)(byte_t)p[7] << 56;
+    w = (w - UINT64_C(0x3030303030303030)) << (8 * (8 - n));
+    w = (w * 10 + (w >> 8)) & UINT64_C(0x00ff00ff00ff00ff);
+    w = (w * 100 + (w >> 16)) & UINT64_C(0x0000ffff0000ffff);
+    return (w * 10000 + (w >> 32)) & UINT64_C(0xffffffff);
 }
-static pstatus_t map_simple_row_data(struct pok_parser_info* info)
+
+static inline uint64_t map_stream_number(const char* p,unsigned n)
 {
-    pstatus_t r;
-    r = map_simple_row(info);
-    if (r == SUCCESS_PARSE)
-        return map_simple_row_data(info);
-    if (r == FAIL_NO_MATCH) {
-        if (pok_data_source_peek(info->dsrc) == -1)
-            return SUCCESS_PARSE;
-        pok_exception_new_format("parse map simple: line %d: expected row or end of input",info->lineno);
-    }
-    return FAIL_WITH_ERROR;
+    static const uint32_t powers[] = {1,10,100,1000,10000,100000,1000000,10000000,100000000};
+    uint64_t value = 0;
+    while (n > 8) {
+        value = value * powers[8] + map_stream_eight_digits(p,8);
+        p += 8;
+        n -= 8;
+    }
+    return value * powers[n] + map_stream_eight_digits(p,n);
 }
-bool_t pok_parse_map_simple(struct pok_parser_info* info)
+
+bool_t pok_parse_map_simple_header(struct pok_parser_info* info)
 {
-    pstatus_t r = pok_parse_qword(info);
-    if (r == FAIL_NO_MATCH) {
-        pok_exception_new_format("parse map simple: line %d: expected width",info->lineno);
+    /* the header is small so it is parsed with the regular grammar */
+    if (pok_parse_qword(info) != SUCCESS_PARSE || pok_parse_newline(info) != SUCCESS_PARSE
+        || pok_parse_qword(info) != SUCCESS_PARSE || pok_parse_newline(info) != SUCCESS_PARSE) {
+        pok_exception_new_format("parse map simple: line %d: expected width and height",info->lineno);
         return FALSE;
     }
-    if (r == SUCCESS_PARSE) {
-        if (pok_parse_newline(info) == FAIL_NO_MATCH) {
-            pok_exception_new_format("parse map simple: line %d: expected newline after width",info->lineno);
-            return FALSE;
-        }
-        r = pok_parse_qword(info);
-        if (r == FAIL_NO_MATCH) {
-            pok_exception_new_format("parse map simple: line %d: expected height",info->lineno);
-            return FALSE;
+    return TRUE;
+}
+bool_t pok_parse_map_simple_rows(struct pok_parser_info* info,uint32_t width,uint32_t height,pok_parser_map_row row,void* context)
+{
+    char* buffer;
+    uint16_t* tiles;
+    size_t col = 0;
+    uint32_t rowNo = 0;
+    char* p, * end;
+    bool_t eof = FALSE, neg = FALSE, result = FALSE;
+    enum map_stream_state state = map_stream_row;
+
+    info->number = 0;
+    buffer = malloc(MAP_STREAM_BLOCK + MAP_STREAM_LOOKAHEAD + MAP_STREAM_PAD);
+    tiles = malloc(sizeof(uint16_t) * (width > 0 ? width : 1));
+    if (buffer == NULL || tiles == NULL) {
+        pok_exception_flag_memory_error();
+        goto done;
+    }
+    p = end = buffer;
+
+    while (TRUE) {
+        char* limit;
+        size_t left = end - p;
+        /* refill the buffer once the data left could end in the middle of a token */
+        if (!eof && left <= MAP_STREAM_LOOKAHEAD) {
+            size_t bytesRead;
+            memmove(buffer,p,left);
+            p = buffer;
+            end = buffer + left;
+            if ( !pok_data_source_read_to_buffer(info->dsrc,end,MAP_STREAM_BLOCK,&bytesRead) )
+                goto done;
+            eof = bytesRead == 0;
+            end += bytesRead;
+            memset(end,0,MAP_STREAM_PAD);
+            if (!eof && (size_t)(end - p) <= MAP_STREAM_LOOKAHEAD)
+                continue; /* short read */
         }
-        if (r == SUCCESS_PARSE) {
-            if (pok_parse_newline(info) == FAIL_NO_MATCH) {
-                pok_exception_new_format("parse map simple: line %d: expected newline after height",info->lineno);
-                return FALSE;
+        if (p >= end)
+            break;
+        limit = eof ? end : end - MAP_STREAM_LOOKAHEAD;
+
+        while (p < limit) {
+            char c = *p;
+            if ((c >= '0' && c <= '9') && state != map_stream_after) {
+                unsigned n;
+                uint64_t value;
+                if (state == map_stream_space && info->separator != ' ')
+                    goto fail;
+                n = map_stream_count_digits(p);
+                if (!eof && p + n >= end) {
+                    pok_exception_new_format("parse map simple: line %d: number is too long",info->lineno);
+                    goto done;
+                }
+                value = map_stream_number(p,n);
+                p += n;
+                /* a number stores the same 16 bits as a negated (or wrapped) 'long long' would */
+                if (col < width)
+                    tiles[col] = (uint16_t)(neg ? 0 - value : value);
+                if (++col == width) {
+                    if (rowNo < height && !(*row)(context,rowNo,tiles))
+                        goto done;
+                    ++rowNo;
+                    col = 0;
+                }
+                ++info->number;
+                neg = FALSE;
+                state = map_stream_after;
+                continue;
             }
-            return map_simple_row_data(info) == SUCCESS_PARSE;
+            switch (state) {
+            case map_stream_row:
+            case map_stream_sep:
+                if (c == '-') {
+                    neg = TRUE;
+                    state = map_stream_sign;
+                }
+                else if (state == map_stream_row && (c == '\n' || c == '\r'))
+                    ; /* the rest of a run of newlines */
+                else if (state == map_stream_sep && (c == ' ' || c == '\t'))
+                    ;
+                else
+                    goto fail;
+                break;
+            case map_stream_sign:
+                goto fail;
+            case map_stream_after:
+            case map_stream_space:
+                if (c == ' ' || c == '\t')
+                    state = map_stream_space;
+                else if (c == '\n' || c == '\r') {
+                    ++info->lineno;
+                    state = map_stream_row;
+                }
+                else if (c == info->separator)
+                    state = map_stream_sep;
+                else if (c == '-' && state == map_stream_space && info->separator == ' ') {
+                    neg = TRUE;
+                    state = map_stream_sign;
+                }
+                else
+                    goto fail;
+                break;
+            }
+            ++p;
         }
     }
-    return FALSE;
+
+    /* the input may end after a row without a newline (but not after a separator) */
+    if (state == map_stream_row || state == map_stream_after || state == map_stream_space) {
+        result = TRUE;
+        goto done;
+    }
+fail:
+    pok_exception_new_format("parse map simple: line %d: expected row or end of input",info->lineno);
+done:
+    free(buffer);
+    free(tiles);
+    return result;
 }
 
 /* grammar/pok-map/warps
@@ -37,7 +37,14 @@ bool_t pok_parse_cmdline(struct pok_parser_info* info);
 bool_t pok_parse_cmdline_ex(const char* cmdline,struct pok_string* buffer,const char*** argvOut);
 
 /* pok_map **********************************************************************/
-bool_t pok_parse_map_simple(struct pok_parser_info* info);
+/* streaming variant of the simple map grammar: the header is parsed first (the width and height
+   are stored in 'qwords'); then the row data is read a block at a time and 'row' is called with
+   each complete row of 'width' tile ids (the array is reused between calls); no tile ids are
+   collected; 'number' is the total number of tile ids afterwards (ids past row 'height' are not
+   passed to 'row'); if 'row' returns FALSE then parsing stops (with the exception it raised) */
+typedef bool_t (*pok_parser_map_row)(void* context,uint32_t rowNo,const uint16_t tiles[]);
+bool_t pok_parse_map_simple_header(struct pok_parser_info* info);
+bool_t pok_parse_map_simple_rows(struct pok_parser_info* info,uint32_t width,uint32_t height,pok_parser_map_row row,void* context);
 bool_t pok_parse_map_warps(struct pok_parser_info* info);
 
 #endif
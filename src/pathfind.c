@@ -0,0 +1,837 @@
+/* pathfind.c - pokgame */
+#include "pathfind.h"
+#include "error.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define PATH_NONE UINT32_MAX /* no distance (unreachable) or no index */
+#define PATH_GOAL 0xffff     /* node index of the goal state */
+#define PATH_WIDE_ENTRANCE 6 /* entrances at least this wide get a node at each end instead of one in the middle */
+#define PATH_CLUSTER_INITIAL_CAPACITY 16
+#define PATH_STATE_INITIAL_CAPACITY 256
+
+/* structs used by the implementation */
+struct path_node
+{
+    uint16_t column, row; /* tile on the chunk's edge */
+    uint8_t side;         /* direction of the neighboring chunk */
+};
+
+/* pok_path_cluster: the abstract graph of a single chunk */
+struct pok_path_cluster
+{
+    struct pok_point pos;
+    uint32_t revisions[5]; /* revision of the chunk then of its neighbors (by direction); zero if not loaded */
+    uint16_t nodec;
+    struct path_node* nodes;
+    uint32_t* dist;        /* nodec x nodec distances between nodes within the chunk */
+    byte_t* passable;      /* bitplane: bit set if the tile is passable */
+};
+
+struct path_state
+{
+    struct pok_point pos; /* chunk position */
+    uint16_t node;        /* node within the chunk's cluster (or PATH_GOAL) */
+    bool_t closed;
+    uint32_t g;           /* distance from the start */
+    uint32_t parent;      /* state that reached this state (PATH_NONE if reached from the start) */
+};
+struct path_open
+{
+    uint32_t f;
+    uint32_t g;
+    uint32_t state;
+};
+struct path_waypoint
+{
+    struct pok_point pos;
+    uint32_t tile; /* row * columns + column */
+};
+
+/* pok_path_search: buffers used to answer queries; they are kept between queries */
+struct pok_path_search
+{
+    /* tile level search within a single chunk */
+    uint32_t tiles;
+    uint32_t stamp;
+    uint32_t* visit; /* 'visit[i] == stamp' if tile 'i' was reached by the current search */
+    uint32_t* dist;
+    uint8_t* from;   /* direction of the step that reached the tile */
+    uint32_t* queue;
+
+    /* distances from the start tile to the nodes of its cluster followed by the distances from the
+       goal tile to the nodes of its cluster */
+    uint32_t nodeAlloc;
+    uint32_t* nodeDist;
+
+    /* abstract search: states are found through an open-addressing table of state indexes */
+    uint32_t statec, stateAlloc;
+    struct path_state* states;
+    uint32_t tableMask;
+    uint32_t* table;
+    uint32_t openc, openAlloc;
+    struct path_open* open; /* binary heap ordered by 'f' */
+    uint32_t waypointc, waypointAlloc;
+    struct path_waypoint* waypoints;
+};
+
+static const int PATH_DX[] = { 0, 0, -1, 1 };
+static const int PATH_DY[] = { -1, 1, 0, 0 };
+
+static inline bool_t path_passable(const struct pok_path_cluster* cluster,uint32_t tile)
+{
+    return (cluster->passable[tile >> 3] >> (tile & 7)) & 1;
+}
+static inline uint32_t path_hash(const struct pok_point* pos,uint32_t salt,uint32_t mask)
+{
+    /* multiplicative hashing of the packed position; the high bits are the best mixed */
+    uint64_t key = ((uint64_t)(uint32_t)pos->X << 32 | (uint32_t)pos->Y) ^ ((uint64_t)salt * UINT64_C(0xff51afd7ed558ccd));
+    return (uint32_t)((key * UINT64_C(0x9e3779b97f4a7c15)) >> 32) & mask;
+}
+static bool_t path_grow(void** array,uint32_t* alloc,uint32_t need,size_t size)
+{
+    /* make sure a buffer holds at least 'need' elements */
+    if (need > *alloc) {
+        void* data;
+        uint32_t n = *alloc == 0 ? 64 : *alloc;
+        while (n < need)
+            n <<= 1;
+        data = realloc(*array,n * size);
+        if (data == NULL) {
+            pok_exception_flag_memory_error();
+            return FALSE;
+        }
+        *array = data;
+        *alloc = n;
+    }
+    return TRUE;
+}
+
+/* pok_path */
+void pok_path_init(struct pok_path* path)
+{
+    path->length = 0;
+    path->alloc = 0;
+    path->steps = NULL;
+}
+void pok_path_delete(struct pok_path* path)
+{
+    if (path->steps != NULL)
+        free(path->steps);
+    pok_path_init(path);
+}
+
+/* pok_path_query */
+void pok_path_query_init(struct pok_path_query* query,const struct pok_point* startChunk,const struct pok_location* startTile,
+    const struct pok_point* goalChunk,const struct pok_location* goalTile)
+{
+    query->startChunk = *startChunk;
+    query->startTile = *startTile;
+    query->goalChunk = *goalChunk;
+    query->goalTile = *goalTile;
+    query->status = pok_path_pending;
+    pok_path_init(&query->path);
+}
+void pok_path_query_delete(struct pok_path_query* query)
+{
+    pok_path_delete(&query->path);
+}
+
+/* tile level search */
+static bool_t path_search_reserve(struct pok_pathfinder* pathfinder)
+{
+    /* allocate the tile level buffers for the map's chunk size */
+    struct pok_path_search* search = pathfinder->_search;
+    uint32_t tiles = (uint32_t)pathfinder->map->chunkSize.columns * pathfinder->map->chunkSize.rows;
+    if (search->tiles < tiles) {
+        uint32_t* visit, *dist, *queue;
+        uint8_t* from;
+        visit = calloc(tiles,sizeof(uint32_t));
+        dist = malloc(tiles * sizeof(uint32_t));
+        queue = malloc(tiles * sizeof(uint32_t));
+        from = malloc(tiles);
+        if (visit == NULL || dist == NULL || queue == NULL || from == NULL) {
+            free(visit);
+            free(dist);
+            free(queue);
+            free(from);
+            pok_exception_flag_memory_error();
+            return FALSE;
+        }
+        free(search->visit);
+        free(search->dist);
+        free(search->queue);
+        free(search->from);
+        search->visit = visit;
+        search->dist = dist;
+        search->queue = queue;
+        search->from = from;
+        search->tiles = tiles;
+        search->stamp = 0;
+    }
+    return TRUE;
+}
+static uint32_t path_bfs(struct pok_path_search* search,const struct pok_path_cluster* cluster,
+    uint16_t columns,uint16_t rows,uint32_t source,uint32_t target)
+{
+    /* breadth-first search over the passable tiles of a chunk from 'source'; the search stops
+       when 'target' is reached (pass PATH_NONE to reach every tile); the distance to 'target' is
+       returned; the distances to the other tiles reached are read with 'path_tile_dist' */
+    uint32_t head = 0, tail = 0;
+    if (++search->stamp == 0) {
+        memset(search->visit,0,search->tiles * sizeof(uint32_t));
+        search->stamp = 1;
+    }
+    search->visit[source] = search->stamp;
+    search->dist[source] = 0;
+    search->queue[tail++] = source;
+    while (head < tail) {
+        int d;
+        uint32_t i = search->queue[head++];
+        uint16_t column = i % columns, row = i / columns;
+        if (i == target)
+            return search->dist[i];
+        for (d = 0;d < 4;++d) {
+            uint32_t j;
+            int c = column + PATH_DX[d], r = row + PATH_DY[d];
+            if (c < 0 || c >= columns || r < 0 || r >= rows)
+                continue;
+            j = (uint32_t)r * columns + c;
+            if (search->visit[j] != search->stamp && path_passable(cluster,j)) {
+                search->visit[j] = search->stamp;
+                search->dist[j] = search->dist[i] + 1;
+                search->from[j] = (uint8_t)d;
+                search->queue[tail++] = j;
+            }
+        }
+    }
+    return PATH_NONE;
+}
+static inline uint32_t path_tile_dist(const struct pok_path_search* search,uint32_t tile)
+{
+    return search->visit[tile] == search->stamp ? search->dist[tile] : PATH_NONE;
+}
+
+/* abstract chunk graphs */
+static void path_cluster_free(struct pok_path_cluster* cluster)
+{
+    free(cluster->nodes);
+    free(cluster->dist);
+    free(cluster->passable);
+    free(cluster);
+}
+static void path_edge_tiles(enum pok_direction side,uint16_t k,uint16_t columns,uint16_t rows,
+    struct pok_location* own,struct pok_location* other)
+{
+    /* get the 'k'th pair of tiles along the boundary between a chunk and its neighbor */
+    switch (side) {
+    case pok_direction_up:
+        own->column = other->column = k;
+        own->row = 0;
+        other->row = rows - 1;
+        break;
+    case pok_direction_down:
+        own->column = other->column = k;
+        own->row = rows - 1;
+        other->row = 0;
+        break;
+    case pok_direction_left:
+        own->row = other->row = k;
+        own->column = 0;
+        other->column = columns - 1;
+        break;
+    default:
+        own->row = other->row = k;
+        own->column = columns - 1;
+        other->column = 0;
+        break;
+    }
+}
+static struct pok_path_cluster* path_cluster_build(struct pok_pathfinder* pathfinder,const struct pok_point* pos,
+    const struct pok_map_chunk* chunk,const struct pok_map_chunk* neighbors[])
+{
+    /* build the abstract graph of a chunk: find the entrances along each boundary shared with a
+       loaded neighbor then the distances between them within the chunk; the entrances are chosen
+       from tile pairs that both chunks see the same way so that the neighbor's graph has the
+       matching node on its side of the boundary */
+    int d;
+    uint32_t i, j;
+    uint16_t columns = pathfinder->map->chunkSize.columns, rows = pathfinder->map->chunkSize.rows;
+    struct pok_path_search* search = pathfinder->_search;
+    struct pok_path_cluster* cluster;
+    cluster = malloc(sizeof(struct pok_path_cluster));
+    if (cluster == NULL) {
+        pok_exception_flag_memory_error();
+        return NULL;
+    }
+    cluster->pos = *pos;
+    cluster->nodec = 0;
+    cluster->dist = NULL;
+    cluster->nodes = malloc(sizeof(struct path_node) * (2 * ((uint32_t)columns + rows) + 4));
+    cluster->passable = calloc(((uint32_t)columns * rows + 7) / 8,1);
+    if (cluster->nodes == NULL || cluster->passable == NULL) {
+        path_cluster_free(cluster);
+        pok_exception_flag_memory_error();
+        return NULL;
+    }
+    for (i = 0;i < (uint32_t)columns * rows;++i)
+        if ( !pok_map_chunk_is_impassable(chunk,pathfinder->tman,i % columns,i / columns) )
+            cluster->passable[i >> 3] |= 1 << (i & 7);
+
+    /* entrances */
+    for (d = pok_direction_up;d <= pok_direction_right;++d) {
+        uint16_t k, first = 0, length;
+        bool_t open = FALSE;
+        if (neighbors[d] == NULL)
+            continue;
+        length = d == pok_direction_up || d == pok_direction_down ? columns : rows;
+        for (k = 0;k <= length;++k) {
+            bool_t both = FALSE;
+            struct pok_location own, other;
+            if (k < length) {
+                path_edge_tiles(d,k,columns,rows,&own,&other);
+                both = path_passable(cluster,(uint32_t)own.row * columns + own.column)
+                    && !pok_map_chunk_is_impassable(neighbors[d],pathfinder->tman,other.column,other.row);
+            }
+            if (both && !open) {
+                first = k;
+                open = TRUE;
+            }
+            else if (!both && open) {
+                /* the entrance spans [first,k) */
+                uint16_t ends[2];
+                int n, e;
+                open = FALSE;
+                if (k - first >= PATH_WIDE_ENTRANCE) {
+                    ends[0] = first;
+                    ends[1] = k - 1;
+                    n = 2;
+                }
+                else {
+                    ends[0] = first + (k - first) / 2;
+                    n = 1;
+                }
+                for (e = 0;e < n;++e) {
+                    struct path_node* node = cluster->nodes + cluster->nodec++;
+                    path_edge_tiles(d,ends[e],columns,rows,&own,&other);
+                    node->column = own.column;
+                    node->row = own.row;
+                    node->side = (uint8_t)d;
+                }
+            }
+        }
+    }
+
+    /* distances between entrances */
+    if (cluster->nodec > 0) {
+        cluster->dist = malloc(sizeof(uint32_t) * cluster->nodec * cluster->nodec);
+        if (cluster->dist == NULL) {
+            path_cluster_free(cluster);
+            pok_exception_flag_memory_error();
+            return NULL;
+        }
+        for (i = 0;i < cluster->nodec;++i) {
+            const struct path_node* node = cluster->nodes + i;
+            path_bfs(search,cluster,columns,rows,(uint32_t)node->row * columns + node->column,PATH_NONE);
+            for (j = 0;j < cluster->nodec;++j)
+                cluster->dist[i * cluster->nodec + j] = path_tile_dist(search,(uint32_t)cluster->nodes[j].row * columns + cluster->nodes[j].column);
+        }
+    }
+    ++pathfinder->builds;
+    return cluster;
+}
+static uint32_t path_cluster_slot(const struct pok_pathfinder* pathfinder,const struct pok_point* pos)
+{
+    /* find the cache slot of the cluster at 'pos' (or the empty slot where it would go) */
+    uint32_t i;
+    for (i = path_hash(pos,0,pathfinder->clusterMask);pathfinder->clusters[i] != NULL;i = (i+1) & pathfinder->clusterMask)
+        if (pathfinder->clusters[i]->pos.X == pos->X && pathfinder->clusters[i]->pos.Y == pos->Y)
+            break;
+    return i;
+}
+static bool_t path_cluster_grow(struct pok_pathfinder* pathfinder)
+{
+    uint32_t i, capacity;
+    struct pok_path_cluster** old = pathfinder->clusters;
+    uint32_t oldCapacity = old == NULL ? 0 : pathfinder->clusterMask + 1;
+    capacity = old == NULL ? PATH_CLUSTER_INITIAL_CAPACITY : oldCapacity << 1;
+    pathfinder->clusters = calloc(capacity,sizeof(struct pok_path_cluster*));
+    if (pathfinder->clusters == NULL) {
+        pathfinder->clusters = old;
+        pok_exception_flag_memory_error();
+        return FALSE;
+    }
+    pathfinder->clusterMask = capacity - 1;
+    for (i = 0;i < oldCapacity;++i)
+        if (old[i] != NULL)
+            pathfinder->clusters[path_cluster_slot(pathfinder,&old[i]->pos)] = old[i];
+    free(old);
+    return TRUE;
+}
+static void path_cluster_remove(struct pok_pathfinder* pathfinder,uint32_t i)
+{
+    /* free the cluster in slot 'i'; the entries that follow it in its probe run are shifted back
+       so that no tombstones are needed */
+    uint32_t j;
+    path_cluster_free(pathfinder->clusters[i]);
+    for (j = (i+1) & pathfinder->clusterMask;pathfinder->clusters[j] != NULL;j = (j+1) & pathfinder->clusterMask) {
+        /* an entry may fill the hole if its home slot is not cyclically within (i,j] */
+        uint32_t k = path_hash(&pathfinder->clusters[j]->pos,0,pathfinder->clusterMask);
+        if (i <= j ? (k <= i || k > j) : (k <= i && k > j)) {
+            pathfinder->clusters[i] = pathfinder->clusters[j];
+            i = j;
+        }
+    }
+    pathfinder->clusters[i] = NULL;
+    --pathfinder->clusterCount;
+}
+static bool_t path_cluster_get(struct pok_pathfinder* pathfinder,const struct pok_point* pos,struct pok_path_cluster** result)
+{
+    /* get the abstract graph of the chunk at 'pos' ('*result' is NULL if the chunk is not loaded);
+       a cached graph is rebuilt if its chunk or one of the chunk's neighbors was revised */
+    int d;
+    uint32_t i;
+    uint32_t revisions[5];
+    const struct pok_map_chunk* chunk, *neighbors[4];
+    *result = NULL;
+    if (pathfinder->clusters == NULL && !path_cluster_grow(pathfinder))
+        return FALSE;
+    i = path_cluster_slot(pathfinder,pos);
+    chunk = pok_map_lookup_chunk(pathfinder->map,pos);
+    if (chunk == NULL) {
+        if (pathfinder->clusters[i] != NULL)
+            path_cluster_remove(pathfinder,i);
+        return TRUE;
+    }
+    revisions[0] = chunk->revision;
+    for (d = pok_direction_up;d <= pok_direction_right;++d) {
+        struct pok_point npos = *pos;
+        pok_direction_add_to_point(d,&npos);
+        neighbors[d] = pok_map_lookup_chunk(pathfinder->map,&npos);
+        revisions[d+1] = neighbors[d] != NULL ? neighbors[d]->revision : 0;
+    }
+    if (pathfinder->clusters[i] != NULL) {
+        if (memcmp(pathfinder->clusters[i]->revisions,revisions,sizeof(revisions)) == 0) {
+            *result = pathfinder->clusters[i];
+            return TRUE;
+        }
+        path_cluster_remove(pathfinder,i);
+    }
+    if ((pathfinder->clusterCount + 1) * 2 > pathfinder->clusterMask + 1 && !path_cluster_grow(pathfinder))
+        return FALSE;
+    if ((*result = path_cluster_build(pathfinder,pos,chunk,neighbors)) == NULL)
+        return FALSE;
+    memcpy((*result)->revisions,revisions,sizeof(revisions));
+    pathfinder->clusters[path_cluster_slot(pathfinder,pos)] = *result;
+    ++pathfinder->clusterCount;
+    return TRUE;
+}
+
+/* abstract search */
+static bool_t path_state_table_grow(struct pok_path_search* search)
+{
+    uint32_t i, capacity = search->table == NULL ? PATH_STATE_INITIAL_CAPACITY : (search->tableMask + 1) << 1;
+    uint32_t* table = malloc(capacity * sizeof(uint32_t));
+    if (table == NULL) {
+        pok_exception_flag_memory_error();
+        return FALSE;
+    }
+    free(search->table);
+    search->table = table;
+    search->tableMask = capacity - 1;
+    memset(table,0xff,capacity * sizeof(uint32_t));
+    for (i = 0;i < search->statec;++i) {
+        uint32_t j;
+        for (j = path_hash(&search->states[i].pos,search->states[i].node,search->tableMask);table[j] != PATH_NONE;j = (j+1) & search->tableMask)
+            ;
+        table[j] = i;
+    }
+    return TRUE;
+}
+static uint32_t path_state_get(struct pok_path_search* search,const struct pok_point* pos,uint16_t node)
+{
+    /* find or add the state for a node; PATH_NONE is returned if memory could not be allocated */
+    uint32_t i, s;
+    for (i = path_hash(pos,node,search->tableMask);(s = search->table[i]) != PATH_NONE;i = (i+1) & search->tableMask)
+        if (search->states[s].node == node && search->states[s].pos.X == pos->X && search->states[s].pos.Y == pos->Y)
+            return s;
+    if ((search->statec + 1) * 2 > search->tableMask + 1) {
+        if ( !path_state_table_grow(search) )
+            return PATH_NONE;
+        for (i = path_hash(pos,node,search->tableMask);search->table[i] != PATH_NONE;i = (i+1) & search->tableMask)
+            ;
+    }
+    if ( !path_grow((void**)&search->states,&search->stateAlloc,search->statec + 1,sizeof(struct path_state)) )
+        return PATH_NONE;
+    s = search->statec++;
+    search->table[i] = s;
+    search->states[s].pos = *pos;
+    search->states[s].node = node;
+    search->states[s].closed = FALSE;
+    search->states[s].g = PATH_NONE;
+    search->states[s].parent = PATH_NONE;
+    return s;
+}
+static bool_t path_open_push(struct pok_path_search* search,uint32_t f,uint32_t g,uint32_t state)
+{
+    uint32_t i;
+    if ( !path_grow((void**)&search->open,&search->openAlloc,search->openc + 1,sizeof(struct path_open)) )
+        return FALSE;
+    for (i = search->openc++;i > 0 && search->open[(i-1)/2].f > f;i = (i-1)/2)
+        search->open[i] = search->open[(i-1)/2];
+    search->open[i].f = f;
+    search->open[i].g = g;
+    search->open[i].state = state;
+    return TRUE;
+}
+static struct path_open path_open_pop(struct pok_path_search* search)
+{
+    uint32_t i = 0;
+    struct path_open top = search->open[0];
+    struct path_open last = search->open[--search->openc];
+    while (TRUE) {
+        uint32_t c = 2*i + 1;
+        if (c >= search->openc)
+            break;
+        if (c + 1 < search->openc && search->open[c+1].f < search->open[c].f)
+            ++c;
+        if (search->open[c].f >= last.f)
+            break;
+        search->open[i] = search->open[c];
+        i = c;
+    }
+    if (search->openc > 0)
+        search->open[i] = last;
+    return top;
+}
+static inline uint32_t path_heuristic(const struct pok_pathfinder* pathfinder,const struct pok_point* pos,uint16_t column,uint16_t row,
+    const struct pok_path_query* query)
+{
+    /* manhattan distance between map tile coordinates */
+    int64_t dx, dy;
+    dx = ((int64_t)pos->X - query->goalChunk.X) * pathfinder->map->chunkSize.columns + column - query->goalTile.column;
+    dy = ((int64_t)pos->Y - query->goalChunk.Y) * pathfinder->map->chunkSize.rows + row - query->goalTile.row;
+    return (uint32_t)((dx < 0 ? -dx : dx) + (dy < 0 ? -dy : dy));
+}
+static bool_t path_relax(struct pok_pathfinder* pathfinder,const struct pok_path_query* query,const struct pok_point* pos,
+    uint16_t node,uint16_t column,uint16_t row,uint32_t g,uint32_t parent)
+{
+    /* reach a node with a distance of 'g'; the node is (re)opened if this is the shortest distance so far */
+    struct pok_path_search* search = pathfinder->_search;
+    uint32_t s = path_state_get(search,pos,node);
+    if (s == PATH_NONE)
+        return FALSE;
+    if (g < search->states[s].g && !search->states[s].closed) {
+        search->states[s].g = g;
+        search->states[s].parent = parent;
+        return path_open_push(search,g + path_heuristic(pathfinder,pos,column,row,query),g,s);
+    }
+    return TRUE;
+}
+static bool_t path_add_steps(struct pok_path* path,struct pok_path_search* search,uint16_t columns,uint32_t source,uint32_t target)
+{
+    /* add the steps of the tile search from 'source' to 'target' to the path (the search must have
+       reached 'target'); the steps are traced backward from the target then reversed */
+    uint32_t i, n = search->dist[target];
+    if ( !path_grow((void**)&path->steps,&path->alloc,path->length + n,1) )
+        return FALSE;
+    for (i = 0;i < n;++i) {
+        uint8_t d = search->from[target];
+        path->steps[path->length + n - 1 - i] = d;
+        target = (uint32_t)((int32_t)target - PATH_DY[d] * columns - PATH_DX[d]);
+    }
+    path->length += n;
+    return target == source;
+}
+static enum pok_path_status path_refine(struct pok_pathfinder* pathfinder,struct pok_path_query* query)
+{
+    /* turn the waypoints of the abstract path into tile steps: waypoints in the same chunk are
+       joined by a search within the chunk and waypoints in adjacent chunks are one step apart */
+    uint32_t i;
+    uint16_t columns = pathfinder->map->chunkSize.columns, rows = pathfinder->map->chunkSize.rows;
+    struct pok_path_search* search = pathfinder->_search;
+    for (i = 1;i < search->waypointc;++i) {
+        const struct path_waypoint* a = search->waypoints + i - 1, *b = search->waypoints + i;
+        if (a->pos.X == b->pos.X && a->pos.Y == b->pos.Y) {
+            struct pok_path_cluster* cluster;
+            if ( !path_cluster_get(pathfinder,&a->pos,&cluster) )
+                return pok_path_failed;
+            if (cluster == NULL || path_bfs(search,cluster,columns,rows,a->tile,b->tile) == PATH_NONE)
+                return pok_path_unreachable;
+            if ( !path_add_steps(&query->path,search,columns,a->tile,b->tile) )
+                return pok_path_failed;
+        }
+        else {
+            uint8_t d = b->pos.Y < a->pos.Y ? pok_direction_up : (b->pos.Y > a->pos.Y ? pok_direction_down
+                : (b->pos.X < a->pos.X ? pok_direction_left : pok_direction_right));
+            if ( !path_grow((void**)&query->path.steps,&query->path.alloc,query->path.length + 1,1) )
+                return pok_path_failed;
+            query->path.steps[query->path.length++] = d;
+        }
+    }
+    return pok_path_found;
+}
+static enum pok_path_status path_search(struct pok_pathfinder* pathfinder,struct pok_path_query* query,
+    struct pok_path_cluster* start,struct pok_path_cluster* goal,uint32_t s,uint32_t t)
+{
+    /* search the abstract graphs from the start tile 's' to the goal tile 't'; the start is joined
+       to the nodes of its cluster and the goal to the nodes of its cluster by tile searches */
+    uint32_t i, state;
+    uint32_t* startDist, *goalDist;
+    uint16_t columns = pathfinder->map->chunkSize.columns, rows = pathfinder->map->chunkSize.rows;
+    struct pok_path_search* search = pathfinder->_search;
+    if ( !path_grow((void**)&search->nodeDist,&search->nodeAlloc,(uint32_t)start->nodec + goal->nodec,sizeof(uint32_t)) )
+        return pok_path_failed;
+    startDist = search->nodeDist;
+    goalDist = search->nodeDist + start->nodec;
+    path_bfs(search,goal,columns,rows,t,PATH_NONE);
+    for (i = 0;i < goal->nodec;++i)
+        goalDist[i] = path_tile_dist(search,(uint32_t)goal->nodes[i].row * columns + goal->nodes[i].column);
+    path_bfs(search,start,columns,rows,s,PATH_NONE);
+    for (i = 0;i < start->nodec;++i)
+        startDist[i] = path_tile_dist(search,(uint32_t)start->nodes[i].row * columns + start->nodes[i].column);
+
+    /* reset the search */
+    search->statec = 0;
+    search->openc = 0;
+    if (search->table == NULL) {
+        if ( !path_state_table_grow(search) )
+            return pok_path_failed;
+    }
+    else
+        memset(search->table,0xff,(search->tableMask + 1) * sizeof(uint32_t));
+    for (i = 0;i < start->nodec;++i)
+        if (startDist[i] != PATH_NONE && !path_relax(pathfinder,query,&start->pos,(uint16_t)i,
+                start->nodes[i].column,start->nodes[i].row,startDist[i],PATH_NONE))
+            return pok_path_failed;
+
+    state = PATH_NONE;
+    while (search->openc > 0) {
+        uint32_t g, j;
+        struct pok_point pos;
+        uint16_t node;
+        struct pok_path_cluster* cluster, *next;
+        struct path_open top = path_open_pop(search);
+        if (search->states[top.state].closed || top.g != search->states[top.state].g)
+            continue;
+        search->states[top.state].closed = TRUE;
+        if (search->states[top.state].node == PATH_GOAL) {
+            state = top.state;
+            break;
+        }
+        ++pathfinder->expanded;
+        pos = search->states[top.state].pos;
+        node = search->states[top.state].node;
+        g = top.g;
+        if ( !path_cluster_get(pathfinder,&pos,&cluster) )
+            return pok_path_failed;
+        if (cluster == NULL)
+            continue;
+        /* reach the goal */
+        if (pos.X == goal->pos.X && pos.Y == goal->pos.Y && goalDist[node] != PATH_NONE
+            && !path_relax(pathfinder,query,&pos,PATH_GOAL,query->goalTile.column,query->goalTile.row,g + goalDist[node],top.state))
+            return pok_path_failed;
+        /* reach the other nodes in the chunk */
+        for (j = 0;j < cluster->nodec;++j) {
+            uint32_t d = cluster->dist[node * cluster->nodec + j];
+            if (j != node && d != PATH_NONE
+                && !path_relax(pathfinder,query,&pos,(uint16_t)j,cluster->nodes[j].column,cluster->nodes[j].row,g + d,top.state))
+                return pok_path_failed;
+        }
+        /* step across the boundary to the matching node of the neighbor */
+        {
+            struct pok_location own, other;
+            struct pok_point npos = pos;
+            uint8_t side = cluster->nodes[node].side;
+            uint16_t k = side == pok_direction_up || side == pok_direction_down ? cluster->nodes[node].column : cluster->nodes[node].row;
+            pok_direction_add_to_point(side,&npos);
+            if ( !path_cluster_get(pathfinder,&npos,&next) )
+                return pok_path_failed;
+            if (next == NULL)
+                continue;
+            path_edge_tiles(side,k,columns,rows,&own,&other);
+            for (j = 0;j < next->nodec;++j) {
+                if (next->nodes[j].side == pok_direction_opposite(side) && next->nodes[j].column == other.column
+                    && next->nodes[j].row == other.row)
+                {
+                    if ( !path_relax(pathfinder,query,&npos,(uint16_t)j,other.column,other.row,g + 1,top.state) )
+                        return pok_path_failed;
+                    break;
+                }
+            }
+        }
+    }
+    if (state == PATH_NONE)
+        return pok_path_unreachable;
+
+    /* collect the waypoints of the abstract path (the goal back to the start) then refine them */
+    search->waypointc = 0;
+    for (;state != PATH_NONE;state = search->states[state].parent) {
+        struct path_waypoint* waypoint;
+        const struct path_state* st = search->states + state;
+        if ( !path_grow((void**)&search->waypoints,&search->waypointAlloc,search->waypointc + 2,sizeof(struct path_waypoint)) )
+            return pok_path_failed;
+        waypoint = search->waypoints + search->waypointc++;
+        waypoint->pos = st->pos;
+        if (st->node == PATH_GOAL)
+            waypoint->tile = t;
+        else {
+            struct pok_path_cluster* cluster;
+            if ( !path_cluster_get(pathfinder,&st->pos,&cluster) )
+                return pok_path_failed;
+            waypoint->tile = (uint32_t)cluster->nodes[st->node].row * columns + cluster->nodes[st->node].column;
+        }
+    }
+    search->waypoints[search->waypointc].pos = start->pos;
+    search->waypoints[search->waypointc++].tile = s;
+    for (i = 0;i < search->waypointc / 2;++i) {
+        struct path_waypoint tmp = search->waypoints[i];
+        search->waypoints[i] = search->waypoints[search->waypointc - 1 - i];
+        search->waypoints[search->waypointc - 1 - i] = tmp;
+    }
+    return path_refine(pathfinder,query);
+}
+
+/* pok_pathfinder */
+struct pok_pathfinder* pok_pathfinder_new(const struct pok_map* map,const struct pok_tile_manager* tman)
+{
+    struct pok_pathfinder* pathfinder;
+    pathfinder = malloc(sizeof(struct pok_pathfinder));
+    if (pathfinder == NULL) {
+        pok_exception_flag_memory_error();
+        return NULL;
+    }
+    pok_pathfinder_init(pathfinder,map,tman);
+    return pathfinder;
+}
+void pok_pathfinder_free(struct pok_pathfinder* pathfinder)
+{
+    pok_pathfinder_delete(pathfinder);
+    free(pathfinder);
+}
+void pok_pathfinder_init(struct pok_pathfinder* pathfinder,const struct pok_map* map,const struct pok_tile_manager* tman)
+{
+    pathfinder->map = map;
+    pathfinder->tman = tman;
+    pathfinder->impassibility = tman->impassibility;
+    pathfinder->clusterCount = 0;
+    pathfinder->clusterMask = 0;
+    pathfinder->clusters = NULL;
+    pathfinder->builds = 0;
+    pathfinder->expanded = 0;
+    pathfinder->_search = NULL;
+}
+void pok_pathfinder_delete(struct pok_pathfinder* pathfinder)
+{
+    struct pok_path_search* search = pathfinder->_search;
+    pok_pathfinder_reset(pathfinder);
+    if (pathfinder->clusters != NULL)
+        free(pathfinder->clusters);
+    if (search != NULL) {
+        free(search->visit);
+        free(search->dist);
+        free(search->from);
+        free(search->queue);
+        free(search->nodeDist);
+        free(search->states);
+        free(search->table);
+        free(search->open);
+        free(search->waypoints);
+        free(search);
+    }
+    pathfinder->clusters = NULL;
+    pathfinder->_search = NULL;
+}
+void pok_pathfinder_invalidate(struct pok_pathfinder* pathfinder,const struct pok_point* chunkPos)
+{
+    /* release the abstract graphs of a chunk and its neighbors (their entrances depend on the chunk) */
+    int d;
+    if (pathfinder->clusters == NULL)
+        return;
+    for (d = pok_direction_up;d <= pok_direction_none;++d) {
+        uint32_t i;
+        struct pok_point pos = *chunkPos;
+        pok_direction_add_to_point(d,&pos);
+        i = path_cluster_slot(pathfinder,&pos);
+        if (pathfinder->clusters[i] != NULL)
+            path_cluster_remove(pathfinder,i);
+    }
+}
+void pok_pathfinder_reset(struct pok_pathfinder* pathfinder)
+{
+    /* release every abstract graph */
+    uint32_t i;
+    if (pathfinder->clusters == NULL)
+        return;
+    for (i = 0;i <= pathfinder->clusterMask;++i) {
+        if (pathfinder->clusters[i] != NULL) {
+            path_cluster_free(pathfinder->clusters[i]);
+            pathfinder->clusters[i] = NULL;
+        }
+    }
+    pathfinder->clusterCount = 0;
+}
+void pok_pathfinder_set_tile_manager(struct pok_pathfinder* pathfinder,const struct pok_tile_manager* tman)
+{
+    /* use a different tile manager (e.g. after the game's tile manager is replaced); the cached
+       graphs were built with the old one's passability rules so they are released */
+    pok_pathfinder_reset(pathfinder);
+    pathfinder->tman = tman;
+    pathfinder->impassibility = tman->impassibility;
+}
+enum pok_path_status pok_pathfinder_find(struct pok_pathfinder* pathfinder,struct pok_path_query* query)
+{
+    /* solve a single query; if the query fails then an exception is generated */
+    uint32_t s, t;
+    uint16_t columns = pathfinder->map->chunkSize.columns, rows = pathfinder->map->chunkSize.rows;
+    struct pok_path_cluster* start, *goal;
+    query->path.length = 0;
+    query->status = pok_path_failed;
+    if (pathfinder->tman->impassibility != pathfinder->impassibility) {
+        /* the tile manager was reloaded with different passability rules */
+        pok_pathfinder_reset(pathfinder);
+        pathfinder->impassibility = pathfinder->tman->impassibility;
+    }
+    if (pathfinder->_search == NULL) {
+        pathfinder->_search = calloc(1,sizeof(struct pok_path_search));
+        if (pathfinder->_search == NULL) {
+            pok_exception_flag_memory_error();
+            return query->status;
+        }
+    }
+    if ( !path_search_reserve(pathfinder) )
+        return query->status;
+    if (query->startTile.column >= columns || query->startTile.row >= rows
+        || query->goalTile.column >= columns || query->goalTile.row >= rows)
+        return query->status = pok_path_unreachable;
+    if (!path_cluster_get(pathfinder,&query->startChunk,&start) || !path_cluster_get(pathfinder,&query->goalChunk,&goal))
+        return query->status;
+    if (start == NULL || goal == NULL)
+        return query->status = pok_path_unreachable;
+    s = (uint32_t)query->startTile.row * columns + query->startTile.column;
+    t = (uint32_t)query->goalTile.row * columns + query->goalTile.column;
+    if (!path_passable(start,s) || !path_passable(goal,t))
+        return query->status = pok_path_unreachable;
+
+    /* a route within a single chunk does not need the abstract graphs */
+    if (start == goal && path_bfs(pathfinder->_search,start,columns,rows,s,t) != PATH_NONE) {
+        if ( !path_add_steps(&query->path,pathfinder->_search,columns,s,t) )
+            return query->status;
+        return query->status = pok_path_found;
+    }
+    return query->status = path_search(pathfinder,query,start,goal,s,t);
+}
+size_t pok_pathfinder_solve(struct pok_pathfinder* pathfinder,struct pok_path_query queries[],size_t count)
+{
+    /* solve a batch of queries; the queries share the pathfinder's cached graphs and buffers; the
+       number of queries with a path is returned; a query that fails has its exception popped so
+       that the rest of the batch is still solved */
+    size_t i, found = 0;
+    for (i = 0;i < count;++i) {
+        if (pok_pathfinder_find(pathfinder,queries + i) == pok_path_found)
+            ++found;
+        else if (queries[i].status == pok_path_failed)
+            pok_exception_pop();
+    }
+    return found;
+}
@@ -0,0 +1,87 @@
+/* pathfind.h - pokgame */
+#ifndef POKGAME_PATHFIND_H
+#define POKGAME_PATHFIND_H
+#include "map-context.h"
+
+/* Notes about pathfinding: a pathfinder finds routes between tiles of a single map using the same
+   passability rules as the map render context (see 'pok_map_chunk_is_impassable'); characters move
+   one tile at a time in the four directions, so a path is a sequence of directions; long routes are
+   found hierarchically (HPA*): each chunk has an abstract graph whose nodes are the entrances along
+   its edges (runs of tiles that are passable on both sides of a chunk boundary) and whose edges are
+   the shortest distances between entrances within the chunk; a query searches the abstract graphs
+   and then refines each abstract edge into tile steps within a single chunk, so the work depends
+   on the number of chunks crossed rather than the number of tiles; routes are near-optimal (they
+   always pass through chunk entrances) */
+
+enum pok_path_status
+{
+    pok_path_pending,     /* the query has not been solved */
+    pok_path_found,       /* 'path' holds a route from the start to the goal */
+    pok_path_unreachable, /* there is no route (or the start/goal is impassable or not loaded) */
+    pok_path_failed       /* the query could not be solved (an exception was generated) */
+};
+
+/* pok_path: a route as a sequence of steps; each step is an 'enum pok_direction' value */
+struct pok_path
+{
+    uint32_t length, alloc;
+    uint8_t* steps;
+};
+void pok_path_init(struct pok_path* path);
+void pok_path_delete(struct pok_path* path);
+
+/* pok_path_query: a single route request; queries are solved in batches */
+struct pok_path_query
+{
+    struct pok_point startChunk;
+    struct pok_location startTile;
+    struct pok_point goalChunk;
+    struct pok_location goalTile;
+
+    enum pok_path_status status;
+    struct pok_path path;
+};
+void pok_path_query_init(struct pok_path_query* query,const struct pok_point* startChunk,const struct pok_location* startTile,
+    const struct pok_point* goalChunk,const struct pok_location* goalTile);
+void pok_path_query_delete(struct pok_path_query* query);
+
+/* pok_pathfinder: finds paths on a map; the pathfinder caches the abstract graph of each chunk it
+   searches; a cached graph is stamped with the revisions of its chunk and the chunk's neighbors and
+   is rebuilt the next time it is needed if any of them changed (chunks are revised when they are
+   updated over the network or by the tile setters) so the cache never needs to be flushed by hand,
+   though 'pok_pathfinder_invalidate' may be used to release graphs early; the graphs also depend on
+   the tile manager's impassibility, so the cache is flushed if it changes or if the tile manager is
+   replaced (see 'pok_pathfinder_set_tile_manager'); only chunks that are loaded are
+   searched and the map is never modified, so a pathfinder may run on any thread (e.g. a worker
+   thread that owns the pathfinder) as long as the caller keeps the map from being modified while a
+   batch is solved; a pathfinder must not be used by more than one thread at a time */
+struct pok_path_cluster;
+struct pok_path_search;
+struct pok_pathfinder
+{
+    const struct pok_map* map;
+    const struct pok_tile_manager* tman;
+    uint16_t impassibility; /* impassibility of 'tman' when the cached graphs were built */
+
+    /* cache of abstract chunk graphs keyed on chunk position (open addressing, linear probing) */
+    uint32_t clusterCount;
+    uint32_t clusterMask;
+    struct pok_path_cluster** clusters;
+
+    /* statistics */
+    uint32_t builds;   /* number of abstract graphs built */
+    uint32_t expanded; /* number of abstract nodes expanded by searches */
+
+    struct pok_path_search* _search; /* search buffers (reused between queries) */
+};
+struct pok_pathfinder* pok_pathfinder_new(const struct pok_map* map,const struct pok_tile_manager* tman);
+void pok_pathfinder_free(struct pok_pathfinder* pathfinder);
+void pok_pathfinder_init(struct pok_pathfinder* pathfinder,const struct pok_map* map,const struct pok_tile_manager* tman);
+void pok_pathfinder_delete(struct pok_pathfinder* pathfinder);
+void pok_pathfinder_invalidate(struct pok_pathfinder* pathfinder,const struct pok_point* chunkPos);
+void pok_pathfinder_reset(struct pok_pathfinder* pathfinder);
+void pok_pathfinder_set_tile_manager(struct pok_pathfinder* pathfinder,const struct pok_tile_manager* tman);
+enum pok_path_status pok_pathfinder_find(struct pok_pathfinder* pathfinder,struct pok_path_query* query);
+size_t pok_pathfinder_solve(struct pok_pathfinder* pathfinder,struct pok_path_query queries[],size_t count);
+
+#endif
@@ -5,45 +5,24 @@
 struct pok_size pok_util_compute_chunk_size(uint32_t width,uint32_t height,const uint32_t max,struct pok_size* chunkSize,
     struct pok_size* lefttop,struct pok_size* rightbottom)
 {
-    bool_t tog;
-    uint16_t r;
+    uint32_t count;
     struct pok_size size;
     /* lefttop will refer to unused left-most columns in the left-most chunks and unused top-most rows in the top-most chunks; rightbottom
        will refer to unused right-most columns in the right-most chunks and unused bottom-most rows in the bottom-most chunks */
-    lefttop->columns = lefttop->rows = 0;
-    rightbottom->columns = rightbottom->rows = 0;
-    size.columns = 0;
-    size.rows = 0;
-    /* find ideal chunk size by dividing dimensions in half; if the dimension is odd at any stage, then
-       we add an extra unused column/row to certain "edge" chunks */
-    tog = TRUE; /* toggle between lefttop and rightbottom */
-    if (width <= max)
-        size.columns = 1;
-    else {
-        while (width > max) {
-            r = width % 2;
-            width /= 2;
-            width += r;
-            (tog ? lefttop : rightbottom)->columns += r;
-            tog = !tog;
-            size.columns += 2;
-        }
-    }
-    tog = TRUE;
-    if (height <= max)
-        size.rows = 1;
-    else {
-        while (height > max) {
-            r = height % 2;
-            height /= 2;
-            height += r;
-            (tog ? lefttop : rightbottom)->rows += r;
-            tog = !tog;
-            size.rows += 2;
-        }
-    }
-    chunkSize->columns = width;
-    chunkSize->rows = height;
+    /* find the ideal chunk size by doubling the number of chunks along a dimension until the chunks fit; if the chunks do not divide
+       the dimension evenly, then the unused columns/rows are split between the "edge" chunks */
+    for (count = 1;(width + count - 1) / count > max;count *= 2)
+        ;
+    size.columns = count;
+    chunkSize->columns = (width + count - 1) / count;
+    lefttop->columns = (chunkSize->columns * count - width) / 2;
+    rightbottom->columns = chunkSize->columns * count - width - lefttop->columns;
+    for (count = 1;(height + count - 1) / count > max;count *= 2)
+        ;
+    size.rows = count;
+    chunkSize->rows = (height + count - 1) / count;
+    lefttop->rows = (chunkSize->rows * count - height) / 2;
+    rightbottom->rows = chunkSize->rows * count - height - lefttop->rows;
     return size;
 }
 
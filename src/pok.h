@@ -37,6 +37,55 @@ void pok_init_default(bool_t doServer);
 /* pok_close: close pokgame version server library */
 void pok_close();
 
+/* pok_set_label: set the label (the engine shows it in its title bar) and the guid (GUID_LENGTH
+   characters) that identify the version to each engine */
+void pok_set_label(const char* label,const char* guid);
+
+/* pok_set_tile_manager, pok_set_sprite_manager: set the encoded static network objects that are
+   sent to each engine (see 'pok_tile_manager_netread' and 'pok_sprite_manager_netread' for their
+   formats); the bytes are copied once and shared by every connection; if an object is not set (or
+   is set to NULL) then engines use their default
+
+   return:        non-zero if the object was set
+*/
+bool_t pok_set_tile_manager(const void* data,size_t size);
+bool_t pok_set_sprite_manager(const void* data,size_t size);
+
+/* pok_set_first_map: set the encoded first map that is sent to each engine (see 'pok_map_netread');
+   it must have map number 1; engines are not served until it is set
+
+   return:        non-zero if the map was set
+*/
+bool_t pok_set_first_map(const void* data,size_t size);
+
+/* pok_set_compression: offer engines the compressed binary protocol to engines that greet the
+   server afterwards; the cached introductory, intermediate and map payloads are dropped and encoded
+   again (each compressed once for every engine) when they are next needed, so this may be called at
+   any time, though each call costs a re-encoding
+
+   level          - a zlib compression level (0 to 9, or -1 for zlib's default)
+   return:        non-zero if compression is available
+*/
+bool_t pok_set_compression(int level);
+
+/* pok_broadcast: send the same bytes to every engine that has been sent the first map; the bytes
+   are stored once no matter how many engines are connected
+
+   return:        non-zero if the bytes were queued
+*/
+bool_t pok_broadcast(const void* data,size_t size);
+
+/* pok_serve: serve engines until an event is handled or the timeout expires; a server accepts
+   any number of engines (the socket name is taken from the POKGAME_SERVER environment variable,
+   or "pokgame-server" if it is not set); otherwise the single engine is served on the standard
+   input and output channel
+
+   mseconds       - the most time to wait (in milliseconds) or negative to wait indefinitely
+
+   return:        the number of engines that are connected or -1 if an error occurred
+*/
+int pok_serve(int mseconds);
+
 /* UTILITY LIBRARY */
 
 /* pok_util_compute_chunk_size: computes a favorable chunk size given the specified dimensions of a map
@@ -3,6 +3,7 @@
 #include "error.h"
 #include "user.h"
 #include "config.h"
+#include "trace.h"
 #include <stdlib.h>
 #include <stdarg.h>
 #include <stdio.h>
@@ -15,6 +16,7 @@
 #else
 #define POKGAME_UP_TIMEOUT    10
 #endif
+#define POKGAME_UP_MAX_STEPS   5 /* most update steps run to catch up after an overrun */
 
 #ifndef POKGAME_TEST
 
@@ -23,6 +25,9 @@ static void aux_graphics_load();
 static void aux_graphics_unload();
 static void configure_stderr();
 static void log_termination();
+#ifdef POKGAME_TRACE
+static void write_trace();
+#endif
 
 const char* POKGAME_NAME;
 
@@ -41,6 +46,7 @@ int main(int argc,const char* argv[])
     pok_user_load_module();
     pok_netobj_load_module();
     pok_gamelock_load_module();
+    pok_trace_load_module();
 
     /* initialize a graphics subsystem for the game; this corresponds to the
        application's top-level window; start up the window and renderer before
@@ -71,7 +77,13 @@ int main(int argc,const char* argv[])
        subsystem has already finished and is waiting to be cleaned up */
     pok_graphics_subsystem_free(sys);
 
+#ifdef POKGAME_TRACE
+    /* save the trace of the session to the content directory */
+    write_trace();
+#endif
+
     /* unload all modules */
+    pok_trace_unload_module();
     pok_gamelock_unload_module();
     pok_netobj_unload_module();
     pok_user_unload_module();
@@ -96,6 +108,7 @@ void aux_graphics_unload()
        is unloading */
 
     pok_glyphs_unload();
+    pok_map_render_unload();
 }
 
 void configure_stderr()
@@ -133,6 +146,19 @@ void log_termination()
 #endif
 }
 
+#ifdef POKGAME_TRACE
+void write_trace()
+{
+    struct pok_string* path = pok_get_content_root_path();
+    if (path == NULL)
+        return;
+    pok_string_concat(path,POKGAME_CONTENT_TRACE_FILE);
+    if ( !pok_trace_flush(path->buf) )
+        pok_error_fromstack(pok_error_warning);
+    pok_string_free(path);
+}
+#endif
+
 #endif /* POKGAME_TEST */
 
 /* pok_intermsg */
@@ -188,6 +214,7 @@ void pok_intermsg_discard(struct pok_intermsg* im)
 static void pok_game_render_menus(const struct pok_graphics_subsystem* sys,struct pok_game_info* game)
 {
     /* this function is a high-level entry to rendering the game's menus */
+    POK_TRACE_BEGIN(render);
 
     /* only one of these should be rendered at a time */
     if (game->messageMenu.base.active)
@@ -202,6 +229,7 @@ static void pok_game_render_menus(const struct pok_graphics_subsystem* sys,struc
     if (game->yesnoMenu.base.active)
         pok_selection_menu_render(&game->yesnoMenu);
 
+    POK_TRACE_END(render,"pok_game_render_menus");
     (void)sys;
 }
 
@@ -218,6 +246,7 @@ struct pok_game_info* pok_game_new(struct pok_graphics_subsystem* sys,struct pok
     /* initialize general parameters */
     pok_timeout_interval_reset(&game->ioTimeout,POKGAME_IO_TIMEOUT);
     pok_timeout_interval_reset(&game->updateTimeout,POKGAME_UP_TIMEOUT);
+    pok_timestep_reset(&game->updateStep,POKGAME_UP_TIMEOUT,POKGAME_UP_MAX_STEPS);
     game->staticOwnerMask = template == NULL ? (2 << _pok_static_obj_top) - 1 : 0x00;
     game->control = TRUE;
     game->gameContext = pok_game_intro_context;
@@ -227,6 +256,7 @@ struct pok_game_info* pok_game_new(struct pok_graphics_subsystem* sys,struct pok
     game->versionCBack = NULL;
     pok_string_init(&game->versionLabel);
     game->versionChannel = NULL;
+    game->ioPoller = NULL;
     game->updateThread = pok_thread_new((pok_thread_entry)update_proc,game);
     if (game->updateThread == NULL)
         pok_error_fromstack(pok_error_fatal);
@@ -288,9 +318,12 @@ void pok_game_free(struct pok_game_info* game)
     pok_input_menu_delete(&game->inputMenu);
     pok_message_menu_delete(&game->messageMenu);
     pok_intermsg_discard(&game->updateInterMsg);
+    pok_game_lock_unregister(&game->updateInterMsg);
     pok_intermsg_discard(&game->ioInterMsg);
     pok_character_free(game->player);
     pok_character_render_context_free(game->charRC);
+    /* the world is freed by the library (which knows nothing about game locks) */
+    pok_game_lock_unregister(game->world);
     pok_world_free(game->world);
     pok_map_render_context_free(game->mapRC);
     if (game->staticOwnerMask & 0x01)
@@ -317,6 +350,8 @@ void pok_game_static_replace(struct pok_game_info* game,enum pok_static_obj_kind
             game->staticOwnerMask |= 0x01;
         game->tman = obj;
         game->mapRC->tman = obj;
+        /* layers baked from the old tiles must not be drawn again */
+        pok_map_render_invalidate();
         break;
     case pok_static_obj_sprite_manager:
         if (game->staticOwnerMask & 0x02)
@@ -350,21 +385,51 @@ void pok_game_unregister(struct pok_game_info* game)
     pok_graphics_subsystem_unregister(game->sys,(graphics_routine_t)pok_game_render_menus,game);
     pok_graphics_subsystem_unregister(game->sys,(graphics_routine_t)pok_fadeout_effect_render,&game->fadeout);
 }
+static int pok_game_atlases(struct pok_game_info* game,struct pok_image** atlases[])
+{
+    /* collect the atlases that were built; unused entries are NULL (the caller passes
+       only the first 'n' to the graphics subsystem) */
+    int n = 0;
+    atlases[0] = atlases[1] = NULL;
+    if (game->tman->atlas != NULL)
+        atlases[n++] = &game->tman->atlas;
+    if (game->sman->atlas != NULL)
+        atlases[n++] = &game->sman->atlas;
+    return n;
+}
 void pok_game_load_textures(struct pok_game_info* game)
 {
+    /* pack the tiles and sprite frames into atlases for the batch renderers; this has
+       to happen before the images are loaded as textures (which discards their pixel
+       data); if either fails then that layer is simply rendered image by image; the
+       atlases that exist are passed after the tile and sprite images */
+    int atlasc;
+    struct pok_image** atlases[2];
+    if (game->tman->atlas == NULL && !pok_tile_manager_build_atlas(game->tman))
+        pok_exception_pop();
+    if (game->sman->atlas == NULL && !pok_sprite_manager_build_atlas(game->sman))
+        pok_exception_pop();
+    atlasc = pok_game_atlases(game,atlases);
     pok_graphics_subsystem_create_textures(
         game->sys,
-        2,
+        2 + atlasc,
         game->tman->tileset, game->tman->tilecnt,
-        game->sman->spritesets, game->sman->imagecnt );
+        game->sman->spritesets, game->sman->imagecnt,
+        atlases[0], 1,
+        atlases[1], 1 );
 }
 void pok_game_delete_textures(struct pok_game_info* game)
 {
+    int atlasc;
+    struct pok_image** atlases[2];
+    atlasc = pok_game_atlases(game,atlases);
     pok_graphics_subsystem_delete_textures(
         game->sys,
-        2,
+        2 + atlasc,
         game->tman->tileset, game->tman->tilecnt,
-        game->sman->spritesets, game->sman->imagecnt );
+        game->sman->spritesets, game->sman->imagecnt,
+        atlases[0], 1,
+        atlases[1], 1 );
 }
 void pok_game_context_push(struct pok_game_info* game)
 {
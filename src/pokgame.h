@@ -99,10 +99,12 @@ struct pok_game_info
     struct pok_string versionLabel; /* version label of the form: "Text Label\0GUID\0" */
     pok_game_callback versionCBack; /* if non-NULL, then a procedure that executes the IO procedure for the version */
     struct pok_data_source* versionChannel; /* data source for version IO */
+    struct pok_io_poller* ioPoller; /* if non-NULL, the IO procedure sleeps on this between exchanges */
 
     /* timeouts for main game procedures (in thousandths of a second) */
     struct pok_timeout_interval ioTimeout;
     struct pok_timeout_interval updateTimeout;
+    struct pok_timestep updateStep; /* fixed-timestep schedule for the update procedure */
 
     /* game control flags */
     enum pok_game_context gameContext; /* flag what the game is currently doing */
@@ -18,6 +18,9 @@
 #define POKGAME_GREETING_SEQUENCE    "pokgame-greetings" /* greetings string */
 #define POKGAME_BINARYMODE_SEQUENCE  "pokgame-binary"    /* indicates to use the binary protocol */
 #define POKGAME_TEXTMODE_SEQUENCE    "pokgame-text"      /* indicates to use the text protocol */
+#define POKGAME_BINARYMODE_Z_SEQUENCE "pokgame-binary-z" /* indicates to use the binary protocol with stream compression: every
+                                                            byte that follows the mode sequence (in both directions) is part of a
+                                                            raw deflate stream that is flushed at the end of each message */
 
 /* protocol masks */
 #define POKGAME_DEFAULT_GRAPHICS_MASK 0x01 /* mask for default settings bitmask sent during intermediate exchange */
@@ -0,0 +1,687 @@
+/* server.c - pokgame */
+#include "server.h"
+#include "error.h"
+#include "protocol.h"
+#include "pok.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* constants */
+#define SERVER_EVENT_BATCH 64   /* events handled per wait */
+#define SERVER_ACCEPT_BATCH 32  /* connections accepted per listener event */
+#define SERVER_READ_SIZE 4096   /* bytes read at once after the exchanges */
+#define SERVER_MAX_GREETING 64  /* longest greeting accepted from an engine */
+#define SERVER_DEFAULT_NAME "pokgame-server" /* socket name used by 'pok_init' unless POKGAME_SERVER is set */
+
+/* pok_server_payload */
+struct pok_server_payload* pok_server_payload_new(const byte_t* data,size_t size)
+{
+    struct pok_server_payload* payload;
+    payload = malloc(sizeof(struct pok_server_payload) + size);
+    if (payload == NULL) {
+        pok_exception_flag_memory_error();
+        return NULL;
+    }
+    payload->refs = 1;
+    payload->size = size;
+    memcpy(payload->data,data,size);
+    return payload;
+}
+struct pok_server_payload* pok_server_payload_new_memory(struct pok_data_source* memory)
+{
+    /* create a payload from the bytes written to a memory data source */
+    size_t size;
+    const byte_t* data;
+    data = pok_data_source_memory(memory,&size);
+    return pok_server_payload_new(data,size);
+}
+void pok_server_payload_release(struct pok_server_payload* payload)
+{
+    if (--payload->refs == 0)
+        free(payload);
+}
+static void server_replace_payload(struct pok_server_payload** slot,struct pok_server_payload* payload)
+{
+    if (*slot != NULL)
+        pok_server_payload_release(*slot);
+    *slot = payload;
+}
+static struct pok_data_source* server_memory(struct pok_server* server)
+{
+    /* create a memory data source to encode bytes that are sent after the mode sequence; they are
+       compressed (on their own) if compression is on */
+    struct pok_data_source* memory = pok_data_source_new_memory();
+    if (memory != NULL && server->compressed && !pok_data_source_compress(memory,pok_iomode_write,server->level)) {
+        pok_data_source_free(memory);
+        return NULL;
+    }
+    return memory;
+}
+static struct pok_server_payload* server_payload(struct pok_server* server,const byte_t* data,size_t size)
+{
+    /* create a payload from bytes that are sent after the mode sequence */
+    size_t bytesOut;
+    struct pok_data_source* memory;
+    struct pok_server_payload* payload = NULL;
+    if (!server->compressed)
+        return pok_server_payload_new(data,size);
+    memory = server_memory(server);
+    if (memory == NULL)
+        return NULL;
+    if ( pok_data_source_write(memory,data,size,&bytesOut) )
+        payload = pok_server_payload_new_memory(memory);
+    pok_data_source_free(memory);
+    return payload;
+}
+
+/* pok_server_connection: the version's side of the exchanges with a single engine */
+enum pok_server_stage
+{
+    pok_server_stage_greet,  /* waiting for the engine's greeting */
+    pok_server_stage_guid,   /* the introductory exchange is queued; waiting for the engine's guid */
+    pok_server_stage_general /* the intermediate exchange is queued; the exchanges are done once it is sent */
+};
+
+struct pok_server_connection
+{
+    struct pok_data_source* dsrc;
+    enum pok_server_stage stage;
+    bool_t ready;      /* the exchanges are complete */
+    int watching;      /* events the connection is waiting on */
+
+    struct pok_string greeting;
+    byte_t guid[GUID_LENGTH];
+    size_t guidProg;
+    uint32_t playerID;
+
+    /* output queue: a ring of payload references; 'offset' is the progress through the first one */
+    struct pok_server_payload** queue;
+    uint32_t qhead, qsize, qcap;
+    size_t offset;
+
+    struct pok_server_connection* prev;
+    struct pok_server_connection* next;
+};
+
+static bool_t server_encode_intro(struct pok_server* server);
+static bool_t server_encode_inter(struct pok_server* server);
+
+static bool_t conn_watch(struct pok_server* server,struct pok_server_connection* conn)
+{
+    /* wait for input at all times and for the channel to accept output while any is queued */
+    int events = pok_io_event_read | (conn->qsize > 0 ? pok_io_event_write : 0);
+    if (events == conn->watching)
+        return TRUE;
+    if (server->group != NULL && !pok_io_group_watch(server->group,conn->dsrc,events,conn))
+        return FALSE;
+    conn->watching = events;
+    return TRUE;
+}
+static void conn_close(struct pok_server* server,struct pok_server_connection* conn)
+{
+    uint32_t i;
+    if (server->group != NULL && conn->watching != 0)
+        pok_io_group_watch(server->group,conn->dsrc,0,NULL);
+    pok_data_source_free(conn->dsrc);
+    for (i = 0;i < conn->qsize;++i)
+        pok_server_payload_release(conn->queue[(conn->qhead + i) & (conn->qcap - 1)]);
+    free(conn->queue);
+    pok_string_delete(&conn->greeting);
+    if (conn->prev != NULL)
+        conn->prev->next = conn->next;
+    else
+        server->conns = conn->next;
+    if (conn->next != NULL)
+        conn->next->prev = conn->prev;
+    --server->stats.connections;
+    if (conn->ready)
+        --server->stats.ready;
+    free(conn);
+}
+static void conn_drop(struct pok_server* server,struct pok_server_connection* conn)
+{
+    /* close a connection because of the exception on the stack; an engine that hangs up after the
+       exchanges is not counted as an error */
+    const struct pok_exception* ex = pok_exception_pop();
+    if (ex != NULL && !(conn->ready && ex->kind == pok_ex_net
+            && (ex->id == pok_ex_net_endofcomms || ex->id == pok_ex_net_brokenpipe)))
+    {
+        ++server->stats.dropped;
+        snprintf(server->lastError,sizeof(server->lastError),"%s",ex->message);
+    }
+    conn_close(server,conn);
+}
+static bool_t conn_new(struct pok_server* server,struct pok_data_source* dsrc)
+{
+    /* the connection owns the data source (even if the function fails) */
+    struct pok_server_connection* conn;
+    conn = malloc(sizeof(struct pok_server_connection));
+    if (conn == NULL) {
+        pok_exception_flag_memory_error();
+        pok_data_source_free(dsrc);
+        return FALSE;
+    }
+    conn->dsrc = dsrc;
+    conn->stage = pok_server_stage_greet;
+    conn->ready = FALSE;
+    conn->watching = 0;
+    pok_string_init(&conn->greeting);
+    conn->guidProg = 0;
+    conn->playerID = 0;
+    conn->queue = NULL;
+    conn->qhead = conn->qsize = conn->qcap = 0;
+    conn->offset = 0;
+    conn->prev = NULL;
+    conn->next = server->conns;
+    if (server->conns != NULL)
+        server->conns->prev = conn;
+    server->conns = conn;
+    ++server->stats.connections;
+    /* payloads are written straight from shared memory; buffering would copy them */
+    pok_data_source_buffering(dsrc,FALSE);
+    if ( !conn_watch(server,conn) ) {
+        conn_drop(server,conn);
+        return FALSE;
+    }
+    return TRUE;
+}
+static bool_t conn_queue(struct pok_server* server,struct pok_server_connection* conn,struct pok_server_payload* payload)
+{
+    if (conn->qsize == conn->qcap) {
+        /* grow the ring (its capacity is a power of two) and unwrap it */
+        uint32_t i, cap = conn->qcap == 0 ? 4 : conn->qcap * 2;
+        struct pok_server_payload** queue = malloc(cap * sizeof(struct pok_server_payload*));
+        if (queue == NULL) {
+            pok_exception_flag_memory_error();
+            return FALSE;
+        }
+        for (i = 0;i < conn->qsize;++i)
+            queue[i] = conn->queue[(conn->qhead + i) & (conn->qcap - 1)];
+        free(conn->queue);
+        conn->queue = queue;
+        conn->qhead = 0;
+        conn->qcap = cap;
+    }
+    ++payload->refs;
+    conn->queue[(conn->qhead + conn->qsize) & (conn->qcap - 1)] = payload;
+    ++conn->qsize;
+    server->stats.queued += payload->size;
+    return TRUE;
+}
+static bool_t conn_send(struct pok_server* server,struct pok_server_connection* conn)
+{
+    /* write queued payloads until the queue is empty or the channel is full; FALSE is returned if an
+       exception was generated */
+    while (conn->qsize > 0) {
+        size_t bytesOut;
+        struct pok_server_payload* payload = conn->queue[conn->qhead];
+        if ( !pok_data_source_write(conn->dsrc,payload->data + conn->offset,payload->size - conn->offset,&bytesOut) )
+            return pok_exception_pop_ex(pok_ex_net,pok_ex_net_wouldblock) != NULL;
+        server->stats.sent += bytesOut;
+        conn->offset += bytesOut;
+        if (conn->offset < payload->size)
+            return TRUE;
+        pok_server_payload_release(payload);
+        conn->qhead = (conn->qhead + 1) & (conn->qcap - 1);
+        --conn->qsize;
+        conn->offset = 0;
+    }
+    if (conn->stage == pok_server_stage_general && !conn->ready) {
+        conn->ready = TRUE;
+        ++server->stats.completed;
+        ++server->stats.ready;
+    }
+    return TRUE;
+}
+static bool_t conn_queue_inter(struct pok_server* server,struct pok_server_connection* conn)
+{
+    /* queue the intermediate exchange: the bitmask, graphics parameters and static objects, then
+       the player character's and world's network ids and then the first map (sent as if by the
+       world's 'add_map' method); only the ids are encoded for each connection; the engine's player
+       character and world netwrites send no fields yet so nothing is read between them */
+    bool_t result;
+    struct pok_data_source* memory;
+    struct pok_server_payload* ids;
+    if (server->firstMap == NULL) {
+        pok_exception_new_format("server: no first map was specified");
+        return FALSE;
+    }
+    if (server->inter == NULL && !server_encode_inter(server))
+        return FALSE;
+    if (server->map == NULL) {
+        if ((server->map = server_payload(server,server->firstMap->data,server->firstMap->size)) == NULL)
+            return FALSE;
+        server->stats.encoded += server->map->size;
+    }
+    memory = server_memory(server);
+    if (memory == NULL)
+        return FALSE;
+    conn->playerID = pok_netobj_allocate_unique_id();
+    if ( !pok_data_stream_write_uint32(memory,conn->playerID) || !pok_data_stream_write_uint32(memory,server->worldID)
+        || (ids = pok_server_payload_new_memory(memory)) == NULL )
+    {
+        pok_data_source_free(memory);
+        return FALSE;
+    }
+    pok_data_source_free(memory);
+    result = conn_queue(server,conn,server->inter) && conn_queue(server,conn,ids) && conn_queue(server,conn,server->map);
+    pok_server_payload_release(ids);
+    return result;
+}
+static bool_t conn_recv(struct pok_server* server,struct pok_server_connection* conn)
+{
+    /* perform a single read for the current stage (a blocking channel is only known to have input
+       for one read); FALSE is returned if an exception was generated */
+    size_t bytesIn;
+    switch (conn->stage) {
+    case pok_server_stage_greet:
+        if ( !pok_data_stream_read_string_ex(conn->dsrc,&conn->greeting) ) {
+            if (pok_exception_pop_ex(pok_ex_net,pok_ex_net_pending) == NULL
+                && pok_exception_pop_ex(pok_ex_net,pok_ex_net_wouldblock) == NULL)
+                return FALSE;
+            if (conn->greeting.len > SERVER_MAX_GREETING) {
+                pok_exception_new_format("server: peer did not send valid protocol greeting sequence");
+                return FALSE;
+            }
+            return TRUE;
+        }
+        if (strcmp(conn->greeting.buf,POKGAME_GREETING_SEQUENCE) != 0) {
+            pok_exception_new_format("server: peer did not send valid protocol greeting sequence");
+            return FALSE;
+        }
+        if (server->intro == NULL && !server_encode_intro(server))
+            return FALSE;
+        if ( !conn_queue(server,conn,server->intro) )
+            return FALSE;
+        /* the engine's guid is the first thing it sends on the compressed stream */
+        if (server->compressed && !pok_data_source_compress(conn->dsrc,pok_iomode_read,server->level))
+            return FALSE;
+        conn->stage = pok_server_stage_guid;
+        break;
+    case pok_server_stage_guid:
+        if ( !pok_data_source_read_to_buffer(conn->dsrc,conn->guid + conn->guidProg,GUID_LENGTH - conn->guidProg,&bytesIn) )
+            return pok_exception_pop_ex(pok_ex_net,pok_ex_net_wouldblock) != NULL;
+        if (bytesIn == 0) {
+            pok_exception_new_ex(pok_ex_net,pok_ex_net_endofcomms);
+            return FALSE;
+        }
+        conn->guidProg += bytesIn;
+        if (conn->guidProg < GUID_LENGTH)
+            break;
+        if ( !conn_queue_inter(server,conn) )
+            return FALSE;
+        conn->stage = pok_server_stage_general;
+        break;
+    case pok_server_stage_general:
+        /* the engine does not perform the general exchange yet: discard its input until it hangs up */
+        if (pok_data_source_read_any(conn->dsrc,SERVER_READ_SIZE,&bytesIn) == NULL)
+            return pok_exception_pop_ex(pok_ex_net,pok_ex_net_wouldblock) != NULL;
+        if (bytesIn == 0) {
+            pok_exception_new_ex(pok_ex_net,pok_ex_net_endofcomms);
+            return FALSE;
+        }
+        break;
+    }
+    return TRUE;
+}
+static void conn_handle(struct pok_server* server,struct pok_server_connection* conn,int events)
+{
+    /* handle the events for a connection; anything queued is sent at once instead of waiting for
+       the channel to report that it can accept output */
+    ++server->stats.events;
+    if ((events & pok_io_event_read) && !conn_recv(server,conn)) {
+        conn_drop(server,conn);
+        return;
+    }
+    if (conn->qsize > 0 && !conn_send(server,conn)) {
+        conn_drop(server,conn);
+        return;
+    }
+    if ( !conn_watch(server,conn) )
+        conn_drop(server,conn);
+}
+
+/* pok_server */
+static struct pok_server* server_alloc()
+{
+    int i;
+    struct pok_server* server;
+    server = malloc(sizeof(struct pok_server));
+    if (server == NULL) {
+        pok_exception_flag_memory_error();
+        return NULL;
+    }
+    server->listener = NULL;
+    server->group = NULL;
+    server->poller = NULL;
+    server->conns = NULL;
+    pok_string_init(&server->label);
+    pok_string_assign(&server->label,"pokgame");
+    memset(server->guid,'0',GUID_LENGTH);
+    server->guid[GUID_LENGTH] = 0;
+    server->usingDefault = TRUE;
+    memset(server->graphics,0,sizeof(server->graphics));
+    for (i = 0;i < _pok_static_obj_top;++i)
+        server->statics[i] = NULL;
+    server->firstMap = NULL;
+    server->intro = NULL;
+    server->inter = NULL;
+    server->map = NULL;
+    server->worldID = pok_netobj_allocate_unique_id();
+    server->compressed = FALSE;
+    server->level = POK_COMPRESSION_DEFAULT;
+    memset(&server->stats,0,sizeof(struct pok_server_stats));
+    server->lastError[0] = 0;
+    return server;
+}
+struct pok_server* pok_server_new(const char* name)
+{
+    /* create a server that listens on the specified local named socket */
+    struct pok_server* server = server_alloc();
+    if (server == NULL)
+        return NULL;
+    if ((server->listener = pok_listener_new_local_named(name)) == NULL
+        || (server->group = pok_io_group_new()) == NULL
+        || !pok_io_group_watch_listener(server->group,server->listener,server))
+    {
+        pok_server_free(server);
+        return NULL;
+    }
+    return server;
+}
+struct pok_server* pok_server_new_channel(struct pok_data_source* channel)
+{
+    /* create a server for a single engine on the specified channel; the server owns the channel */
+    struct pok_server* server = server_alloc();
+    if (server == NULL) {
+        pok_data_source_free(channel);
+        return NULL;
+    }
+    if ((server->poller = pok_io_poller_new(channel)) == NULL) {
+        pok_data_source_free(channel);
+        pok_server_free(server);
+        return NULL;
+    }
+    if ( !conn_new(server,channel) ) {
+        pok_server_free(server);
+        return NULL;
+    }
+    return server;
+}
+void pok_server_free(struct pok_server* server)
+{
+    int i;
+    while (server->conns != NULL)
+        conn_close(server,server->conns);
+    if (server->group != NULL)
+        pok_io_group_free(server->group);
+    if (server->listener != NULL)
+        pok_listener_free(server->listener);
+    if (server->poller != NULL)
+        pok_io_poller_free(server->poller);
+    for (i = 0;i < _pok_static_obj_top;++i)
+        server_replace_payload(server->statics + i,NULL);
+    server_replace_payload(&server->firstMap,NULL);
+    server_replace_payload(&server->intro,NULL);
+    server_replace_payload(&server->inter,NULL);
+    server_replace_payload(&server->map,NULL);
+    pok_string_delete(&server->label);
+    free(server);
+}
+void pok_server_set_label(struct pok_server* server,const char* label,const char* guid)
+{
+    /* the guid is padded (or truncated) to GUID_LENGTH characters */
+    size_t len = strlen(guid);
+    pok_string_assign(&server->label,label);
+    memset(server->guid,'0',GUID_LENGTH);
+    memcpy(server->guid,guid,len < GUID_LENGTH ? len : GUID_LENGTH);
+    server_replace_payload(&server->intro,NULL);
+}
+void pok_server_set_graphics(struct pok_server* server,uint16_t dimension,uint16_t windowWidth,uint16_t windowHeight,
+    uint16_t playerLocationX,uint16_t playerLocationY,uint16_t playerOffsetX,uint16_t playerOffsetY)
+{
+    server->usingDefault = FALSE;
+    server->graphics[0] = dimension;
+    server->graphics[1] = windowWidth;
+    server->graphics[2] = windowHeight;
+    server->graphics[3] = playerLocationX;
+    server->graphics[4] = playerLocationY;
+    server->graphics[5] = playerOffsetX;
+    server->graphics[6] = playerOffsetY;
+    server_replace_payload(&server->inter,NULL);
+}
+bool_t pok_server_set_static(struct pok_server* server,enum pok_static_obj_kind kind,const byte_t* data,size_t size)
+{
+    /* set the encoded form of a static network object (see its 'netread' function); NULL data unsets
+       the object so that engines use their default */
+    struct pok_server_payload* payload = NULL;
+    if (kind >= _pok_static_obj_top) {
+        pok_exception_new_format("server: bad static object kind: %d",kind);
+        return FALSE;
+    }
+    if (data != NULL && (payload = pok_server_payload_new(data,size)) == NULL)
+        return FALSE;
+    server_replace_payload(server->statics + kind,payload);
+    server_replace_payload(&server->inter,NULL);
+    return TRUE;
+}
+bool_t pok_server_set_first_map(struct pok_server* server,const byte_t* data,size_t size)
+{
+    /* set the encoded form of the first map (see 'pok_map_netread'); it must have map number 1 */
+    struct pok_server_payload* payload = pok_server_payload_new(data,size);
+    if (payload == NULL)
+        return FALSE;
+    server_replace_payload(&server->firstMap,payload);
+    server_replace_payload(&server->map,NULL);
+    return TRUE;
+}
+bool_t pok_server_set_compression(struct pok_server* server,bool_t on,int level)
+{
+    /* offer engines the compressed binary protocol; this applies to engines that greet the server
+       afterwards; FALSE is returned if compression is not available */
+    struct pok_data_source* probe;
+    if (on && (level < POK_COMPRESSION_DEFAULT || level > 9)) {
+        pok_exception_new_format("server: bad compression level: %d",level);
+        return FALSE;
+    }
+    server->compressed = on;
+    server->level = level;
+    if (on) {
+        if ((probe = server_memory(server)) == NULL) {
+            server->compressed = FALSE;
+            return FALSE;
+        }
+        pok_data_source_free(probe);
+    }
+    server_replace_payload(&server->intro,NULL);
+    server_replace_payload(&server->inter,NULL);
+    server_replace_payload(&server->map,NULL);
+    return TRUE;
+}
+bool_t pok_server_broadcast(struct pok_server* server,const byte_t* data,size_t size)
+{
+    /* queue the same bytes on every connection that has (at least) queued the exchanges; they are
+       stored once; FALSE is returned if the payload could not be created */
+    struct pok_server_connection* conn, *next;
+    struct pok_server_payload* payload = server_payload(server,data,size);
+    if (payload == NULL)
+        return FALSE;
+    server->stats.encoded += payload->size;
+    for (conn = server->conns;conn != NULL;conn = next) {
+        next = conn->next;
+        if (conn->stage != pok_server_stage_general)
+            continue;
+        if ( !conn_queue(server,conn,payload) || !conn_send(server,conn) || !conn_watch(server,conn) )
+            conn_drop(server,conn);
+    }
+    pok_server_payload_release(payload);
+    return TRUE;
+}
+static void server_accept(struct pok_server* server)
+{
+    int i;
+    for (i = 0;i < SERVER_ACCEPT_BATCH;++i) {
+        struct pok_data_source* dsrc = pok_listener_accept(server->listener);
+        if (dsrc == NULL) {
+            const struct pok_exception* ex = pok_exception_pop();
+            if (ex != NULL && !(ex->kind == pok_ex_net && ex->id == pok_ex_net_wouldblock))
+                snprintf(server->lastError,sizeof(server->lastError),"%s",ex->message);
+            break;
+        }
+        ++server->stats.accepted;
+        conn_new(server,dsrc);
+    }
+}
+int pok_server_run(struct pok_server* server,int mseconds)
+{
+    /* wait at most 'mseconds' (or indefinitely if negative) for events and handle them; the number
+       of events is returned or -1 if an exception was generated */
+    int i, n;
+    struct pok_io_group_event events[SERVER_EVENT_BATCH];
+    if (server->group == NULL) {
+        /* the single channel: the poller's timer is one-shot and zero disarms it */
+        int ready;
+        if (server->conns == NULL)
+            return 0;
+        pok_io_poller_set_timer(server->poller,mseconds < 0 ? 0 : (mseconds == 0 ? 1 : mseconds));
+        ++server->stats.waits;
+        ready = pok_io_poller_wait(server->poller,server->conns->watching);
+        if (ready == 0)
+            return -1;
+        ready &= server->conns->watching;
+        if (ready == 0)
+            return 0;
+        conn_handle(server,server->conns,ready);
+        return 1;
+    }
+    ++server->stats.waits;
+    n = pok_io_group_wait(server->group,events,SERVER_EVENT_BATCH,mseconds);
+    for (i = 0;i < n;++i) {
+        if (events[i].tag == server)
+            server_accept(server);
+        else
+            conn_handle(server,events[i].tag,events[i].events);
+    }
+    return n;
+}
+static bool_t server_encode_intro(struct pok_server* server)
+{
+    /* encode the version's side of the introductory exchange: the greeting, the protocol mode, the
+       label and the guid (each null-terminated); the stream is compressed after the mode sequence if
+       compression is on */
+    size_t size;
+    struct pok_data_source* memory = pok_data_source_new_memory();
+    if (memory == NULL)
+        return FALSE;
+    if ( !pok_data_stream_write_string_ex(memory,POKGAME_GREETING_SEQUENCE,sizeof(POKGAME_GREETING_SEQUENCE))
+        || (server->compressed
+            ? !pok_data_stream_write_string_ex(memory,POKGAME_BINARYMODE_Z_SEQUENCE,sizeof(POKGAME_BINARYMODE_Z_SEQUENCE))
+                || !pok_data_source_compress(memory,pok_iomode_write,server->level)
+            : !pok_data_stream_write_string_ex(memory,POKGAME_BINARYMODE_SEQUENCE,sizeof(POKGAME_BINARYMODE_SEQUENCE)))
+        || !pok_data_stream_write_string_ex(memory,server->label.buf,server->label.len + 1)
+        || !pok_data_stream_write_string_ex(memory,server->guid,GUID_LENGTH + 1)
+        || (server->intro = pok_server_payload_new_memory(memory)) == NULL )
+    {
+        pok_data_source_free(memory);
+        return FALSE;
+    }
+    pok_data_source_memory(memory,&size);
+    server->stats.encoded += size;
+    pok_data_source_free(memory);
+    return TRUE;
+}
+static bool_t server_encode_inter(struct pok_server* server)
+{
+    /* encode the shared part of the intermediate exchange: the bitmask that tells the engine which
+       objects follow, the graphics parameters and the static objects */
+    int i;
+    size_t size;
+    bool_t result = TRUE;
+    byte_t bitmask = 0;
+    struct pok_data_source* memory = server_memory(server);
+    if (memory == NULL)
+        return FALSE;
+    if (!server->usingDefault)
+        bitmask |= POKGAME_DEFAULT_GRAPHICS_MASK;
+    if (server->statics[pok_static_obj_tile_manager] != NULL)
+        bitmask |= POKGAME_DEFAULT_TILES_MASK;
+    if (server->statics[pok_static_obj_sprite_manager] != NULL)
+        bitmask |= POKGAME_DEFAULT_SPRITES_MASK;
+    result = pok_data_stream_write_byte(memory,bitmask);
+    for (i = 0;result && !server->usingDefault && i < 7;++i)
+        result = pok_data_stream_write_uint16(memory,server->graphics[i]);
+    for (i = 0;result && i < _pok_static_obj_top;++i)
+        if (server->statics[i] != NULL)
+            result = pok_data_source_write(memory,server->statics[i]->data,server->statics[i]->size,&size);
+    if (!result || (server->inter = pok_server_payload_new_memory(memory)) == NULL) {
+        pok_data_source_free(memory);
+        return FALSE;
+    }
+    server->stats.encoded += server->inter->size;
+    pok_data_source_free(memory);
+    return TRUE;
+}
+
+/* version library: the functions declared in 'pok.h' drive a single server */
+static struct pok_server* versionServer = NULL;
+
+void pok_init(uint16_t dimension,uint16_t windowWidth,uint16_t windowHeight,uint16_t playerLocationX,uint16_t playerLocationY,
+    uint16_t playerOffsetX,uint16_t playerOffsetY,bool_t doServer)
+{
+    pok_init_default(doServer);
+    pok_server_set_graphics(versionServer,dimension,windowWidth,windowHeight,playerLocationX,playerLocationY,playerOffsetX,playerOffsetY);
+}
+void pok_init_default(bool_t doServer)
+{
+    pok_exception_load_module();
+    if (doServer) {
+        const char* name = getenv("POKGAME_SERVER");
+        versionServer = pok_server_new(name != NULL ? name : SERVER_DEFAULT_NAME);
+    }
+    else {
+        struct pok_data_source* channel = pok_data_source_new_standard();
+        if (channel != NULL)
+            versionServer = pok_server_new_channel(channel);
+    }
+    if (versionServer == NULL)
+        pok_error_fromstack(pok_error_fatal);
+}
+void pok_close()
+{
+    if (versionServer != NULL) {
+        pok_server_free(versionServer);
+        versionServer = NULL;
+    }
+    pok_exception_unload_module();
+}
+void pok_set_label(const char* label,const char* guid)
+{
+    pok_server_set_label(versionServer,label,guid);
+}
+bool_t pok_set_tile_manager(const void* data,size_t size)
+{
+    return pok_server_set_static(versionServer,pok_static_obj_tile_manager,data,size);
+}
+bool_t pok_set_sprite_manager(const void* data,size_t size)
+{
+    return pok_server_set_static(versionServer,pok_static_obj_sprite_manager,data,size);
+}
+bool_t pok_set_first_map(const void* data,size_t size)
+{
+    return pok_server_set_first_map(versionServer,data,size);
+}
+bool_t pok_set_compression(int level)
+{
+    return pok_server_set_compression(versionServer,TRUE,level);
+}
+bool_t pok_broadcast(const void* data,size_t size)
+{
+    return pok_server_broadcast(versionServer,data,size);
+}
+int pok_serve(int mseconds)
+{
+    if (pok_server_run(versionServer,mseconds) == -1)
+        return -1;
+    return versionServer->stats.connections;
+}
@@ -0,0 +1,83 @@
+/* server.h - pokgame */
+#ifndef POKGAME_SERVER_H
+#define POKGAME_SERVER_H
+#include "net.h"
+#include "netobj.h"
+
+/* Notes about the version server: the version library serves engines over channels; a server
+   either listens on a local named socket and serves many engines at once or serves a single engine
+   on a channel it is given (e.g. the standard IO channel an engine gives a version process); each
+   connection is driven by a state machine that performs the version's side of the introductory and
+   intermediate exchanges (see io-proc.c) one step at a time as its channel becomes ready, so a
+   single thread can serve hundreds of engines; the bytes that are the same for every engine (the
+   greetings and label, the graphics parameters, the static network objects and the first map) are
+   encoded once into shared payloads that each connection queues by reference; if compression is on
+   then each payload is compressed once on its own (see 'pok_data_source_compress') and a connection
+   inflates what its engine sends after the mode sequence */
+
+/* pok_server_payload: bytes queued on one or more connections; a payload is reference counted so
+   that it is stored once no matter how many connections send it */
+struct pok_server_payload
+{
+    uint32_t refs;
+    size_t size;
+    byte_t data[];
+};
+struct pok_server_payload* pok_server_payload_new(const byte_t* data,size_t size);
+struct pok_server_payload* pok_server_payload_new_memory(struct pok_data_source* memory);
+void pok_server_payload_release(struct pok_server_payload* payload);
+
+/* pok_server_stats: counters kept by a server */
+struct pok_server_stats
+{
+    uint32_t connections;   /* connections that are open */
+    uint32_t ready;         /* open connections that finished the exchanges */
+    uint64_t accepted;      /* connections accepted */
+    uint64_t completed;     /* connections that finished the exchanges */
+    uint64_t dropped;       /* connections closed because of an error (see 'lastError') */
+    uint64_t encoded;       /* bytes stored in shared payloads */
+    uint64_t queued;        /* bytes queued on connections (shared payloads count once per connection) */
+    uint64_t sent;          /* bytes sent to connections */
+    uint64_t waits;         /* times the server waited for events */
+    uint64_t events;        /* events handled */
+};
+
+struct pok_server_connection;
+struct pok_server
+{
+    struct pok_listener* listener;      /* NULL if the server has a single channel */
+    struct pok_io_group* group;         /* waits on the listener and connections */
+    struct pok_io_poller* poller;       /* waits on the single channel */
+    struct pok_server_connection* conns;
+
+    /* parts of the exchanges that are the same for every connection; 'intro' and 'inter' are
+       encoded the first time a connection needs them after they change */
+    struct pok_string label;
+    char guid[GUID_LENGTH+1];
+    bool_t usingDefault;                /* if non-zero, the engine keeps its default graphics parameters */
+    uint16_t graphics[7];               /* graphics parameters (see 'pok_graphics_subsystem_netread') */
+    struct pok_server_payload* statics[_pok_static_obj_top];
+    struct pok_server_payload* firstMap;
+    struct pok_server_payload* intro;   /* greetings, mode, label and guid */
+    struct pok_server_payload* inter;   /* bitmask, graphics parameters and static objects */
+    struct pok_server_payload* map;     /* first map as it is sent */
+    uint32_t worldID;
+    bool_t compressed;                  /* if non-zero, the compressed binary protocol is used */
+    int level;                          /* compression level */
+
+    struct pok_server_stats stats;
+    char lastError[256];                /* message of the last exception that dropped a connection */
+};
+struct pok_server* pok_server_new(const char* name);
+struct pok_server* pok_server_new_channel(struct pok_data_source* channel);
+void pok_server_free(struct pok_server* server);
+void pok_server_set_label(struct pok_server* server,const char* label,const char* guid);
+void pok_server_set_graphics(struct pok_server* server,uint16_t dimension,uint16_t windowWidth,uint16_t windowHeight,
+    uint16_t playerLocationX,uint16_t playerLocationY,uint16_t playerOffsetX,uint16_t playerOffsetY);
+bool_t pok_server_set_static(struct pok_server* server,enum pok_static_obj_kind kind,const byte_t* data,size_t size);
+bool_t pok_server_set_first_map(struct pok_server* server,const byte_t* data,size_t size);
+bool_t pok_server_set_compression(struct pok_server* server,bool_t on,int level);
+bool_t pok_server_broadcast(struct pok_server* server,const byte_t* data,size_t size);
+int pok_server_run(struct pok_server* server,int mseconds);
+
+#endif
@@ -3,6 +3,7 @@
 #include "error.h"
 #include "protocol.h"
 #include <stdlib.h>
+#include <string.h>
 
 struct pok_sprite_manager* pok_sprite_manager_new(const struct pok_graphics_subsystem* sys)
 {
@@ -28,6 +29,9 @@ void pok_sprite_manager_init(struct pok_sprite_manager* sman,const struct pok_gr
     sman->imagecnt = 0;
     sman->spritesets = NULL;
     sman->spriteassoc = NULL;
+    sman->atlas = NULL;
+    sman->atlasColumns = 0;
+    sman->atlasCells = NULL;
     sman->_sheet = NULL;
 }
 void pok_sprite_manager_delete(struct pok_sprite_manager* sman)
@@ -45,6 +49,10 @@ void pok_sprite_manager_delete(struct pok_sprite_manager* sman)
     }
     if (sman->spriteassoc != NULL)
         free(sman->spriteassoc);
+    if (sman->atlas != NULL)
+        pok_image_free(sman->atlas);
+    if (sman->atlasCells != NULL)
+        free(sman->atlasCells);
     if (sman->_sheet != NULL)
         pok_image_free(sman->_sheet);
 }
@@ -171,6 +179,73 @@ bool_t pok_sprite_manager_fromfile_png(struct pok_sprite_manager* sman,const cha
         return FALSE;
     return pok_sprite_manager_fromfile_generic(sman,img,flags);
 }
+bool_t pok_sprite_manager_build_atlas(struct pok_sprite_manager* sman)
+{
+    /* pack the pixel data of each distinct sprite frame into a single atlas image; this must be done
+       before the frames are loaded as textures since that operation discards their pixel data; the
+       sheet itself is a single column of frames which is too tall to be a texture for more than a
+       few sprites, so the frames are laid out in a square-ish grid instead */
+    uint16_t i;
+    uint32_t r, dim, width, cells, cell;
+    struct pok_image* atlas;
+    if (sman->atlas != NULL) {
+        pok_exception_new_ex(pok_ex_spriteman,pok_ex_spriteman_already);
+        return FALSE;
+    }
+    dim = sman->sys->dimension;
+    cells = 0;
+    for (i = 0;i < sman->imagecnt;++i) {
+        const struct pok_image* img = sman->spritesets[i];
+        if (img == NULL || img->pixels.data == NULL || img->width != dim || img->height != dim) {
+            pok_exception_new_ex(pok_ex_spriteman,pok_ex_spriteman_no_pixels);
+            return FALSE;
+        }
+        /* duplicate frames reuse the previous image */
+        if (i == 0 || img != sman->spritesets[i-1])
+            ++cells;
+    }
+    if (cells == 0) {
+        pok_exception_new_ex(pok_ex_spriteman,pok_ex_spriteman_no_pixels);
+        return FALSE;
+    }
+    sman->atlasColumns = 1;
+    while ((uint32_t)sman->atlasColumns * sman->atlasColumns < cells)
+        ++sman->atlasColumns;
+    width = dim * sman->atlasColumns;
+    atlas = pok_image_new();
+    if (atlas == NULL)
+        return FALSE;
+    atlas->width = width;
+    atlas->height = dim * ((cells + sman->atlasColumns - 1) / sman->atlasColumns);
+    atlas->flags = pok_image_flag_alpha;
+    atlas->pixels.data = calloc((size_t)atlas->width * atlas->height,sizeof(union alpha_pixel));
+    sman->atlasCells = malloc(sizeof(uint32_t) * sman->imagecnt);
+    if (atlas->pixels.data == NULL || sman->atlasCells == NULL) {
+        pok_exception_flag_memory_error();
+        pok_image_free(atlas);
+        if (sman->atlasCells != NULL) {
+            free(sman->atlasCells);
+            sman->atlasCells = NULL;
+        }
+        return FALSE;
+    }
+    cell = 0;
+    for (i = 0;i < sman->imagecnt;++i) {
+        union alpha_pixel* dst;
+        const struct pok_image* img = sman->spritesets[i];
+        if (i > 0 && img == sman->spritesets[i-1]) {
+            sman->atlasCells[i] = sman->atlasCells[i-1];
+            continue;
+        }
+        sman->atlasCells[i] = cell;
+        dst = atlas->pixels.dataRGBA + (size_t)(cell / sman->atlasColumns) * dim * width + (cell % sman->atlasColumns) * dim;
+        for (r = 0;r < dim;++r,dst += width)
+            memcpy(dst,img->pixels.dataRGBA + r * dim,dim * sizeof(union alpha_pixel));
+        ++cell;
+    }
+    sman->atlas = atlas;
+    return TRUE;
+}
 enum pok_network_result pok_sprite_manager_netread(struct pok_sprite_manager* sman,struct pok_data_source* dsrc,
     struct pok_netobj_readinfo* info)
 {
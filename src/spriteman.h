@@ -9,7 +9,8 @@
 enum pok_ex_spriteman
 {
     pok_ex_spriteman_already, /* the sprite manager was already configured for the specified operation */
-    pok_ex_spriteman_bad_image_dimension /* specified image dimensions were incorrect */
+    pok_ex_spriteman_bad_image_dimension, /* specified image dimensions were incorrect */
+    pok_ex_spriteman_no_pixels /* the sprite frames were not loaded or no longer have pixel data */
 };
 
 /* the elements in this enum will map direction to sprite frame indeces */
@@ -54,6 +55,13 @@ struct pok_sprite_manager
        that make up a single character set */
     struct pok_image*** spriteassoc;
 
+    /* sprite atlas (optional): a single image that packs every distinct sprite frame into a grid so
+       that a renderer can draw any character from one texture; frame 'spritesets[i]' occupies grid
+       cell 'atlasCells[i]' (row-major, 'atlasColumns' cells across); duplicate frames share a cell */
+    struct pok_image* atlas;
+    uint16_t atlasColumns;
+    uint32_t* atlasCells;
+
     /* reserved for implementation */
     struct pok_image* _sheet;
 };
@@ -66,7 +74,12 @@ bool_t pok_sprite_manager_open(struct pok_sprite_manager* sman,struct pok_data_s
 bool_t pok_sprite_manager_load(struct pok_sprite_manager* sman,uint16_t flags,uint16_t spriteCnt,const byte_t* data,bool_t byRef);
 bool_t pok_sprite_manager_fromfile(struct pok_sprite_manager* sman,const char* file,uint16_t flags);
 bool_t pok_sprite_manager_fromfile_png(struct pok_sprite_manager* sman,const char* file,uint16_t flags);
+bool_t pok_sprite_manager_build_atlas(struct pok_sprite_manager* sman);
 enum pok_network_result pok_sprite_manager_netread(struct pok_sprite_manager* sman,struct pok_data_source* dsrc,
     struct pok_netobj_readinfo* info);
 
+/* get the atlas cell of frame 'frame' of sprite 'spriteIndex' */
+static inline uint32_t pok_sprite_manager_get_cell(const struct pok_sprite_manager* sman,uint16_t spriteIndex,uint16_t frame)
+{ return sman->atlasCells[sman->spriteassoc[spriteIndex] + frame - sman->spritesets]; }
+
 #endif
@@ -2,6 +2,7 @@
 #include "tileman.h"
 #include "error.h"
 #include <stdlib.h>
+#include <string.h>
 
 /* pok_tile_terrain_info */
 static void pok_tile_terrain_info_init(struct pok_tile_terrain_info* info)
@@ -69,8 +70,15 @@ void pok_tile_manager_init(struct pok_tile_manager* tman,const struct pok_graphi
     tman->impassibility = 1; /* black tile is impassable, everything else passable */
     tman->tileset = NULL;
     tman->tileani = NULL;
+    tman->aniframes = NULL;
+    tman->aniframeTicks = 0;
     for (i = 0;i < POK_TILE_TERRAIN_TOP;++i)
         pok_tile_terrain_info_init(tman->terrain + i);
+    tman->terrainMask = NULL;
+    tman->atlas = NULL;
+    tman->atlasPixels = NULL;
+    tman->atlasColumns = 0;
+    tman->atlasMask = NULL;
     tman->_sheet = NULL;
 }
 void pok_tile_manager_delete(struct pok_tile_manager* tman)
@@ -86,15 +94,26 @@ void pok_tile_manager_delete(struct pok_tile_manager* tman)
     }
     if (tman->tileani!=NULL && (tman->flags & pok_tile_manager_flag_ani_byref) == 0)
         free(tman->tileani);
+    if (tman->aniframes != NULL)
+        free(tman->aniframes);
     if ((tman->flags & pok_tile_manager_flag_terrain_byref) == 0)
         for (i = 0;i < POK_TILE_TERRAIN_TOP;++i)
             pok_tile_terrain_info_delete(tman->terrain + i);
+    if (tman->terrainMask != NULL)
+        free(tman->terrainMask);
+    if (tman->atlas != NULL)
+        pok_image_free(tman->atlas);
+    if (tman->atlasPixels != NULL)
+        pok_image_free(tman->atlasPixels);
+    if (tman->atlasMask != NULL)
+        free(tman->atlasMask);
     if (tman->_sheet != NULL)
         pok_image_free(tman->_sheet);
 }
-static void pok_tile_manager_compute_ani_ticks(struct pok_tile_manager* tman)
+static bool_t pok_tile_manager_compute_ani_ticks(struct pok_tile_manager* tman)
 {
-    /* compute total ticks involved in a tile animation's indirections */
+    /* compute total ticks involved in a tile animation's indirections; then allocate
+       the resolved frame table for the current animation counter */
     uint16_t i, j;
     struct pok_tile_ani_data* ani = tman->tileani;
     for (i = 0;i < tman->tilecnt;++i,++ani) {
@@ -120,6 +139,15 @@ static void pok_tile_manager_compute_ani_ticks(struct pok_tile_manager* tman)
             } while (j > 0);
         }
     }
+    if (tman->aniframes == NULL) {
+        tman->aniframes = malloc(sizeof(uint16_t) * tman->tilecnt);
+        if (tman->aniframes == NULL) {
+            pok_exception_flag_memory_error();
+            return FALSE;
+        }
+    }
+    pok_tile_manager_update_ani(tman,tman->aniframeTicks);
+    return TRUE;
 }
 bool_t pok_tile_manager_save(struct pok_tile_manager* tman,struct pok_data_source* dsrc)
 {
@@ -212,7 +240,8 @@ bool_t pok_tile_manager_open(struct pok_tile_manager* tman,struct pok_data_sourc
                 if (!pok_data_stream_read_byte(dsrc,&tman->tileani[i].ticks) || !pok_data_stream_read_uint16(dsrc,&tman->tileani[i].forward)
                     || !pok_data_stream_read_uint16(dsrc,&tman->tileani[i].backward))
                     return FALSE;
-            pok_tile_manager_compute_ani_ticks(tman);
+            if ( !pok_tile_manager_compute_ani_ticks(tman) )
+                return FALSE;
         }
         /* read special tiles */
         for (i = 0;i < POK_TILE_TERRAIN_TOP;++i) {
@@ -227,7 +256,7 @@ bool_t pok_tile_manager_open(struct pok_tile_manager* tman,struct pok_data_sourc
                 if ( !pok_data_stream_read_uint16(dsrc,tman->terrain[i].list + j) )
                     return FALSE;
         }
-        return TRUE;
+        return pok_tile_manager_build_terrain(tman);
     }
     return FALSE;
 }
@@ -293,8 +322,7 @@ bool_t pok_tile_manager_load_ani(struct pok_tile_manager* tman,uint16_t anic,str
         for (i = 0;i < anic;++i)
             tman->tileani[i] = data[i];
     }
-    pok_tile_manager_compute_ani_ticks(tman);
-    return TRUE;
+    return pok_tile_manager_compute_ani_ticks(tman);
 }
 static bool_t pok_tile_manager_from_image(struct pok_tile_manager* tman,struct pok_image* img)
 {
@@ -341,6 +369,131 @@ bool_t pok_tile_manager_fromfile_tiles_png(struct pok_tile_manager* tman,const c
         return FALSE;
     return pok_tile_manager_from_image(tman,img);
 }
+bool_t pok_tile_manager_build_atlas(struct pok_tile_manager* tman)
+{
+    /* pack the pixel data of each tile image into a single atlas image; this must be done before the
+       tile images are loaded as textures since that operation discards their pixel data; tiles without
+       pixel data (e.g. the black tile, which is just a fill reference) are left out of the atlas */
+    uint16_t i, rows;
+    uint32_t r, dim, width;
+    size_t pixsz;
+    bool_t alpha = FALSE;
+    struct pok_image* atlas;
+    if (tman->atlas != NULL) {
+        pok_exception_new_ex(pok_ex_tileman,pok_ex_tileman_already);
+        return FALSE;
+    }
+    if (tman->tilecnt == 0) {
+        pok_exception_new_ex(pok_ex_tileman,pok_ex_tileman_zero_tiles);
+        return FALSE;
+    }
+    dim = tman->sys->dimension;
+    for (i = 0;i < tman->tilecnt;++i)
+        if (tman->tileset[i] != NULL && tman->tileset[i]->pixels.data != NULL
+            && (tman->tileset[i]->flags & pok_image_flag_alpha))
+            alpha = TRUE;
+    /* use a square-ish grid so that neither side of the atlas grows too large for a texture */
+    tman->atlasColumns = 1;
+    while ((uint32_t)tman->atlasColumns * tman->atlasColumns < tman->tilecnt)
+        ++tman->atlasColumns;
+    rows = (tman->tilecnt + tman->atlasColumns - 1) / tman->atlasColumns;
+    width = dim * tman->atlasColumns;
+    pixsz = alpha ? sizeof(union alpha_pixel) : sizeof(union pixel);
+    atlas = pok_image_new();
+    if (atlas == NULL)
+        return FALSE;
+    atlas->width = width;
+    atlas->height = dim * rows;
+    atlas->flags = alpha ? pok_image_flag_alpha : pok_image_flag_none;
+    atlas->pixels.data = calloc((size_t)atlas->width * atlas->height,pixsz);
+    tman->atlasMask = malloc(tman->tilecnt);
+    if (atlas->pixels.data == NULL || tman->atlasMask == NULL) {
+        pok_exception_flag_memory_error();
+        pok_image_free(atlas);
+        if (tman->atlasMask != NULL) {
+            free(tman->atlasMask);
+            tman->atlasMask = NULL;
+        }
+        return FALSE;
+    }
+    for (i = 0;i < tman->tilecnt;++i) {
+        struct pok_image* tile = tman->tileset[i];
+        byte_t* dst;
+        tman->atlasMask[i] = tile != NULL && tile->pixels.data != NULL && tile->width == dim && tile->height == dim;
+        if (!tman->atlasMask[i])
+            continue;
+        dst = (byte_t*)atlas->pixels.data + (((size_t)(i / tman->atlasColumns) * dim * width) + (i % tman->atlasColumns) * dim) * pixsz;
+        for (r = 0;r < dim;++r,dst += width * pixsz) {
+            if (alpha && (tile->flags & pok_image_flag_alpha) == 0) {
+                /* promote RGB tile row to RGBA */
+                uint32_t c;
+                union alpha_pixel* apix = (union alpha_pixel*)dst;
+                const union pixel* pix = tile->pixels.dataRGB + r * dim;
+                for (c = 0;c < dim;++c) {
+                    apix[c].rgba[0] = pix[c].rgb[0];
+                    apix[c].rgba[1] = pix[c].rgb[1];
+                    apix[c].rgba[2] = pix[c].rgb[2];
+                    apix[c].rgba[3] = 0xff;
+                }
+            }
+            else
+                memcpy(dst,(const byte_t*)tile->pixels.data + r * dim * pixsz,dim * pixsz);
+        }
+    }
+    /* keep a copy of the pixel data for compositing; the copy is optional */
+    tman->atlasPixels = pok_image_new();
+    if (tman->atlasPixels != NULL) {
+        size_t sz = (size_t)atlas->width * atlas->height * pixsz;
+        *tman->atlasPixels = *atlas;
+        tman->atlasPixels->pixels.data = malloc(sz);
+        if (tman->atlasPixels->pixels.data == NULL) {
+            free(tman->atlasPixels);
+            tman->atlasPixels = NULL;
+        }
+        else
+            memcpy(tman->atlasPixels->pixels.data,atlas->pixels.data,sz);
+    }
+    else
+        pok_exception_pop();
+    tman->atlas = atlas;
+    return TRUE;
+}
+bool_t pok_tile_manager_build_terrain(struct pok_tile_manager* tman)
+{
+    /* build the terrain classification table from the terrain lists; this must be called again
+       if the lists are changed; list entries that are not valid tile ids are ignored */
+    uint16_t i, j;
+    if (tman->tilecnt == 0) {
+        pok_exception_new_ex(pok_ex_tileman,pok_ex_tileman_zero_tiles);
+        return FALSE;
+    }
+    if (tman->terrainMask == NULL) {
+        /* the tile count does not change once tiles are loaded so the table is only allocated once */
+        tman->terrainMask = malloc(sizeof(uint16_t) * tman->tilecnt);
+        if (tman->terrainMask == NULL) {
+            pok_exception_flag_memory_error();
+            return FALSE;
+        }
+    }
+    memset(tman->terrainMask,0,sizeof(uint16_t) * tman->tilecnt);
+    for (i = 0;i < POK_TILE_TERRAIN_TOP;++i)
+        for (j = 0;j < tman->terrain[i].length;++j)
+            if (tman->terrain[i].list[j] < tman->tilecnt)
+                tman->terrainMask[tman->terrain[i].list[j]] |= POK_TILE_TERRAIN_BIT(i);
+    return TRUE;
+}
+size_t pok_tile_manager_find_terrain(const struct pok_tile_manager* tman,const uint16_t tiles[],size_t count,uint16_t mask)
+{
+    /* find the first tile in a run of tile ids (e.g. a row of a chunk's tile plane) that has any of
+       the terrain attributes in 'mask'; 'count' is returned if there is no such tile */
+    size_t i;
+    const uint16_t* table = tman->terrainMask;
+    if (table != NULL)
+        for (i = 0;i < count;++i)
+            if (tiles[i] < tman->tilecnt && (table[tiles[i]] & mask) != 0)
+                return i;
+    return count;
+}
 static enum pok_network_result pok_tile_ani_data_netread(struct pok_tile_ani_data* ani,struct pok_data_source* dsrc,
     struct pok_netobj_readinfo* info)
 {
@@ -408,7 +561,8 @@ static enum pok_network_result pok_tile_manager_netread_ani(struct pok_tile_mana
             --info->fieldCnt;
         } while (info->fieldCnt > 0);
         if (info->fieldCnt == 0) {
-            pok_tile_manager_compute_ani_ticks(tman);
+            if ( !pok_tile_manager_compute_ani_ticks(tman) )
+                return pok_net_failed_internal;
             ++info->fieldProg;
         }
     }
@@ -488,32 +642,57 @@ enum pok_network_result pok_tile_manager_netread(struct pok_tile_manager* tman,s
                 break;
             pok_netobj_readinfo_reset(info->next);
         }
+        if (result == pok_net_completed && !pok_tile_manager_build_terrain(tman))
+            return pok_net_failed_internal;
     }
     return result;
 }
-struct pok_image* pok_tile_manager_get_tile(const struct pok_tile_manager* tman,uint16_t tileid,uint32_t aniticks)
+static uint16_t pok_tile_manager_walk_ani(const struct pok_tile_manager* tman,uint16_t tileid,uint32_t aniticks)
+{
+    /* tile animation structures form a linked list of tileset position; a tile
+       animation sequence oscillates back and forth */
+    struct pok_tile_ani_data* ani = tman->tileani + tileid;
+    if (ani->totalTicks > 0) {
+        bool_t dir = TRUE;
+        uint32_t rem = aniticks % ani->totalTicks;
+        while (rem >= ani->ticks) {
+            struct pok_tile_ani_data* prev;
+            if (dir && ani->forward == 0)
+                dir = FALSE;
+            prev = ani;
+            tileid = dir ? ani->forward : ani->backward;
+            ani = tman->tileani + tileid;
+            rem -= prev->ticks;
+        }
+    }
+    return tileid;
+}
+void pok_tile_manager_update_ani(struct pok_tile_manager* tman,uint32_t aniticks)
+{
+    /* resolve the animation frame of every tile for the specified animation counter; this
+       is done once per counter change so that per-tile lookups are a single table access */
+    uint16_t i;
+    if (tman->aniframes != NULL) {
+        for (i = 0;i < tman->tilecnt;++i)
+            tman->aniframes[i] = pok_tile_manager_walk_ani(tman,i,aniticks);
+        tman->aniframeTicks = aniticks;
+    }
+}
+uint16_t pok_tile_manager_resolve_tile(const struct pok_tile_manager* tman,uint16_t tileid,uint32_t aniticks)
 {
     if (tileid >= tman->tilecnt)
         tileid = 0;
     /* find animation tile for specified tile based on 'aniframe'; note
-       that tile animation is optional and must first be loaded */
+       that tile animation is optional and must first be loaded; use the
+       resolved frame table if it was built for the specified counter */
     if (tman->tileani != NULL) {
-        /* tile animation structures form a linked list of tileset position; a tile
-           animation sequence oscillates back and forth */
-        struct pok_tile_ani_data* ani = tman->tileani + tileid;
-        if (ani->totalTicks > 0) {
-            bool_t dir = TRUE;
-            uint32_t rem = aniticks % ani->totalTicks;
-            while (rem >= ani->ticks) {
-                struct pok_tile_ani_data* prev;
-                if (dir && ani->forward == 0)
-                    dir = FALSE;
-                prev = ani;
-                tileid = dir ? ani->forward : ani->backward;
-                ani = tman->tileani + tileid;
-                rem -= prev->ticks;
-            }
-        }
+        if (tman->aniframes != NULL && tman->aniframeTicks == aniticks)
+            return tman->aniframes[tileid];
+        return pok_tile_manager_walk_ani(tman,tileid,aniticks);
     }
-    return tman->tileset[tileid];
+    return tileid;
+}
+struct pok_image* pok_tile_manager_get_tile(const struct pok_tile_manager* tman,uint16_t tileid,uint32_t aniticks)
+{
+    return tman->tileset[pok_tile_manager_resolve_tile(tman,tileid,aniticks)];
 }
@@ -51,6 +51,11 @@ struct pok_tile_terrain_info
     uint16_t* list;
 };
 
+/* terrain masks: a terrain mask has bit POK_TILE_TERRAIN_BIT(kind) set for each terrain kind */
+#define POK_TILE_TERRAIN_BIT(kind) ((uint16_t)(1 << (kind)))
+#define POK_TILE_TERRAIN_LEDGES (POK_TILE_TERRAIN_BIT(pok_tile_terrain_ledge_down) \
+        | POK_TILE_TERRAIN_BIT(pok_tile_terrain_ledge_left) | POK_TILE_TERRAIN_BIT(pok_tile_terrain_ledge_right))
+
 /* pok_tile_manager: interface to manage tile images and animation */
 struct pok_tile_manager
 {
@@ -71,12 +76,33 @@ struct pok_tile_manager
        tileset[tileani[id]] */
     struct pok_tile_ani_data* tileani;
 
+    /* resolved animation frame table: if animation data is loaded, 'aniframes[id]' caches the
+       animation frame of tile 'id' at animation counter value 'aniframeTicks'; the table is
+       rebuilt by 'pok_tile_manager_update_ani' when the counter advances */
+    uint16_t* aniframes;
+    uint32_t aniframeTicks;
+
     /* terrain tile lists: every tile of the kinds enumerated here receives the specified
        terrain attribute; this is more convenient than specifying it for certain instantiated
        tiles in a map; the game engine will be able to automatically recognize these tiles and
        apply effects */
     struct pok_tile_terrain_info terrain[POK_TILE_TERRAIN_TOP];
 
+    /* terrain classification table: 'terrainMask[id]' is the terrain mask of tile 'id' (the union of
+       the terrain lists the tile appears in); the table is built from the lists when the tile
+       manager is read and lets any terrain attribute be tested in constant time */
+    uint16_t* terrainMask;
+
+    /* tile atlas (optional): a single image that packs every tile image into a grid so that a
+       renderer can draw any tile from one texture; tile 'id' occupies grid cell 'id' (row-major,
+       'atlasColumns' cells across); tiles without pixel data are not packed and have a zero entry
+       in 'atlasMask'; 'atlasPixels' keeps a copy of the atlas pixel data for renderers that
+       composite tiles themselves (the atlas gives up its pixel data once it becomes a texture) */
+    struct pok_image* atlas;
+    struct pok_image* atlasPixels;
+    uint16_t atlasColumns;
+    byte_t* atlasMask;
+
     /* reserved for the implementation */
     struct pok_image* _sheet;
 };
@@ -90,8 +116,19 @@ bool_t pok_tile_manager_load_tiles(struct pok_tile_manager* tman,uint16_t imgc,u
 bool_t pok_tile_manager_load_ani(struct pok_tile_manager* tman,uint16_t anic,struct pok_tile_ani_data* data,bool_t byRef);
 bool_t pok_tile_manager_fromfile_tiles(struct pok_tile_manager* tman,const char* file);
 bool_t pok_tile_manager_fromfile_tiles_png(struct pok_tile_manager* tman,const char* file);
+bool_t pok_tile_manager_build_atlas(struct pok_tile_manager* tman);
+bool_t pok_tile_manager_build_terrain(struct pok_tile_manager* tman);
+size_t pok_tile_manager_find_terrain(const struct pok_tile_manager* tman,const uint16_t tiles[],size_t count,uint16_t mask);
 enum pok_network_result pok_tile_manager_netread(struct pok_tile_manager* tman,struct pok_data_source* dsrc,
     struct pok_netobj_readinfo* info);
+void pok_tile_manager_update_ani(struct pok_tile_manager* tman,uint32_t aniticks);
+uint16_t pok_tile_manager_resolve_tile(const struct pok_tile_manager* tman,uint16_t tileid,uint32_t aniticks);
 struct pok_image* pok_tile_manager_get_tile(const struct pok_tile_manager* tman,uint16_t tileid,uint32_t aniticks);
 
+/* get the terrain mask of a tile (zero if the tile has no terrain attributes or the table was not built) */
+static inline uint16_t pok_tile_manager_get_terrain(const struct pok_tile_manager* tman,uint16_t tileid)
+{ return tman->terrainMask != NULL && tileid < tman->tilecnt ? tman->terrainMask[tileid] : 0; }
+static inline bool_t pok_tile_manager_is_terrain(const struct pok_tile_manager* tman,uint16_t tileid,enum pok_tile_terrain_type kind)
+{ return (pok_tile_manager_get_terrain(tman,tileid) & POK_TILE_TERRAIN_BIT(kind)) != 0; }
+
 #endif
@@ -0,0 +1,179 @@
+/* trace.c - pokgame */
+#include "trace.h"
+#include "gamelock.h"
+#include "net.h"
+#include "error.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+
+#ifdef POKGAME_TRACE
+
+#define TRACE_MAX_THREADS    16
+#define TRACE_BUFFER_SIZE 65536 /* spans kept per thread; must be a power of 2 */
+
+#if defined(POKGAME_WIN32)
+#include <Windows.h>
+#define TRACE_TLS __declspec(thread)
+#define trace_claim_slot() (InterlockedIncrement(&threadCount) - 1)
+#else
+#define TRACE_TLS __thread
+#define trace_claim_slot() (__sync_fetch_and_add(&threadCount,1))
+#endif
+
+struct trace_span
+{
+    const char* name;
+    uint64_t start;
+    uint64_t end;
+};
+
+/* trace_buffer: ring buffer of spans recorded by a single thread; only the owning thread
+   writes to the buffer; 'count' is the total number of spans ever recorded (so the oldest
+   spans are overwritten once it passes the buffer size) */
+struct trace_buffer
+{
+    const char* name;
+    uint32_t tid;
+    volatile uint64_t count;
+    struct trace_span spans[TRACE_BUFFER_SIZE];
+};
+
+static uint64_t origin;
+static volatile long threadCount;
+static struct trace_buffer* volatile buffers[TRACE_MAX_THREADS];
+static TRACE_TLS struct trace_buffer* threadBuffer;
+
+static struct trace_buffer* trace_get_buffer()
+{
+    /* get the calling thread's buffer, registering a new one if this is the thread's first span;
+       threads beyond the maximum are not traced */
+    if (threadBuffer == NULL) {
+        long slot = trace_claim_slot();
+        struct trace_buffer* buffer;
+        if (slot >= TRACE_MAX_THREADS)
+            return NULL;
+        buffer = malloc(sizeof(struct trace_buffer));
+        if (buffer == NULL)
+            pok_error(pok_error_fatal,"memory fail in trace_get_buffer()");
+        buffer->name = NULL;
+        buffer->tid = (uint32_t)slot + 1;
+        buffer->count = 0;
+        threadBuffer = buffer;
+        buffers[slot] = buffer;
+    }
+    return threadBuffer;
+}
+
+void pok_trace_load_module()
+{
+    origin = pok_timestep_clock();
+}
+void pok_trace_unload_module()
+{
+    int i;
+    for (i = 0;i < TRACE_MAX_THREADS;++i) {
+        if (buffers[i] != NULL) {
+            free(buffers[i]);
+            buffers[i] = NULL;
+        }
+    }
+    threadCount = 0;
+}
+
+void pok_trace_thread(const char* name)
+{
+    struct trace_buffer* buffer = trace_get_buffer();
+    if (buffer != NULL)
+        buffer->name = name;
+}
+uint64_t pok_trace_clock()
+{
+    return pok_timestep_clock();
+}
+void pok_trace_span(const char* name,uint64_t start)
+{
+    struct trace_span* span;
+    struct trace_buffer* buffer = threadBuffer != NULL ? threadBuffer : trace_get_buffer();
+    if (buffer == NULL)
+        return;
+    span = buffer->spans + (buffer->count & (TRACE_BUFFER_SIZE-1));
+    span->name = name;
+    span->start = start;
+    span->end = pok_timestep_clock();
+    ++buffer->count;
+}
+
+static bool_t trace_write(struct pok_data_source* dsrc,const char* format, ...)
+{
+    int len;
+    char buf[256];
+    va_list args;
+    va_start(args,format);
+    len = vsnprintf(buf,sizeof(buf),format,args);
+    va_end(args);
+    if (len < 0 || (size_t)len >= sizeof(buf))
+        len = sizeof(buf) - 1;
+    buf[len] = 0;
+    return pok_data_stream_write_string(dsrc,buf);
+}
+bool_t pok_trace_flush(const char* file)
+{
+    /* write the spans as 'complete' events (ph 'X') with timestamps in microseconds relative
+       to when the module was loaded; each thread is named with a metadata event (ph 'M') */
+    int i;
+    bool_t first = TRUE;
+    struct pok_data_source* dsrc;
+    dsrc = pok_data_source_new_file(file,pok_filemode_create_always,pok_iomode_write);
+    if (dsrc == NULL)
+        return FALSE;
+    pok_data_source_buffering(dsrc,TRUE);
+    if ( !trace_write(dsrc,"{\"traceEvents\":[\n") )
+        goto fail;
+    for (i = 0;i < TRACE_MAX_THREADS;++i) {
+        uint64_t j, count;
+        struct trace_buffer* buffer = buffers[i];
+        if (buffer == NULL)
+            continue;
+        if (buffer->name != NULL) {
+            if ( !trace_write(dsrc,"%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+                    first ? "" : ",\n",buffer->tid,buffer->name) )
+                goto fail;
+            first = FALSE;
+        }
+        count = buffer->count;
+        for (j = count > TRACE_BUFFER_SIZE ? count - TRACE_BUFFER_SIZE : 0;j < count;++j) {
+            const struct trace_span* span = buffer->spans + (j & (TRACE_BUFFER_SIZE-1));
+            if (span->start < origin || span->end < span->start)
+                continue;
+            if ( !trace_write(dsrc,"%s{\"name\":\"%s\",\"cat\":\"pokgame\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                    first ? "" : ",\n",span->name,buffer->tid,(span->start - origin) / 1000.0,(span->end - span->start) / 1000.0) )
+                goto fail;
+            first = FALSE;
+        }
+    }
+    if ( !trace_write(dsrc,"\n]}\n") || !pok_data_source_flush(dsrc) )
+        goto fail;
+    pok_data_source_free(dsrc);
+    return TRUE;
+fail:
+    pok_data_source_free(dsrc);
+    return FALSE;
+}
+
+#else
+
+/* tracing is disabled: nothing is ever recorded */
+void pok_trace_load_module()
+{
+}
+void pok_trace_unload_module()
+{
+}
+bool_t pok_trace_flush(const char* file)
+{
+    (void)file;
+    return TRUE;
+}
+
+#endif
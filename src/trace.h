@@ -0,0 +1,46 @@
+/* trace.h - pokgame */
+#ifndef POKGAME_TRACE_H
+#define POKGAME_TRACE_H
+#include "types.h"
+
+/* the tracer records timed spans of work done by the game threads (the graphics loop, the
+   update procedure and the IO procedure) so that a session can be inspected on a timeline; each
+   thread records into its own ring buffer (so recording never takes a lock) and the buffers are
+   written out in the Chrome trace-event format (load the file in 'chrome://tracing' or Perfetto);
+   tracing is compiled in when POKGAME_TRACE is defined: otherwise the macros below expand to
+   nothing and the module functions do nothing */
+
+/* module load/unload */
+void pok_trace_load_module();
+void pok_trace_unload_module();
+
+/* write every span recorded so far to 'file'; this is safe to call at any time, though spans
+   that are being recorded while the buffers are written may be incomplete */
+bool_t pok_trace_flush(const char* file);
+
+#ifdef POKGAME_TRACE
+
+void pok_trace_thread(const char* name); /* name the calling thread in the trace */
+uint64_t pok_trace_clock();
+void pok_trace_span(const char* name,uint64_t start); /* record span from 'start' until now */
+
+/* record the span of code between BEGIN and END under 'name'; 'name' must be a string literal
+   (or some other string that outlives the module); CALL records a single statement and SPAN
+   records a span from a clock value that the caller already has */
+#define POK_TRACE_THREAD(name) pok_trace_thread(name)
+#define POK_TRACE_BEGIN(span) uint64_t span##_trace = pok_trace_clock()
+#define POK_TRACE_END(span,name) pok_trace_span(name,span##_trace)
+#define POK_TRACE_SPAN(name,start) pok_trace_span(name,start)
+#define POK_TRACE_CALL(name,stmt) do { POK_TRACE_BEGIN(call); stmt; POK_TRACE_END(call,name); } while (0)
+
+#else
+
+#define POK_TRACE_THREAD(name)
+#define POK_TRACE_BEGIN(span)
+#define POK_TRACE_END(span,name)
+#define POK_TRACE_SPAN(name,start)
+#define POK_TRACE_CALL(name,stmt) do { stmt; } while (0)
+
+#endif
+
+#endif
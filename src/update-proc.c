@@ -2,6 +2,7 @@
 #include "pokgame.h"
 #include "protocol.h"
 #include "error.h"
+#include "trace.h"
 
 /* the update procedure runs the game engine logic; it changes a global configuration that
    is handled by the other two game procedures (IO and graphics); this procedure must obtain
@@ -18,6 +19,9 @@
 #define MAP_TICKS_NORMAL MAP_SCROLL_TIME / MAP_GRANULARITY
 #define MAP_TICKS_FAST  MAP_SCROLL_TIME_FAST / MAP_GRANULARITY_FAST
 
+#define MAP_PREFETCH               1 /* number of chunks ahead of the player to prefetch */
+#define MAP_PREFETCH_FAST          3 /* number of chunks ahead of the player to prefetch when fast */
+
 #define INITIAL_FADEIN_DELAY     350 /* "initial fadein" happens before we show the game */
 #define INITIAL_FADEIN_TIME     2000
 #define WARP_FADEOUT_TIME        600 /* warp transitions */
@@ -43,10 +47,12 @@ static void map_terrain_logic(struct pok_game_info* info);
 static bool_t latent_warp_logic(struct pok_game_info* info,enum pok_direction direction);
 static bool_t warp_logic(struct pok_game_info* info);
 static void intermsg_logic(struct pok_game_info* info);
+static void render_snapshot_logic(struct pok_game_info* info);
 static enum pok_character_effect get_effect_from_terrain(struct pok_map_render_context* mapRC,
     struct pok_tile_manager* tman,
     enum pok_direction direction);
 static void warp_transition_logic(struct pok_game_info* info);
+static void wake_io(struct pok_game_info* info);
 
 /* this procedure drives all the game logic; the return value has special meaning:
     0 - exit via in game event (e.g. the player selected a menu item)
@@ -56,11 +62,15 @@ int update_proc(struct pok_game_info* info)
 {
     int r = 0;
     uint32_t tileAniTicks = 0;
+    uint32_t dueSteps = 0;
     uint64_t gameTime = 0;
 
+    POK_TRACE_THREAD("update");
+
     /* setup default settings */
     info->mapRC->scrollTicksAmt = MAP_TICKS_NORMAL;
     info->playerContext->aniTicksAmt = MAP_TICKS_NORMAL;
+    info->mapRC->prefetchChunks = MAP_PREFETCH;
     info->mapRC->granularity = MAP_GRANULARITY;
     info->playerContext->granularity = MAP_GRANULARITY;
     info->pausePlayerMap = FALSE;
@@ -76,55 +86,87 @@ int update_proc(struct pok_game_info* info)
     /* game logic loop */
     do {
         bool_t skip = 0;
+        POK_TRACE_BEGIN(step);
 
         /* key input logic */
-        update_key_input(info);
+        POK_TRACE_CALL("update_key_input",update_key_input(info));
 
         if (!info->pausePlayerMap) {
             /* perform input-sensitive update operations; if an update operation just completed, then skip the timeout;
-               these must be performed at the same time before a frame is updated */
-            pok_graphics_subsystem_lock(info->sys);
-            skip = pok_map_render_context_update(info->mapRC,info->sys->dimension,info->updateTimeout.elapsed)
-                +  pok_character_context_update(info->playerContext,info->sys->dimension,info->updateTimeout.elapsed);
-            pok_graphics_subsystem_unlock(info->sys);
+               these must be performed at the same time before a frame is updated (the renderer only sees them
+               together once the render snapshot is published) */
+            POK_TRACE_CALL("context_update",
+                skip = pok_map_render_context_update(info->mapRC,info->sys->dimension,info->updateTimeout.elapsed)
+                    +  pok_character_context_update(info->playerContext,info->sys->dimension,info->updateTimeout.elapsed));
         }
 
         /* perform other updates */
-        character_update(info);
-        menu_update(info);
+        POK_TRACE_CALL("character_update",character_update(info));
+        POK_TRACE_CALL("menu_update",menu_update(info));
 
         /* perform game logic operations */
-        fadeout_logic(info);
-        daycycle_logic(info);
-        map_terrain_logic(info);
-        intermsg_logic(info);
-        warp_transition_logic(info);
+        POK_TRACE_CALL("fadeout_logic",fadeout_logic(info));
+        POK_TRACE_CALL("daycycle_logic",daycycle_logic(info));
+        POK_TRACE_CALL("map_terrain_logic",map_terrain_logic(info));
+        POK_TRACE_CALL("intermsg_logic",intermsg_logic(info));
+        POK_TRACE_CALL("warp_transition_logic",warp_transition_logic(info));
+        POK_TRACE_END(step,"update_step");
 
         if (!skip) {
             /* update global counter and map context's tile animation counter */
             if (tileAniTicks >= 250) { /* tile animation ticks every 1/4 second */
+                /* advance the counter and resolve the tile manager's frame table for it
+                   together so that the renderer never sees a stale table */
+                pok_graphics_subsystem_lock(info->sys);
                 ++info->mapRC->tileAniTicks;
+                pok_tile_manager_update_ani(info->tman,info->mapRC->tileAniTicks);
+                pok_graphics_subsystem_unlock(info->sys);
                 tileAniTicks = 0;
             }
 
-            /* perform timeout and update tile animation ticks */
-            pok_timeout(&info->updateTimeout);
+            /* wait for the next fixed step; if the previous steps overran their deadlines then
+               several steps may be due, in which case they run back-to-back without sleeping;
+               every step advances the game by exactly one step period so that the logic does not
+               depend on how long processing took */
+            if (dueSteps == 0)
+                POK_TRACE_CALL("update_wait",dueSteps = pok_timestep_wait(&info->updateStep));
+            --dueSteps;
+            info->updateTimeout.elapsed = info->updateStep.mseconds;
             tileAniTicks += info->updateTimeout.elapsed;
             gameTime += info->updateTimeout.elapsed;
         }
         else
+            /* an update completed: run the next step immediately without advancing time so that
+               continuous input does not hitch */
             info->updateTimeout.elapsed = 0;
 
+        /* hand the render state produced by this update step to the renderer */
+        POK_TRACE_CALL("render_snapshot_logic",render_snapshot_logic(info));
+
         if ( !pok_graphics_subsystem_has_window(info->sys) ) {
             r = 1;
             break;
         }
     } while (info->control);
 
+    /* report how well the update procedure kept to its schedule */
+    if (info->updateStep.overruns > 0)
+        pok_message("update: deadline overran on %llu of %llu waits; %llu steps dropped",
+            (unsigned long long)info->updateStep.overruns,
+            (unsigned long long)info->updateStep.waits,
+            (unsigned long long)info->updateStep.dropped);
+    if (info->mapRC->prefetchStats.misses > 0)
+        pok_message("update: %u of %u chunks were not loaded ahead of the player; %u chunks prefetched",
+            info->mapRC->prefetchStats.misses,
+            info->mapRC->prefetchStats.hits + info->mapRC->prefetchStats.misses,
+            info->mapRC->prefetchStats.requests);
+
     /* remove hooks from graphics subsystem */
     pok_graphics_subsystem_pop_hook(info->sys->textentryHook);
     pok_graphics_subsystem_pop_hook(info->sys->keyupHook);
 
+    /* the IO procedure may be sleeping until we exit (e.g. because the window closed) */
+    wake_io(info);
     return r;
 }
 
@@ -152,6 +194,7 @@ void update_key_input(struct pok_game_info* info)
                     pok_intermsg_setup(&info->updateInterMsg,pok_keyinput_intermsg,INTERMSG_DELAY);
                     info->updateInterMsg.payload.key = pok_input_key_ABUTTON;
                     info->updateInterMsg.ready = TRUE;
+                    wake_io(info);
                     info->gameContext = pok_game_intermsg_context;
                 }
             }
@@ -174,6 +217,7 @@ void update_key_input(struct pok_game_info* info)
                             running = TRUE;
                             info->mapRC->scrollTicksAmt = MAP_TICKS_FAST;
                             info->playerContext->aniTicksAmt = MAP_TICKS_FAST;
+                            info->mapRC->prefetchChunks = MAP_PREFETCH_FAST;
                             info->mapRC->granularity = MAP_GRANULARITY_FAST;
                             info->playerContext->granularity = MAP_GRANULARITY_FAST;
                         }
@@ -182,12 +226,13 @@ void update_key_input(struct pok_game_info* info)
                         running = FALSE;
                         info->mapRC->scrollTicksAmt = MAP_TICKS_NORMAL;
                         info->playerContext->aniTicksAmt = MAP_TICKS_NORMAL;
+                        info->mapRC->prefetchChunks = MAP_PREFETCH;
                         info->mapRC->granularity = MAP_GRANULARITY;
                         info->playerContext->granularity = MAP_GRANULARITY;
                     }
                 }
 
-                player_move_logic(info,direction);
+                POK_TRACE_CALL("player_move_logic",player_move_logic(info,direction));
             }
         }
     }
@@ -227,7 +272,7 @@ void character_update(struct pok_game_info* info)
     pok_game_lock(info->charRC);
     for (iter = 0;iter < info->charRC->chars.da_top;++iter) {
         struct pok_character_context* context = (struct pok_character_context*) info->charRC->chars.da_data[iter];
-        if (context != info->playerContext) {
+        if (context != NULL && context != info->playerContext) {
             pok_character_context_update(
                 context,
                 info->sys->dimension,
@@ -249,6 +294,7 @@ void menu_update(struct pok_game_info* info)
                 info->messageMenu.base.focused = FALSE;
                 pok_intermsg_setup(&info->updateInterMsg,pok_completed_intermsg,INTERMSG_DELAY);
                 info->updateInterMsg.ready = TRUE;
+                wake_io(info);
                 info->gameContext = pok_game_intermsg_context;
             }
         }
@@ -259,6 +305,7 @@ void menu_update(struct pok_game_info* info)
                 pok_intermsg_setup(&info->updateInterMsg,pok_stringinput_intermsg,INTERMSG_DELAY);
                 pok_text_input_read(&info->inputMenu.input,info->updateInterMsg.payload.string);
                 info->updateInterMsg.ready = TRUE;
+                wake_io(info);
                 info->gameContext = pok_game_intermsg_context;
             }
         }
@@ -268,25 +315,13 @@ void menu_update(struct pok_game_info* info)
 
 bool_t check_collisions(struct pok_game_info* info)
 {
-    size_t iter;
-    bool_t status = TRUE;
-    /* check against all character contexts in the character render context; this
-       procedure assumes that the map render context is currently locked; we only
-       check NPCs for character collisions */
+    bool_t status;
+    /* check for a character on the map render context's tile using the character render
+       context's spatial index; this procedure assumes that the map render context is currently
+       locked; we only check NPCs for character collisions */
     pok_game_lock(info->charRC);
-    for (iter = 0;iter < info->charRC->chars.da_top;++iter) {
-        struct pok_character* ch;
-        struct pok_character_context* ctx;
-        ctx = info->charRC->chars.da_data[iter];
-        ch = ctx->character;
-        if (!ch->isPlayer && ch->mapNo == info->mapRC->map->mapNo && ch->chunkPos.X == info->mapRC->chunkpos.X
-            && ch->chunkPos.Y == info->mapRC->chunkpos.Y && ch->tilePos.column == info->mapRC->relpos.column
-            && ch->tilePos.row == info->mapRC->relpos.row)
-        {
-            status = FALSE;
-            break;
-        }
-    }
+    status = pok_character_render_context_find(info->charRC,info->mapRC->map->mapNo,
+        &info->mapRC->chunkpos,&info->mapRC->relpos,TRUE) == NULL;
     pok_game_unlock(info->charRC);
 
     return status;
@@ -298,13 +333,13 @@ void player_move_logic(struct pok_game_info* info,enum pok_direction direction)
     if (direction != pok_direction_none) {
         if (direction == info->player->direction || info->mapRC->groove) { /* player facing update direction */
             if (!info->playerContext->update && !info->mapRC->update) {
-                bool_t skip;
+                bool_t skip, latentWarp;
                 bool_t groove = info->mapRC->groove;
                 enum pok_character_effect effect = pok_character_normal_effect;
 
-                /* lock the graphics subsystem: this prevents rendering momentarily so that
-                   we can update the player and the map at the same time without a race */
-                pok_graphics_subsystem_lock(info->sys);
+                /* note: the player and the map are updated at the same time without a race since
+                   the renderer only sees them through the render snapshot published after this
+                   update step */
 
                 /* lock the map render context so that it is not updated by anyone except this
                    procedure; note: 'get_effect_from_terrain()' expects mapRC to be locked */
@@ -318,7 +353,8 @@ void player_move_logic(struct pok_game_info* info,enum pok_direction direction)
                 /* update map context: test to see if the current tile has a latent warp; if so, this
                    would change the map and animate it to 1 tile offset the warp location; this will
                    setup a transition */
-                if ( !latent_warp_logic(info,direction) ) {
+                POK_TRACE_CALL("latent_warp_logic",latentWarp = latent_warp_logic(info,direction));
+                if ( !latentWarp ) {
                     /* attempt to update the map focus; the map render context will
                        handle impassable tile collisions */
                     if ( pok_map_render_context_move(info->mapRC,direction,skip,TRUE) ) {
@@ -334,13 +370,13 @@ void player_move_logic(struct pok_game_info* info,enum pok_direction direction)
                         else { /* we can safely pass into the new location */
                             bool_t didWarp;
                             /* check for non-latent warps; these calls will setup a transition */
-                            didWarp = warp_logic(info);
+                            POK_TRACE_CALL("warp_logic",didWarp = warp_logic(info));
                             /* prepare the map context to be updated; if we skipped a column/row then double the
                                length of the map scroll animation */
                             pok_map_render_context_set_update(info->mapRC,direction,info->sys->dimension*(skip+1));
                             /* update the player character's location */
-                            info->player->chunkPos = info->mapRC->chunkpos;
-                            info->player->tilePos = info->mapRC->relpos;
+                            if ( !pok_character_context_set_player(info->playerContext,info->mapRC) )
+                                pok_exception_pop();
                             info->playerContext->slowDown = FALSE;
 
                             /* determine if (after the map update) the tile terrain prompts a change in game context; we
@@ -376,7 +412,6 @@ void player_move_logic(struct pok_game_info* info,enum pok_direction direction)
                 }
 
                 pok_game_modify_exit(info->mapRC);
-                pok_graphics_subsystem_unlock(info->sys);
             }
         }
         else if (!info->playerContext->update) {
@@ -411,7 +446,8 @@ bool_t map_warp_change(struct pok_game_info* info)
             if (result) {
                 /* set the player character as well */
                 pok_game_modify_enter(info->playerContext);
-                pok_character_context_set_player(info->playerContext,info->mapRC);
+                if ( !pok_character_context_set_player(info->playerContext,info->mapRC) )
+                    pok_exception_pop();
                 pok_game_modify_exit(info->playerContext);
             }
         }
@@ -493,7 +529,6 @@ void fadeout_logic(struct pok_game_info* info)
             if (map_warp_change(info)) {
                 /* save exit direction and update player */
                 enum pok_direction direction = (info->mapTrans->warpKind - pok_tile_warp_latent_up) % 4;
-                pok_graphics_subsystem_lock(info->sys);
                 if (info->gameContext != pok_game_warp_latent_fadeout_context) {
                     /* we do an animation if exiting a building or cave */
                     pok_game_modify_enter(info->playerContext);
@@ -512,7 +547,6 @@ void fadeout_logic(struct pok_game_info* info)
                         info->sys->dimension );
                     pok_game_modify_exit(info->mapRC);
                 }
-                pok_graphics_subsystem_unlock(info->sys);
                 /* pause the map scrolling until the fadein effect completes */
                 info->pausePlayerMap = TRUE;
             }
@@ -546,7 +580,7 @@ void daycycle_logic(struct pok_game_info* info)
 void map_terrain_logic(struct pok_game_info* info)
 {
     if (info->gameContext == pok_game_sliding_context)
-        player_move_logic(info,info->player->direction);
+        POK_TRACE_CALL("player_move_logic",player_move_logic(info,info->player->direction));
 }
 
 bool_t latent_warp_logic(struct pok_game_info* info,enum pok_direction direction)
@@ -558,7 +592,9 @@ bool_t latent_warp_logic(struct pok_game_info* info,enum pok_direction direction
 
     /* we can safely grab the tile data since we assume the map render context
        is locked when this procedure is called */
-    tdata = &info->mapRC->chunk->data[info->mapRC->relpos.row][info->mapRC->relpos.column].data;
+    tdata = pok_map_chunk_get_warp(info->mapRC->chunk,info->mapRC->relpos.column,info->mapRC->relpos.row);
+    if (tdata == NULL)
+        return FALSE;
 
     kind = tdata->warpKind;
     if ((((kind == pok_tile_warp_latent_up || kind == pok_tile_warp_latent_cave_up || kind == pok_tile_warp_latent_door_up)
@@ -600,9 +636,9 @@ bool_t warp_logic(struct pok_game_info* info)
 
     /* we can safely grab the tile data since we assume the map render context
        is locked when this procedure is called */
-    tdata = &info->mapRC->chunk->data[info->mapRC->relpos.row][info->mapRC->relpos.column].data;
+    tdata = pok_map_chunk_get_warp(info->mapRC->chunk,info->mapRC->relpos.column,info->mapRC->relpos.row);
 
-    if (tdata->warpKind != pok_tile_warp_none &&
+    if (tdata != NULL && tdata->warpKind != pok_tile_warp_none &&
         (tdata->warpKind < pok_tile_warp_latent_up || tdata->warpKind > pok_tile_warp_latent_cave_right)) {
         /* set warp effect and change game context depending on warp kind; the old game context
            must be saved so that we can restore it after the warp fade in */
@@ -682,34 +718,46 @@ void intermsg_logic(struct pok_game_info* info)
     }
 }
 
+void render_snapshot_logic(struct pok_game_info* info)
+{
+    /* capture the map and character render state into a render snapshot and publish it; the
+       renderer draws the most recently published snapshot without locking the graphics subsystem;
+       if the characters cannot be captured (memory failure) then the renderer draws them from
+       their contexts; the map render context is locked for modification since capturing may
+       recompute its chunk render info */
+    struct pok_map_render_snapshot* snapshot;
+    pok_game_modify_enter(info->mapRC);
+    snapshot = pok_map_render_context_begin_snapshot(info->mapRC,info->sys);
+    if ( !pok_character_render_context_capture(info->charRC,snapshot) )
+        pok_exception_pop();
+    pok_map_render_context_publish(info->mapRC);
+    pok_game_modify_exit(info->mapRC);
+}
+
 enum pok_character_effect get_effect_from_terrain(struct pok_map_render_context* mapRC,
     struct pok_tile_manager* tman,enum pok_direction direction)
 {
     /* this function checks the current map location and determines if a
        character effect should be applied; it assumes the map-render context is
        locked for reading */
-    uint16_t i;
     uint16_t tileid;
-    struct pok_tile* tile;
+    struct pok_tile tile;
     /* obtain current tile id */
-    tileid = mapRC->chunk->data[mapRC->relpos.row][mapRC->relpos.column].data.tileid;
+    tileid = pok_map_chunk_get_tileid(mapRC->chunk,mapRC->relpos.column,mapRC->relpos.row);
     /* check ice tiles: ice tiles cause the player to slide */
-    for (i = 0;i < tman->terrain[pok_tile_terrain_ice].length;++i)
-        if (tman->terrain[pok_tile_terrain_ice].list[i] == tileid)
-            return pok_character_slide_effect;
+    if ( pok_tile_manager_is_terrain(tman,tileid,pok_tile_terrain_ice) )
+        return pok_character_slide_effect;
     /* check ledge tiles: ledge tiles cause the player to jump over the ledge tile; the
        player must be facing the correct direction; the ledge tile is assumed to be one tile
        in front of the player */
     if (direction > pok_direction_up) {
-        tile = pok_map_render_context_get_adjacent_tile(
-            mapRC,
-            direction == pok_direction_left ? -1 : (direction == pok_direction_right ? 1 : 0),
-            direction == pok_direction_down ? 1 : 0 );
-        if (tile != NULL) {
-            int d = pok_tile_terrain_ledge_down + (direction-1);
-            for (i = 0;i < tman->terrain[d].length;++i)
-                if (tman->terrain[d].list[i] == tile->data.tileid)
-                    return pok_character_jump_effect;
+        if ( pok_map_render_context_get_adjacent_tile(
+                mapRC,
+                direction == pok_direction_left ? -1 : (direction == pok_direction_right ? 1 : 0),
+                direction == pok_direction_down ? 1 : 0,
+                &tile ) ) {
+            if ( pok_tile_manager_is_terrain(tman,tile.data.tileid,pok_tile_terrain_ledge_down + (direction-1)) )
+                return pok_character_jump_effect;
         }
     }
     return pok_character_normal_effect;
@@ -819,12 +867,19 @@ void warp_transition_logic(struct pok_game_info* info)
 {
     /* this routine handles multistage warps that need additional logic */
     if (info->gameContext == pok_game_warp_spin_context) {
-        warp_spin_logic(info);
+        POK_TRACE_CALL("warp_spin_logic",warp_spin_logic(info));
     }
     else if (info->gameContext == pok_game_warp_spinup_context) {
-        warp_spinup_logic(info);
+        POK_TRACE_CALL("warp_spinup_logic",warp_spinup_logic(info));
     }
     else if (info->gameContext == pok_game_warp_spindown_context) {
-        warp_spindown_logic(info);
+        POK_TRACE_CALL("warp_spindown_logic",warp_spindown_logic(info));
     }
 }
+
+void wake_io(struct pok_game_info* info)
+{
+    /* let the IO procedure know that it has something to do (if it sleeps on a poller) */
+    if (info->ioPoller != NULL)
+        pok_io_poller_wakeup(info->ioPoller);
+}
@@ -0,0 +1,444 @@
+/* bench.c - pokgame render benchmarks */
+#include "graphics-headless.h"
+#include "tileman.h"
+#include "spriteman.h"
+#include "map-context.h"
+#include "character-context.h"
+#include "effect.h"
+#include "menu.h"
+#include "gamelock.h"
+#include "error.h"
+#include <GL/gl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* this program times the game's render routines against a synthetic world using the headless
+   graphics implementation; it is built and run by 'make bench'; results are printed as a table
+   and written as JSON (to the file named by the first argument, if any) so that they can be
+   compared between commits; the optional second argument labels the results (e.g. a commit id) */
+
+const char* POKGAME_NAME;
+
+extern void compute_chunk_render_info(struct pok_map_render_context* context,const struct pok_graphics_subsystem* sys);
+
+#define BENCH_TILES          512  /* number of tile images */
+#define BENCH_ANI_GROUPS      32  /* number of 4-frame tile animation cycles (the last tiles are animated) */
+#define BENCH_MAP_WIDTH      512  /* map dimensions in tiles (this produces 16 chunks) */
+#define BENCH_MAP_HEIGHT     512
+#define BENCH_SPRITES         16  /* number of sprite sets */
+#define BENCH_CHARACTERS     300  /* number of characters near the view */
+#define BENCH_CROWD         5000  /* number of characters scattered over the rest of the map */
+#define BENCH_SAMPLES        300  /* timed samples per benchmark */
+#define BENCH_WARMUP          20  /* untimed samples per benchmark */
+
+/* benchmark cases: each sample times 'batch' calls to 'run'; 'prepare' (if any) is called before
+   each sample outside of the timed region */
+struct bench_case
+{
+    const char* name;
+    uint32_t batch;
+    void (*prepare)();
+    void (*run)();
+};
+
+struct bench_result
+{
+    const char* name;
+    uint32_t samples;
+    uint32_t batch;
+    double mean, median, p95, min; /* nanoseconds per call */
+};
+
+/* synthetic world */
+static struct {
+    struct pok_graphics_subsystem* sys;
+    struct pok_tile_manager* tman;
+    struct pok_sprite_manager* sman;
+    struct pok_map* map;
+    struct pok_map_render_context* mapRC;
+    struct pok_character_render_context* charRC;
+    struct pok_character* chars[BENCH_CHARACTERS+BENCH_CROWD];
+    struct pok_map_render_snapshot snapshot;
+    struct pok_fadeout_effect fadeout;
+    struct pok_message_menu menu;
+    struct pok_tile_ani_data anidata[BENCH_TILES+1];
+    byte_t* tileData;
+    byte_t* spriteData;
+    uint16_t* mapData;
+} world;
+
+static uint32_t seed = 2463534242u;
+static volatile bool_t done;
+static char renderer[128];
+static struct bench_result results[16];
+static int resultc;
+
+static uint32_t bench_rand()
+{
+    /* deterministic so that every run uses the same world */
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+static int bench_compar(const void* left,const void* right)
+{
+    double a = *(const double*)left, b = *(const double*)right;
+    return a < b ? -1 : (a > b ? 1 : 0);
+}
+
+/* world construction */
+static void bench_build_world()
+{
+    size_t i, n;
+    uint16_t dim;
+    struct pok_point chunkpos;
+    struct pok_location relpos;
+    const char* text;
+
+    world.sys = pok_graphics_subsystem_new();
+    pok_graphics_subsystem_default(world.sys);
+    dim = world.sys->dimension;
+
+    /* tiles: random pixels; the last tiles form animation cycles of 4 frames each */
+    n = (size_t)BENCH_TILES * dim * dim * 3;
+    world.tileData = malloc(n);
+    for (i = 0;i < n;++i)
+        world.tileData[i] = (byte_t)bench_rand();
+    world.tman = pok_tile_manager_new(world.sys);
+    if ( !pok_tile_manager_load_tiles(world.tman,BENCH_TILES,0,world.tileData,TRUE) )
+        pok_error_fromstack(pok_error_fatal);
+    memset(world.anidata,0,sizeof(world.anidata));
+    for (i = 0;i < BENCH_ANI_GROUPS*4;++i) {
+        uint16_t tile = BENCH_TILES - BENCH_ANI_GROUPS*4 + 1 + i;
+        world.anidata[tile].ticks = i % 8 < 4 ? 3 : 6;
+        world.anidata[tile].forward = i % 4 == 3 ? tile - 3 : tile + 1;
+    }
+    if ( !pok_tile_manager_load_ani(world.tman,BENCH_TILES+1,world.anidata,TRUE) )
+        pok_error_fromstack(pok_error_fatal);
+
+    /* map: about a fifth of the tiles are animated */
+    world.mapData = malloc(sizeof(uint16_t) * BENCH_MAP_WIDTH * BENCH_MAP_HEIGHT);
+    for (i = 0;i < BENCH_MAP_WIDTH * BENCH_MAP_HEIGHT;++i) {
+        if (bench_rand() % 5 == 0)
+            world.mapData[i] = BENCH_TILES - BENCH_ANI_GROUPS*4 + 1 + bench_rand() % (BENCH_ANI_GROUPS*4);
+        else
+            world.mapData[i] = 1 + bench_rand() % (BENCH_TILES - BENCH_ANI_GROUPS*4);
+    }
+    world.map = pok_map_new();
+    if ( !pok_map_load_simple(world.map,world.mapData,BENCH_MAP_WIDTH,BENCH_MAP_HEIGHT) )
+        pok_error_fromstack(pok_error_fatal);
+
+    /* center the view near a chunk corner so that 4 chunks are visible */
+    world.mapRC = pok_map_render_context_new(world.tman);
+    pok_map_render_context_set_map(world.mapRC,world.map);
+    chunkpos.X = 1;
+    chunkpos.Y = 1;
+    relpos.column = 2;
+    relpos.row = 2;
+    if ( !pok_map_render_context_center_on(world.mapRC,&chunkpos,&relpos) )
+        pok_error_fromstack(pok_error_fatal);
+
+    /* sprites and characters scattered around the view (some are off screen) */
+    n = (size_t)BENCH_SPRITES * 8 * dim * dim * 4;
+    world.spriteData = malloc(n);
+    for (i = 0;i < n;++i)
+        world.spriteData[i] = (byte_t)bench_rand();
+    world.sman = pok_sprite_manager_new(world.sys);
+    if ( !pok_sprite_manager_load(world.sman,0,BENCH_SPRITES,world.spriteData,TRUE) )
+        pok_error_fromstack(pok_error_fatal);
+    world.charRC = pok_character_render_context_new(world.mapRC,world.sman);
+    for (i = 0;i < BENCH_CHARACTERS;++i) {
+        struct pok_point cpos = chunkpos;
+        struct pok_location tpos;
+        struct pok_character_context* cc;
+        tpos.column = relpos.column + bench_rand() % 12;
+        tpos.row = relpos.row + bench_rand() % 12;
+        world.chars[i] = pok_character_new_ex(bench_rand() % BENCH_SPRITES,world.map->mapNo,&cpos,&tpos);
+        if (world.chars[i] == NULL)
+            pok_error_fromstack(pok_error_fatal);
+        cc = pok_character_render_context_add_ex(world.charRC,world.chars[i]);
+        if (cc == NULL)
+            pok_error_fromstack(pok_error_fatal);
+        /* some characters are jumping */
+        cc->shadow = i % 10 == 0;
+    }
+    for (;i < BENCH_CHARACTERS+BENCH_CROWD;++i) {
+        struct pok_point cpos;
+        struct pok_location tpos;
+        cpos.X = bench_rand() % 4;
+        cpos.Y = bench_rand() % 4;
+        tpos.column = bench_rand() % world.map->chunkSize.columns;
+        tpos.row = bench_rand() % world.map->chunkSize.rows;
+        world.chars[i] = pok_character_new_ex(bench_rand() % BENCH_SPRITES,world.map->mapNo,&cpos,&tpos);
+        if (world.chars[i] == NULL || !pok_character_render_context_add(world.charRC,world.chars[i]))
+            pok_error_fromstack(pok_error_fatal);
+    }
+
+    /* a fadeout halfway through */
+    pok_fadeout_effect_init(&world.fadeout);
+    pok_fadeout_effect_set_update(&world.fadeout,world.sys,1000,pok_fadeout_to_center,FALSE);
+    pok_fadeout_effect_update(&world.fadeout,500);
+
+    /* an open message menu with long text; note that glyph textures are not loaded (there is no
+       install directory) so glyphs are drawn untextured, which still exercises text layout */
+    text = "The quick brown fox jumps over the lazy dog. Pack my box with five dozen liquor jugs. "
+        "How vexingly quick daft zebras jump! Sphinx of black quartz, judge my vow. The five boxing "
+        "wizards jump quickly. Jackdaws love my big sphinx of quartz. Mr. Jock, TV quiz PhD, bags few lynx.";
+    pok_message_menu_init(&world.menu,world.sys);
+    pok_message_menu_activate(&world.menu,text);
+    world.menu.text.progress = world.menu.text.curcount;
+}
+static void bench_free_world()
+{
+    size_t i;
+    pok_message_menu_delete(&world.menu);
+    pok_character_render_context_free(world.charRC);
+    for (i = 0;i < BENCH_CHARACTERS+BENCH_CROWD;++i)
+        pok_character_free(world.chars[i]);
+    free(world.snapshot.sprites);
+    pok_sprite_manager_free(world.sman);
+    pok_map_render_context_free(world.mapRC);
+    pok_map_free(world.map);
+    pok_tile_manager_free(world.tman);
+    pok_graphics_subsystem_free(world.sys);
+    free(world.spriteData);
+    free(world.tileData);
+    free(world.mapData);
+}
+
+/* benchmark operations */
+static void bench_tick()
+{
+    /* advance the tile animation like the update procedure does */
+    ++world.mapRC->tileAniTicks;
+    pok_tile_manager_update_ani(world.tman,world.mapRC->tileAniTicks);
+}
+static void bench_tick_immediate()
+{
+    world.mapRC->batch = FALSE;
+    bench_tick();
+}
+static void bench_tick_batch()
+{
+    world.mapRC->batch = TRUE;
+    world.mapRC->bake = FALSE;
+    bench_tick();
+}
+static void bench_tick_baked()
+{
+    world.mapRC->batch = TRUE;
+    world.mapRC->bake = TRUE;
+    bench_tick();
+}
+static void bench_sprites_immediate()
+{
+    world.charRC->batch = FALSE;
+}
+static void bench_sprites_batch()
+{
+    world.charRC->batch = TRUE;
+}
+static void bench_compute_chunk_render_info()
+{
+    compute_chunk_render_info(world.mapRC,world.sys);
+}
+static void bench_map_render()
+{
+    glClear(GL_COLOR_BUFFER_BIT);
+    pok_map_render(world.sys,world.mapRC);
+    glFinish();
+}
+static void bench_character_render()
+{
+    pok_character_render(world.sys,world.charRC);
+    glFinish();
+}
+static void bench_character_capture()
+{
+    if ( !pok_character_render_context_capture(world.charRC,&world.snapshot) )
+        pok_error_fromstack(pok_error_fatal);
+}
+static void bench_character_find()
+{
+    /* probe for a character on a random tile like a collision check */
+    struct pok_point cpos;
+    struct pok_location tpos;
+    cpos.X = bench_rand() % 4;
+    cpos.Y = bench_rand() % 4;
+    tpos.column = bench_rand() % world.map->chunkSize.columns;
+    tpos.row = bench_rand() % world.map->chunkSize.rows;
+    pok_character_render_context_find(world.charRC,world.map->mapNo,&cpos,&tpos,TRUE);
+}
+static void bench_fadeout_render()
+{
+    pok_fadeout_effect_render(world.sys,&world.fadeout);
+    glFinish();
+}
+static void bench_menu_render()
+{
+    pok_message_menu_render(&world.menu);
+    glFinish();
+}
+static void bench_frame()
+{
+    glClear(GL_COLOR_BUFFER_BIT);
+    pok_map_render(world.sys,world.mapRC);
+    pok_character_render(world.sys,world.charRC);
+    pok_message_menu_render(&world.menu);
+    pok_fadeout_effect_render(world.sys,&world.fadeout);
+    glFinish();
+}
+
+static const struct bench_case cases[] = {
+    { "compute_chunk_render_info", 1000, NULL, bench_compute_chunk_render_info },
+    { "map_render", 1, bench_tick_immediate, bench_map_render },
+    { "map_render_batch", 1, bench_tick_batch, bench_map_render },
+    { "map_render_baked", 1, bench_tick_baked, bench_map_render },
+    { "character_render", 1, bench_sprites_immediate, bench_character_render },
+    { "character_render_batch", 1, bench_sprites_batch, bench_character_render },
+    { "character_capture", 10, NULL, bench_character_capture },
+    { "character_find", 1000, NULL, bench_character_find },
+    { "fadeout_render", 1, NULL, bench_fadeout_render },
+    { "menu_render", 1, NULL, bench_menu_render },
+    { "frame", 1, bench_tick_baked, bench_frame }
+};
+
+static void bench_run(const struct bench_case* bc)
+{
+    uint32_t i, j;
+    double samples[BENCH_SAMPLES], total = 0;
+    struct bench_result* result = results + resultc++;
+    for (i = 0;i < BENCH_WARMUP + BENCH_SAMPLES;++i) {
+        uint64_t start;
+        if (bc->prepare != NULL)
+            bc->prepare();
+        start = pok_timestep_clock();
+        for (j = 0;j < bc->batch;++j)
+            bc->run();
+        if (i >= BENCH_WARMUP) {
+            samples[i - BENCH_WARMUP] = (double)(pok_timestep_clock() - start) / bc->batch;
+            total += samples[i - BENCH_WARMUP];
+        }
+    }
+    qsort(samples,BENCH_SAMPLES,sizeof(double),bench_compar);
+    result->name = bc->name;
+    result->samples = BENCH_SAMPLES;
+    result->batch = bc->batch;
+    result->mean = total / BENCH_SAMPLES;
+    result->median = samples[BENCH_SAMPLES / 2];
+    result->p95 = samples[BENCH_SAMPLES * 95 / 100];
+    result->min = samples[0];
+}
+static void bench_check_bake(const struct pok_graphics_subsystem* sys)
+{
+    /* the baked layers must produce the same frame as the plain batch renderer; the baked frame is
+       drawn a few times first so that every visible block has been baked */
+    int i;
+    byte_t* expected, *actual;
+    GLsizei w = sys->windowSize.columns * sys->dimension, h = sys->windowSize.rows * sys->dimension;
+    expected = malloc((size_t)w * h * 4);
+    actual = malloc((size_t)w * h * 4);
+    if (expected == NULL || actual == NULL)
+        pok_error(pok_error_fatal,"memory failure in bench_check_bake()");
+    bench_tick_batch();
+    bench_map_render();
+    glReadPixels(0,0,w,h,GL_RGBA,GL_UNSIGNED_BYTE,expected);
+    world.mapRC->bake = TRUE;
+    for (i = 0;i < 16;++i)
+        bench_map_render();
+    glReadPixels(0,0,w,h,GL_RGBA,GL_UNSIGNED_BYTE,actual);
+    for (i = 0;i < w * h;++i)
+        /* the alpha channel is not displayed */
+        if (memcmp(expected + i*4,actual + i*4,3) != 0)
+            pok_error(pok_error_fatal,"baked map layers do not match the batch renderer");
+    free(expected);
+    free(actual);
+}
+static void bench_routine(const struct pok_graphics_subsystem* sys,void* context)
+{
+    /* run every benchmark once on the render thread (where the GL context is current) */
+    size_t i;
+    /* wait until the tile and sprite textures have been created */
+    if (done || world.tman->atlas->texref == 0)
+        return;
+    strncpy(renderer,(const char*)glGetString(GL_RENDERER),sizeof(renderer)-1);
+    /* draw the map once so the character renderer has a view */
+    pok_map_render(sys,world.mapRC);
+    world.snapshot = *world.mapRC->view;
+    world.snapshot.spritec = world.snapshot.spriteAlloc = 0;
+    world.snapshot.sprites = NULL;
+    bench_check_bake(sys);
+    for (i = 0;i < sizeof(cases)/sizeof(cases[0]);++i)
+        bench_run(cases + i);
+    pok_map_render_unload();
+    done = TRUE;
+    (void)context;
+}
+
+static void bench_report(FILE* out,const char* label)
+{
+    int i;
+    fprintf(out,"{\n  \"label\": \"%s\",\n  \"dimension\": %u,\n  \"window\": [%u, %u],\n",
+        label,world.sys->dimension,world.sys->windowSize.columns,world.sys->windowSize.rows);
+    fprintf(out,"  \"renderer\": \"%s\",\n  \"results\": [\n",renderer);
+    for (i = 0;i < resultc;++i)
+        fprintf(out,"    {\"name\": \"%s\", \"samples\": %u, \"batch\": %u, \"mean_ns\": %.1f, \"median_ns\": %.1f, "
+            "\"p95_ns\": %.1f, \"min_ns\": %.1f}%s\n",
+            results[i].name,results[i].samples,results[i].batch,results[i].mean,results[i].median,
+            results[i].p95,results[i].min,i+1 < resultc ? "," : "");
+    fputs("  ]\n}\n",out);
+}
+
+int main(int argc,const char* argv[])
+{
+    int i;
+    struct pok_timeout_interval wait;
+    struct pok_graphics_headless_options options;
+    POKGAME_NAME = argv[0];
+
+    pok_exception_load_module();
+    pok_gamelock_load_module();
+    bench_build_world();
+
+    /* render as fast as possible; benchmarks run inside a single frame */
+    memset(&options,0,sizeof(options));
+    options.unpaced = TRUE;
+    pok_graphics_headless_configure(&options);
+    if ( !pok_graphics_subsystem_begin(world.sys) )
+        pok_error_fromstack(pok_error_fatal);
+    if (pok_tile_manager_build_atlas(world.tman) && pok_sprite_manager_build_atlas(world.sman))
+        pok_graphics_subsystem_create_textures(world.sys,4,
+            world.tman->tileset,world.tman->tilecnt,
+            world.sman->spritesets,world.sman->imagecnt,
+            &world.tman->atlas,1,
+            &world.sman->atlas,1);
+    else
+        pok_error_fromstack(pok_error_fatal);
+    pok_graphics_subsystem_register(world.sys,bench_routine,NULL);
+    pok_timeout_interval_reset(&wait,10);
+    while (!done)
+        pok_timeout_no_elapsed(&wait);
+
+    /* report results */
+    printf("%-28s %12s %12s %12s %12s\n","benchmark","mean(ns)","median(ns)","p95(ns)","min(ns)");
+    for (i = 0;i < resultc;++i)
+        printf("%-28s %12.1f %12.1f %12.1f %12.1f\n",results[i].name,results[i].mean,results[i].median,
+            results[i].p95,results[i].min);
+    if (argc > 1) {
+        FILE* out = fopen(argv[1],"w");
+        if (out == NULL) {
+            fprintf(stderr,"%s: cannot open '%s'\n",argv[0],argv[1]);
+            return 1;
+        }
+        bench_report(out,argc > 2 ? argv[2] : "");
+        fclose(out);
+    }
+
+    pok_graphics_subsystem_end(world.sys);
+    bench_free_world();
+    pok_gamelock_unload_module();
+    pok_exception_unload_module();
+    return 0;
+}
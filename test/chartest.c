@@ -0,0 +1,230 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "character-context.h"
+#include "map.h"
+#include "error.h"
+#include "graphics.h"
+
+/* char_test1() - checks the character render context's spatial index: characters are scattered over
+   a few maps, moved around and removed; tile probes and view captures are compared against a scan
+   of every character */
+
+#define CHAR_TEST_CHARACTERS 2000
+#define CHAR_TEST_MOVES 20000
+#define CHAR_TEST_PROBES 20000
+#define CHAR_TEST_VIEWS 500
+
+static uint32_t char_test_seed = 0x6b8b4567;
+static uint32_t char_test_rand()
+{
+    char_test_seed ^= char_test_seed << 13;
+    char_test_seed ^= char_test_seed >> 17;
+    char_test_seed ^= char_test_seed << 5;
+    return char_test_seed;
+}
+
+static void char_test_position(uint32_t* mapNo,struct pok_point* chunkPos,struct pok_location* tilePos)
+{
+    *mapNo = 1 + char_test_rand() % 2;
+    chunkPos->X = (int32_t)(char_test_rand() % 5) - 2;
+    chunkPos->Y = (int32_t)(char_test_rand() % 5) - 2;
+    tilePos->column = char_test_rand() % 32;
+    tilePos->row = char_test_rand() % 32;
+}
+static bool_t char_test_occupied(struct pok_character* chars[],bool_t active[],uint32_t mapNo,
+    const struct pok_point* chunkPos,const struct pok_location* tilePos,bool_t npcOnly)
+{
+    int i;
+    for (i = 0;i < CHAR_TEST_CHARACTERS;++i) {
+        const struct pok_character* ch = chars[i];
+        if (active[i] && ch->mapNo == mapNo && ch->chunkPos.X == chunkPos->X && ch->chunkPos.Y == chunkPos->Y
+            && ch->tilePos.column == tilePos->column && ch->tilePos.row == tilePos->row && !(npcOnly && ch->isPlayer))
+            return TRUE;
+    }
+    return FALSE;
+}
+static bool_t char_test_visible(const struct pok_map_render_snapshot* view,const struct pok_character* ch)
+{
+    int i;
+    if (ch->mapNo != view->map->mapNo)
+        return FALSE;
+    for (i = 0;i < 4;++i) {
+        const struct pok_chunk_render_info* info = view->info + i;
+        if (info->chunkPos.X == ch->chunkPos.X && info->chunkPos.Y == ch->chunkPos.Y
+            && ch->tilePos.column >= info->loc.column && ch->tilePos.column < info->loc.column + info->across
+            && ch->tilePos.row >= info->loc.row && ch->tilePos.row < info->loc.row + info->down)
+            return TRUE;
+    }
+    return FALSE;
+}
+
+int char_test1()
+{
+    int i, j;
+    uint32_t mapNo;
+    struct pok_point chunkPos;
+    struct pok_location tilePos;
+    uint16_t tiles[4*4];
+    struct pok_map* map;
+    struct pok_map_render_snapshot view;
+    struct pok_character_render_context* charRC;
+    static struct pok_character* chars[CHAR_TEST_CHARACTERS];
+    static struct pok_character_context* contexts[CHAR_TEST_CHARACTERS];
+    static bool_t active[CHAR_TEST_CHARACTERS];
+
+    charRC = pok_character_render_context_new(NULL,NULL);
+    assert(charRC != NULL);
+    for (i = 0;i < CHAR_TEST_CHARACTERS;++i) {
+        char_test_position(&mapNo,&chunkPos,&tilePos);
+        chars[i] = pok_character_new_ex(0,mapNo,&chunkPos,&tilePos);
+        assert(chars[i] != NULL);
+        chars[i]->isPlayer = i % 50 == 0;
+        contexts[i] = pok_character_render_context_add_ex(charRC,chars[i]);
+        assert(contexts[i] != NULL);
+        active[i] = TRUE;
+    }
+
+    /* move characters around; some are removed and added back */
+    for (i = 0;i < CHAR_TEST_MOVES;++i) {
+        j = char_test_rand() % CHAR_TEST_CHARACTERS;
+        if (char_test_rand() % 10 == 0) {
+            if (active[j]) {
+                assert( pok_character_render_context_remove(charRC,chars[j]) );
+                active[j] = FALSE;
+            }
+            else {
+                contexts[j] = pok_character_render_context_add_ex(charRC,chars[j]);
+                assert(contexts[j] != NULL);
+                active[j] = TRUE;
+            }
+        }
+        else if (active[j]) {
+            if (char_test_rand() % 2 == 0) {
+                /* step to an adjacent tile (this usually stays in the same cell) */
+                mapNo = chars[j]->mapNo;
+                chunkPos = chars[j]->chunkPos;
+                tilePos = chars[j]->tilePos;
+                tilePos.column = (tilePos.column + 1) % 32;
+            }
+            else
+                char_test_position(&mapNo,&chunkPos,&tilePos);
+            assert( pok_character_context_set_position(contexts[j],mapNo,&chunkPos,&tilePos) );
+        }
+    }
+
+    /* tile probes */
+    for (i = 0;i < CHAR_TEST_PROBES;++i) {
+        bool_t npcOnly = char_test_rand() % 2;
+        struct pok_character_context* cc;
+        char_test_position(&mapNo,&chunkPos,&tilePos);
+        cc = pok_character_render_context_find(charRC,mapNo,&chunkPos,&tilePos,npcOnly);
+        assert( (cc != NULL) == char_test_occupied(chars,active,mapNo,&chunkPos,&tilePos,npcOnly) );
+        if (cc != NULL)
+            assert( cc->character->mapNo == mapNo && cc->character->chunkPos.X == chunkPos.X
+                && cc->character->chunkPos.Y == chunkPos.Y && cc->character->tilePos.column == tilePos.column
+                && cc->character->tilePos.row == tilePos.row && !(npcOnly && cc->character->isPlayer) );
+    }
+
+    /* view captures: four regions in distinct chunks */
+    map = pok_map_new();
+    assert(map != NULL);
+    memset(tiles,0,sizeof(tiles));
+    assert( pok_map_load_simple(map,tiles,4,4) );
+    memset(&view,0,sizeof(struct pok_map_render_snapshot));
+    view.map = map;
+    for (i = 0;i < CHAR_TEST_VIEWS;++i) {
+        int k, count = 0;
+        map->mapNo = 1 + char_test_rand() % 2;
+        for (k = 0;k < 4;++k) {
+            view.info[k].chunk = map->origin;
+            view.info[k].chunkPos.X = (k & 1) - 1 + (int32_t)(char_test_rand() % 2);
+            view.info[k].chunkPos.Y = (k >> 1) * 2 - 1;
+            view.info[k].loc.column = char_test_rand() % 32;
+            view.info[k].loc.row = char_test_rand() % 32;
+            view.info[k].across = char_test_rand() % (33 - view.info[k].loc.column);
+            view.info[k].down = char_test_rand() % (33 - view.info[k].loc.row);
+        }
+        if (view.info[0].chunkPos.X == view.info[1].chunkPos.X)
+            view.info[1].across = 0;
+        if (view.info[2].chunkPos.X == view.info[3].chunkPos.X)
+            view.info[3].across = 0;
+        assert( pok_character_render_context_capture(charRC,&view) );
+        for (j = 0;j < CHAR_TEST_CHARACTERS;++j)
+            if (active[j] && char_test_visible(&view,chars[j]))
+                ++count;
+        assert(view.spritec == count);
+        for (j = 0;j < view.spritec;++j) {
+            struct pok_character ch;
+            ch.mapNo = view.sprites[j].mapNo;
+            ch.chunkPos = view.sprites[j].chunkPos;
+            ch.tilePos = view.sprites[j].tilePos;
+            assert( char_test_visible(&view,&ch) );
+        }
+    }
+    free(view.sprites);
+    pok_map_free(map);
+
+    pok_character_render_context_free(charRC);
+    for (i = 0;i < CHAR_TEST_CHARACTERS;++i)
+        pok_character_free(chars[i]);
+    printf("character grid: ok\n");
+    return 0;
+}
+
+/* char_test2() - checks that the sprite atlas holds each distinct frame once and that every frame of
+   every sprite maps to the cell with its pixels */
+int char_test2()
+{
+    int k;
+    uint16_t i, j;
+    uint32_t dim, n, m;
+    byte_t* data;
+    struct pok_graphics_subsystem* sys;
+    struct pok_sprite_manager* sman;
+    uint16_t flags[] = { pok_sprite_manager_no_alt, pok_sprite_manager_updown_alt | pok_sprite_manager_leftright_alt };
+
+    sys = pok_graphics_subsystem_new();
+    pok_graphics_subsystem_default(sys);
+    dim = sys->dimension;
+    for (k = 0;k < 2;++k) {
+        uint32_t cells = 0;
+        sman = pok_sprite_manager_new(sys);
+        assert(sman != NULL);
+        assert( !pok_sprite_manager_build_atlas(sman) );
+        pok_exception_pop();
+        /* 7 sprites with 12 frames each (some are duplicates without the alt flags) */
+        n = 7 * 12 * dim * dim * 4;
+        data = malloc(n);
+        assert(data != NULL);
+        for (m = 0;m < n / 4;++m) {
+            uint32_t v = char_test_rand();
+            memcpy(data + m * 4,&v,4);
+        }
+        assert( pok_sprite_manager_load(sman,flags[k],7,data,TRUE) );
+        assert( pok_sprite_manager_build_atlas(sman) );
+        assert( !pok_sprite_manager_build_atlas(sman) );
+        pok_exception_pop();
+        for (i = 0;i < sman->imagecnt;++i)
+            if (i == 0 || sman->spritesets[i] != sman->spritesets[i-1])
+                ++cells;
+        assert((uint32_t)sman->atlasColumns * sman->atlasColumns >= cells);
+        assert(sman->atlas->width == dim * sman->atlasColumns && sman->atlas->height >= dim * (cells / sman->atlasColumns));
+        for (i = 0;i < sman->spritecnt;++i) {
+            for (j = 0;j < 12;++j) {
+                uint32_t r, cell = pok_sprite_manager_get_cell(sman,i,j);
+                const struct pok_image* frame = sman->spriteassoc[i][j];
+                assert(cell < cells);
+                for (r = 0;r < dim;++r)
+                    assert( memcmp(sman->atlas->pixels.dataRGBA + ((size_t)(cell / sman->atlasColumns) * dim + r) * sman->atlas->width
+                            + (cell % sman->atlasColumns) * dim,frame->pixels.dataRGBA + r * dim,dim * 4) == 0 );
+            }
+        }
+        pok_sprite_manager_free(sman);
+        free(data);
+    }
+    pok_graphics_subsystem_free(sys);
+    printf("sprite atlas: ok\n");
+    return 0;
+}
@@ -5,6 +5,9 @@
 #include "menu.h"
 #include "gamelock.h"
 #include "error.h"
+#ifdef POKGAME_HEADLESS
+#include "graphics-headless.h"
+#endif
 #include <stdio.h>
 #include <string.h>
 #include <ctype.h>
@@ -12,6 +15,7 @@
 
 extern const char* POKGAME_NAME;
 extern const char* HOME;
+extern const char* TMPDIR;
 extern void compute_chunk_render_info(struct pok_map_render_context* context,const struct pok_graphics_subsystem* sys);
 
 static char* get_token(char** start,char delim);
@@ -98,6 +102,19 @@ int graphics_main_test1()
     textInput.accepting = TRUE;
     contexts[2] = &textInput;
 
+#ifdef POKGAME_HEADLESS
+    /* there is no window to look at, so save a frame every second */
+    {
+        static char dumpPrefix[1024];
+        struct pok_graphics_headless_options headlessOptions = { 0, FALSE, 0, NULL };
+        snprintf(dumpPrefix,sizeof(dumpPrefix),"%s/pokgame-frame-",TMPDIR);
+        headlessOptions.dumpEvery = sys->framerate;
+        headlessOptions.dumpPrefix = dumpPrefix;
+        pok_graphics_headless_configure(&headlessOptions);
+        printf("headless: saving frames to %s*.png\n",dumpPrefix);
+    }
+#endif
+
     pok_graphics_subsystem_begin(sys);
     pok_graphics_subsystem_register(sys,routines[0],contexts[0]);
 
@@ -136,10 +153,10 @@ int graphics_main_test1()
             compute_chunk_render_info(globals.mcxt,sys);
             printf("chunkSize{%d %d} focus{%d,%d} relpos{%d,%d} chunkpos{%d,%d} chunk{%d} viewing:\n",globals.mcxt->map->chunkSize.columns,
                 globals.mcxt->map->chunkSize.rows,globals.mcxt->focus[0],globals.mcxt->focus[1],globals.mcxt->relpos.column,
-                globals.mcxt->relpos.row,globals.mcxt->chunkpos.X,globals.mcxt->chunkpos.Y,globals.mcxt->chunk->data[0][0].data.tileid);
+                globals.mcxt->relpos.row,globals.mcxt->chunkpos.X,globals.mcxt->chunkpos.Y,pok_map_chunk_get_tileid(globals.mcxt->chunk,0,0));
             for (j = 0;j < 3;++j) { /* rows */
                 for (i = 0;i < 3;++i) /* columns */
-                    printf("%d   ",globals.mcxt->viewingChunks[i][j]==NULL ? -1 : globals.mcxt->viewingChunks[i][j]->data[0][0].data.tileid);
+                    printf("%d   ",globals.mcxt->viewingChunks[i][j]==NULL ? -1 : pok_map_chunk_get_tileid(globals.mcxt->viewingChunks[i][j],0,0));
                 putchar('\n');
             }
             for (i = 0;i < 4;++i) {
@@ -152,7 +169,7 @@ int graphics_main_test1()
                         globals.mcxt->info[i].down,
                         globals.mcxt->info[i].loc.column,
                         globals.mcxt->info[i].loc.row,
-                        globals.mcxt->info[i].chunk->data[0][0].data.tileid );
+                        pok_map_chunk_get_tileid(globals.mcxt->info[i].chunk,0,0) );
             }
         }
         else if (strcmp(tok,"keylisten") == 0) {
@@ -171,6 +188,33 @@ int graphics_main_test1()
                 pok_timeout_no_elapsed(&inv);
             }
         }
+        else if (strcmp(tok,"atlas") == 0) {
+            /* pack the tiles into an atlas and load it as a texture for the batch renderer */
+            if (tman->atlas == NULL && pok_tile_manager_build_atlas(tman))
+                pok_graphics_subsystem_create_textures(sys,1,&tman->atlas,1);
+        }
+        else if (strcmp(tok,"batch") == 0) {
+            globals.mcxt->batch = !globals.mcxt->batch;
+            printf("batch rendering: %s\n",globals.mcxt->batch ? "on" : "off");
+        }
+        else if (strcmp(tok,"bake") == 0) {
+            globals.mcxt->bake = !globals.mcxt->bake;
+            printf("baked layers: %s\n",globals.mcxt->bake ? "on" : "off");
+        }
+        else if (strcmp(tok,"stats") == 0) {
+            /* print frame timing (in milliseconds) */
+            const struct pok_graphics_frame_stats* stats = &sys->frameStats;
+            uint64_t n = stats->frames > 0 ? stats->frames : 1;
+            printf("frames=%llu missed=%llu render=%.3f swap=%.3f slack=%.3f (avg: render=%.3f swap=%.3f slack=%.3f)\n",
+                (unsigned long long)stats->frames,
+                (unsigned long long)stats->missed,
+                stats->renderTime / 1e6,
+                stats->swapTime / 1e6,
+                stats->slack / 1e6,
+                stats->totalRenderTime / 1e6 / n,
+                stats->totalSwapTime / 1e6 / n,
+                stats->totalSlack / 1e6 / n);
+        }
         else if (strcmp(tok,"offset") == 0) {
             if (globals.mcxt->offset[0] == -16)
                 globals.mcxt->offset[0] = 0;
@@ -0,0 +1,294 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include "gamelock.h"
+#include "error.h"
+
+/* lock_test1() - contention benchmark for game object locks; N reader threads
+   repeatedly lock a shared object for reading while 1 writer thread repeatedly
+   modifies it; this compares the gamelock module against the implementation it
+   replaced (a semaphore-based reader/writer lock found through a hashmap guarded
+   by a global lock) */
+
+#define LOCK_TEST_OBJECTS 32      /* number of objects registered with each lock table */
+#define LOCK_TEST_DURATION 1000   /* milliseconds per run */
+#define LOCK_TEST_MAX_READERS 16
+
+#ifdef POKGAME_LINUX
+#include <semaphore.h>
+#include <dstructs/hashmap.h>
+
+/* the replaced implementation (only built where POSIX semaphores are fully implemented) */
+#define LEGACY_SEMAPHORE_MAX 10
+
+struct legacy_lock
+{
+    void* object;
+    sem_t readOnly;
+    sem_t modify;
+    pthread_mutex_t atom;
+};
+
+static struct legacy_lock* legacy_glock;
+static struct hashmap legacy_locks;
+
+static struct legacy_lock* legacy_lock_new(void* object)
+{
+    struct legacy_lock* lock = malloc(sizeof(struct legacy_lock));
+    lock->object = object;
+    sem_init(&lock->readOnly,0,LEGACY_SEMAPHORE_MAX);
+    sem_init(&lock->modify,0,1);
+    pthread_mutex_init(&lock->atom,NULL);
+    return lock;
+}
+static void legacy_lock_free(struct legacy_lock* lock)
+{
+    sem_destroy(&lock->readOnly);
+    sem_destroy(&lock->modify);
+    pthread_mutex_destroy(&lock->atom);
+    free(lock);
+}
+static int legacy_lock_hash(const void** obj,int size)
+{
+    return (long long int)*obj % size;
+}
+static int legacy_lock_compar(const struct legacy_lock* left,const struct legacy_lock* right)
+{
+    long long int result = (long long int)left->object - (long long int)right->object;
+    return result < 0 ? -1 : (result > 0 ? 1 : 0);
+}
+static void legacy_aquire(struct legacy_lock* lock)
+{
+    sem_wait(&lock->modify);
+}
+static void legacy_release(struct legacy_lock* lock)
+{
+    sem_post(&lock->modify);
+}
+static void legacy_up(struct legacy_lock* lock)
+{
+    int value;
+    pthread_mutex_lock(&lock->atom);
+    sem_getvalue(&lock->readOnly,&value);
+    if (value == LEGACY_SEMAPHORE_MAX) {
+        sem_wait(&lock->modify);
+        sem_wait(&lock->readOnly);
+        pthread_mutex_unlock(&lock->atom);
+        return;
+    }
+    pthread_mutex_unlock(&lock->atom);
+    sem_wait(&lock->readOnly);
+}
+static void legacy_down(struct legacy_lock* lock)
+{
+    int value;
+    pthread_mutex_lock(&lock->atom);
+    sem_post(&lock->readOnly);
+    sem_getvalue(&lock->readOnly,&value);
+    if (value == LEGACY_SEMAPHORE_MAX)
+        sem_post(&lock->modify);
+    pthread_mutex_unlock(&lock->atom);
+}
+static struct legacy_lock* legacy_lookup(void* object)
+{
+    /* objects are registered before the benchmark runs */
+    struct legacy_lock* lock;
+    legacy_up(legacy_glock);
+    lock = hashmap_lookup(&legacy_locks,&object);
+    legacy_down(legacy_glock);
+    return lock;
+}
+static void legacy_game_modify_enter(void* object)
+{
+    legacy_aquire(legacy_lookup(object));
+}
+static void legacy_game_modify_exit(void* object)
+{
+    legacy_release(legacy_lookup(object));
+}
+static void legacy_game_lock(void* object)
+{
+    legacy_up(legacy_lookup(object));
+}
+static void legacy_game_unlock(void* object)
+{
+    legacy_down(legacy_lookup(object));
+}
+static void legacy_load(void** objects,int count)
+{
+    int i;
+    legacy_glock = legacy_lock_new(NULL);
+    hashmap_init(&legacy_locks,20,(hash_function)legacy_lock_hash,(key_comparator)legacy_lock_compar);
+    for (i = 0;i < count;++i)
+        hashmap_insert(&legacy_locks,legacy_lock_new(objects[i]));
+}
+static void legacy_unload()
+{
+    hashmap_delete_ex(&legacy_locks,(destructor)legacy_lock_free);
+    legacy_lock_free(legacy_glock);
+}
+
+#endif
+
+/* benchmark state */
+struct lock_test_impl
+{
+    const char* name;
+    void (*lock)(void*);
+    void (*unlock)(void*);
+    void (*modify_enter)(void*);
+    void (*modify_exit)(void*);
+};
+
+struct lock_test_object
+{
+    int value[8];
+};
+
+static struct lock_test_object objects[LOCK_TEST_OBJECTS];
+static const struct lock_test_impl* impl;
+static volatile int running;
+static volatile int torn;
+
+static uint64_t lock_test_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+static void* lock_test_reader(void* arg)
+{
+    /* read the hot object; the values are checked to make sure the writer's updates are not torn */
+    uint64_t* count = arg;
+    struct lock_test_object* obj = objects + LOCK_TEST_OBJECTS/2;
+    while (running) {
+        int i, v;
+        impl->lock(obj);
+        v = obj->value[0];
+        for (i = 1;i < 8;++i)
+            if (obj->value[i] != v) {
+                __sync_fetch_and_add(&torn,1);
+                break;
+            }
+        impl->unlock(obj);
+        ++*count;
+    }
+    return NULL;
+}
+static void* lock_test_writer(void* arg)
+{
+    uint64_t* count = arg;
+    struct lock_test_object* obj = objects + LOCK_TEST_OBJECTS/2;
+    while (running) {
+        int i;
+        impl->modify_enter(obj);
+        for (i = 0;i < 8;++i)
+            ++obj->value[i];
+        impl->modify_exit(obj);
+        ++*count;
+    }
+    return NULL;
+}
+static void lock_test_run(const struct lock_test_impl* which,int readers)
+{
+    int i;
+    uint64_t start, elapsed, total;
+    uint64_t counts[LOCK_TEST_MAX_READERS+1];
+    pthread_t threads[LOCK_TEST_MAX_READERS+1];
+    struct timespec ts;
+    impl = which;
+    running = 1;
+    torn = 0;
+    memset(counts,0,sizeof(counts));
+    start = lock_test_now();
+    pthread_create(threads,NULL,lock_test_writer,counts);
+    for (i = 1;i <= readers;++i)
+        pthread_create(threads+i,NULL,lock_test_reader,counts+i);
+    ts.tv_sec = LOCK_TEST_DURATION / 1000;
+    ts.tv_nsec = (LOCK_TEST_DURATION % 1000) * 1000000;
+    nanosleep(&ts,NULL);
+    running = 0;
+    for (i = 0;i <= readers;++i)
+        pthread_join(threads[i],NULL);
+    elapsed = lock_test_now() - start;
+    total = 0;
+    for (i = 1;i <= readers;++i)
+        total += counts[i];
+    printf("%-8s readers=%-2d  reads/sec=%12.0f  writes/sec=%12.0f  ns/read=%8.1f  torn=%d\n",
+        which->name,
+        readers,
+        total * 1e9 / elapsed,
+        counts[0] * 1e9 / elapsed,
+        total > 0 ? (double)elapsed * readers / total : 0.0,
+        torn);
+}
+
+int lock_test1()
+{
+    int i, n;
+    char input[64];
+    void* objs[LOCK_TEST_OBJECTS];
+    static const struct lock_test_impl gamelockImpl = {
+        "gamelock",
+        pok_game_lock,
+        pok_game_unlock,
+        pok_game_modify_enter,
+        pok_game_modify_exit
+    };
+#ifdef POKGAME_LINUX
+    static const struct lock_test_impl legacyImpl = {
+        "legacy",
+        legacy_game_lock,
+        legacy_game_unlock,
+        legacy_game_modify_enter,
+        legacy_game_modify_exit
+    };
+#endif
+
+    fputs("max reader threads [8]: ",stdout);
+    n = 8;
+    if (fgets(input,sizeof(input),stdin) != NULL && input[0] != '\n')
+        n = atoi(input);
+    if (n < 1)
+        n = 1;
+    if (n > LOCK_TEST_MAX_READERS)
+        n = LOCK_TEST_MAX_READERS;
+
+    /* register every object with both implementations so that lookups search a
+       populated table */
+    for (i = 0;i < LOCK_TEST_OBJECTS;++i) {
+        objs[i] = objects + i;
+        pok_game_lock(objs[i]);
+        pok_game_unlock(objs[i]);
+    }
+#ifdef POKGAME_LINUX
+    legacy_load(objs,LOCK_TEST_OBJECTS);
+#endif
+
+    for (i = 1;i <= n;i *= 2) {
+#ifdef POKGAME_LINUX
+        lock_test_run(&legacyImpl,i);
+#endif
+        lock_test_run(&gamelockImpl,i);
+    }
+
+#ifdef POKGAME_LINUX
+    legacy_unload();
+#endif
+
+    /* short-lived objects are unregistered when they are freed so that churn never fills the
+       table (which has 4096 slots) */
+    for (i = 0;i < 4096 * 8;++i) {
+        void* obj = malloc(64);
+        pok_game_modify_enter(obj);
+        pok_game_modify_exit(obj);
+        pok_game_lock_unregister(obj);
+        free(obj);
+    }
+    for (i = 0;i < LOCK_TEST_OBJECTS;++i)
+        pok_game_lock_unregister(objs[i]);
+    printf("churn: %d objects registered and unregistered\n",4096 * 8);
+    return 0;
+}
@@ -11,7 +11,22 @@ const char* HOME;
 
 extern int main_test();
 extern int net_test1();
+extern int net_test2();
+extern int net_test3();
+extern int net_test4();
+extern int net_test5();
 extern int graphics_main_test1();
+extern int lock_test1();
+extern int map_test1();
+extern int map_test2();
+extern int map_test3();
+extern int map_test4();
+extern int map_test5();
+extern int map_test6();
+extern int char_test1();
+extern int char_test2();
+extern int path_test1();
+extern int server_test1();
 
 void halt()
 {
@@ -52,8 +67,38 @@ int main(int argc,const char* argv[])
         input[i] = 0;
     if (strcmp(input,"net") == 0)
         assert(net_test1() == 0);
+    else if (strcmp(input,"image transfer") == 0)
+        assert(net_test2() == 0);
+    else if (strcmp(input,"data source") == 0)
+        assert(net_test3() == 0);
+    else if (strcmp(input,"io poller") == 0)
+        assert(net_test4() == 0);
+    else if (strcmp(input,"stream compression") == 0)
+        assert(net_test5() == 0);
     else if (strcmp(input,"graphics 1") == 0)
         graphics_main_test1();
+    else if (strcmp(input,"lock") == 0)
+        lock_test1();
+    else if (strcmp(input,"map") == 0)
+        assert(map_test1() == 0);
+    else if (strcmp(input,"map index") == 0)
+        assert(map_test2() == 0);
+    else if (strcmp(input,"map residency") == 0)
+        assert(map_test3() == 0);
+    else if (strcmp(input,"map text") == 0)
+        assert(map_test4() == 0);
+    else if (strcmp(input,"map update") == 0)
+        assert(map_test5() == 0);
+    else if (strcmp(input,"map terrain") == 0)
+        assert(map_test6() == 0);
+    else if (strcmp(input,"character grid") == 0)
+        assert(char_test1() == 0);
+    else if (strcmp(input,"sprite atlas") == 0)
+        assert(char_test2() == 0);
+    else if (strcmp(input,"path") == 0)
+        assert(path_test1() == 0);
+    else if (strcmp(input,"version server") == 0)
+        assert(server_test1() == 0);
     else /*if (strcmp(input,"main") == 0)*/
         main_test();
 
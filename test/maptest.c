@@ -0,0 +1,705 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "map.h"
+#include "map-context.h"
+#include "pok.h"
+#include "gamelock.h"
+#include "error.h"
+#include "tileman.h"
+#include "graphics.h"
+#include <dstructs/treemap.h>
+
+/* map_test1() - builds a large overworld, saves it in the recursive map format and in the
+   indexed map format and then compares how long it takes to open each one; the indexed map
+   is opened lazily, so only the chunks around the origin should be loaded up front; every
+   chunk in the reopened maps is then checked against the original map */
+
+#define MAP_TEST_CHUNK_DIMENSION 32
+#define MAP_TEST_CHUNKS_ACROSS 64
+#define MAP_TEST_CHUNKS_DOWN 64
+
+extern const char* TMPDIR;
+
+static uint32_t map_test_seed = 0x2545f491;
+static uint32_t map_test_rand()
+{
+    map_test_seed ^= map_test_seed << 13;
+    map_test_seed ^= map_test_seed >> 17;
+    map_test_seed ^= map_test_seed << 5;
+    return map_test_seed;
+}
+
+static struct pok_map* map_test_build()
+{
+    int x, y;
+    uint32_t i;
+    struct pok_map* map;
+    struct pok_size chunkSize = {MAP_TEST_CHUNK_DIMENSION,MAP_TEST_CHUNK_DIMENSION};
+    uint16_t tiles[MAP_TEST_CHUNK_DIMENSION * MAP_TEST_CHUNK_DIMENSION];
+    for (i = 0;i < MAP_TEST_CHUNK_DIMENSION * MAP_TEST_CHUNK_DIMENSION;++i)
+        tiles[i] = map_test_rand() % 400;
+    map = pok_map_new();
+    assert( pok_map_configure(map,&chunkSize,tiles,MAP_TEST_CHUNK_DIMENSION * MAP_TEST_CHUNK_DIMENSION) );
+    for (y = 0;y < MAP_TEST_CHUNKS_DOWN;++y) {
+        for (x = 0;x < MAP_TEST_CHUNKS_ACROSS;++x) {
+            struct pok_point adj;
+            struct pok_tile_data warp;
+            struct pok_map_chunk* chunk;
+            if (x == 0 && y == 0)
+                continue;
+            for (i = 0;i < MAP_TEST_CHUNK_DIMENSION * MAP_TEST_CHUNK_DIMENSION;++i)
+                tiles[i] = map_test_rand() % 400;
+            adj.X = x == 0 ? 0 : x - 1;
+            adj.Y = x == 0 ? y - 1 : y;
+            chunk = pok_map_add_chunk(map,&adj,x == 0 ? pok_direction_down : pok_direction_right,
+                tiles,MAP_TEST_CHUNK_DIMENSION * MAP_TEST_CHUNK_DIMENSION);
+            assert(chunk != NULL);
+            /* give some chunks passability exceptions and warps */
+            if ((x + y) % 7 == 0) {
+                pok_map_chunk_set_passability(chunk,x % MAP_TEST_CHUNK_DIMENSION,y % MAP_TEST_CHUNK_DIMENSION,TRUE,FALSE);
+                pok_map_chunk_set_passability(chunk,y % MAP_TEST_CHUNK_DIMENSION,x % MAP_TEST_CHUNK_DIMENSION,FALSE,TRUE);
+                warp.tileid = 0;
+                warp.warpMap = x * MAP_TEST_CHUNKS_DOWN + y;
+                warp.warpChunk.X = -x;
+                warp.warpChunk.Y = -y;
+                warp.warpLocation.column = 3;
+                warp.warpLocation.row = 4;
+                warp.warpKind = pok_tile_warp_instant;
+                assert( pok_map_chunk_set_warp(chunk,5,(x + y) % MAP_TEST_CHUNK_DIMENSION,&warp) );
+                assert( pok_map_chunk_set_warp(chunk,1,2,&warp) );
+            }
+        }
+    }
+    return map;
+}
+
+static void map_test_compare(struct pok_map* expected,struct pok_map* map,bool_t complex)
+{
+    /* look up every chunk in 'map' (this loads a lazy map completely) */
+    int x, y;
+    size_t ntiles = (size_t)expected->chunkSize.columns * expected->chunkSize.rows;
+    assert(map->chunkSize.columns == expected->chunkSize.columns && map->chunkSize.rows == expected->chunkSize.rows);
+    assert(map->mapNo == expected->mapNo);
+    for (y = 0;y < MAP_TEST_CHUNKS_DOWN;++y) {
+        for (x = 0;x < MAP_TEST_CHUNKS_ACROSS;++x) {
+            struct pok_point pos;
+            const struct pok_map_chunk* a, * b;
+            pos.X = x;
+            pos.Y = y;
+            a = pok_map_get_chunk(expected,&pos);
+            b = pok_map_get_chunk(map,&pos);
+            assert(a != NULL && b != NULL);
+            assert(memcmp(a->tiles,b->tiles,ntiles * sizeof(uint16_t)) == 0);
+            if (x > 0)
+                assert(b->adjacent[pok_direction_left] != NULL && b->adjacent[pok_direction_left]->adjacent[pok_direction_right] == b);
+            if (complex) {
+                uint16_t i;
+                assert(memcmp(a->impass,b->impass,(ntiles + 7) / 8 * 2) == 0);
+                assert(a->warpc == b->warpc);
+                for (i = 0;i < a->warpc;++i) {
+                    assert(a->warps[i].index == b->warps[i].index);
+                    assert(a->warps[i].data.warpMap == b->warps[i].data.warpMap);
+                    assert(pok_point_compar(&a->warps[i].data.warpChunk,&b->warps[i].data.warpChunk) == 0);
+                    assert(pok_location_compar(&a->warps[i].data.warpLocation,&b->warps[i].data.warpLocation) == 0);
+                    assert(a->warps[i].data.warpKind == b->warps[i].data.warpKind);
+                }
+            }
+        }
+    }
+}
+
+int map_test1()
+{
+    uint64_t t;
+    double classicOpen, indexedOpen;
+    char classicFile[1024], indexedFile[1024];
+    struct pok_map* map, * classic, * indexed;
+    struct pok_data_source* dsrc;
+
+    printf("building %dx%d chunk map with %dx%d chunks\n",MAP_TEST_CHUNKS_ACROSS,MAP_TEST_CHUNKS_DOWN,
+        MAP_TEST_CHUNK_DIMENSION,MAP_TEST_CHUNK_DIMENSION);
+    map = map_test_build();
+    map->mapNo = 7;
+    snprintf(classicFile,sizeof(classicFile),"%s/pokgame-maptest.map",TMPDIR);
+    snprintf(indexedFile,sizeof(indexedFile),"%s/pokgame-maptest.pkmi",TMPDIR);
+
+    /* save the map in both formats */
+    dsrc = pok_data_source_new_file(classicFile,pok_filemode_create_always,pok_iomode_write);
+    assert(dsrc != NULL);
+    pok_data_source_buffering(dsrc,TRUE);
+    assert( pok_map_save(map,dsrc,FALSE) && pok_data_source_flush(dsrc) );
+    pok_data_source_free(dsrc);
+    dsrc = pok_data_source_new_file(indexedFile,pok_filemode_create_always,pok_iomode_write);
+    assert(dsrc != NULL);
+    pok_data_source_buffering(dsrc,TRUE);
+    assert( pok_map_save_indexed(map,dsrc) && pok_data_source_flush(dsrc) );
+    pok_data_source_free(dsrc);
+
+    /* open the map in both formats; the indexed map loads the chunks that would be visible
+       from the origin */
+    t = pok_timestep_clock();
+    classic = pok_map_new();
+    dsrc = pok_data_source_new_file(classicFile,pok_filemode_open_existing,pok_iomode_read);
+    assert(dsrc != NULL);
+    assert( pok_map_open(classic,dsrc) );
+    pok_data_source_free(dsrc);
+    classicOpen = (pok_timestep_clock() - t) / 1000000.0;
+    t = pok_timestep_clock();
+    indexed = pok_map_new();
+    if ( !pok_map_open_indexed(indexed,indexedFile) )
+        pok_error_fromstack(pok_error_fatal);
+    pok_map_focus(indexed,&indexed->originPos,NULL);
+    indexedOpen = (pok_timestep_clock() - t) / 1000000.0;
+    printf("open recursive format: %.3f ms\nopen indexed format: %.3f ms\n",classicOpen,indexedOpen);
+
+    /* check every chunk */
+    map_test_compare(map,classic,FALSE);
+    map_test_compare(map,indexed,TRUE);
+
+    /* the reopened indexed map can be saved again (its chunk planes are in the file view) */
+    dsrc = pok_data_source_new_file(classicFile,pok_filemode_create_always,pok_iomode_write);
+    assert(dsrc != NULL);
+    pok_data_source_buffering(dsrc,TRUE);
+    assert( pok_map_save_indexed(indexed,dsrc) && pok_data_source_flush(dsrc) );
+    pok_data_source_free(dsrc);
+    puts("all chunks matched");
+
+    pok_map_free(map);
+    pok_map_free(classic);
+    pok_map_free(indexed);
+    remove(classicFile);
+    remove(indexedFile);
+    return 0;
+}
+
+/* map_test2() - chunk lookup benchmark; compares the map's chunk index against the treemap
+   (keyed by heap-allocated positions) that it replaced on a map with a large number of chunks */
+
+#define MAP_TEST2_CHUNKS_ACROSS 128
+#define MAP_TEST2_CHUNKS_DOWN 128
+#define MAP_TEST2_LOOKUPS 4000000
+
+struct legacy_chunk_key
+{
+    struct pok_point pos;
+    struct pok_map_chunk* chunk;
+};
+
+int map_test2()
+{
+    int x, y;
+    uint32_t i;
+    uint64_t t;
+    uintptr_t check[2] = {0,0};
+    double legacyLookup, indexLookup;
+    struct pok_map* map;
+    struct treemap legacy;
+    struct pok_point* queries;
+    struct pok_size chunkSize = {POK_MIN_MAP_CHUNK_DIMENSION,POK_MIN_MAP_CHUNK_DIMENSION};
+    uint16_t tile = 1;
+
+    /* build the map (each chunk is inserted into the index) */
+    map = pok_map_new();
+    assert( pok_map_configure(map,&chunkSize,&tile,1) );
+    for (y = 0;y < MAP_TEST2_CHUNKS_DOWN;++y) {
+        for (x = 0;x < MAP_TEST2_CHUNKS_ACROSS;++x) {
+            struct pok_point adj;
+            if (x == 0 && y == 0)
+                continue;
+            adj.X = x == 0 ? 0 : x - 1;
+            adj.Y = x == 0 ? y - 1 : y;
+            assert( pok_map_add_chunk(map,&adj,x == 0 ? pok_direction_down : pok_direction_right,&tile,1) != NULL );
+        }
+    }
+
+    /* build the treemap */
+    treemap_init(&legacy,(key_comparator)pok_point_compar,free);
+    for (y = 0;y < MAP_TEST2_CHUNKS_DOWN;++y) {
+        for (x = 0;x < MAP_TEST2_CHUNKS_ACROSS;++x) {
+            struct legacy_chunk_key* key = malloc(sizeof(struct legacy_chunk_key));
+            key->pos.X = x;
+            key->pos.Y = y;
+            key->chunk = pok_map_get_chunk(map,&key->pos);
+            assert(treemap_insert(&legacy,key) == 0);
+        }
+    }
+
+    /* random lookups; about 1 in 8 misses the map */
+    queries = malloc(sizeof(struct pok_point) * MAP_TEST2_LOOKUPS);
+    for (i = 0;i < MAP_TEST2_LOOKUPS;++i) {
+        queries[i].X = (int32_t)(map_test_rand() % (MAP_TEST2_CHUNKS_ACROSS + MAP_TEST2_CHUNKS_ACROSS/8)) - MAP_TEST2_CHUNKS_ACROSS/16;
+        queries[i].Y = (int32_t)(map_test_rand() % MAP_TEST2_CHUNKS_DOWN);
+    }
+    t = pok_timestep_clock();
+    for (i = 0;i < MAP_TEST2_LOOKUPS;++i) {
+        struct legacy_chunk_key* key = treemap_lookup(&legacy,queries + i);
+        check[0] += key != NULL ? (uintptr_t)key->chunk : 1;
+    }
+    legacyLookup = (pok_timestep_clock() - t) / (double)MAP_TEST2_LOOKUPS;
+    t = pok_timestep_clock();
+    for (i = 0;i < MAP_TEST2_LOOKUPS;++i) {
+        struct pok_map_chunk* chunk = pok_map_get_chunk(map,queries + i);
+        check[1] += chunk != NULL ? (uintptr_t)chunk : 1;
+    }
+    indexLookup = (pok_timestep_clock() - t) / (double)MAP_TEST2_LOOKUPS;
+    assert(check[0] == check[1]);
+
+    printf("%d chunks, %d lookups\n",MAP_TEST2_CHUNKS_ACROSS * MAP_TEST2_CHUNKS_DOWN,MAP_TEST2_LOOKUPS);
+    printf("treemap: %.1f ns/lookup\nindex: %.1f ns/lookup\n",legacyLookup,indexLookup);
+
+    /* removing chunks keeps the remaining chunks reachable */
+    for (x = 1;x < MAP_TEST2_CHUNKS_ACROSS;x += 2) {
+        struct pok_point pos = {x,x % MAP_TEST2_CHUNKS_DOWN};
+        assert( pok_map_remove_chunk(map,&pos) );
+        assert(pok_map_get_chunk(map,&pos) == NULL);
+    }
+    for (y = 0;y < MAP_TEST2_CHUNKS_DOWN;++y) {
+        for (x = 0;x < MAP_TEST2_CHUNKS_ACROSS;++x) {
+            struct pok_point pos = {x,y};
+            assert((pok_map_get_chunk(map,&pos) != NULL) == !(x % 2 == 1 && y == x % MAP_TEST2_CHUNKS_DOWN));
+        }
+    }
+
+    free(queries);
+    treemap_delete(&legacy);
+    pok_map_free(map);
+    return 0;
+}
+
+/* map_test3() - chunk residency; walks a render context across a map that is over its chunk
+   budget and checks that the number of loaded chunks stays bounded, that the chunks around the
+   context are always loaded and linked and that evicted chunks come back unchanged; this is done
+   for a map opened from an indexed map file and for a dynamic map whose evicted chunks are
+   requested again through the map's request callback; the file-backed walk is done with and
+   without chunk prefetching to compare how many chunks had to be loaded when they were needed */
+
+#define MAP_TEST3_BUDGET_CHUNKS 40
+#define MAP_TEST3_PINNED_CHUNKS ((POK_MAP_FOCUS_RADIUS*2+1) * (POK_MAP_FOCUS_RADIUS*2+1) + 1)
+
+static int map_test3_requests = 0;
+
+static void map_test3_request(struct pok_map* map,const struct pok_point* pos,void* context)
+{
+    /* restore the chunk from the reference map */
+    struct pok_point adj;
+    const struct pok_map_chunk* ref;
+    ref = pok_map_get_chunk((struct pok_map*)context,pos);
+    assert(ref != NULL);
+    adj.X = pos->X - 1;
+    adj.Y = pos->Y;
+    assert( pok_map_add_chunk(map,&adj,pok_direction_right,ref->tiles,
+            (uint32_t)map->chunkSize.columns * map->chunkSize.rows) != NULL );
+    ++map_test3_requests;
+}
+
+static void map_test3_check(struct pok_map* expected,struct pok_map_render_context* context)
+{
+    int i, j, dir;
+    uint32_t k;
+    size_t ntiles = (size_t)expected->chunkSize.columns * expected->chunkSize.rows;
+    const struct pok_map* map = context->map;
+    assert(map->loadedChunks.count <= MAP_TEST3_BUDGET_CHUNKS + MAP_TEST3_PINNED_CHUNKS);
+    /* the context's chunks match the reference map */
+    for (i = 0;i < 3;++i) {
+        for (j = 0;j < 3;++j) {
+            struct pok_point pos;
+            const struct pok_map_chunk* ref;
+            pos.X = context->chunkpos.X + i - context->focus[0];
+            pos.Y = context->chunkpos.Y + j - context->focus[1];
+            ref = pok_map_get_chunk(expected,&pos);
+            assert((ref == NULL) == (context->viewingChunks[i][j] == NULL));
+            if (ref != NULL)
+                assert(memcmp(ref->tiles,context->viewingChunks[i][j]->tiles,ntiles * sizeof(uint16_t)) == 0);
+        }
+    }
+    /* every loaded chunk is linked to loaded chunks only */
+    for (k = 0;map->loadedChunks.entries != NULL && k <= map->loadedChunks.mask;++k) {
+        const struct pok_map_chunk_index_entry* entry = map->loadedChunks.entries + k;
+        if (entry->chunk == NULL)
+            continue;
+        for (dir = pok_direction_up;dir <= pok_direction_right;++dir) {
+            const struct pok_map_chunk* adj = entry->chunk->adjacent[dir];
+            if (adj != NULL) {
+                uint32_t l;
+                struct pok_point pos = entry->pos;
+                pok_direction_add_to_point(dir,&pos);
+                assert(adj->adjacent[pok_direction_opposite(dir)] == entry->chunk);
+                for (l = 0;l <= map->loadedChunks.mask;++l)
+                    if (map->loadedChunks.entries[l].chunk == adj)
+                        break;
+                assert(l <= map->loadedChunks.mask && pok_point_compar(&map->loadedChunks.entries[l].pos,&pos) == 0);
+            }
+        }
+    }
+}
+
+static struct pok_map_prefetch_stats map_test3_walk(struct pok_map* expected,struct pok_map* map,uint16_t prefetch)
+{
+    /* walk tile by tile along every fourth row of chunks (each pass moves in the opposite
+       direction from the last) and then back up the first column of chunks */
+    int x, y;
+    struct pok_map_prefetch_stats stats;
+    struct pok_map_render_context* context;
+    context = pok_map_render_context_new(NULL);
+    context->prefetchChunks = prefetch;
+    pok_map_render_context_set_map(context,map);
+    map_test3_check(expected,context);
+    for (y = 0;y < MAP_TEST_CHUNKS_DOWN;y += 4) {
+        enum pok_direction dir = (y / 4) % 2 == 0 ? pok_direction_right : pok_direction_left;
+        for (x = 0;x < (MAP_TEST_CHUNKS_ACROSS - 1) * MAP_TEST_CHUNK_DIMENSION;++x) {
+            assert( pok_map_render_context_move(context,dir,0,FALSE) );
+            if (x % MAP_TEST_CHUNK_DIMENSION == 0)
+                map_test3_check(expected,context);
+        }
+        for (x = 0;x < 4 * MAP_TEST_CHUNK_DIMENSION && y + 4 < MAP_TEST_CHUNKS_DOWN;++x)
+            assert( pok_map_render_context_move(context,pok_direction_down,0,FALSE) );
+    }
+    while ( pok_map_render_context_move(context,pok_direction_up,0,FALSE) )
+        ;
+    map_test3_check(expected,context);
+    stats = context->prefetchStats;
+    pok_map_render_context_free(context);
+    return stats;
+}
+
+int map_test3()
+{
+    size_t cost;
+    uint16_t tileid;
+    uint32_t revision;
+    struct pok_map_prefetch_stats stats[2];
+    char indexedFile[1024];
+    struct pok_point pos = {40,40};
+    struct pok_map* map, * indexed, * dynamic;
+    struct pok_map_chunk* chunk;
+    struct pok_data_source* dsrc;
+    uint32_t ntiles = MAP_TEST_CHUNK_DIMENSION * MAP_TEST_CHUNK_DIMENSION;
+
+    map = map_test_build();
+    snprintf(indexedFile,sizeof(indexedFile),"%s/pokgame-maptest.pkmi",TMPDIR);
+    dsrc = pok_data_source_new_file(indexedFile,pok_filemode_create_always,pok_iomode_write);
+    assert(dsrc != NULL);
+    pok_data_source_buffering(dsrc,TRUE);
+    assert( pok_map_save_indexed(map,dsrc) && pok_data_source_flush(dsrc) );
+    pok_data_source_free(dsrc);
+    cost = sizeof(struct pok_map_chunk) + ntiles * sizeof(uint16_t) + (ntiles + 7) / 8 * 2;
+
+    /* indexed map: evicted chunks are loaded again from the file; a change to a chunk's tiles
+       survives eviction */
+    indexed = pok_map_new();
+    if ( !pok_map_open_indexed(indexed,indexedFile) )
+        pok_error_fromstack(pok_error_fatal);
+    pok_map_set_budget(indexed,MAP_TEST3_BUDGET_CHUNKS * cost,NULL,NULL);
+    chunk = pok_map_get_chunk(indexed,&pos);
+    tileid = 399 - chunk->tiles[0];
+    revision = chunk->revision;
+    pok_map_chunk_set_tileid(chunk,0,0,tileid);
+    assert(chunk->revision != revision); /* the setters renew the revision */
+    pok_map_chunk_set_tileid(pok_map_get_chunk(map,&pos),0,0,tileid);
+    stats[0] = map_test3_walk(map,indexed,0);
+    printf("indexed map: %u chunks loaded after walk\n",indexed->loadedChunks.count);
+
+    /* walk again with chunks prefetched ahead of the context; only the chunks around the start
+       position and the chunks entered by turning should have to be loaded when they are needed */
+    stats[1] = map_test3_walk(map,indexed,3);
+    printf("without prefetching: %u hits, %u misses\nwith prefetching: %u hits, %u misses, %u chunks prefetched\n",
+        stats[0].hits,stats[0].misses,stats[1].hits,stats[1].misses,stats[1].requests);
+    assert(stats[1].misses * 4 < stats[0].misses);
+    map_test_compare(map,indexed,TRUE);
+
+    /* dynamic map: evicted chunks are requested from the reference map */
+    map_test_seed = 0x2545f491;
+    dynamic = map_test_build();
+    pok_map_chunk_set_tileid(pok_map_get_chunk(dynamic,&pos),0,0,tileid);
+    pok_map_set_budget(dynamic,MAP_TEST3_BUDGET_CHUNKS * cost,map_test3_request,map);
+    map_test3_walk(map,dynamic,1);
+    printf("dynamic map: %u chunks loaded after walk, %d chunks requested\n",dynamic->loadedChunks.count,map_test3_requests);
+    assert(map_test3_requests > 0);
+    map_test_compare(map,dynamic,FALSE);
+
+    /* once the request function is removed, evicted chunks are forgotten instead of requested */
+    pok_map_set_budget(dynamic,MAP_TEST3_BUDGET_CHUNKS * cost,map_test3_request,map);
+    assert(dynamic->residency.evicted.count > 0);
+    pok_map_set_budget(dynamic,0,NULL,NULL);
+    assert(dynamic->residency.evicted.count == 0);
+    for (pos.Y = 0;pos.Y < MAP_TEST_CHUNKS_DOWN;++pos.Y)
+        for (pos.X = 0;pos.X < MAP_TEST_CHUNKS_ACROSS;++pos.X)
+            pok_map_get_chunk(dynamic,&pos);
+
+    pok_map_free(map);
+    pok_map_free(indexed);
+    pok_map_free(dynamic);
+    remove(indexedFile);
+    return 0;
+}
+
+/* map_test4() - text map loading; loads a generated 4096x4096 tile map from the space-separated
+   and comma-separated formats and checks every tile; a few small files check the edges of the
+   grammar (negative and wrapped ids, CRLF line endings, a missing final newline and bad input) */
+
+#define MAP_TEST4_DIMENSION 4096
+
+static void map_test4_write(const char* file,const char* contents)
+{
+    FILE* f = fopen(file,"wb");
+    assert(f != NULL);
+    fputs(contents,f);
+    fclose(f);
+}
+
+static size_t map_test4_generate(const char* file,const uint16_t tiles[],uint32_t columns,uint32_t rows,char sep)
+{
+    uint32_t i, j;
+    size_t size;
+    FILE* f = fopen(file,"wb");
+    assert(f != NULL);
+    fprintf(f,"%u\n%u\n",columns,rows);
+    for (i = 0;i < rows;++i)
+        for (j = 0;j < columns;++j)
+            fprintf(f,j + 1 < columns ? "%u%c" : "%u\n",tiles[(size_t)i * columns + j],sep);
+    size = (size_t)ftell(f);
+    fclose(f);
+    return size;
+}
+
+static void map_test4_verify(struct pok_map* map,const uint16_t tiles[],uint32_t columns,uint32_t rows)
+{
+    /* find each tile using the same chunk layout as the loader */
+    uint32_t i, j;
+    struct pok_size chunkSize, lefttop, rightbottom;
+    pok_util_compute_chunk_size(columns,rows,POK_MAX_MAP_CHUNK_DIMENSION,&chunkSize,&lefttop,&rightbottom);
+    assert(chunkSize.columns == map->chunkSize.columns && chunkSize.rows == map->chunkSize.rows);
+    for (i = 0;i < rows;++i) {
+        for (j = 0;j < columns;++j) {
+            struct pok_point pos;
+            const struct pok_map_chunk* chunk;
+            uint32_t x = j + lefttop.columns, y = i + lefttop.rows;
+            pos.X = x / chunkSize.columns;
+            pos.Y = y / chunkSize.rows;
+            chunk = pok_map_get_chunk(map,&pos);
+            assert(chunk != NULL);
+            assert(chunk->tiles[y % chunkSize.rows * chunkSize.columns + x % chunkSize.columns] == tiles[(size_t)i * columns + j]);
+        }
+    }
+}
+
+int map_test4()
+{
+    int k;
+    size_t i, size;
+    uint64_t t;
+    char file[1024];
+    uint16_t* tiles;
+    struct pok_map* map;
+    uint16_t expected[] = {1,2,3,65535,5,1};
+
+    snprintf(file,sizeof(file),"%s/pokgame-maptest.txt",TMPDIR);
+
+    /* grammar edges */
+    map_test4_write(file,"3\n2\n1 2\t 3\n65535 5 65537");
+    map = pok_map_new();
+    assert( pok_map_fromfile_space(map,file) );
+    map_test4_verify(map,expected,3,2);
+    pok_map_free(map);
+    map_test4_write(file,"3\r\n2\r\n1, 2 ,3 \r\n-1,5,65537\r\n");
+    map = pok_map_new();
+    assert( pok_map_fromfile_csv(map,file) );
+    map_test4_verify(map,expected,3,2);
+    pok_map_free(map);
+    map_test4_write(file,"3\n2\n1 2 3\n-1 5 1 7 8\n");
+    map = pok_map_new();
+    assert( pok_map_fromfile_space(map,file) ); /* extra ids are ignored */
+    map_test4_verify(map,expected,3,2);
+    pok_map_free(map);
+    map_test4_write(file,"3\n2\n1,2,3,-1,5,1,7\n");
+    map = pok_map_new();
+    assert( !pok_map_fromfile_csv(map,file) && map->origin == NULL ); /* too many ids */
+    pok_exception_pop();
+    map_test4_write(file,"3\n2\n1,2,3\n4,x,6\n");
+    assert( !pok_map_fromfile_csv(map,file) && map->origin == NULL );
+    pok_exception_pop();
+    map_test4_write(file,"3\n2\n1,2,3\n4,5,\n");
+    assert( !pok_map_fromfile_csv(map,file) && map->origin == NULL );
+    pok_exception_pop();
+    pok_map_free(map);
+
+    /* large maps */
+    tiles = malloc(sizeof(uint16_t) * MAP_TEST4_DIMENSION * MAP_TEST4_DIMENSION);
+    assert(tiles != NULL);
+    for (i = 0;i < (size_t)MAP_TEST4_DIMENSION * MAP_TEST4_DIMENSION;++i)
+        tiles[i] = map_test_rand() % (i % 7 == 0 ? 65536 : 400);
+    for (k = 0;k < 2;++k) {
+        double elapsed;
+        size = map_test4_generate(file,tiles,MAP_TEST4_DIMENSION,MAP_TEST4_DIMENSION,k == 0 ? ' ' : ',');
+        map = pok_map_new();
+        t = pok_timestep_clock();
+        if ( !(k == 0 ? pok_map_fromfile_space(map,file) : pok_map_fromfile_csv(map,file)) )
+            pok_error_fromstack(pok_error_fatal);
+        elapsed = (pok_timestep_clock() - t) / 1000000.0;
+        printf("%s %dx%d (%.1f MB): %.1f ms, %.1f MB/s, %.2f ns/tile\n",k == 0 ? "space" : "csv",
+            MAP_TEST4_DIMENSION,MAP_TEST4_DIMENSION,size / 1e6,elapsed,size / 1e3 / elapsed,
+            elapsed * 1e6 / ((double)MAP_TEST4_DIMENSION * MAP_TEST4_DIMENSION));
+        map_test4_verify(map,tiles,MAP_TEST4_DIMENSION,MAP_TEST4_DIMENSION);
+        pok_map_free(map);
+    }
+
+    free(tiles);
+    remove(file);
+    return 0;
+}
+
+/* map_test5() - sends chunk update methods through a file and applies them to a chunk; every
+   update that changes the tile plane must renew the chunk's revision (this is what tells the
+   renderer that its baked layers for the chunk are stale) */
+
+static enum pok_network_result map_test5_recv(struct pok_map_chunk* chunk,struct pok_data_source* dsrc,
+    enum pok_map_chunk_method method)
+{
+    enum pok_network_result result;
+    struct pok_netobj_readinfo info;
+    pok_netobj_readinfo_init(&info);
+    result = pok_map_chunk_netmethod_recv(chunk,dsrc,&info,method);
+    pok_netobj_readinfo_delete(&info);
+    return result;
+}
+
+int map_test5()
+{
+    int i;
+    uint32_t revision;
+    char file[1024];
+    uint16_t tiles[12*10];
+    struct pok_map* map;
+    struct pok_map_chunk* chunk;
+    struct pok_data_source* dsrc;
+    struct pok_netobj_writeinfo winfo;
+    struct pok_netobj_upinfo uinfo;
+
+    snprintf(file,sizeof(file),"%s/pokgame-maptest.upd",TMPDIR);
+    for (i = 0;i < 12*10;++i)
+        tiles[i] = 1 + i % 5;
+    map = pok_map_new();
+    assert( pok_map_load_simple(map,tiles,12,10) );
+    chunk = map->origin;
+    assert( chunk->columns == 12 && chunk->rows == 10 );
+
+    /* a tile update, a region update and a region that is out of bounds */
+    dsrc = pok_data_source_new_file(file,pok_filemode_create_always,pok_iomode_write);
+    assert(dsrc != NULL);
+    pok_netobj_upinfo_init(&uinfo,pok_map_chunk_update_tile);
+    uinfo.methodParams.mapChunk.update_tile.tileID = 7;
+    uinfo.methodParams.mapChunk.update_tile.column = 11;
+    uinfo.methodParams.mapChunk.update_tile.row = 9;
+    pok_netobj_writeinfo_init(&winfo);
+    assert( pok_map_chunk_netmethod_send(chunk,dsrc,&winfo,&uinfo) == pok_net_completed );
+    pok_netobj_upinfo_init(&uinfo,pok_map_chunk_update_region);
+    uinfo.methodParams.mapChunk.update_region.tileID = 9;
+    uinfo.methodParams.mapChunk.update_region.top = 2;
+    uinfo.methodParams.mapChunk.update_region.bottom = 4;
+    uinfo.methodParams.mapChunk.update_region.left = 1;
+    uinfo.methodParams.mapChunk.update_region.right = 3;
+    pok_netobj_writeinfo_init(&winfo);
+    assert( pok_map_chunk_netmethod_send(chunk,dsrc,&winfo,&uinfo) == pok_net_completed );
+    uinfo.methodParams.mapChunk.update_region.bottom = 10;
+    pok_netobj_writeinfo_init(&winfo);
+    assert( pok_map_chunk_netmethod_send(chunk,dsrc,&winfo,&uinfo) == pok_net_completed );
+    pok_data_source_free(dsrc);
+
+    dsrc = pok_data_source_new_file(file,pok_filemode_open_existing,pok_iomode_read);
+    assert(dsrc != NULL);
+    revision = chunk->revision;
+    assert( map_test5_recv(chunk,dsrc,pok_map_chunk_update_tile) == pok_net_completed );
+    assert( pok_map_chunk_get_tileid(chunk,11,9) == 7 && chunk->revision != revision );
+    revision = chunk->revision;
+    assert( map_test5_recv(chunk,dsrc,pok_map_chunk_update_region) == pok_net_completed );
+    assert( chunk->revision != revision );
+    for (i = 0;i < 12*10;++i) {
+        uint16_t c = i % 12, r = i / 12;
+        uint16_t id = (c == 11 && r == 9) ? 7 : ((c >= 1 && c <= 3 && r >= 2 && r <= 4) ? 9 : tiles[i]);
+        assert( pok_map_chunk_get_tileid(chunk,c,r) == id );
+    }
+    revision = chunk->revision;
+    assert( map_test5_recv(chunk,dsrc,pok_map_chunk_update_region) == pok_net_failed_protocol );
+    assert( chunk->revision == revision && pok_map_chunk_get_tileid(chunk,1,5) == tiles[5*12+1] );
+    pok_exception_pop();
+    pok_data_source_free(dsrc);
+
+    /* revisions are unique among chunks */
+    pok_map_free(map);
+    map = pok_map_new();
+    assert( pok_map_load_simple(map,tiles,12,10) );
+    assert( map->origin->revision != revision );
+    pok_map_free(map);
+    remove(file);
+    printf("chunk update methods: ok\n");
+    return 0;
+}
+
+static uint16_t map_test6_terrain(const struct pok_tile_manager* tman,uint16_t tileid)
+{
+    /* compute a terrain mask the slow way by scanning each terrain list */
+    uint16_t i, j, mask = 0;
+    for (i = 0;i < POK_TILE_TERRAIN_TOP;++i)
+        for (j = 0;j < tman->terrain[i].length;++j)
+            if (tman->terrain[i].list[j] == tileid)
+                mask |= POK_TILE_TERRAIN_BIT(i);
+    return mask;
+}
+int map_test6()
+{
+    int i, j;
+    byte_t* data;
+    uint16_t tiles[12*10];
+    uint16_t lists[POK_TILE_TERRAIN_TOP][8];
+    struct pok_map* map;
+    struct pok_graphics_subsystem* sys;
+    struct pok_tile_manager* tman;
+
+    sys = pok_graphics_subsystem_new();
+    pok_graphics_subsystem_default(sys);
+    data = calloc(40 * sys->dimension * sys->dimension,3);
+    assert(data != NULL);
+    tman = pok_tile_manager_new(sys);
+    assert( pok_tile_manager_load_tiles(tman,40,1,data,TRUE) );
+
+    /* terrain lists overlap and include ids that are not valid tiles */
+    tman->flags |= pok_tile_manager_flag_terrain_byref;
+    for (i = 0;i < POK_TILE_TERRAIN_TOP;++i) {
+        tman->terrain[i].length = 1 + map_test_rand() % 8;
+        tman->terrain[i].list = lists[i];
+        for (j = 0;j < tman->terrain[i].length;++j)
+            lists[i][j] = map_test_rand() % 48;
+    }
+    assert( pok_tile_manager_get_terrain(tman,3) == 0 );
+    assert( pok_tile_manager_build_terrain(tman) );
+    for (i = 0;i < 0x10000;++i)
+        assert( pok_tile_manager_get_terrain(tman,i) == (i < tman->tilecnt ? map_test6_terrain(tman,i) : 0) );
+    for (i = 0;i < POK_TILE_TERRAIN_TOP;++i)
+        assert( pok_tile_manager_is_terrain(tman,lists[i][0],i) == (lists[i][0] < tman->tilecnt) );
+
+    /* scan the rows of a chunk for ledges */
+    for (i = 0;i < 12*10;++i)
+        tiles[i] = map_test_rand() % tman->tilecnt;
+    map = pok_map_new();
+    assert( pok_map_load_simple(map,tiles,12,10) );
+    for (i = 0;i < 10;++i) {
+        size_t k, first = 12;
+        for (k = 0;k < 12;++k) {
+            if (map_test6_terrain(tman,pok_map_chunk_get_tileid(map->origin,k,i)) & POK_TILE_TERRAIN_LEDGES) {
+                first = k;
+                break;
+            }
+        }
+        assert( pok_tile_manager_find_terrain(tman,map->origin->tiles + i*12,12,POK_TILE_TERRAIN_LEDGES) == first );
+    }
+    assert( pok_tile_manager_find_terrain(tman,tiles,12*10,0) == 12*10 );
+
+    pok_map_free(map);
+    pok_tile_manager_free(tman);
+    pok_graphics_subsystem_free(sys);
+    free(data);
+    printf("terrain table: ok\n");
+    return 0;
+}
@@ -1,6 +1,12 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <assert.h>
 #include "net.h"
+#include "image.h"
+#include "gamelock.h"
+#include "config.h"
+#include "standard1.h"
 #include "error.h"
 
 extern const char* TMPDIR;
@@ -61,3 +67,490 @@ int net_test1()
     }
     return 0;
 }
+
+/* net_test2() - measure the throughput of 'pok_image_netread' over a local pipe; a second thread
+   writes a series of images to the pipe while this thread reads them and checks their pixels */
+
+#define NET_TEST_IMAGE_WIDTH 1024
+#define NET_TEST_IMAGE_HEIGHT 1024
+#define NET_TEST_IMAGE_COUNT 64
+
+static int net_test2_writer(struct pok_data_source* dsrc)
+{
+    int i;
+    size_t j, written;
+    size_t total = NET_TEST_IMAGE_WIDTH * NET_TEST_IMAGE_HEIGHT * sizeof(union alpha_pixel);
+    byte_t* pixels = malloc(total);
+    if (pixels == NULL)
+        return 1;
+    for (j = 0;j < total;++j)
+        pixels[j] = (byte_t)(j * 31);
+    for (i = 0;i < NET_TEST_IMAGE_COUNT;++i) {
+        /* the first byte numbers the image */
+        pixels[0] = (byte_t)i;
+        if (!pok_data_stream_write_byte(dsrc,1) || !pok_data_stream_write_uint32(dsrc,NET_TEST_IMAGE_WIDTH)
+            || !pok_data_stream_write_uint32(dsrc,NET_TEST_IMAGE_HEIGHT))
+            break;
+        for (j = 0;j < total;j += written)
+            if (!pok_data_source_write(dsrc,pixels + j,total - j,&written))
+                break;
+        if (j < total)
+            break;
+    }
+    if (i == NET_TEST_IMAGE_COUNT && !pok_data_source_flush(dsrc))
+        i = 0;
+    free(pixels);
+    return i < NET_TEST_IMAGE_COUNT;
+}
+
+int net_test2()
+{
+    int i;
+    uint64_t elapsed = 0;
+    size_t total = NET_TEST_IMAGE_WIDTH * NET_TEST_IMAGE_HEIGHT * sizeof(union alpha_pixel);
+    struct pok_thread* writer;
+    struct pok_data_source* pipe;
+
+    pipe = pok_data_source_new_local_anon();
+    if (pipe == NULL) {
+        printf("failed to create local pipe\n");
+        pok_exception_pop();
+        return 1;
+    }
+    writer = pok_thread_new((pok_thread_entry)net_test2_writer,pipe);
+    pok_thread_start(writer);
+
+    for (i = 0;i < NET_TEST_IMAGE_COUNT;++i) {
+        size_t j;
+        const byte_t* pixels;
+        uint64_t start;
+        enum pok_network_result result;
+        struct pok_netobj_readinfo info;
+        struct pok_image* img = pok_image_new();
+        pok_netobj_readinfo_init(&info);
+        start = pok_timestep_clock();
+        do {
+            result = pok_image_netread(img,pipe,&info);
+        } while (result == pok_net_incomplete);
+        elapsed += pok_timestep_clock() - start;
+        if (result != pok_net_completed) {
+            printf("failed to read image %d\n",i);
+            pok_exception_pop();
+            return 1;
+        }
+        assert(img->width == NET_TEST_IMAGE_WIDTH && img->height == NET_TEST_IMAGE_HEIGHT);
+        assert(img->flags & pok_image_flag_alpha);
+        pixels = img->pixels.data;
+        assert(pixels[0] == (byte_t)i);
+        for (j = 1;j < total;++j)
+            assert(pixels[j] == (byte_t)(j * 31));
+        pok_netobj_readinfo_delete(&info);
+        pok_image_free(img);
+    }
+
+    assert(pok_thread_join(writer) == 0);
+    pok_thread_free(writer);
+    pok_data_source_free(pipe);
+    printf("image transfer: %d images (%u bytes each) in %.1f ms: %.1f MB/s\n",NET_TEST_IMAGE_COUNT,(unsigned)total,
+        elapsed / 1e6,(double)total * NET_TEST_IMAGE_COUNT / (1 << 20) / (elapsed / 1e9));
+    return 0;
+}
+
+/* net_test3() - check the data source's buffering with a stream of mixed records sent over a local
+   pipe: small fields straddle the end of the input buffer, strings are read a byte at a time and
+   every so often a record carries a blob larger than the initial buffers; the data source's
+   counters are printed at the end */
+
+#define NET_TEST_RECORD_COUNT 20000
+#define NET_TEST_BLOB_SIZE 20000
+
+static byte_t net_test3_blob[NET_TEST_BLOB_SIZE + 64];
+
+static int net_test3_writer(struct pok_data_source* dsrc)
+{
+    int i;
+    char name[32];
+    for (i = 0;i < NET_TEST_RECORD_COUNT;++i) {
+        sprintf(name,"record %d",i);
+        if (!pok_data_stream_write_uint32(dsrc,i) || !pok_data_stream_write_uint16(dsrc,(uint16_t)(i * 7))
+            || !pok_data_stream_write_string(dsrc,name) || !pok_data_stream_write_byte(dsrc,0)
+            || !pok_data_stream_write_uint64(dsrc,(uint64_t)i << 33))
+            return 1;
+        if (i % 100 == 0) {
+            size_t size = NET_TEST_BLOB_SIZE + i % 64, written;
+            if (!pok_data_source_write(dsrc,net_test3_blob,size,&written))
+                return 1;
+            if (written < size && !pok_data_source_save(dsrc,net_test3_blob + written,size - written))
+                return 1;
+        }
+    }
+    return !pok_data_source_flush(dsrc);
+}
+
+static bool_t net_test3_retry(bool_t result)
+{
+    /* a field that has only partially arrived is read again */
+    const struct pok_exception* ex;
+    if (result)
+        return FALSE;
+    ex = pok_exception_peek();
+    assert(ex != NULL && ex->kind == pok_ex_net && ex->id == pok_ex_net_pending);
+    pok_exception_pop();
+    return TRUE;
+}
+
+static int net_test3_stream(bool_t compressed)
+{
+    int i;
+    size_t j;
+    struct pok_thread* writer;
+    struct pok_data_source* pipe;
+    struct pok_data_source_stats stats;
+    struct pok_string name;
+
+    for (j = 0;j < sizeof(net_test3_blob);++j)
+        net_test3_blob[j] = (byte_t)(j * 13 + 5);
+    pipe = pok_data_source_new_local_anon();
+    if (pipe == NULL) {
+        printf("failed to create local pipe\n");
+        pok_exception_pop();
+        return 1;
+    }
+    /* the pipe's two ends belong to the same data source so both directions are compressed */
+    if (compressed && !pok_data_source_compress(pipe,pok_iomode_full_duplex,POK_COMPRESSION_DEFAULT)) {
+        printf("failed to compress local pipe: %s\n",pok_exception_pop()->message);
+        pok_data_source_free(pipe);
+        return 1;
+    }
+    writer = pok_thread_new((pok_thread_entry)net_test3_writer,pipe);
+    pok_thread_start(writer);
+
+    pok_string_init(&name);
+    for (i = 0;i < NET_TEST_RECORD_COUNT;++i) {
+        char expect[32];
+        uint16_t u16;
+        uint32_t u32;
+        uint64_t u64;
+        while ( net_test3_retry(pok_data_stream_read_uint32(pipe,&u32)) )
+            ;
+        assert(u32 == (uint32_t)i);
+        while ( net_test3_retry(pok_data_stream_read_uint16(pipe,&u16)) )
+            ;
+        assert(u16 == (uint16_t)(i * 7));
+        /* peek at the string's first bytes before reading it a byte at a time */
+        assert(pok_data_source_peek(pipe) == 'r');
+        assert(pok_data_source_peek_ex(pipe,6) == ' ');
+        pok_string_clear(&name);
+        while (TRUE) {
+            char c = pok_data_source_pop(pipe);
+            assert(c != (char) -1);
+            if (c == 0)
+                break;
+            pok_string_concat_char(&name,c);
+        }
+        sprintf(expect,"record %d",i);
+        assert(strcmp(name.buf,expect) == 0);
+        while ( net_test3_retry(pok_data_stream_read_uint64(pipe,&u64)) )
+            ;
+        assert(u64 == (uint64_t)i << 33);
+        if (i % 100 == 0) {
+            /* the whole blob must be returned by a single read once it has arrived */
+            byte_t* data;
+            size_t size = NET_TEST_BLOB_SIZE + i % 64, bytesRead;
+            while (TRUE) {
+                data = pok_data_source_read(pipe,size,&bytesRead);
+                assert(data != NULL && bytesRead > 0);
+                if (bytesRead == size)
+                    break;
+                pok_data_source_unread(pipe,bytesRead);
+            }
+            assert(memcmp(data,net_test3_blob,size) == 0);
+        }
+    }
+    pok_string_delete(&name);
+
+    assert(pok_thread_join(writer) == 0);
+    pok_thread_free(writer);
+    pok_data_source_getstats(pipe,&stats);
+    /* the marker that ends the last compressed message may not have been read */
+    assert(compressed ? stats.bytesIn <= stats.bytesOut : stats.bytesIn == stats.bytesOut);
+    assert(stats.resizes > 0);
+    assert(stats.inflated == stats.deflated);
+    printf("%s: %u records, %.1f KB in %u reads and %u writes, %u compactions, %u resizes\n",
+        compressed ? "compressed data source" : "data source",NET_TEST_RECORD_COUNT,stats.bytesIn / 1024.0,
+        (unsigned)stats.readCalls,(unsigned)stats.writeCalls,(unsigned)stats.compactions,(unsigned)stats.resizes);
+    if (compressed)
+        printf("  %.1f KB before compression\n",stats.deflated / 1024.0);
+    pok_data_source_free(pipe);
+    return 0;
+}
+
+int net_test3()
+{
+    return net_test3_stream(FALSE);
+}
+
+/* net_test4() - check the IO poller: a thread writes single bytes to a pipe at intervals and the
+   time between each write and the poller reporting input is measured; then the timer and
+   wakeups (including one that arrives while the waiter is not interested) are checked */
+
+#define NET_TEST_PINGS 200
+
+static volatile uint64_t net_test4_stamp;
+
+static int net_test4_writer(struct pok_data_source* dsrc)
+{
+    int i;
+    struct pok_timeout_interval interval;
+    pok_timeout_interval_reset(&interval,1);
+    for (i = 0;i < NET_TEST_PINGS;++i) {
+        pok_timeout(&interval);
+        net_test4_stamp = pok_timestep_clock();
+        if (!pok_data_stream_write_byte(dsrc,(byte_t)i) || !pok_data_source_flush(dsrc))
+            return 1;
+    }
+    return 0;
+}
+
+static int net_test4_waker(struct pok_io_poller* poller)
+{
+    struct pok_timeout_interval interval;
+    pok_timeout_interval_reset(&interval,20);
+    pok_timeout(&interval);
+    pok_io_poller_wakeup(poller);
+    return 0;
+}
+
+int net_test4()
+{
+    int i;
+    uint64_t start, latency = 0, worst = 0;
+    struct pok_thread* thread;
+    struct pok_data_source* pipe;
+    struct pok_io_poller* poller;
+
+    pipe = pok_data_source_new_local_anon();
+    if (pipe == NULL) {
+        printf("failed to create local pipe\n");
+        pok_exception_pop();
+        return 1;
+    }
+    poller = pok_io_poller_new(pipe);
+    if (poller == NULL) {
+        printf("failed to create poller\n");
+        pok_exception_pop();
+        pok_data_source_free(pipe);
+        return 1;
+    }
+
+    /* input readiness */
+    thread = pok_thread_new((pok_thread_entry)net_test4_writer,pipe);
+    pok_thread_start(thread);
+    pok_io_poller_set_timer(poller,1000);
+    for (i = 0;i < NET_TEST_PINGS;++i) {
+        byte_t b;
+        uint64_t t;
+        assert(pok_io_poller_wait(poller,pok_io_event_read) == pok_io_event_read);
+        t = pok_timestep_clock() - net_test4_stamp;
+        latency += t;
+        if (t > worst)
+            worst = t;
+        assert(pok_data_stream_read_byte(pipe,&b) && b == (byte_t)i);
+    }
+    assert(pok_thread_join(thread) == 0);
+    pok_thread_free(thread);
+
+    /* the timer expires when nothing arrives */
+    start = pok_timestep_clock();
+    pok_io_poller_set_timer(poller,50);
+    assert(pok_io_poller_wait(poller,pok_io_event_read) == pok_io_event_timer);
+    assert(pok_timestep_clock() - start >= 45000000);
+
+    /* a wakeup from another thread */
+    thread = pok_thread_new((pok_thread_entry)net_test4_waker,poller);
+    pok_thread_start(thread);
+    pok_io_poller_set_timer(poller,1000);
+    assert(pok_io_poller_wait(poller,pok_io_event_read | pok_io_event_wakeup) == pok_io_event_wakeup);
+    pok_thread_join(thread);
+    pok_thread_free(thread);
+
+    /* a wakeup that arrives while waiting for something else is reported later */
+    pok_io_poller_wakeup(poller);
+    pok_io_poller_set_timer(poller,20);
+    assert(pok_io_poller_wait(poller,pok_io_event_read) == pok_io_event_timer);
+    assert(pok_io_poller_wait(poller,pok_io_event_wakeup) == pok_io_event_wakeup);
+
+    pok_io_poller_free(poller);
+    pok_data_source_free(pipe);
+    printf("io poller: %d wakeups on input: %.1f us average latency, %.1f us worst\n",NET_TEST_PINGS,
+        latency / 1e3 / NET_TEST_PINGS,worst / 1e3);
+    return 0;
+}
+
+/* net_test5() - check and measure stream compression: the record stream from net_test3 is sent over a
+   compressed pipe; then the default assets (the standard tileset and spriteset images and the default
+   map chunk tiled over a map) are written to a file as separately flushed messages and read back
+   with their 'netread' functions, once for each compression level, and the bytes on the wire and
+   the time spent on each side are reported; last, corrupt input must be detected */
+
+#define NET_TEST_MAP_CHUNKS 64
+#define NET_TEST_LEVELS 4
+
+static struct pok_image* net_test5_asset(const char* file,uint32_t width,uint32_t height,bool_t* standIn)
+{
+    /* load an image from the install directory; if it is missing then a stand-in with a similar
+       makeup is generated: 32x32 tiles that each use a few colors in runs */
+    uint32_t x, y;
+    uint32_t seed = 0x9e3779b9;
+    struct pok_image* img;
+    struct pok_string* path = pok_get_install_root_path();
+    pok_string_concat(path,POKGAME_DEFAULT_DIRECTORY);
+    pok_string_concat(path,file);
+    img = pok_image_png_new(path->buf);
+    pok_string_free(path);
+    if (img != NULL)
+        return img;
+    pok_exception_pop();
+    *standIn = TRUE;
+    img = pok_image_new_rgba_fill(width,height,(union alpha_pixel){ .value = 0 });
+    assert(img != NULL);
+    for (y = 0;y < height;++y) {
+        byte_t run = 0;
+        for (x = 0;x < width;++x) {
+            union alpha_pixel* p = img->pixels.dataRGBA + y * width + x;
+            uint32_t tile = (y / 32) * (width / 32) + x / 32;
+            if (run == 0) {
+                seed ^= seed << 13;
+                seed ^= seed >> 17;
+                seed ^= seed << 5;
+                run = 1 + seed % 8;
+            }
+            --run;
+            p->rgba[0] = (byte_t)(tile * 37 + (seed & 3) * 40);
+            p->rgba[1] = (byte_t)(tile * 11 + (seed & 3) * 40);
+            p->rgba[2] = (byte_t)(tile * 5 + (seed & 3) * 40);
+            p->rgba[3] = (seed & 15) == 0 ? 0 : 255;
+        }
+    }
+    return img;
+}
+static bool_t net_test5_write_image(struct pok_data_source* dsrc,const struct pok_image* img)
+{
+    /* send an image in the format read by 'pok_image_netread' */
+    size_t written, total = ((img->flags & pok_image_flag_alpha) ? sizeof(union alpha_pixel) : sizeof(union pixel))
+        * img->width * img->height;
+    return pok_data_stream_write_byte(dsrc,(img->flags & pok_image_flag_alpha) != 0)
+        && pok_data_stream_write_uint32(dsrc,img->width) && pok_data_stream_write_uint32(dsrc,img->height)
+        && pok_data_source_write(dsrc,img->pixels.data,total,&written)
+        && (written == total || pok_data_source_save(dsrc,(const byte_t*)img->pixels.data + written,total - written))
+        && pok_data_source_flush(dsrc);
+}
+static void net_test5_read_image(struct pok_data_source* dsrc,const struct pok_image* expect)
+{
+    size_t total = ((expect->flags & pok_image_flag_alpha) ? sizeof(union alpha_pixel) : sizeof(union pixel))
+        * expect->width * expect->height;
+    struct pok_netobj_readinfo info;
+    struct pok_image* img = pok_image_new();
+    pok_netobj_readinfo_init(&info);
+    assert(pok_image_netread(img,dsrc,&info) == pok_net_completed);
+    assert(img->width == expect->width && img->height == expect->height && img->flags == (expect->flags & pok_image_flag_alpha));
+    assert(memcmp(img->pixels.data,expect->pixels.data,total) == 0);
+    pok_netobj_readinfo_delete(&info);
+    pok_image_free(img);
+}
+
+int net_test5()
+{
+    int i;
+    uint32_t k;
+    char fname[256];
+    bool_t standIn = FALSE;
+    size_t chunkTiles = DEFAULT_MAP_CHUNK_SIZE.columns * DEFAULT_MAP_CHUNK_SIZE.rows;
+    static const int levels[NET_TEST_LEVELS] = { -2, 1, POK_COMPRESSION_DEFAULT, 9 };
+    struct pok_image* tileset;
+    struct pok_image* spriteset;
+    struct pok_data_source* dsrc;
+
+    if (net_test3_stream(TRUE) != 0)
+        return 1;
+
+    tileset = net_test5_asset(POKGAME_STS_IMAGE,256,2048,&standIn);
+    spriteset = net_test5_asset(POKGAME_SSS_IMAGE,384,1024,&standIn);
+    sprintf(fname,"%s/pokgame-zstream",TMPDIR);
+    printf("stream compression: %s assets: tileset %ux%u, spriteset %ux%u, %d map chunks\n",
+        standIn ? "stand-in" : "default",tileset->width,tileset->height,spriteset->width,spriteset->height,NET_TEST_MAP_CHUNKS);
+    for (i = 0;i < NET_TEST_LEVELS;++i) {
+        uint64_t start, writeTime, readTime;
+        struct pok_data_source_stats wstats, rstats;
+
+        /* write each asset as a separate message (the map a chunk at a time) */
+        dsrc = pok_data_source_new_file(fname,pok_filemode_create_always,pok_iomode_write);
+        assert(dsrc != NULL);
+        start = pok_timestep_clock();
+        if (levels[i] >= POK_COMPRESSION_DEFAULT)
+            assert( pok_data_source_compress(dsrc,pok_iomode_write,levels[i]) );
+        assert( net_test5_write_image(dsrc,tileset) && net_test5_write_image(dsrc,spriteset) );
+        for (k = 0;k < NET_TEST_MAP_CHUNKS;++k) {
+            size_t t;
+            for (t = 0;t < chunkTiles;++t)
+                assert( pok_data_stream_write_uint16(dsrc,DEFAULT_MAP_CHUNK[t]) );
+            assert( pok_data_source_flush(dsrc) );
+        }
+        pok_data_source_getstats(dsrc,&wstats);
+        pok_data_source_free(dsrc);
+        writeTime = pok_timestep_clock() - start;
+
+        /* read them back */
+        dsrc = pok_data_source_new_file(fname,pok_filemode_open_existing,pok_iomode_read);
+        assert(dsrc != NULL);
+        start = pok_timestep_clock();
+        if (levels[i] >= POK_COMPRESSION_DEFAULT)
+            assert( pok_data_source_compress(dsrc,pok_iomode_read,0) );
+        net_test5_read_image(dsrc,tileset);
+        net_test5_read_image(dsrc,spriteset);
+        for (k = 0;k < NET_TEST_MAP_CHUNKS;++k) {
+            size_t t;
+            for (t = 0;t < chunkTiles;++t) {
+                uint16_t tile;
+                assert( pok_data_stream_read_uint16(dsrc,&tile) && tile == DEFAULT_MAP_CHUNK[t] );
+            }
+        }
+        readTime = pok_timestep_clock() - start;
+        pok_data_source_getstats(dsrc,&rstats);
+        pok_data_source_free(dsrc);
+        assert(rstats.bytesIn == wstats.bytesOut);
+        if (levels[i] >= POK_COMPRESSION_DEFAULT)
+            assert(rstats.inflated == wstats.deflated);
+
+        if (levels[i] < POK_COMPRESSION_DEFAULT)
+            printf("  uncompressed:  %8.1f KB on the wire,            write %6.2f ms, read %6.2f ms\n",
+                wstats.bytesOut / 1024.0,writeTime / 1e6,readTime / 1e6);
+        else
+            printf("  level %2d:      %8.1f KB on the wire (%5.1f%%), write %6.2f ms, read %6.2f ms\n",levels[i],
+                wstats.bytesOut / 1024.0,100.0 * wstats.bytesOut / wstats.deflated,writeTime / 1e6,readTime / 1e6);
+    }
+    remove(fname);
+
+    /* a bad block type is detected */
+    {
+        size_t bytesRead;
+        byte_t garbage[64];
+        const struct pok_exception* ex;
+        memset(garbage,0xff,sizeof(garbage));
+        dsrc = pok_data_source_new_file(fname,pok_filemode_create_always,pok_iomode_write);
+        assert(dsrc != NULL);
+        assert( pok_data_source_write(dsrc,garbage,sizeof(garbage),&bytesRead) && pok_data_source_flush(dsrc) );
+        pok_data_source_free(dsrc);
+        dsrc = pok_data_source_new_file(fname,pok_filemode_open_existing,pok_iomode_read);
+        assert(dsrc != NULL && pok_data_source_compress(dsrc,pok_iomode_read,0));
+        assert(pok_data_source_read(dsrc,16,&bytesRead) == NULL);
+        ex = pok_exception_pop();
+        assert(ex != NULL && ex->kind == pok_ex_net && ex->id == pok_ex_net_corrupt_stream);
+        pok_data_source_free(dsrc);
+        remove(fname);
+    }
+
+    pok_image_free(tileset);
+    pok_image_free(spriteset);
+    return 0;
+}
@@ -0,0 +1,249 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "pathfind.h"
+#include "error.h"
+
+/* path_test1() - checks the pathfinder on a grid of chunks with random walls: every path is walked to
+   make sure it only crosses passable tiles and ends at the goal, and its length is compared against a
+   breadth-first search over the whole map; chunks are then edited (as if updated over the network)
+   to make sure stale abstract graphs are never used */
+
+#define PATH_TEST_CHUNK_DIMENSION 16
+#define PATH_TEST_CHUNKS_ACROSS 8
+#define PATH_TEST_CHUNKS_DOWN 6
+#define PATH_TEST_COLUMNS (PATH_TEST_CHUNK_DIMENSION * PATH_TEST_CHUNKS_ACROSS)
+#define PATH_TEST_ROWS (PATH_TEST_CHUNK_DIMENSION * PATH_TEST_CHUNKS_DOWN)
+#define PATH_TEST_QUERIES 300
+#define PATH_TEST_ROUNDS 4
+
+static uint32_t path_test_seed = 0x2545f491;
+static uint32_t path_test_rand()
+{
+    path_test_seed ^= path_test_seed << 13;
+    path_test_seed ^= path_test_seed >> 17;
+    path_test_seed ^= path_test_seed << 5;
+    return path_test_seed;
+}
+
+static uint16_t path_test_tile()
+{
+    /* tile 0 is impassable; about a quarter of the tiles are walls */
+    return path_test_rand() % 4 == 0 ? 0 : 1 + path_test_rand() % 8;
+}
+static bool_t path_test_passable(const struct pok_map* map,const struct pok_tile_manager* tman,int x,int y)
+{
+    struct pok_point pos;
+    const struct pok_map_chunk* chunk;
+    if (x < 0 || x >= PATH_TEST_COLUMNS || y < 0 || y >= PATH_TEST_ROWS)
+        return FALSE;
+    pos.X = x / PATH_TEST_CHUNK_DIMENSION;
+    pos.Y = y / PATH_TEST_CHUNK_DIMENSION;
+    chunk = pok_map_lookup_chunk(map,&pos);
+    return chunk != NULL && !pok_map_chunk_is_impassable(chunk,tman,x % PATH_TEST_CHUNK_DIMENSION,y % PATH_TEST_CHUNK_DIMENSION);
+}
+static uint32_t path_test_distance(const struct pok_map* map,const struct pok_tile_manager* tman,int sx,int sy,int gx,int gy)
+{
+    /* breadth-first search over the whole map; UINT32_MAX if the goal cannot be reached */
+    static uint32_t dist[PATH_TEST_COLUMNS * PATH_TEST_ROWS];
+    static uint32_t queue[PATH_TEST_COLUMNS * PATH_TEST_ROWS];
+    static const int dx[] = { 0, 0, -1, 1 }, dy[] = { -1, 1, 0, 0 };
+    uint32_t head = 0, tail = 0;
+    memset(dist,0xff,sizeof(dist));
+    dist[sy * PATH_TEST_COLUMNS + sx] = 0;
+    queue[tail++] = sy * PATH_TEST_COLUMNS + sx;
+    while (head < tail) {
+        int d;
+        uint32_t i = queue[head++];
+        int x = i % PATH_TEST_COLUMNS, y = i / PATH_TEST_COLUMNS;
+        if (x == gx && y == gy)
+            return dist[i];
+        for (d = 0;d < 4;++d) {
+            int nx = x + dx[d], ny = y + dy[d];
+            if (path_test_passable(map,tman,nx,ny) && dist[ny * PATH_TEST_COLUMNS + nx] == UINT32_MAX) {
+                dist[ny * PATH_TEST_COLUMNS + nx] = dist[i] + 1;
+                queue[tail++] = ny * PATH_TEST_COLUMNS + nx;
+            }
+        }
+    }
+    return UINT32_MAX;
+}
+static void path_test_query(struct pok_path_query* query,int* sx,int* sy,int* gx,int* gy)
+{
+    struct pok_point startChunk, goalChunk;
+    struct pok_location startTile, goalTile;
+    *sx = path_test_rand() % PATH_TEST_COLUMNS;
+    *sy = path_test_rand() % PATH_TEST_ROWS;
+    if (path_test_rand() % 4 == 0) {
+        /* a nearby goal (often in the same chunk) */
+        *gx = *sx + (int)(path_test_rand() % 17) - 8;
+        *gy = *sy + (int)(path_test_rand() % 17) - 8;
+        *gx = *gx < 0 ? 0 : (*gx >= PATH_TEST_COLUMNS ? PATH_TEST_COLUMNS - 1 : *gx);
+        *gy = *gy < 0 ? 0 : (*gy >= PATH_TEST_ROWS ? PATH_TEST_ROWS - 1 : *gy);
+    }
+    else {
+        *gx = path_test_rand() % PATH_TEST_COLUMNS;
+        *gy = path_test_rand() % PATH_TEST_ROWS;
+    }
+    startChunk.X = *sx / PATH_TEST_CHUNK_DIMENSION;
+    startChunk.Y = *sy / PATH_TEST_CHUNK_DIMENSION;
+    startTile.column = *sx % PATH_TEST_CHUNK_DIMENSION;
+    startTile.row = *sy % PATH_TEST_CHUNK_DIMENSION;
+    goalChunk.X = *gx / PATH_TEST_CHUNK_DIMENSION;
+    goalChunk.Y = *gy / PATH_TEST_CHUNK_DIMENSION;
+    goalTile.column = *gx % PATH_TEST_CHUNK_DIMENSION;
+    goalTile.row = *gy % PATH_TEST_CHUNK_DIMENSION;
+    pok_path_query_init(query,&startChunk,&startTile,&goalChunk,&goalTile);
+}
+static void path_test_walk(const struct pok_map* map,const struct pok_tile_manager* tman,const struct pok_path* path,
+    int x,int y,int gx,int gy)
+{
+    uint32_t i;
+    for (i = 0;i < path->length;++i) {
+        struct pok_point pos = { x, y };
+        assert(path->steps[i] <= pok_direction_right);
+        pok_direction_add_to_point(path->steps[i],&pos);
+        x = pos.X;
+        y = pos.Y;
+        assert( path_test_passable(map,tman,x,y) );
+    }
+    assert(x == gx && y == gy);
+}
+
+int path_test1()
+{
+    int x, y, round;
+    uint32_t i;
+    uint64_t optimal = 0, total = 0;
+    uint32_t found = 0, unreachable = 0;
+    uint16_t tiles[PATH_TEST_CHUNK_DIMENSION * PATH_TEST_CHUNK_DIMENSION];
+    struct pok_map* map;
+    struct pok_tile_manager tman;
+    struct pok_pathfinder* pathfinder;
+    struct pok_size chunkSize = {PATH_TEST_CHUNK_DIMENSION,PATH_TEST_CHUNK_DIMENSION};
+    static struct pok_path_query queries[PATH_TEST_QUERIES];
+    static int coords[PATH_TEST_QUERIES][4];
+
+    /* the pathfinder only needs the impassibility threshold from the tile manager */
+    memset(&tman,0,sizeof(struct pok_tile_manager));
+    tman.impassibility = 0;
+
+    map = pok_map_new();
+    assert(map != NULL);
+    for (y = 0;y < PATH_TEST_CHUNKS_DOWN;++y) {
+        for (x = 0;x < PATH_TEST_CHUNKS_ACROSS;++x) {
+            struct pok_point adj;
+            for (i = 0;i < PATH_TEST_CHUNK_DIMENSION * PATH_TEST_CHUNK_DIMENSION;++i)
+                tiles[i] = path_test_tile();
+            if (x == 0 && y == 0) {
+                assert( pok_map_configure(map,&chunkSize,tiles,PATH_TEST_CHUNK_DIMENSION * PATH_TEST_CHUNK_DIMENSION) );
+                continue;
+            }
+            adj.X = x == 0 ? 0 : x - 1;
+            adj.Y = x == 0 ? y - 1 : y;
+            assert( pok_map_add_chunk(map,&adj,x == 0 ? pok_direction_down : pok_direction_right,
+                    tiles,PATH_TEST_CHUNK_DIMENSION * PATH_TEST_CHUNK_DIMENSION) != NULL );
+        }
+    }
+
+    pathfinder = pok_pathfinder_new(map,&tman);
+    assert(pathfinder != NULL);
+    for (round = 0;round < PATH_TEST_ROUNDS;++round) {
+        uint32_t builds = pathfinder->builds;
+        size_t count = 0;
+        for (i = 0;i < PATH_TEST_QUERIES;++i)
+            path_test_query(queries + i,coords[i],coords[i]+1,coords[i]+2,coords[i]+3);
+        /* solve the batch with the abstract graphs that are cached from the previous round */
+        if (round > 0)
+            assert(pok_pathfinder_solve(pathfinder,queries,0) == 0);
+        count = pok_pathfinder_solve(pathfinder,queries,PATH_TEST_QUERIES);
+        for (i = 0;i < PATH_TEST_QUERIES;++i) {
+            int* c = coords[i];
+            uint32_t d = UINT32_MAX;
+            if (path_test_passable(map,&tman,c[0],c[1]) && path_test_passable(map,&tman,c[2],c[3]))
+                d = path_test_distance(map,&tman,c[0],c[1],c[2],c[3]);
+            if (d == UINT32_MAX)
+                assert(queries[i].status == pok_path_unreachable);
+            else {
+                assert(queries[i].status == pok_path_found);
+                assert(queries[i].path.length >= d);
+                path_test_walk(map,&tman,&queries[i].path,c[0],c[1],c[2],c[3]);
+                optimal += d;
+                total += queries[i].path.length;
+                ++found;
+                --count;
+            }
+            if (queries[i].status == pok_path_unreachable)
+                ++unreachable;
+            pok_path_query_delete(queries + i);
+        }
+        assert(count == 0);
+        if (round > 0)
+            assert(pathfinder->builds - builds < PATH_TEST_CHUNKS_ACROSS * PATH_TEST_CHUNKS_DOWN / 2);
+
+        /* edit a few chunks; their graphs and their neighbors' graphs must be rebuilt */
+        for (i = 0;i < 5;++i) {
+            uint32_t k;
+            struct pok_point pos;
+            struct pok_map_chunk* chunk;
+            pos.X = path_test_rand() % PATH_TEST_CHUNKS_ACROSS;
+            pos.Y = path_test_rand() % PATH_TEST_CHUNKS_DOWN;
+            chunk = pok_map_lookup_chunk(map,&pos);
+            assert(chunk != NULL);
+            for (k = 0;k < PATH_TEST_CHUNK_DIMENSION * PATH_TEST_CHUNK_DIMENSION;++k)
+                if (path_test_rand() % 3 == 0)
+                    chunk->tiles[k] = path_test_tile();
+            /* wall off a column on the chunk's left edge now and then */
+            if (i == 0)
+                for (k = 0;k < PATH_TEST_CHUNK_DIMENSION;++k)
+                    pok_map_chunk_set_tileid(chunk,0,k,0);
+            pok_map_chunk_revise(chunk);
+        }
+    }
+
+    /* a goal outside of the loaded chunks cannot be reached */
+    {
+        struct pok_path_query query;
+        struct pok_point startChunk = {0,0}, goalChunk = {PATH_TEST_CHUNKS_ACROSS,0};
+        struct pok_location tile = {0,0};
+        pok_path_query_init(&query,&startChunk,&tile,&goalChunk,&tile);
+        assert(pok_pathfinder_find(pathfinder,&query) == pok_path_unreachable);
+        pok_path_query_delete(&query);
+    }
+
+    /* explicit invalidation and reset release the cached graphs */
+    i = pathfinder->clusterCount;
+    assert(i > 0);
+    {
+        struct pok_point pos = {3,3};
+        pok_pathfinder_invalidate(pathfinder,&pos);
+        assert(pathfinder->clusterCount < i);
+    }
+    pok_pathfinder_reset(pathfinder);
+    assert(pathfinder->clusterCount == 0);
+
+    /* a change to the tile manager's impassibility flushes the cached graphs: the second round
+       makes tile 1 a wall, so a path through a stale graph would cross one */
+    for (round = 0;round < 2;++round) {
+        tman.impassibility = round;
+        for (i = 0;i < PATH_TEST_QUERIES;++i) {
+            int* c = coords[i];
+            path_test_query(queries + i,c,c+1,c+2,c+3);
+            if (pok_pathfinder_find(pathfinder,queries + i) == pok_path_found)
+                path_test_walk(map,&tman,&queries[i].path,c[0],c[1],c[2],c[3]);
+            else if (queries[i].status == pok_path_failed)
+                pok_exception_pop();
+            pok_path_query_delete(queries + i);
+        }
+    }
+    tman.impassibility = 0;
+    pok_pathfinder_set_tile_manager(pathfinder,&tman);
+    assert(pathfinder->clusterCount == 0);
+
+    pok_pathfinder_free(pathfinder);
+    pok_map_free(map);
+    printf("path: %u found, %u unreachable, %.3f of optimal length\n",found,unreachable,
+        optimal > 0 ? (double)total / optimal : 1.0);
+    return 0;
+}
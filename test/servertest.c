@@ -0,0 +1,269 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "server.h"
+#include "protocol.h"
+#include "gamelock.h"
+#include "error.h"
+
+extern const char* TMPDIR;
+
+/* server_test1() - load test for the version server: a server thread serves engine stand-ins
+   that each connect over a local named socket, perform the engine's side of the introductory and
+   intermediate exchanges and check every byte they receive; once every stand-in has finished the
+   exchanges the server broadcasts a payload to all of them; this is repeated for several rounds
+   and the handshake throughput and latencies are reported; a peer with a bad greeting must be
+   dropped; the test is run once with the plain binary protocol and once with the compressed one */
+
+#define SERVER_TEST_CLIENTS 256
+#define SERVER_TEST_ROUNDS 4
+#define SERVER_TEST_TILES_SIZE (256 * 1024)
+#define SERVER_TEST_SPRITES_SIZE (128 * 1024)
+#define SERVER_TEST_MAP_SIZE (64 * 1024)
+#define SERVER_TEST_BROADCAST_SIZE (16 * 1024)
+
+static char server_test_name[256];
+static bool_t server_test_compressed;
+static byte_t* server_test_intro;
+static size_t server_test_intro_size;
+static byte_t* server_test_label;
+static size_t server_test_label_size;
+static byte_t* server_test_tiles;
+static byte_t* server_test_sprites;
+static byte_t* server_test_map;
+static byte_t* server_test_message;
+static uint32_t server_test_world;
+static volatile bool_t server_test_stop;
+static volatile uint64_t server_test_stamp;
+static uint64_t server_test_handshakes[SERVER_TEST_CLIENTS * SERVER_TEST_ROUNDS];
+static uint64_t server_test_fanouts[SERVER_TEST_CLIENTS * SERVER_TEST_ROUNDS];
+static uint32_t server_test_players[SERVER_TEST_CLIENTS * SERVER_TEST_ROUNDS];
+
+static uint32_t server_test_seed = 0x6b43a9b5;
+static byte_t* server_test_blob(size_t size)
+{
+    size_t i;
+    byte_t* blob = malloc(size);
+    assert(blob != NULL);
+    for (i = 0;i < size;++i) {
+        server_test_seed ^= server_test_seed << 13;
+        server_test_seed ^= server_test_seed >> 17;
+        server_test_seed ^= server_test_seed << 5;
+        blob[i] = (byte_t)server_test_seed;
+    }
+    return blob;
+}
+static int server_test_compare(const void* left,const void* right)
+{
+    uint64_t a = *(const uint64_t*)left, b = *(const uint64_t*)right;
+    return a < b ? -1 : (a > b ? 1 : 0);
+}
+static int server_test_compare_id(const void* left,const void* right)
+{
+    uint32_t a = *(const uint32_t*)left, b = *(const uint32_t*)right;
+    return a < b ? -1 : (a > b ? 1 : 0);
+}
+
+static bool_t server_test_expect(struct pok_data_source* dsrc,const byte_t* expected,size_t size)
+{
+    /* read exactly 'size' bytes and compare them */
+    byte_t chunk[4096];
+    size_t bytesIn;
+    while (size > 0) {
+        size_t n = size < 4096 ? size : 4096;
+        if (!pok_data_source_read_to_buffer(dsrc,chunk,n,&bytesIn) || bytesIn == 0)
+            return FALSE;
+        if (memcmp(chunk,expected,bytesIn) != 0)
+            return FALSE;
+        expected += bytesIn;
+        size -= bytesIn;
+    }
+    return TRUE;
+}
+static bool_t server_test_uint32(struct pok_data_source* dsrc,uint32_t* value)
+{
+    while ( !pok_data_stream_read_uint32(dsrc,value) )
+        if (pok_exception_pop_ex(pok_ex_net,pok_ex_net_pending) == NULL)
+            return FALSE;
+    return TRUE;
+}
+
+static int server_test_engine(void* param)
+{
+    /* an engine stand-in */
+    int round;
+    size_t index = (size_t)param;
+    byte_t guid[GUID_LENGTH];
+    byte_t bitmask = POKGAME_DEFAULT_TILES_MASK | POKGAME_DEFAULT_SPRITES_MASK;
+    memset(guid,'a' + index % 26,GUID_LENGTH);
+    for (round = 0;round < SERVER_TEST_ROUNDS;++round) {
+        uint32_t player, world;
+        size_t slot = round * SERVER_TEST_CLIENTS + index;
+        uint64_t start = pok_timestep_clock();
+        struct pok_data_source* dsrc = pok_data_source_new_local_named(server_test_name);
+        if (dsrc == NULL)
+            return 1;
+        if (!pok_data_stream_write_string_ex(dsrc,POKGAME_GREETING_SEQUENCE,sizeof(POKGAME_GREETING_SEQUENCE))
+            || !pok_data_source_flush(dsrc)
+            || !server_test_expect(dsrc,server_test_intro,server_test_intro_size)
+            || (server_test_compressed && !pok_data_source_compress(dsrc,pok_iomode_full_duplex,POK_COMPRESSION_DEFAULT))
+            || !server_test_expect(dsrc,server_test_label,server_test_label_size)
+            || !pok_data_stream_write_string_ex(dsrc,(const char*)guid,GUID_LENGTH)
+            || !pok_data_source_flush(dsrc)
+            || !server_test_expect(dsrc,&bitmask,1)
+            || !server_test_expect(dsrc,server_test_tiles,SERVER_TEST_TILES_SIZE)
+            || !server_test_expect(dsrc,server_test_sprites,SERVER_TEST_SPRITES_SIZE)
+            || !server_test_uint32(dsrc,&player) || !server_test_uint32(dsrc,&world) || world != server_test_world
+            || !server_test_expect(dsrc,server_test_map,SERVER_TEST_MAP_SIZE))
+        {
+            pok_data_source_free(dsrc);
+            return 1;
+        }
+        server_test_handshakes[slot] = pok_timestep_clock() - start;
+        server_test_players[slot] = player;
+        if ( !server_test_expect(dsrc,server_test_message,SERVER_TEST_BROADCAST_SIZE) ) {
+            pok_data_source_free(dsrc);
+            return 1;
+        }
+        server_test_fanouts[slot] = pok_timestep_clock() - server_test_stamp;
+        pok_data_source_free(dsrc);
+    }
+    return 0;
+}
+static int server_test_serve(struct pok_server* server)
+{
+    /* broadcast once every stand-in has finished the exchanges for the round (and its connection
+       from the previous round is closed) */
+    uint32_t broadcasts = 0;
+    while (!server_test_stop) {
+        if (pok_server_run(server,10) == -1)
+            return 1;
+        if (server->stats.ready == SERVER_TEST_CLIENTS && server->stats.completed >= (broadcasts + 1) * SERVER_TEST_CLIENTS) {
+            server_test_stamp = pok_timestep_clock();
+            if ( !pok_server_broadcast(server,server_test_message,SERVER_TEST_BROADCAST_SIZE) )
+                return 1;
+            ++broadcasts;
+        }
+    }
+    return broadcasts == SERVER_TEST_ROUNDS ? 0 : 1;
+}
+
+static byte_t* server_test_encode(const char* first,size_t firstSize,const char* second,size_t secondSize,size_t* size)
+{
+    byte_t* encoded;
+    const byte_t* data;
+    struct pok_data_source* memory = pok_data_source_new_memory();
+    assert(memory != NULL);
+    assert( pok_data_stream_write_string_ex(memory,first,firstSize) && pok_data_stream_write_string_ex(memory,second,secondSize) );
+    data = pok_data_source_memory(memory,size);
+    encoded = malloc(*size);
+    memcpy(encoded,data,*size);
+    pok_data_source_free(memory);
+    return encoded;
+}
+
+static int server_test_run(bool_t compressed)
+{
+    size_t i, n = SERVER_TEST_CLIENTS * SERVER_TEST_ROUNDS;
+    uint64_t start, elapsed;
+    struct pok_thread* serverThread;
+    struct pok_thread* threads[SERVER_TEST_CLIENTS];
+    struct pok_server* server;
+
+#ifdef POKGAME_WIN32
+    /* local named sockets are named pipes on Win32 */
+    strcpy(server_test_name,"\\\\.\\pipe\\pokgame-server-test");
+#else
+    sprintf(server_test_name,"%s/pokgame-server-test",TMPDIR);
+#endif
+    server = pok_server_new(server_test_name);
+    if (server == NULL) {
+        printf("failed to create server: %s\n",pok_exception_pop()->message);
+        return 1;
+    }
+    server_test_tiles = server_test_blob(SERVER_TEST_TILES_SIZE);
+    server_test_sprites = server_test_blob(SERVER_TEST_SPRITES_SIZE);
+    server_test_map = server_test_blob(SERVER_TEST_MAP_SIZE);
+    server_test_message = server_test_blob(SERVER_TEST_BROADCAST_SIZE);
+    server_test_world = server->worldID;
+    pok_server_set_label(server,"server test","0123456789abcdef");
+    assert( pok_server_set_static(server,pok_static_obj_tile_manager,server_test_tiles,SERVER_TEST_TILES_SIZE) );
+    assert( pok_server_set_static(server,pok_static_obj_sprite_manager,server_test_sprites,SERVER_TEST_SPRITES_SIZE) );
+    assert( pok_server_set_first_map(server,server_test_map,SERVER_TEST_MAP_SIZE) );
+    assert( pok_server_set_compression(server,compressed,POK_COMPRESSION_DEFAULT) );
+
+    /* the introductory exchange the stand-ins expect; the label and guid are the first bytes that
+       are compressed */
+    server_test_compressed = compressed;
+    server_test_intro = server_test_encode(POKGAME_GREETING_SEQUENCE,sizeof(POKGAME_GREETING_SEQUENCE),
+        compressed ? POKGAME_BINARYMODE_Z_SEQUENCE : POKGAME_BINARYMODE_SEQUENCE,
+        compressed ? sizeof(POKGAME_BINARYMODE_Z_SEQUENCE) : sizeof(POKGAME_BINARYMODE_SEQUENCE),&server_test_intro_size);
+    server_test_label = server_test_encode("server test",sizeof("server test"),"0123456789abcdef",GUID_LENGTH + 1,
+        &server_test_label_size);
+
+    server_test_stop = FALSE;
+    serverThread = pok_thread_new((pok_thread_entry)server_test_serve,server);
+    pok_thread_start(serverThread);
+
+    /* a peer that does not greet properly is dropped */
+    {
+        size_t bytesIn;
+        byte_t b;
+        struct pok_data_source* dsrc = pok_data_source_new_local_named(server_test_name);
+        assert(dsrc != NULL);
+        assert( pok_data_stream_write_string_ex(dsrc,"hello",sizeof("hello")) && pok_data_source_flush(dsrc) );
+        assert( pok_data_source_read_to_buffer(dsrc,&b,1,&bytesIn) && bytesIn == 0 );
+        pok_data_source_free(dsrc);
+    }
+
+    start = pok_timestep_clock();
+    for (i = 0;i < SERVER_TEST_CLIENTS;++i) {
+        threads[i] = pok_thread_new(server_test_engine,(void*)i);
+        pok_thread_start(threads[i]);
+    }
+    for (i = 0;i < SERVER_TEST_CLIENTS;++i) {
+        assert(pok_thread_join(threads[i]) == 0);
+        pok_thread_free(threads[i]);
+    }
+    elapsed = pok_timestep_clock() - start;
+    server_test_stop = TRUE;
+    assert(pok_thread_join(serverThread) == 0);
+    pok_thread_free(serverThread);
+
+    /* every player character got its own network id */
+    qsort(server_test_players,n,sizeof(uint32_t),server_test_compare_id);
+    for (i = 1;i < n;++i)
+        assert(server_test_players[i] != server_test_players[i-1]);
+    assert(server->stats.completed == n);
+    assert(server->stats.accepted == n + 1);
+    assert(server->stats.dropped == 1);
+
+    qsort(server_test_handshakes,n,sizeof(uint64_t),server_test_compare);
+    qsort(server_test_fanouts,n,sizeof(uint64_t),server_test_compare);
+    printf("version server%s: %d engines x %d rounds: %.0f handshakes/s, %.1f MB/s sent (%.1f MB encoded)\n",
+        compressed ? " (compressed)" : "",SERVER_TEST_CLIENTS,SERVER_TEST_ROUNDS,n / (elapsed / 1e9),server->stats.sent / (elapsed / 1e3),
+        server->stats.encoded / 1e6);
+    printf("  handshake latency: p50 %.2f ms, p99 %.2f ms, max %.2f ms\n",server_test_handshakes[n / 2] / 1e6,
+        server_test_handshakes[n * 99 / 100] / 1e6,server_test_handshakes[n - 1] / 1e6);
+    printf("  broadcast latency: p50 %.2f ms, p99 %.2f ms, max %.2f ms\n",server_test_fanouts[n / 2] / 1e6,
+        server_test_fanouts[n * 99 / 100] / 1e6,server_test_fanouts[n - 1] / 1e6);
+    printf("  server: %llu waits, %llu events\n",(unsigned long long)server->stats.waits,
+        (unsigned long long)server->stats.events);
+
+    pok_server_free(server);
+    free(server_test_intro);
+    free(server_test_label);
+    free(server_test_tiles);
+    free(server_test_sprites);
+    free(server_test_map);
+    free(server_test_message);
+    return 0;
+}
+
+int server_test1()
+{
+    if (server_test_run(FALSE) != 0)
+        return 1;
+    return server_test_run(TRUE);
+}